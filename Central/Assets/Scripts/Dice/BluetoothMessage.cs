@@ -356,6 +356,7 @@ namespace Dice
         public DieMessageType type { get; set; } = DieMessageType.BulkData;
         public byte size;
         public ushort offset;
+        public uint crc; // CRC-32 of the data, see Utils.computeHash
         [MarshalAs(UnmanagedType.ByValArray, SizeConst = DieMessages.maxDataSize)]
         public byte[] data;
     }
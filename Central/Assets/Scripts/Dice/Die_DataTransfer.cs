@@ -49,6 +49,7 @@ public partial class Die
                 data.data = new byte[DieMessages.maxDataSize];
 
                 System.Array.Copy(bytes, offset, data.data, 0, data.size);
+                data.crc = Utils.computeHash(data.data, 0, data.size);
 
                 //Debug.Log("Sending Bulk Data (offset: 0x" + data.offset.ToString("X") + ", length: " + data.size + ")");
                 //StringBuilder hexdumpBuilder = new StringBuilder();
@@ -37,13 +37,29 @@ public static class Utils
 		return 4 * ((address + 3) / 4);
 	}
 
-	/* D. J. Bernstein hash function */
+	/* CRC-32 (same as zlib), must match Utils::computeHash in the firmware */
+	static uint[] crcTable;
+
 	public static uint computeHash(byte[] data) {
-		uint hash = 5381;
-		for (int i = 0; i < data.Length; ++i) {
-			hash = 33 * hash ^ data[i];
+		return computeHash(data, 0, data.Length);
+	}
+
+	public static uint computeHash(byte[] data, int offset, int size) {
+		if (crcTable == null) {
+			crcTable = new uint[256];
+			for (uint i = 0; i < 256; ++i) {
+				uint c = i;
+				for (int k = 0; k < 8; ++k) {
+					c = (c & 1) != 0 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+				}
+				crcTable[i] = c;
+			}
+		}
+		uint crc = 0xFFFFFFFF;
+		for (int i = offset; i < offset + size; ++i) {
+			crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
 		}
-		return hash;
+		return ~crc;
 	}
 
 }
\ No newline at end of file
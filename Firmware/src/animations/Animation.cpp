@@ -1,10 +1,14 @@
 #include "animation.h"
 #include "data_set/data_set.h"
 #include "data_set/data_animation_bits.h"
+#include "data_set/data_set_compiled.h"
 
 #include "assert.h"
 #include "../utils/utils.h"
 #include "nrf_log.h"
+#include "core/pool.h"
+#include <new>
+#include <algorithm>
 
 #include "animation_simple.h"
 #include "animation_gradient.h"
@@ -12,6 +16,7 @@
 #include "animation_rainbow.h"
 #include "animation_gradientpattern.h"
 #include "animation_noise.h"
+#include "animation_compiled.h"
 
 
 // Define new and delete
@@ -24,17 +29,34 @@ void operator delete(void* ptr, unsigned int) { free(ptr); }
 
 using namespace Utils;
 using namespace DataSet;
+using namespace Core;
 
 namespace Animations
 {
+	// Size of the largest animation instance class, all the pool blocks are that big
+	constexpr int maxInstanceSize() {
+		return std::max({
+			sizeof(AnimationInstanceSimple),
+			sizeof(AnimationInstanceGradient),
+			sizeof(AnimationInstanceRainbow),
+			sizeof(AnimationInstanceKeyframed),
+			sizeof(AnimationInstanceGradientPattern),
+			sizeof(AnimationInstanceNoise),
+			sizeof(AnimationInstanceCompiled)});
+	}
+
+	// Animation instances come out of this pool instead of the heap, so that playing lots of
+	// short animations doesn't fragment our (very small) heap.
+	Pool<maxInstanceSize(), MAX_ANIMS> instancePool;
+
 	/// Dims the passed in color by the passed in intensity (normalized 0 - 255)
 	/// </summary>
 	uint32_t scaleColor(uint32_t refColor, uint8_t intensity)
 	{
-		uint8_t r = getRed(refColor);
-		uint8_t g = getGreen(refColor);
-		uint8_t b = getBlue(refColor);
-		return toColor(r * intensity / MAX_LEVEL, g * intensity / MAX_LEVEL, b * intensity / MAX_LEVEL);
+		// Red and blue are scaled with a single multiply, each in its own 16 bit lane
+		uint32_t rb = (((refColor & 0xFF00FF) * intensity) / MAX_LEVEL) & 0xFF00FF;
+		uint32_t g = (((refColor & 0xFF00) * intensity) / MAX_LEVEL) & 0xFF00;
+		return rb | g;
 	}
 
 	AnimationInstance::AnimationInstance(const Animation* preset, const AnimationBits* bits) 
@@ -52,44 +74,83 @@ namespace Animations
 		loop = _loop;
 	}
 
+	/// <summary>
+	/// Returns the next time (same time base as updateLEDs) at which the leds may need a different
+	/// color than the one computed for the passed in time. The default is to just keep refreshing.
+	/// </summary>
+	int AnimationInstance::getNextUpdateTime(int ms) {
+		return ms + DEFAULT_FRAME_MS;
+	}
+
 	AnimationInstance* createAnimationInstance(int animationIndex) {
 		// Grab the preset data
 		const Animation* preset = DataSet::getAnimation(animationIndex);
+
+		// Use the precompiled timelines when we have them
+		auto compiled = DataSet::getCompiledAnimation(animationIndex);
+		if (compiled != nullptr) {
+			void* block = instancePool.alloc();
+			if (block == nullptr) {
+				NRF_LOG_ERROR("Too many animation instances");
+				return nullptr;
+			}
+			return new (block) AnimationInstanceCompiled(preset, DataSet::getAnimationBits(), compiled);
+		}
 		return createAnimationInstance(preset, DataSet::getAnimationBits());
 	}
 
 	AnimationInstance* createAnimationInstance(const Animation* preset, const AnimationBits* bits) {
+		void* block = instancePool.alloc();
+		if (block == nullptr) {
+			NRF_LOG_ERROR("Too many animation instances");
+			return nullptr;
+		}
+
 		AnimationInstance* ret = nullptr;
 		switch (preset->type) {
 			case Animation_Simple:
-				// Maybe we'll pass an allocator at some point, this is the only place I've ever used a new in the firmware...
-				ret = new AnimationInstanceSimple(static_cast<const AnimationSimple*>(preset), bits);
+				ret = new (block) AnimationInstanceSimple(static_cast<const AnimationSimple*>(preset), bits);
 				break;
 			case Animation_Gradient:
-				ret = new AnimationInstanceGradient(static_cast<const AnimationGradient*>(preset), bits);
+				ret = new (block) AnimationInstanceGradient(static_cast<const AnimationGradient*>(preset), bits);
 				break;
 			case Animation_Rainbow:
-				ret = new AnimationInstanceRainbow(static_cast<const AnimationRainbow*>(preset), bits);
+				ret = new (block) AnimationInstanceRainbow(static_cast<const AnimationRainbow*>(preset), bits);
 				break;
 			case Animation_Keyframed:
-				ret = new AnimationInstanceKeyframed(static_cast<const AnimationKeyframed*>(preset), bits);
+				ret = new (block) AnimationInstanceKeyframed(static_cast<const AnimationKeyframed*>(preset), bits);
 				break;
 			case Animation_GradientPattern:
-				ret = new AnimationInstanceGradientPattern(static_cast<const AnimationGradientPattern*>(preset), bits);
+				ret = new (block) AnimationInstanceGradientPattern(static_cast<const AnimationGradientPattern*>(preset), bits);
 				break;
 			case Animation_Noise:
-				ret = new AnimationInstanceNoise(static_cast<const AnimationNoise*>(preset), bits);
+				ret = new (block) AnimationInstanceNoise(static_cast<const AnimationNoise*>(preset), bits);
 				break;
 			default:
 				NRF_LOG_ERROR("Unknown animation preset type");
+				instancePool.free(block);
 				break;
 		}
 		return ret;
 	}
 
 	void destroyAnimationInstance(AnimationInstance* animationInstance) {
-		// Eventually we might use an allocator
-		delete animationInstance;
+		if (animationInstance != nullptr) {
+			// Instances were constructed in place, so destroy in place too
+			animationInstance->~AnimationInstance();
+			instancePool.free(animationInstance);
+		}
+	}
+
+	int getInstanceCount() {
+		return instancePool.count();
 	}
-}
 
+	int getInstanceHighWaterMark() {
+		return instancePool.highWaterMark();
+	}
+
+	int getInstanceAllocFailures() {
+		return instancePool.failureCount();
+	}
+}
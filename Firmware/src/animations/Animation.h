@@ -2,6 +2,9 @@
 
 #include <stdint.h>
 
+#define MAX_ANIMS (20) // Max number of animation instances alive at the same time
+#define DEFAULT_FRAME_MS (33) // Update period of animations that can't tell when their output changes
+
 #pragma pack(push, 1)
 
 namespace DataSet
@@ -58,12 +61,18 @@ namespace Animations
 		virtual int animationSize() const = 0;
 		virtual int updateLEDs(int ms, int retIndices[], uint32_t retColors[]) = 0;
 		virtual int stop(int retIndices[]) = 0;
+		virtual int getNextUpdateTime(int ms);
 	};
 
 	Animations::AnimationInstance* createAnimationInstance(int animationIndex);
 	Animations::AnimationInstance* createAnimationInstance(const Animations::Animation* preset, const DataSet::AnimationBits* bits);
 	void destroyAnimationInstance(Animations::AnimationInstance* animationInstance);
 
+	// Instance allocator statistics
+	int getInstanceCount();
+	int getInstanceHighWaterMark();
+	int getInstanceAllocFailures();
+
 }
 
 #pragma pack(pop)
@@ -0,0 +1,160 @@
+#include "animation_compiled.h"
+#include "animation_keyframed.h"
+#include "animation_gradientpattern.h"
+#include "data_set/data_set.h"
+#include "data_set/data_set_compiled.h"
+#include "../utils/utils.h"
+#include "config/board_config.h"
+#include <stdlib.h>
+
+using namespace Utils;
+
+namespace Animations
+{
+	/// <summary>
+	/// Evaluates a single color channel of the segment
+	/// </summary>
+	int evaluateChannel(uint8_t start, int32_t delta, int time) {
+		int ret = start + ((delta * time + 0x8000) >> 16);
+		return ret < 0 ? 0 : (ret > 255 ? 255 : ret);
+	}
+
+	/// <summary>
+	/// Returns the segment color at the given animation time, which should be between this segment's
+	/// start time and the next segment's start time.
+	/// </summary>
+	uint32_t CompiledSegment::evaluate(int time) const {
+		int dt = time > startTime ? time - startTime : 0;
+		return toColor(
+			evaluateChannel(getRed(startColor), deltaRed, dt),
+			evaluateChannel(getGreen(startColor), deltaGreen, dt),
+			evaluateChannel(getBlue(startColor), deltaBlue, dt));
+	}
+
+	/// <summary>
+	/// constructor for compiled animation instances
+	/// Needs the preset and its compiled version
+	/// </summary>
+	AnimationInstanceCompiled::AnimationInstanceCompiled(const Animation* preset, const DataSet::AnimationBits* bits, const CompiledAnimation* compiled)
+		: AnimationInstance(preset, bits)
+		, compiled(compiled) {
+	}
+
+	/// <summary>
+	/// destructor
+	/// </summary>
+	AnimationInstanceCompiled::~AnimationInstanceCompiled() {
+	}
+
+	/// <summary>
+	/// Small helper to return the expected size of the preset data
+	/// </summary>
+	int AnimationInstanceCompiled::animationSize() const {
+		switch (animationPreset->type) {
+			case Animation_Keyframed:
+				return sizeof(AnimationKeyframed);
+			case Animation_GradientPattern:
+				return sizeof(AnimationGradientPattern);
+			default:
+				return sizeof(Animation);
+		}
+	}
+
+	/// <summary>
+	/// (re)Initializes the instance to animate leds. This can be called on a reused instance.
+	/// </summary>
+	void AnimationInstanceCompiled::start(int _startTime, uint8_t _remapFace, bool _loop) {
+		AnimationInstance::start(_startTime, _remapFace, _loop);
+		for (int i = 0; i < MAX_TRACK_CURSORS; ++i) {
+			cursors[i] = 0;
+		}
+	}
+
+	/// <summary>
+	/// Computes the list of LEDs that need to be on, and what their intensities should be.
+	/// Every timeline is evaluated the same way, whatever the type of the original preset.
+	/// </summary>
+	/// <param name="ms">The animation time (in milliseconds)</param>
+	/// <param name="retIndices">the return list of LED indices to fill, max size should be at least 21, the max number of leds</param>
+	/// <param name="retColors">the return list of LED color to fill, max size should be at least 21, the max number of leds</param>
+	/// <returns>The number of leds/intensities added to the return array</returns>
+	int AnimationInstanceCompiled::updateLEDs(int ms, int retIndices[], uint32_t retColors[]) {
+		int time = ms - startTime;
+		uint32_t ledMask = lowBitsMask(Config::BoardManager::getBoard()->ledCount);
+
+		int totalCount = 0;
+		for (int i = 0; i < compiled->timelineCount; ++i) {
+			auto& timeline = DataSet::getCompiledTimeline(compiled->timelinesOffset + i);
+			if (timeline.segmentCount == 0) {
+				continue;
+			}
+			const CompiledSegment* segments = DataSet::getCompiledSegments(timeline.segmentsOffset);
+			uint32_t color = segments[findSegment(i, timeline, time)].evaluate(time);
+			totalCount += extractBitIndices(timeline.ledMask & ledMask, color, &retIndices[totalCount], &retColors[totalCount]);
+		}
+		return totalCount;
+	}
+
+	/// <summary>
+	/// Returns the next time any of the timelines changes color. Constant segments don't need
+	/// updating until the next segment starts, fades need it as soon as a channel moves by one step.
+	/// </summary>
+	int AnimationInstanceCompiled::getNextUpdateTime(int ms) {
+		int time = ms - startTime;
+		int ret = startTime + animationPreset->duration;
+		for (int i = 0; i < compiled->timelineCount; ++i) {
+			auto& timeline = DataSet::getCompiledTimeline(compiled->timelinesOffset + i);
+			if (timeline.segmentCount == 0) {
+				continue;
+			}
+			const CompiledSegment* segments = DataSet::getCompiledSegments(timeline.segmentsOffset);
+			int segmentIndex = findSegment(i, timeline, time);
+			auto& segment = segments[segmentIndex];
+
+			// Never sleep past the start of the next segment, it may jump or fade faster
+			int next = ret;
+			if (segmentIndex + 1 < timeline.segmentCount) {
+				next = startTime + segments[segmentIndex + 1].startTime;
+			}
+			int maxDelta = std::max(abs(segment.deltaRed), std::max(abs(segment.deltaGreen), abs(segment.deltaBlue)));
+			if (maxDelta > 0) {
+				// Deltas are 16.16 per ms, so this is how long until some channel changes by one
+				next = std::min(next, ms + std::max(1, 0x10000 / maxDelta));
+			}
+			ret = std::min(ret, next);
+		}
+		return ret;
+	}
+
+	/// <summary>
+	/// Returns the index of the segment of the timeline that contains the passed in time.
+	/// Resumes from the last segment, unless time went backward (i.e. the animation looped).
+	/// </summary>
+	int AnimationInstanceCompiled::findSegment(int timelineIndex, const CompiledTimeline& timeline, int time) {
+		const CompiledSegment* segments = DataSet::getCompiledSegments(timeline.segmentsOffset);
+		int segmentIndex = timelineIndex < MAX_TRACK_CURSORS ? cursors[timelineIndex] : 0;
+		if (segments[segmentIndex].startTime > time) {
+			segmentIndex = 0;
+		}
+		while (segmentIndex + 1 < timeline.segmentCount && segments[segmentIndex + 1].startTime <= time) {
+			segmentIndex++;
+		}
+		if (timelineIndex < MAX_TRACK_CURSORS) {
+			cursors[timelineIndex] = (uint16_t)segmentIndex;
+		}
+		return segmentIndex;
+	}
+
+	/// <summary>
+	/// Clear all LEDs controlled by this animation, for instance when the anim gets interrupted.
+	/// </summary>
+	int AnimationInstanceCompiled::stop(int retIndices[]) {
+		uint32_t ledMask = lowBitsMask(Config::BoardManager::getBoard()->ledCount);
+		int totalCount = 0;
+		for (int i = 0; i < compiled->timelineCount; ++i) {
+			auto& timeline = DataSet::getCompiledTimeline(compiled->timelinesOffset + i);
+			totalCount += extractBitIndices(timeline.ledMask & ledMask, &retIndices[totalCount]);
+		}
+		return totalCount;
+	}
+}
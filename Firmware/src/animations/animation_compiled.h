@@ -0,0 +1,76 @@
+#pragma once
+
+#include "animations/Animation.h"
+#include "animations/keyframes.h"
+
+#pragma pack(push, 1)
+
+namespace Animations
+{
+	/// <summary>
+	/// A single linear piece of a compiled timeline. Colors are already resolved from the palette
+	/// and the times are in animation time, so evaluating it is a multiply-add per channel.
+	/// size: 20 bytes
+	/// </summary>
+	struct CompiledSegment
+	{
+		uint32_t startColor;	// color at startTime
+		int32_t deltaRed;		// change per ms, 16.16 fixed point
+		int32_t deltaGreen;
+		int32_t deltaBlue;
+		uint16_t startTime;		// ms since the animation started
+		uint16_t padding;
+
+		uint32_t evaluate(int time) const;
+	};
+
+	/// <summary>
+	/// A compiled track, i.e. the list of segments driving a set of (canonical) leds
+	/// size: 8 bytes (+ the actual segment data)
+	/// </summary>
+	struct CompiledTimeline
+	{
+		uint32_t ledMask;			// leds to drive, flow order already applied
+		uint16_t segmentsOffset;	// offset into the global compiled segment buffer
+		uint16_t segmentCount;
+	};
+
+	/// <summary>
+	/// Compiled version of a keyframed or gradient pattern animation preset
+	/// size: 4 bytes (+ the actual timeline data)
+	/// </summary>
+	struct CompiledAnimation
+	{
+		uint16_t timelinesOffset;	// offset into the global compiled timeline buffer
+		uint16_t timelineCount;		// 0 if the preset could not be compiled
+	};
+
+	/// <summary>
+	/// Instance of a compiled animation, all the preset types that can be compiled
+	/// are played back by this single class.
+	/// </summary>
+	class AnimationInstanceCompiled
+		: public AnimationInstance
+	{
+	private:
+		const CompiledAnimation* compiled;
+		uint16_t cursors[MAX_TRACK_CURSORS]; // Current segment for the first few timelines
+
+	public:
+		AnimationInstanceCompiled(const Animation* preset, const DataSet::AnimationBits* bits, const CompiledAnimation* compiled);
+		virtual ~AnimationInstanceCompiled();
+
+	public:
+		virtual int animationSize() const;
+
+		virtual void start(int _startTime, uint8_t _remapFace, bool _loop);
+		virtual int updateLEDs(int ms, int retIndices[], uint32_t retColors[]);
+		virtual int stop(int retIndices[]);
+		virtual int getNextUpdateTime(int ms);
+
+	private:
+		int findSegment(int timelineIndex, const CompiledTimeline& timeline, int time);
+	};
+}
+
+#pragma pack(pop)
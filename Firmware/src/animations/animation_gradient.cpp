@@ -1,4 +1,5 @@
 #include "animation_gradient.h"
+#include "utils/utils.h"
 #include "data_set/data_set.h"
 #include "data_set/data_animation_bits.h"
 
@@ -30,6 +31,7 @@ namespace Animations
 	/// </summary>
 	void AnimationInstanceGradient::start(int _startTime, uint8_t _remapFace, bool _loop) {
 		AnimationInstance::start(_startTime, _remapFace, _loop);
+		gradientCursor.reset();
 	}
 
 	/// <summary>
@@ -47,19 +49,10 @@ namespace Animations
         auto& gradient = animationBits->getRGBTrack(preset->gradientTrackOffset);
 
         int gradientTime = time * 1000 / preset->duration;
-        uint32_t color = gradient.evaluateColor(animationBits, gradientTime);
+        uint32_t color = gradient.evaluateColor(animationBits, gradientTime, &gradientCursor);
 
         // Fill the indices and colors for the anim controller to know how to update leds
-        int retCount = 0;
-        for (int i = 0; i < 20; ++i) {
-            if ((preset->faceMask & (1 << i)) != 0)
-            {
-                retIndices[retCount] = i;
-                retColors[retCount] = color;
-                retCount++;
-            }
-        }
-        return retCount;
+        return Utils::extractBitIndices(preset->faceMask & Utils::lowBitsMask(20), color, retIndices, retColors);
 	}
 
 	/// <summary>
@@ -67,15 +60,7 @@ namespace Animations
 	/// </summary>
 	int AnimationInstanceGradient::stop(int retIndices[]) {
 		auto preset = getPreset();
-            int retCount = 0;
-            for (int i = 0; i < 20; ++i) {
-                if ((preset->faceMask & (1 << i)) != 0)
-                {
-                    retIndices[retCount] = i;
-                    retCount++;
-                }
-            }
-            return retCount;
+		return Utils::extractBitIndices(preset->faceMask & Utils::lowBitsMask(20), retIndices);
 	}
 
 	const AnimationGradient* AnimationInstanceGradient::getPreset() const {
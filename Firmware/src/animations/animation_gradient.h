@@ -1,6 +1,7 @@
 #pragma once
 
 #include "animations/Animation.h"
+#include "animations/keyframes.h"
 
 #pragma pack(push, 1)
 
@@ -23,6 +24,9 @@ namespace Animations
 	class AnimationInstanceGradient
 		: public AnimationInstance
 	{
+	private:
+		TrackCursor gradientCursor;
+
 	public:
 		AnimationInstanceGradient(const AnimationGradient* preset, const DataSet::AnimationBits* bits);
 		virtual ~AnimationInstanceGradient();
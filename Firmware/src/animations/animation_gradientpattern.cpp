@@ -41,6 +41,10 @@ namespace Animations
 		AnimationInstance::start(_startTime, _remapFace, _loop);
         auto preset = getPreset();
 		NRF_LOG_INFO("override: %d", preset->overrideWithFace);
+		gradientCursor.reset();
+		for (int i = 0; i < MAX_TRACK_CURSORS; ++i) {
+			cursors[i].reset();
+		}
 		if (preset->overrideWithFace) {
 			// Compute color based on face is 127
 	        rgb = animationBits->getPaletteColor(PALETTE_COLOR_FROM_FACE);
@@ -68,7 +72,7 @@ namespace Animations
         	gradientColor = rgb;
 		} else {
 			int gradientTime = time * 1000 / preset->duration;
-			gradientColor = gradient.evaluateColor(animationBits, gradientTime);
+			gradientColor = gradient.evaluateColor(animationBits, gradientTime, &gradientCursor);
 		}
 
         int trackTime = time * 256 / preset->speedMultiplier256;
@@ -82,7 +86,8 @@ namespace Animations
         for (int i = 0; i < preset->trackCount; ++i)
         {
             auto track = animationBits->getTrack((uint16_t)(preset->tracksOffset + i)); 
-            int count = track.evaluate(animationBits, gradientColor, trackTime, indices, colors);
+            auto cursor = i < MAX_TRACK_CURSORS ? &cursors[i] : nullptr;
+            int count = track.evaluate(animationBits, gradientColor, trackTime, indices, colors, cursor);
             for (int j = 0; j < count; ++j)
             {
                 retIndices[totalCount+j] = indices[j];
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "animations/Animation.h"
+#include "animations/keyframes.h"
 
 #pragma pack(push, 1)
 
@@ -32,6 +33,8 @@ namespace Animations
 	{
 	private:
 		uint32_t rgb;
+		TrackCursor gradientCursor;
+		TrackCursor cursors[MAX_TRACK_CURSORS]; // Cached keyframe position for the first few tracks
 
 	public:
 		AnimationInstanceGradientPattern(const AnimationGradientPattern* preset, const DataSet::AnimationBits* bits);
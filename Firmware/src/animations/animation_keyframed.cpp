@@ -12,6 +12,14 @@
 
 namespace Animations
 {
+	/// <summary>
+	/// Maps a face index to the led index it lights up when the animation uses flow order
+	/// </summary>
+	int flowOrderToLEDIndex(int faceIndex) {
+		static const uint8_t faceIndices[] = {  17, 1, 19, 13, 3, 10, 8, 5, 15, 7, 9, 11, 14, 4, 12, 0, 18, 2, 16, 6 };
+		return faceIndices[faceIndex];
+	}
+
 	/// <summary>
 	/// constructor for keyframe-based animation instances
 	/// Needs to have an associated preset passed in
@@ -38,6 +46,9 @@ namespace Animations
 	/// </summary>
 	void AnimationInstanceKeyframed::start(int _startTime, uint8_t _remapFace, bool _loop) {
 		AnimationInstance::start(_startTime, _remapFace, _loop);
+		for (int i = 0; i < MAX_TRACK_CURSORS; ++i) {
+			cursors[i].reset();
+		}
 	}
 
 	/// <summary>
@@ -50,8 +61,6 @@ namespace Animations
 	/// <returns>The number of leds/intensities added to the return array</returns>
 	int AnimationInstanceKeyframed::updateLEDs(int ms, int retIndices[], uint32_t retColors[])
 	{
-		static int faceIndices[] = {  17, 1, 19, 13, 3, 10, 8, 5, 15, 7, 9, 11, 14, 4, 12, 0, 18, 2, 16, 6 };
-
 		int time = ms - startTime;
 		auto preset = getPreset();
 
@@ -68,12 +77,13 @@ namespace Animations
 		for (int i = 0; i < preset->trackCount; ++i)
 		{
 			auto& track = tracks[i]; 
-			auto count = track.evaluate(animationBits, trackTime, indices, colors);
+			auto cursor = i < MAX_TRACK_CURSORS ? &cursors[i] : nullptr;
+			auto count = track.evaluate(animationBits, trackTime, indices, colors, cursor);
 			if (preset->flowOrder != 0)
 			{
 				// Use reverse lookup so that indices mean led index and not face index
 				for (int j = 0; j < count; ++j) {
-					indices[j] = faceIndices[indices[j]];
+					indices[j] = flowOrderToLEDIndex(indices[j]);
 				}
 			}
 			indices += count;
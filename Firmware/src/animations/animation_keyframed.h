@@ -1,6 +1,7 @@
 #pragma once
 
 #include "animations/Animation.h"
+#include "animations/keyframes.h"
 
 #pragma pack(push, 1)
 
@@ -23,6 +24,9 @@ namespace Animations
 		uint8_t padding_flowOrder;
 	};
 
+	// Face index to led index lookup for animations that use flow order
+	int flowOrderToLEDIndex(int faceIndex);
+
 	/// <summary>
 	/// Keyframe-based animation instance data
 	/// </summary>
@@ -31,6 +35,7 @@ namespace Animations
 	{
 	private:
 		uint32_t specialColorPayload; // meaning varies
+		TrackCursor cursors[MAX_TRACK_CURSORS]; // Cached keyframe position for the first few tracks
 
 	public:
 		AnimationInstanceKeyframed(const AnimationKeyframed* preset, const DataSet::AnimationBits* bits);
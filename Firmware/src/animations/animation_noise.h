@@ -1,6 +1,7 @@
 #pragma once
 
 #include "animations/Animation.h"
+#include "animations/keyframes.h"
 
 #pragma pack(push, 1)
 
@@ -33,6 +34,7 @@ namespace Animations
 		virtual int stop(int retIndices[]);
 
         uint16_t curRand;
+        TrackCursor gradientCursor;
 
 	private:
 		const AnimationNoise* getPreset() const;
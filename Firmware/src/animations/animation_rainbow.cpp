@@ -1,4 +1,5 @@
 #include "animation_rainbow.h"
+#include "utils/utils.h"
 #include "utils/rainbow.h"
 
 namespace Animations
@@ -60,28 +61,19 @@ namespace Animations
 		}
 
 		// Fill the indices and colors for the anim controller to know how to update leds
+		uint32_t mask = preset->faceMask & Utils::lowBitsMask(20);
 		int retCount = 0;
         if (preset->traveling != 0) {
-			for (int i = 0; i < 20; ++i) {
-				if ((preset->faceMask & (1 << i)) != 0)
-				{
-					retIndices[retCount] = faceIndices[i];
-					retColors[retCount] = Rainbow::wheel((uint8_t)((wheelPos + i * 256 / 20) % 256), intensity);
-					retCount++;
-				}
+			for (; mask != 0; mask = Utils::clearLowestBit(mask)) {
+				int i = Utils::lowestBitIndex(mask);
+				retIndices[retCount] = faceIndices[i];
+				retColors[retCount] = Rainbow::wheel((uint8_t)((wheelPos + i * 256 / 20) % 256), intensity);
+				retCount++;
 			}
 		} else {
 			// All leds same color
 			color = Rainbow::wheel((uint8_t)wheelPos, intensity);
-
-			for (int i = 0; i < 20; ++i) {
-				if ((preset->faceMask & (1 << i)) != 0)
-				{
-					retIndices[retCount] = i;
-					retColors[retCount] = color;
-					retCount++;
-				}
-			}
+			retCount = Utils::extractBitIndices(mask, color, retIndices, retColors);
 		}
 		return retCount;
 	}
@@ -91,15 +83,7 @@ namespace Animations
 	/// </summary>
 	int AnimationInstanceRainbow::stop(int retIndices[]) {
 		auto preset = getPreset();
-            int retCount = 0;
-            for (int i = 0; i < 20; ++i) {
-                if ((preset->faceMask & (1 << i)) != 0)
-                {
-                    retIndices[retCount] = i;
-                    retCount++;
-                }
-            }
-            return retCount;
+		return Utils::extractBitIndices(preset->faceMask & Utils::lowBitsMask(20), retIndices);
 	}
 
 	const AnimationRainbow* AnimationInstanceRainbow::getPreset() const {
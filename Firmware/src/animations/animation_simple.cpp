@@ -55,8 +55,8 @@ namespace Animations
         int onOffTime = (period - fadeTime * 2) / 2;
         int time = (ms - startTime) % period;
 
-        if (time <= fadeTime) {
-            // Ramp up
+        if (time < fadeTime) {
+            // Ramp up, blinks without fades start on right away
             color = Utils::interpolateColors(black, 0, rgb, fadeTime, time);
         } else if (time <= fadeTime + onOffTime) {
             color = rgb;
@@ -68,16 +68,7 @@ namespace Animations
         }
 
         // Fill the indices and colors for the anim controller to know how to update leds
-        int retCount = 0;
-        for (int i = 0; i < 20; ++i) {
-            if ((preset->faceMask & (1 << i)) != 0)
-            {
-                retIndices[retCount] = i;
-                retColors[retCount] = color;
-                retCount++;
-            }
-        }
-        return retCount;
+        return Utils::extractBitIndices(preset->faceMask & Utils::lowBitsMask(20), color, retIndices, retColors);
 	}
 
 	/// <summary>
@@ -85,15 +76,34 @@ namespace Animations
 	/// </summary>
 	int AnimationInstanceSimple::stop(int retIndices[]) {
         auto preset = getPreset();
-        int retCount = 0;
-        for (int i = 0; i < 20; ++i) {
-            if ((preset->faceMask & (1 << i)) != 0)
-            {
-                retIndices[retCount] = i;
-                retCount++;
-            }
+        return Utils::extractBitIndices(preset->faceMask & Utils::lowBitsMask(20), retIndices);
+	}
+
+	/// <summary>
+	/// The leds only need refreshing while fading, the color holds while on and off.
+	/// </summary>
+	int AnimationInstanceSimple::getNextUpdateTime(int ms) {
+        auto preset = getPreset();
+        int period = preset->duration / preset->count;
+        int fadeTime = period * preset->fade / (255 * 2);
+        int onOffTime = (period - fadeTime * 2) / 2;
+        int time = (ms - startTime) % period;
+        int periodStart = ms - time;
+
+        if (time < fadeTime) {
+            // Ramping up
+            return ms + DEFAULT_FRAME_MS;
+        } else if (time <= fadeTime + onOffTime) {
+            // On until the ramp down starts
+            return periodStart + fadeTime + onOffTime + 1;
+        } else if (time < fadeTime * 2 + onOffTime) {
+            // Ramping down
+            return ms + DEFAULT_FRAME_MS;
+        } else {
+            // Off until the next period, or until the animation ends after the last one
+            int nextPeriodStart = periodStart + period;
+            return nextPeriodStart < startTime + preset->duration ? nextPeriodStart : startTime + preset->duration + 1;
         }
-        return retCount;
 	}
 
 	const AnimationSimple* AnimationInstanceSimple::getPreset() const {
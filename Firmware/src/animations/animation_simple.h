@@ -34,6 +34,7 @@ namespace Animations
 		virtual void start(int _startTime, uint8_t _remapFace, bool _loop);
 		virtual int updateLEDs(int ms, int retIndices[], uint32_t retColors[]);
 		virtual int stop(int retIndices[]);
+		virtual int getNextUpdateTime(int ms);
 
 	private:
 		const AnimationSimple* getPreset() const;
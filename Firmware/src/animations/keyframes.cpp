@@ -8,6 +8,53 @@ using namespace Config;
 
 namespace Animations
 {
+	/// <summary>
+	/// Puts the cursor back at the beginning of the track
+	/// </summary>
+	void TrackCursor::reset() {
+		time = 0;
+		nextIndex = 0;
+	}
+
+	/// <summary>
+	/// Finds the index of the first keyframe whose time is at or after the passed in time,
+	/// (i.e. the end of the segment we're in). If a cursor is passed in, the search resumes
+	/// from where the previous one ended when time moves forward, which is O(1) amortized.
+	/// Going back in time (loop, restart) falls back to a binary search.
+	/// </summary>
+	template <typename KeyframeT>
+	int findNextKeyframe(const KeyframeT* keyframes, int keyFrameCount, int time, TrackCursor* cursor) {
+		// Keyframe times are at most 10s, so clamping the time doesn't change the result
+		uint16_t clampedTime = (uint16_t)(time < 0 ? 0 : (time > 0xFFFF ? 0xFFFF : time));
+
+		int nextIndex = 0;
+		if (cursor != nullptr && clampedTime >= cursor->time) {
+			// Move forward from the last known segment
+			nextIndex = cursor->nextIndex;
+			while (nextIndex < keyFrameCount && keyframes[nextIndex].time() < clampedTime) {
+				nextIndex++;
+			}
+		} else {
+			// Random seek, binary search for the first keyframe not before the time
+			int count = keyFrameCount;
+			while (count > 0) {
+				int step = count / 2;
+				int index = nextIndex + step;
+				if (keyframes[index].time() < clampedTime) {
+					nextIndex = index + 1;
+					count -= step + 1;
+				} else {
+					count = step;
+				}
+			}
+		}
+
+		if (cursor != nullptr) {
+			cursor->time = clampedTime;
+			cursor->nextIndex = (uint8_t)nextIndex;
+		}
+		return nextIndex;
+	}
 
 	uint16_t RGBKeyframe::time() const {
 		// Unpack
@@ -45,35 +92,25 @@ namespace Animations
 	/// Evaluate an animation track's for a given time, in milliseconds, and fills returns arrays of led indices and colors
 	/// Values outside the track's range are clamped to first or last keyframe value.
 	/// </summary>
-	int RGBTrack::evaluate(const DataSet::AnimationBits* bits, int time, int retIndices[], uint32_t retColors[]) const {
+	int RGBTrack::evaluate(const DataSet::AnimationBits* bits, int time, int retIndices[], uint32_t retColors[], TrackCursor* cursor) const {
 		if (keyFrameCount == 0)
 			return 0;
 
-		uint32_t color = evaluateColor(bits, time);
+		uint32_t color = evaluateColor(bits, time, cursor);
 
 		// Fill the return arrays
-		int currentCount = 0;
-		for (int i = 0; i < Config::BoardManager::getBoard()->ledCount; ++i) {
-			if (ledMask & (1 << i)) {
-				retIndices[currentCount] = i;
-				retColors[currentCount] = color;
-				currentCount++;
-			}
-		}
-		return currentCount;
+		uint32_t mask = ledMask & Utils::lowBitsMask(Config::BoardManager::getBoard()->ledCount);
+		return Utils::extractBitIndices(mask, color, retIndices, retColors);
 	}
 
 	/// <summary>
 	/// Evaluate an animation track's for a given time, in milliseconds
 	/// Values outside the track's range are clamped to first or last keyframe value.
 	/// </summary>
-	uint32_t RGBTrack::evaluateColor(const DataSet::AnimationBits* bits, int time) const
+	uint32_t RGBTrack::evaluateColor(const DataSet::AnimationBits* bits, int time, TrackCursor* cursor) const
 	{
 		// Find the first keyframe
-		int nextIndex = 0;
-		while (nextIndex < keyFrameCount && getRGBKeyframe(bits, nextIndex).time() < time) {
-			nextIndex++;
-		}
+		int nextIndex = findNextKeyframe(&getRGBKeyframe(bits, 0), keyFrameCount, time, cursor);
 
 		uint32_t color = 0;
 		if (nextIndex == 0) {
@@ -104,14 +141,8 @@ namespace Animations
 	/// </sumary>
 	int RGBTrack::extractLEDIndices(int retIndices[]) const {
 		// Fill the return arrays
-		int currentCount = 0;
-		for (int i = 0; i < Config::BoardManager::getBoard()->ledCount; ++i) {
-			if (ledMask & (1 << i)) {
-				retIndices[currentCount] = i;
-				currentCount++;
-			}
-		}
-		return currentCount;
+		uint32_t mask = ledMask & Utils::lowBitsMask(Config::BoardManager::getBoard()->ledCount);
+		return Utils::extractBitIndices(mask, retIndices);
 	}
 
 
@@ -150,35 +181,25 @@ namespace Animations
 	/// Evaluate an animation track's for a given time, in milliseconds, and fills returns arrays of led indices and colors
 	/// Values outside the track's range are clamped to first or last keyframe value.
 	/// </summary>
-	int Track::evaluate(const DataSet::AnimationBits* bits, uint32_t color, int time, int retIndices[], uint32_t retColors[]) const {
+	int Track::evaluate(const DataSet::AnimationBits* bits, uint32_t color, int time, int retIndices[], uint32_t retColors[], TrackCursor* cursor) const {
 		if (keyFrameCount == 0)
 			return 0;
 
-		uint32_t mcolor = modulateColor(bits, color, time);
+		uint32_t mcolor = modulateColor(bits, color, time, cursor);
 
 		// Fill the return arrays
-		int currentCount = 0;
-		for (int i = 0; i < Config::BoardManager::getBoard()->ledCount; ++i) {
-			if (ledMask & (1 << i)) {
-				retIndices[currentCount] = i;
-				retColors[currentCount] = mcolor;
-				currentCount++;
-			}
-		}
-		return currentCount;
+		uint32_t mask = ledMask & Utils::lowBitsMask(Config::BoardManager::getBoard()->ledCount);
+		return Utils::extractBitIndices(mask, mcolor, retIndices, retColors);
 	}
 
 	/// <summary>
 	/// Evaluate an animation track's for a given time, in milliseconds
 	/// Values outside the track's range are clamped to first or last keyframe value.
 	/// </summary>
-	uint32_t Track::modulateColor(const DataSet::AnimationBits* bits, uint32_t color, int time) const
+	uint32_t Track::modulateColor(const DataSet::AnimationBits* bits, uint32_t color, int time, TrackCursor* cursor) const
 	{
         // Find the first keyframe
-        int nextIndex = 0;
-        while (nextIndex < keyFrameCount && getKeyframe(bits, (uint16_t)nextIndex).time() < time) {
-            nextIndex++;
-        }
+        int nextIndex = findNextKeyframe(&getKeyframe(bits, 0), keyFrameCount, time, cursor);
 
         uint8_t intensity = 0;
         if (nextIndex == 0) {
@@ -209,14 +230,8 @@ namespace Animations
 	/// </sumary>
 	int Track::extractLEDIndices(int retIndices[]) const {
 		// Fill the return arrays
-		int currentCount = 0;
-		for (int i = 0; i < Config::BoardManager::getBoard()->ledCount; ++i) {
-			if (ledMask & (1 << i)) {
-				retIndices[currentCount] = i;
-				currentCount++;
-			}
-		}
-		return currentCount;
+		uint32_t mask = ledMask & Utils::lowBitsMask(Config::BoardManager::getBoard()->ledCount);
+		return Utils::extractBitIndices(mask, retIndices);
 	}
 
 
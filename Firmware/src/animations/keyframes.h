@@ -2,10 +2,26 @@
 
 #include "animations/Animation.h"
 
+#define MAX_TRACK_CURSORS 8 // Max number of tracks per animation instance that get a cached cursor
+
 #pragma pack(push, 1)
 
 namespace Animations
 {
+	/// <summary>
+	/// Remembers which keyframe segment a track was last evaluated in, so that the next
+	/// evaluation (typically one frame later) can resume from there instead of scanning
+	/// from the first keyframe. This is instance data, tracks themselves live in flash.
+	/// size: 3 bytes
+	/// </summary>
+	struct TrackCursor
+	{
+		uint16_t time;		// Last evaluated time, clamped to 0 - 65535 ms
+		uint8_t nextIndex;	// Index of the first keyframe at or after that time
+
+		void reset();
+	};
+
 	/// <summary>
 	/// Stores a single keyframe of an LED animation
 	/// size: 2 bytes, split this way:
@@ -39,8 +55,8 @@ namespace Animations
 
 		uint16_t getDuration(const DataSet::AnimationBits* bits) const;
 		const RGBKeyframe& getRGBKeyframe(const DataSet::AnimationBits* bits, uint16_t keyframeIndex) const;
-		int evaluate(const DataSet::AnimationBits* bits, int time, int retIndices[], uint32_t retColors[]) const;
-		uint32_t evaluateColor(const DataSet::AnimationBits* bits, int time) const;
+		int evaluate(const DataSet::AnimationBits* bits, int time, int retIndices[], uint32_t retColors[], TrackCursor* cursor = nullptr) const;
+		uint32_t evaluateColor(const DataSet::AnimationBits* bits, int time, TrackCursor* cursor = nullptr) const;
 		int extractLEDIndices(int retIndices[]) const;
 	};
 
@@ -76,8 +92,8 @@ namespace Animations
 
 		uint16_t getDuration(const DataSet::AnimationBits* bits) const;
 		const Keyframe& getKeyframe(const DataSet::AnimationBits* bits, uint16_t keyframeIndex) const;
-		int evaluate(const DataSet::AnimationBits* bits, uint32_t color, int time, int retIndices[], uint32_t retColors[]) const;
-        uint32_t modulateColor(const DataSet::AnimationBits* bits, uint32_t color, int time) const;
+		int evaluate(const DataSet::AnimationBits* bits, uint32_t color, int time, int retIndices[], uint32_t retColors[], TrackCursor* cursor = nullptr) const;
+        uint32_t modulateColor(const DataSet::AnimationBits* bits, uint32_t color, int time, TrackCursor* cursor = nullptr) const;
 		int extractLEDIndices(int retIndices[]) const;
 	};
 
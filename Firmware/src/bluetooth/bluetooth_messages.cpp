@@ -47,6 +47,30 @@ const char* Message::GetMessageTypeString(Message::MessageType msgType)
 		return "Flash";
 	case MessageType_RequestDefaultAnimSetColor:
 		return "RequestDefaultAnimSetColor";
+	case MessageType_TelemetryRaw:
+		return "TelemetryRaw";
+	case MessageType_RollCapture:
+		return "RollCapture";
+	case MessageType_BulkWindowSetup:
+		return "BulkWindowSetup";
+	case MessageType_BulkWindowSetupAck:
+		return "BulkWindowSetupAck";
+	case MessageType_BulkWindowDataAck:
+		return "BulkWindowDataAck";
+	case MessageType_TransferCompressedAnimSet:
+		return "TransferCompressedAnimSet";
+	case MessageType_RequestDataSetHashes:
+		return "RequestDataSetHashes";
+	case MessageType_DataSetHashes:
+		return "DataSetHashes";
+	case MessageType_TransferAnimSetPatch:
+		return "TransferAnimSetPatch";
+	case MessageType_TransferAnimSetPatchAck:
+		return "TransferAnimSetPatchAck";
+	case MessageType_BulkResumeSetup:
+		return "BulkResumeSetup";
+	case MessageType_BulkResumeSetupAck:
+		return "BulkResumeSetupAck";
 	default:
 		return "<missing>";
 	}
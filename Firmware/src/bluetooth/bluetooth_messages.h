@@ -7,6 +7,8 @@
 
 #define MAX_DATA_SIZE 100
 #define VERSION_INFO_SIZE 6
+#define TELEMETRY_RAW_DATA_SIZE 64
+#define DATA_SET_SECTION_COUNT 13 // See DataSet::DataSetSection
 
 #pragma pack(push, 1)
 
@@ -84,6 +86,18 @@ struct Message
 		MessageType_LightUpFace,
 		MessageType_SetLEDToColor,
 		MessageType_DebugAnimController,
+		MessageType_TelemetryRaw,
+		MessageType_RollCapture,
+		MessageType_BulkWindowSetup,
+		MessageType_BulkWindowSetupAck,
+		MessageType_BulkWindowDataAck,
+		MessageType_TransferCompressedAnimSet, // Same as TransferAnimSet, but the data is sent LZ77 compressed
+		MessageType_RequestDataSetHashes,
+		MessageType_DataSetHashes,
+		MessageType_TransferAnimSetPatch,
+		MessageType_TransferAnimSetPatchAck,
+		MessageType_BulkResumeSetup,
+		MessageType_BulkResumeSetupAck,
 
 		MessageType_Count
 	};
@@ -150,6 +164,7 @@ struct MessageBulkData
 {
 	uint8_t size;
 	uint16_t offset;
+	uint32_t crc; // CRC-32 of the data, see Utils::computeHash
 	uint8_t data[MAX_DATA_SIZE];
 
 	inline MessageBulkData() : Message(Message::MessageType_BulkData) {}
@@ -162,6 +177,60 @@ struct MessageBulkDataAck
 	inline MessageBulkDataAck() : Message(Message::MessageType_BulkDataAck) {}
 };
 
+/// <summary>
+/// Bulk setup from senders that can keep several chunks in flight. Receivers that can too answer
+/// with MessageBulkWindowSetupAck, the others with a plain BulkSetupAck (i.e. one chunk at a time).
+/// </summary>
+struct MessageBulkWindowSetup
+	: Message
+{
+	uint16_t size;
+	uint8_t windowSize; // Chunks in flight
+
+	inline MessageBulkWindowSetup() : Message(Message::MessageType_BulkWindowSetup) {}
+};
+
+struct MessageBulkWindowSetupAck
+	: Message
+{
+	uint8_t windowSize; // Chunks in flight the receiver can take
+
+	inline MessageBulkWindowSetupAck() : Message(Message::MessageType_BulkWindowSetupAck) {}
+};
+
+struct MessageBulkWindowDataAck
+	: Message
+{
+	uint16_t offset;	// Everything before was received
+	uint32_t chunkMask;	// Bit i is set if the chunk i chunks after offset was received too
+
+	inline MessageBulkWindowDataAck() : Message(Message::MessageType_BulkWindowDataAck) {}
+};
+
+/// <summary>
+/// Bulk setup for transfers that can be picked up where they left off if the connection drops.
+/// The central keeps the same session id when it sends the same data again.
+/// </summary>
+struct MessageBulkResumeSetup
+	: Message
+{
+	uint32_t sessionId;
+	uint16_t size;
+	uint8_t windowSize; // Chunks in flight, 1 to send them one at a time
+
+	inline MessageBulkResumeSetup() : Message(Message::MessageType_BulkResumeSetup) {}
+};
+
+struct MessageBulkResumeSetupAck
+	: Message
+{
+	uint16_t offset; // The receiver already has everything before this...
+	uint32_t hash; // ...and this is its hash, so the central can check it's the same data
+	uint8_t windowSize;
+
+	inline MessageBulkResumeSetupAck() : Message(Message::MessageType_BulkResumeSetupAck) {}
+};
+
 struct MessageTransferAnimSet
 	: Message
 {
@@ -188,6 +257,45 @@ struct MessageTransferAnimSetAck
 	inline MessageTransferAnimSetAck() : Message(Message::MessageType_TransferAnimSetAck) {}
 };
 
+/// <summary>
+/// Hash of each section of the current data set, so the central can tell which
+/// flash pages need updating. Pages are counted from the start of the settings.
+/// </summary>
+struct MessageDataSetHashes
+	: Message
+{
+	uint16_t pageSize;
+	uint16_t dataOffset; // Where the data set data starts, from the start of the first page
+	uint32_t dataSize;
+	uint32_t sectionHashes[DATA_SET_SECTION_COUNT];
+
+	inline MessageDataSetHashes() : Message(Message::MessageType_DataSetHashes) {}
+};
+
+/// <summary>
+/// Same as TransferAnimSet, but only the pages in the mask are sent, the others
+/// are expected to be unchanged.
+/// </summary>
+struct MessageTransferAnimSetPatch
+	: MessageTransferAnimSet
+{
+	uint32_t pageMask;
+
+	inline MessageTransferAnimSetPatch() { type = Message::MessageType_TransferAnimSetPatch; }
+};
+
+/// <summary>
+/// Sent when the die is ready to receive the first page in the mask, as one bulk transfer.
+/// The die may add pages to the ones the central asked for, i.e. pages it can't keep.
+/// </summary>
+struct MessageTransferAnimSetPatchAck
+	: Message
+{
+	uint8_t result;
+	uint32_t pageMask; // Pages still to be sent
+	inline MessageTransferAnimSetPatchAck() : Message(Message::MessageType_TransferAnimSetPatchAck) {}
+};
+
 struct MessageTransferTestAnimSet
 	: Message
 {
@@ -264,14 +372,60 @@ struct MessageStopAnim
 	inline MessageStopAnim() : Message(Message::MessageType_StopAnim) {}
 };
 
+enum TelemetryMode : uint8_t
+{
+	TelemetryMode_Off = 0,
+	TelemetryMode_Frames,	// MessageAcc, at most every 100ms
+	TelemetryMode_Raw,		// MessageTelemetryRaw, every sample
+	TelemetryMode_Capture	// MessageRollCapture and bulk data, after each roll
+};
+
 struct MessageRequestTelemetry
 	: public Message
 {
-	uint8_t telemetry;
+	uint8_t telemetry; // TelemetryMode
 
 	inline MessageRequestTelemetry() : Message(Message::MessageType_RequestTelemetry) {}
 };
 
+/// <summary>
+/// Batched raw accelerometer readings (telemetry v2). The first sample is sent as is, the next ones
+/// as a stream of 4 bit nibbles, low nibble first. For each axis of each sample, a nibble holds the
+/// signed difference to the previous reading (-7 to 7), or 0x8 followed by 2 nibbles of the 8 bit
+/// reading itself when it moved more than that.
+/// </summary>
+struct MessageTelemetryRaw
+	: public Message
+{
+	uint16_t sequence;		// Incremented for every batch, sent or not, so the central can tell what it missed
+	uint8_t sampleRate;		// Hz
+	uint8_t sampleCount;
+	uint32_t time;			// Of the first sample, in ms
+	int8_t firstX, firstY, firstZ;
+	uint8_t data[TELEMETRY_RAW_DATA_SIZE]; // Only the used part is sent
+
+	inline MessageTelemetryRaw() : Message(Message::MessageType_TelemetryRaw) {}
+};
+
+/// <summary>
+/// Announces a roll captured on the die, the samples follow as bulk data,
+/// 3 bytes each for the x, y and z 8 bit readings
+/// </summary>
+struct MessageRollCapture
+	: public Message
+{
+	uint32_t time;			// Of the first sample, in ms
+	uint16_t sampleCount;
+	uint16_t triggerIndex;	// Sample at which the die started being handled or rolling
+	uint8_t sampleRate;		// Hz
+	uint8_t rollState;		// What the roll ended on, OnFace or Crooked
+	uint8_t face;
+	uint8_t truncated;		// 1 when the history didn't go back far enough for the pre-roll, if the trigger
+							// is missing too the samples start after it and triggerIndex is 0
+
+	inline MessageRollCapture() : Message(Message::MessageType_RollCapture) {}
+};
+
 struct MessageProgramDefaultAnimSet
 	: public Message
 {
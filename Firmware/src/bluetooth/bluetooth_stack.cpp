@@ -59,7 +59,7 @@ namespace Stack
     #define SEC_PARAM_MIN_KEY_SIZE          7                                       /**< Minimum encryption key size. */
     #define SEC_PARAM_MAX_KEY_SIZE          16                                      /**< Maximum encryption key size. */
 
-    #define MAX_CLIENTS 2
+    #define MAX_CLIENTS 4
 
     #define RSSI_THRESHOLD_DBM 1
 
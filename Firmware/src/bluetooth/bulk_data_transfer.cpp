@@ -1,14 +1,24 @@
 #include "bulk_data_transfer.h"
 #include "bluetooth_messages.h"
 #include "bluetooth_message_service.h"
+#include "bluetooth_stack.h"
 #include "drivers_nrf/timers.h"
 #include "malloc.h"
 #include "drivers_nrf/flash.h"
+#include "utils/utils.h"
 
 #define RETRY_MS (10000) // ms
 #define TIMEOUT_MS (3000) // ms
 #define BLOCK_SIZE (MAX_DATA_SIZE)
 #define MAX_RETRY_COUNT (5)
+#define BULK_WINDOW_SIZE (8) // Most chunks in flight, up to 32 with the ack mask
+#define WINDOW_RETRY_MS (1000) // ms, acks come back every connection interval or so
+#define FAST_RESEND_THRESHOLD (2) // Chunks received past a missing one before we resend it
+#define BULK_QUEUE_SIZE (BULK_WINDOW_SIZE - 1) // Chunks that can wait while another one is written to flash
+#define DECODE_BUFFER_SIZE (128) // Decoded bytes waiting to be written to flash
+#define LZ77_HEADER_SIZE (4) // Decoded size
+#define LZ77_TOKEN_SIZE (3) // 16 bit back reference (offset << 4 | length), then a literal
+#define LZ77_MAX_TOKEN_OUTPUT (16) // 15 bytes copied, plus the literal
 
 using namespace DriversNRF;
 
@@ -31,12 +41,26 @@ namespace Bluetooth
 		State currentState;
 		uint16_t currentOffset;
 
+		// Sliding window, when the central can take several chunks at once
+		int windowSize; // 1 if it only knows to ack one chunk at a time
+		int chunkCount;
+		int ackedChunks; // The central has all the chunks before this one
+		uint32_t ackedChunkMask; // And bit i is set if it has chunk ackedChunks + i too
+		int nextChunk; // First chunk we haven't sent yet
+		int fastResendChunk; // Missing chunk we already resent without waiting for the timeout
+
 		int retryCount;
 		sendResultCallback callback;
 		void* context;
 
 		APP_TIMER_DEF(timeoutTimer);
 
+		void onSetupAck(void* context, const Message* message);
+		void onDataAck(void* context, const Message* message);
+		void onWindowDataAck(void* context, const Message* message);
+		void onDataTimeout(void* context);
+		void finish(bool result);
+
 		void sendSetupMessage() {
 			NRF_LOG_DEBUG("Sending Setup Message");
 			// Start the timeout timer before anything else
@@ -48,17 +72,54 @@ namespace Bluetooth
 			MessageService::SendMessage(&setupMsg);
 		}
 
+		bool sendChunk(uint16_t offset) {
+			MessageBulkData dataMsg;
+			dataMsg.size = MIN(size - offset, BLOCK_SIZE);
+			dataMsg.offset = offset;
+			memcpy(dataMsg.data, &data[offset], dataMsg.size);
+			dataMsg.crc = Utils::computeHash(dataMsg.data, dataMsg.size);
+			return MessageService::SendMessage(&dataMsg);
+		}
+
 		void sendCurrentChunk() {
 			NRF_LOG_DEBUG("Sending Chunk (offset: %d)", currentOffset);
 			// Start the timeout timer before anything else
 			Timers::startTimer(timeoutTimer, RETRY_MS, nullptr);
 
 			// Then send the data chunk
-			MessageBulkData dataMsg;
-			dataMsg.size = MIN(size - currentOffset, BLOCK_SIZE);
-			dataMsg.offset = currentOffset;
-			memcpy(dataMsg.data, &data[currentOffset], dataMsg.size);
-			MessageService::SendMessage(&dataMsg);
+			sendChunk(currentOffset);
+		}
+
+		/// <summary>
+		/// Sends the chunks the window has room for. If the radio is busy we stop there,
+		/// the next ack or the timeout carry on.
+		/// </summary>
+		void sendWindow() {
+			while (nextChunk < chunkCount && nextChunk < ackedChunks + windowSize) {
+				if (!sendChunk(nextChunk * BLOCK_SIZE)) {
+					break;
+				}
+				nextChunk++;
+			}
+		}
+
+		/// <summary>
+		/// Resends the chunks in flight before the passed in one that the central doesn't have
+		/// </summary>
+		void resendMissingChunks(int endChunk) {
+			for (int i = ackedChunks; i < endChunk; ++i) {
+				if ((ackedChunkMask & (1u << (i - ackedChunks))) == 0) {
+					NRF_LOG_DEBUG("Resending Chunk (offset: %d)", i * BLOCK_SIZE);
+					if (!sendChunk(i * BLOCK_SIZE)) {
+						break;
+					}
+				}
+			}
+		}
+
+		void restartTimeout() {
+			Timers::stopTimer(timeoutTimer);
+			Timers::startTimer(timeoutTimer, windowSize > 1 ? WINDOW_RETRY_MS : RETRY_MS, nullptr);
 		}
 
 		/// <summary>
@@ -81,9 +142,7 @@ namespace Bluetooth
 					retryCount++;
 					if (retryCount >= MAX_RETRY_COUNT) {
 						// Fail!
-						currentState = State_Done;
-						MessageService::UnregisterMessageHandler(Message::MessageType_BulkSetupAck);
-						callback(context, false, data, size);
+						finish(false);
 					} else {
 						// Try again...
 						sendSetupMessage();
@@ -92,64 +151,137 @@ namespace Bluetooth
 				// Else ignore
 				});
 
-			// We register for a response first to be sure and not miss the ack
-			MessageService::RegisterMessageHandler(Message::MessageType_BulkSetupAck, nullptr, [](void* context, const Message* message) {
-				NRF_LOG_DEBUG("Received Ack for Setup");
-				if (currentState == State_WaitingForSetupAck) {
-					// Cancel the timer first
-					Timers::stopTimer(timeoutTimer);
+			// We register for a response first to be sure and not miss the ack,
+			// centrals that can take several chunks at once answer with the window ack
+			MessageService::RegisterMessageHandler(Message::MessageType_BulkSetupAck, nullptr, onSetupAck);
+			MessageService::RegisterMessageHandler(Message::MessageType_BulkWindowSetupAck, nullptr, onSetupAck);
 
-					// Stop listening for ack
-					MessageService::UnregisterMessageHandler(Message::MessageType_BulkSetupAck);
+			currentState = State_WaitingForSetupAck;
+			sendSetupMessage();
+		}
 
-					// Start sending data, wait for timeout or ack
-					Timers::createTimer(&timeoutTimer, APP_TIMER_MODE_SINGLE_SHOT, [](void* context) {
-						if (currentState == State_WaitingForDataAck) {
-							retryCount++;
-							if (retryCount >= MAX_RETRY_COUNT) {
-								// Fail!
-								currentState = State_Done;
-								MessageService::UnregisterMessageHandler(Message::MessageType_BulkDataAck);
-								callback(context, false, data, size);
-							} else {
-								// Try again
-								sendCurrentChunk();
-							}
-						}
-					});
+		void onSetupAck(void* context, const Message* message) {
+			NRF_LOG_DEBUG("Received Ack for Setup");
+			if (currentState == State_WaitingForSetupAck) {
+				// Cancel the timer first
+				Timers::stopTimer(timeoutTimer);
+
+				// Stop listening for ack
+				MessageService::UnregisterMessageHandler(Message::MessageType_BulkSetupAck);
+				MessageService::UnregisterMessageHandler(Message::MessageType_BulkWindowSetupAck);
+
+				windowSize = 1;
+				if (message->type == Message::MessageType_BulkWindowSetupAck) {
+					auto ack = (const MessageBulkWindowSetupAck*)message;
+					windowSize = MAX(1, MIN(ack->windowSize, BULK_WINDOW_SIZE));
+				}
+
+				// Start sending data, wait for timeout or ack
+				retryCount = 0;
+				Timers::createTimer(&timeoutTimer, APP_TIMER_MODE_SINGLE_SHOT, onDataTimeout);
+
+				currentState = State_WaitingForDataAck;
+				if (windowSize > 1) {
+					NRF_LOG_DEBUG("Sending with a window of %d chunks", windowSize);
+					chunkCount = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+					ackedChunks = 0;
+					ackedChunkMask = 0;
+					nextChunk = 0;
+					fastResendChunk = -1;
 
 					// We register for a response first to be sure and not miss the ack
-					MessageService::RegisterMessageHandler(Message::MessageType_BulkDataAck, nullptr, [](void* context, const Message* message) {
-						auto ack = (MessageBulkDataAck*)message;
-						NRF_LOG_DEBUG("Received Ack for Chunk (offset: %d)", ack->offset);
-
-						if (ack->offset == currentOffset)
-						{
-							// Cancel the timer first
-							Timers::stopTimer(timeoutTimer);
-
-							if (currentOffset + BLOCK_SIZE < size) {
-								// Good, move onto the next chunk
-								currentOffset += BLOCK_SIZE;
-								sendCurrentChunk();
-							} else {
-								// Done!
-								currentState = State_Done;
-								MessageService::UnregisterMessageHandler(Message::MessageType_BulkDataAck);
-								callback(context, true, data, size);
-							}
-						}
-						// Else ignore this ack, we've probably already gotten it!
-					});
+					MessageService::RegisterMessageHandler(Message::MessageType_BulkWindowDataAck, nullptr, onWindowDataAck);
+					restartTimeout();
+					sendWindow();
+				} else {
+					// We register for a response first to be sure and not miss the ack
+					MessageService::RegisterMessageHandler(Message::MessageType_BulkDataAck, nullptr, onDataAck);
+					sendCurrentChunk();
+				}
+			}
+			// Else ignore this ack, we've probably already gotten it!
+		}
+
+		void onDataAck(void* context, const Message* message) {
+			auto ack = (MessageBulkDataAck*)message;
+			NRF_LOG_DEBUG("Received Ack for Chunk (offset: %d)", ack->offset);
+
+			if (ack->offset == currentOffset)
+			{
+				// Cancel the timer first
+				Timers::stopTimer(timeoutTimer);
+				retryCount = 0;
 
-					currentState = State_WaitingForDataAck;
+				if (currentOffset + BLOCK_SIZE < size) {
+					// Good, move onto the next chunk
+					currentOffset += BLOCK_SIZE;
 					sendCurrentChunk();
+				} else {
+					// Done!
+					finish(true);
 				}
-				// Else ignore this ack, we've probably already gotten it!
-			});
+			}
+			// Else ignore this ack, we've probably already gotten it!
+		}
 
-			currentState = State_WaitingForSetupAck;
-			sendSetupMessage();
+		void onWindowDataAck(void* context, const Message* message) {
+			auto ack = (const MessageBulkWindowDataAck*)message;
+			NRF_LOG_DEBUG("Received Ack for Chunks (offset: %d, mask: 0x%08x)", ack->offset, ack->chunkMask);
+
+			int acked = ack->offset >= size ? chunkCount : ack->offset / BLOCK_SIZE;
+			if (currentState != State_WaitingForDataAck || acked < ackedChunks) {
+				// Older than what we already know
+				return;
+			}
+
+			if (acked > ackedChunks) {
+				retryCount = 0;
+			}
+			ackedChunks = acked;
+			ackedChunkMask = ack->chunkMask;
+
+			if (ackedChunks >= chunkCount) {
+				// Done!
+				Timers::stopTimer(timeoutTimer);
+				finish(true);
+				return;
+			}
+
+			// The central got chunks past one it doesn't have, that one was most likely lost
+			if (__builtin_popcount(ackedChunkMask) >= FAST_RESEND_THRESHOLD && fastResendChunk != ackedChunks) {
+				fastResendChunk = ackedChunks;
+				resendMissingChunks(ackedChunks + 32 - __builtin_clz(ackedChunkMask));
+			}
+
+			restartTimeout();
+			sendWindow();
+		}
+
+		void onDataTimeout(void* context) {
+			if (currentState == State_WaitingForDataAck) {
+				retryCount++;
+				if (retryCount >= MAX_RETRY_COUNT) {
+					// Fail!
+					finish(false);
+				} else if (windowSize > 1) {
+					// Resend whatever the central is missing
+					restartTimeout();
+					resendMissingChunks(nextChunk);
+					sendWindow();
+				} else {
+					// Try again
+					sendCurrentChunk();
+				}
+			}
+		}
+
+		void finish(bool result) {
+			currentState = State_Done;
+			MessageService::UnregisterMessageHandler(Message::MessageType_BulkSetupAck);
+			MessageService::UnregisterMessageHandler(Message::MessageType_BulkWindowSetupAck);
+			MessageService::UnregisterMessageHandler(Message::MessageType_BulkDataAck);
+			MessageService::UnregisterMessageHandler(Message::MessageType_BulkWindowDataAck);
+			callback(context, result, data, size);
 		}
 
 		#if DICE_SELFTEST && BULK_DATA_TRANSFER_SELFTEST
@@ -201,6 +333,11 @@ namespace Bluetooth
 		State currentState;
 		uint16_t currentOffset;
 
+		// Sliding window, when the central sends several chunks at once
+		int windowSize; // 1 if it sends one chunk at a time
+		int receivedChunks; // We have all the chunks before this one
+		uint32_t receivedChunkMask; // And bit i is set if we have chunk receivedChunks + i too
+
 		int retryCount;
 		receiveAllocator allocator;
 		receiveResultCallback callback;
@@ -211,6 +348,49 @@ namespace Bluetooth
 		uint8_t dataBuffer[132] __attribute__ ((aligned (4))); // data is 100 bytes so this should be enough
 		#pragma pack(pop)
 
+		// Chunks of a windowed transfer keep coming while we write one to flash, they wait here
+		struct QueuedChunk
+		{
+			uint16_t offset;
+			uint16_t size;
+			uint8_t data[MAX_DATA_SIZE];
+		};
+		QueuedChunk chunkQueue[BULK_QUEUE_SIZE];
+		uint32_t queuedChunkMask; // Bit i is set if chunkQueue[i] is in use
+		bool programming; // The chunk in dataBuffer is being written (or decoded) to flash
+		uint16_t programmingOffset;
+		bool connectionLost; // While programming, we fail once the flash is done
+
+		// Compressed transfers to flash, decoded as the chunks come in. Back references
+		// are read from what's already in flash, so we only keep the bytes not written yet.
+		bool decompress;
+		uint32_t expectedDecodedSize;
+		uint32_t decodedSize; // From the stream header
+		uint32_t decodedCount; // Bytes decoded so far...
+		uint32_t writtenCount; // ...of which these are in flash
+		int decodeCount; // And the rest is in the decode buffer
+		uint8_t decodeBuffer[DECODE_BUFFER_SIZE] __attribute__ ((aligned (4)));
+		uint8_t tokenBytes[LZ77_HEADER_SIZE]; // Token (or header) split across two chunks
+		int tokenByteCount;
+		bool headerRead;
+		uint16_t nextOffset; // Chunks need to be decoded in order
+		uint16_t chunkOffset;
+		int chunkSize;
+		int chunkPosition;
+
+		// What the last transfer to flash has written in one go from the start, and its CRC,
+		// so we don't need to go over the flash again once it's done (decoded data if compressed)
+		uint32_t writtenSize;
+		uint32_t writtenHash;
+
+		// Last resumable transfer to flash. It's kept when the connection drops, so that
+		// the central can pick up from there instead of sending everything again.
+		uint32_t resumeSessionId;
+		uint32_t resumeFlashAddress;
+		uint16_t resumeSize; // 0 if there is nothing to resume
+		bool resumable; // The central set up the current transfer with a resume setup
+		bool resuming; // The current transfer picks up the last one
+
 		APP_TIMER_DEF(timeoutTimer);
 
 		void sendSetupAckMessage() {
@@ -219,7 +399,138 @@ namespace Bluetooth
 			Timers::startTimer(timeoutTimer, RETRY_MS, nullptr);
 
 			// Then send the message
-			MessageService::SendMessage(Message::MessageType_BulkSetupAck);
+			if (resumable) {
+				MessageBulkResumeSetupAck ackMsg;
+				ackMsg.offset = writtenSize;
+				ackMsg.hash = writtenHash;
+				ackMsg.windowSize = windowSize;
+				MessageService::SendMessage(&ackMsg);
+			} else if (windowSize > 1) {
+				MessageBulkWindowSetupAck ackMsg;
+				ackMsg.windowSize = windowSize;
+				MessageService::SendMessage(&ackMsg);
+			} else {
+				MessageService::SendMessage(Message::MessageType_BulkSetupAck);
+			}
+		}
+
+		/// <summary>
+		/// Reads the transfer size and window from any kind of setup message
+		/// </summary>
+		void readSetupMessage(const Message* message) {
+			if (message->type == Message::MessageType_BulkWindowSetup) {
+				auto msg = (const MessageBulkWindowSetup*)message;
+				size = msg->size;
+				windowSize = MAX(1, MIN(msg->windowSize, BULK_WINDOW_SIZE));
+			} else if (message->type == Message::MessageType_BulkResumeSetup) {
+				auto msg = (const MessageBulkResumeSetup*)message;
+				size = msg->size;
+				windowSize = MAX(1, MIN(msg->windowSize, BULK_WINDOW_SIZE));
+			} else {
+				auto msg = (const MessageBulkSetup*)message;
+				size = msg->size;
+				windowSize = 1;
+			}
+			receivedChunks = 0;
+			receivedChunkMask = 0;
+			queuedChunkMask = 0;
+			programming = false;
+		}
+
+		void unregisterSetupHandlers() {
+			MessageService::UnregisterMessageHandler(Message::MessageType_BulkSetup);
+			MessageService::UnregisterMessageHandler(Message::MessageType_BulkWindowSetup);
+			MessageService::UnregisterMessageHandler(Message::MessageType_BulkResumeSetup);
+		}
+
+		bool isChunkReceived(uint16_t offset) {
+			int chunk = offset / BLOCK_SIZE;
+			return chunk < receivedChunks ||
+				(chunk - receivedChunks < 32 && (receivedChunkMask & (1u << (chunk - receivedChunks))) != 0);
+		}
+
+		/// <summary>
+		/// Records a chunk as received, returns false if we already had it or it doesn't fit in the ack mask
+		/// </summary>
+		bool markChunkReceived(uint16_t offset) {
+			int chunk = offset / BLOCK_SIZE;
+			if (isChunkReceived(offset) || chunk - receivedChunks >= 32) {
+				return false;
+			}
+			receivedChunkMask |= 1u << (chunk - receivedChunks);
+			while (receivedChunkMask & 1) {
+				receivedChunkMask >>= 1;
+				receivedChunks++;
+			}
+			return true;
+		}
+
+		bool allChunksReceived() {
+			return receivedChunks * BLOCK_SIZE >= size;
+		}
+
+		/// <summary>
+		/// Checks that the chunk fits in the transfer and wasn't corrupted on the way
+		/// </summary>
+		bool isChunkValid(const MessageBulkData* msg) {
+			if (msg->size > MAX_DATA_SIZE || msg->offset + msg->size > size ||
+				Utils::computeHash(msg->data, msg->size) != msg->crc) {
+				NRF_LOG_WARNING("Dropping bad bulk data chunk (offset: 0x%04x)", msg->offset);
+				return false;
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// Keeps a chunk until we're done programming the previous one, returns false if there's no room.
+		/// The central resends whatever we don't ack anyway.
+		/// </summary>
+		bool queueChunk(const MessageBulkData* msg) {
+			int freeSlot = -1;
+			for (int i = 0; i < BULK_QUEUE_SIZE; ++i) {
+				if ((queuedChunkMask & (1u << i)) == 0) {
+					freeSlot = i;
+				} else if (chunkQueue[i].offset == msg->offset) {
+					// Already waiting
+					return true;
+				}
+			}
+			if (freeSlot < 0) {
+				return false;
+			}
+			chunkQueue[freeSlot].offset = msg->offset;
+			chunkQueue[freeSlot].size = msg->size;
+			memcpy(chunkQueue[freeSlot].data, msg->data, msg->size);
+			queuedChunkMask |= 1u << freeSlot;
+			return true;
+		}
+
+		/// <summary>
+		/// Returns the queued chunk with the lowest offset, or -1 if the queue is empty
+		/// </summary>
+		int firstQueuedChunk() {
+			int ret = -1;
+			for (int i = 0; i < BULK_QUEUE_SIZE; ++i) {
+				if ((queuedChunkMask & (1u << i)) != 0 && (ret < 0 || chunkQueue[i].offset < chunkQueue[ret].offset)) {
+					ret = i;
+				}
+			}
+			return ret;
+		}
+
+		/// <summary>
+		/// Takes a chunk out of the queue, copying it to the (aligned) data buffer
+		/// </summary>
+		void dequeueChunk(int slot) {
+			memcpy(dataBuffer, chunkQueue[slot].data, chunkQueue[slot].size);
+			queuedChunkMask &= ~(1u << slot);
+		}
+
+		void sendWindowAckMessage() {
+			MessageBulkWindowDataAck ackMsg;
+			ackMsg.offset = MIN(receivedChunks * BLOCK_SIZE, size);
+			ackMsg.chunkMask = receivedChunkMask;
+			MessageService::SendMessage(&ackMsg);
 		}
 
 		void sendBulkAckMessage(uint16_t offset) {
@@ -243,6 +554,7 @@ namespace Bluetooth
 			allocator = theAllocator;
 			callback = theCallback;
 			context = theContext;
+			resumable = false;
 
 			currentState = State_Init;
 
@@ -251,14 +563,14 @@ namespace Bluetooth
 				if (currentState == State_Init) {
 					// Fail!
 					currentState = State_Done;
-					MessageService::UnregisterMessageHandler(Message::MessageType_BulkSetup);
+					unregisterSetupHandlers();
 					callback(context, false, nullptr, 0);
 				}
 				// Else ignore
 			});
 
-			// We register for the setup message
-			MessageService::RegisterMessageHandler(Message::MessageType_BulkSetup, nullptr, [](void* context, const Message* message) {
+			// We register for the setup message, from either kind of sender
+			static auto onSetup = [](void* context, const Message* message) {
 				NRF_LOG_INFO("Received Bulk Setup");
 				if (currentState == State_WaitingForSetup || currentState == State_WaitingForData) {
 
@@ -266,12 +578,11 @@ namespace Bluetooth
 					Timers::stopTimer(timeoutTimer);
 
 					// Stop listening for setup
-					MessageService::UnregisterMessageHandler(Message::MessageType_BulkSetup);
+					unregisterSetupHandlers();
 
 					// Allocate memory for the data
-					auto msg = (const MessageBulkSetup*)message;
-					data = allocator(context, msg->size);
-					size = msg->size;
+					readSetupMessage(message);
+					data = allocator(context, size);
 					if (data == nullptr) {
 						// Not enough memory
 						currentState = State_Done;
@@ -299,12 +610,29 @@ namespace Bluetooth
 					});
 
 					MessageService::RegisterMessageHandler(Message::MessageType_BulkData, nullptr, [](void* context, const Message* message) {
+						auto msg = (const MessageBulkData*)message;
+						if (!isChunkValid(msg)) {
+							return;
+						}
 
 						// Cancel the timer first
 						Timers::stopTimer(timeoutTimer);
 
 						// Copy the data
-						auto msg = (const MessageBulkData*)message;
+						if (windowSize > 1) {
+							// Chunks may come out of order, or more than once if an ack got lost
+							if (markChunkReceived(msg->offset)) {
+								memcpy(&data[msg->offset], msg->data, msg->size);
+							}
+							sendWindowAckMessage();
+							if (allChunksReceived()) {
+								// Done
+								MessageService::UnregisterMessageHandler(Message::MessageType_BulkData);
+								callback(context, true, data, size);
+							}
+							return;
+						}
+
 						memcpy(&data[msg->offset], msg->data, msg->size);
 
 						if (msg->offset + msg->size >= size) {
@@ -321,56 +649,356 @@ namespace Bluetooth
 					sendSetupAckMessage();
 				}
 				// Else ignore this setup, we've probably already gotten it!
-			});
+			};
+			MessageService::RegisterMessageHandler(Message::MessageType_BulkSetup, nullptr, onSetup);
+			MessageService::RegisterMessageHandler(Message::MessageType_BulkWindowSetup, nullptr, onSetup);
 
 			currentState = State_WaitingForSetup;
 		}
 
+		/// <summary>
+		/// Starts keeping track of a resumable transfer to flash, or checks that the setup
+		/// is for the transfer we're picking up
+		/// </summary>
+		bool setupResume(const Message* message) {
+			resumable = message->type == Message::MessageType_BulkResumeSetup;
+			if (resuming) {
+				auto msg = (const MessageBulkResumeSetup*)message;
+				if (!resumable || msg->sessionId != resumeSessionId || msg->size != resumeSize) {
+					// It's not the same data, and we can't start over on flash that isn't erased
+					NRF_LOG_WARNING("Bulk transfer doesn't match the one to resume");
+					resumeSize = 0;
+					return false;
+				}
+				NRF_LOG_INFO("Resuming bulk transfer at 0x%04x", writtenSize);
+				receivedChunks = writtenSize / BLOCK_SIZE;
+			} else if (resumable && !decompress) {
+				resumeSessionId = ((const MessageBulkResumeSetup*)message)->sessionId;
+				resumeFlashAddress = flashAddress;
+				resumeSize = size;
+				writtenSize = 0;
+				writtenHash = 0;
+			} else {
+				// The decoder can't pick up halfway, and other transfers may overwrite the last one
+				resumeSize = 0;
+				writtenSize = 0;
+				writtenHash = 0;
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// Adds the data now written to flash in one go from the start to the running CRC
+		/// </summary>
+		void updateWritten(uint32_t writtenEnd) {
+			writtenEnd = MIN(writtenEnd, size);
+			if (writtenEnd > writtenSize) {
+				writtenHash = Utils::updateHash(writtenHash, (const uint8_t*)(flashAddress + writtenSize), writtenEnd - writtenSize);
+				writtenSize = writtenEnd;
+			}
+		}
+
+		void onConnectionEvent(void* param, bool connected);
+
+		/// <summary>
+		/// Ends a transfer to flash. If it's resumable, what was written so far is kept track of.
+		/// </summary>
+		void finishToFlash(bool result, uint32_t resultSize) {
+			currentState = State_Done;
+			Timers::stopTimer(timeoutTimer);
+			unregisterSetupHandlers();
+			MessageService::UnregisterMessageHandler(Message::MessageType_BulkData);
+			Bluetooth::Stack::unHook(onConnectionEvent);
+			queuedChunkMask = 0;
+			programming = false;
+			connectionLost = false;
+			if (flashCallback != nullptr) {
+				flashCallback(context, result, flashAddress, resultSize);
+			}
+		}
+
+		void writeChunk(uint16_t offset, uint16_t chunkSize);
+
 		void receiveChunk(void* c, const Message* message) {
 			auto msg = (const MessageBulkData*)message;
+			if (!isChunkValid(msg)) {
+				// The central resends whatever we don't ack
+				return;
+			}
+
 			// Cancel the timer first
 			Timers::stopTimer(timeoutTimer);
 
-			// Ignore further messaged until we've programmed flash
-			MessageService::UnregisterMessageHandler(Message::MessageType_BulkData);
+			if (windowSize > 1 && isChunkReceived(msg->offset)) {
+				// Already programmed, our ack must have been lost
+				sendWindowAckMessage();
+				return;
+			}
 
-			// Program the data
-			NRF_LOG_DEBUG("Received Bulk Data (offset: 0x%04x, length: %d)", msg->offset, msg->size);
+			if (programming) {
+				// Write it once the flash is free
+				if (msg->offset != programmingOffset) {
+					queueChunk(msg);
+				}
+				return;
+			}
 
 			// Copy the data to properly aligned buffer
 			memcpy(dataBuffer, msg->data, msg->size);
-			NRF_LOG_DEBUG("Writing data to flash at 0x%08x", flashAddress + msg->offset);
-			//NRF_LOG_HEXDUMP_INFO(dataBuffer, msg->size);
+			writeChunk(msg->offset, msg->size);
+		}
+
+		/// <summary>
+		/// Programs the chunk in the data buffer, then moves on to the queued ones
+		/// </summary>
+		void writeChunk(uint16_t offset, uint16_t chunkSize) {
+			programming = true;
+			programmingOffset = offset;
+
+			// Program the data
+			NRF_LOG_DEBUG("Writing data to flash at 0x%08x (length: %d)", flashAddress + offset, chunkSize);
+			//NRF_LOG_HEXDUMP_INFO(dataBuffer, chunkSize);
 
 			// Round up the size of the data to write, which should be okay because the
 			// temporary buffer is large enough
-			uint32_t flashWriteSize = 4 * ((msg->size + 3) / 4);
+			uint32_t flashWriteSize = 4 * ((chunkSize + 3) / 4);
 
 			// Go ahead
-			Flash::write(nullptr, flashAddress + msg->offset, dataBuffer, flashWriteSize,
+			Flash::write(nullptr, flashAddress + offset, dataBuffer, flashWriteSize,
 				[](void* context, bool result, uint32_t address, uint16_t s) {
+					programming = false;
+					if (currentState != State_WaitingForData) {
+						// The transfer failed while we were programming
+						return;
+					}
+					if (connectionLost) {
+						finishToFlash(false, 0);
+						return;
+					}
 
 					uint16_t offset = (uint16_t)(address - flashAddress);
-					if (offset + s < size) {
-						// Be ready to receive the next message
-						MessageService::RegisterMessageHandler(Message::MessageType_BulkData, nullptr, receiveChunk);
+					bool done;
+					if (windowSize > 1) {
+						markChunkReceived(offset);
+						updateWritten(receivedChunks * BLOCK_SIZE);
+						done = allChunksReceived();
+					} else {
+						if (offset <= writtenSize) {
+							updateWritten(offset + s);
+						}
+						done = offset + s >= size;
 					}
 
 					// And send an ack!
-					sendBulkAckMessage(offset);
+					if (windowSize > 1) {
+						sendWindowAckMessage();
+					} else {
+						sendBulkAckMessage(offset);
+					}
 
 					// Are we done?
-					if (offset + s >= size) {
+					if (done) {
 						// Done
 						NRF_LOG_DEBUG("Done!")
-						if (flashCallback != nullptr) {
-							flashCallback(context, true, flashAddress, size);
-						}
+						resumeSize = 0;
+						finishToFlash(true, size);
+						return;
+					}
+
+					// Chunks that came in while we were programming
+					int slot = firstQueuedChunk();
+					if (slot >= 0) {
+						uint16_t queuedOffset = chunkQueue[slot].offset;
+						uint16_t queuedSize = chunkQueue[slot].size;
+						dequeueChunk(slot);
+						writeChunk(queuedOffset, queuedSize);
+					}
+				}
+			);
+		}
+
+		void decodeNewChunk(uint16_t offset, uint16_t newChunkSize);
+		void decodeChunk();
+		void finishCompressedChunk();
+
+		/// <summary>
+		/// Receives a chunk of an LZ77 stream (see Utils::lz77_compress) and decodes it to flash
+		/// </summary>
+		void receiveCompressedChunk(void* c, const Message* message) {
+			auto msg = (const MessageBulkData*)message;
+			if (!isChunkValid(msg)) {
+				return;
+			}
+			Timers::stopTimer(timeoutTimer);
+
+			if (msg->offset < nextOffset || (programming && msg->offset == chunkOffset)) {
+				// Got this one twice, our ack must have been lost
+				if (windowSize > 1) {
+					sendWindowAckMessage();
+				} else if (msg->offset < nextOffset) {
+					sendBulkAckMessage(msg->offset);
+				}
+				return;
+			}
+
+			if (programming || msg->offset != nextOffset) {
+				// Chunks have to be decoded in order, keep it until the ones before it are done
+				queueChunk(msg);
+				return;
+			}
+
+			memcpy(dataBuffer, msg->data, msg->size);
+			decodeNewChunk(msg->offset, msg->size);
+		}
+
+		/// <summary>
+		/// Starts decoding the chunk in the data buffer
+		/// </summary>
+		void decodeNewChunk(uint16_t offset, uint16_t newChunkSize) {
+			programming = true;
+			chunkOffset = offset;
+			chunkSize = newChunkSize;
+			chunkPosition = 0;
+			decodeChunk();
+		}
+
+		uint8_t decodedByte(uint32_t position) {
+			if (position < writtenCount) {
+				return ((const uint8_t*)flashAddress)[position];
+			} else {
+				return decodeBuffer[position - writtenCount];
+			}
+		}
+
+		/// <summary>
+		/// Writes the decoded bytes to flash, keeping what doesn't make a whole word for later,
+		/// and carries on decoding once it's done
+		/// </summary>
+		void writeDecoded(bool last) {
+			if (last && decodeCount == 0) {
+				finishCompressedChunk();
+				return;
+			}
+			uint32_t writeSize = last ? Utils::roundUpTo4(decodeCount) : (decodeCount & ~3);
+			uint32_t newBytes = last ? decodeCount : writeSize;
+			writtenHash = Utils::updateHash(writtenHash, decodeBuffer, newBytes);
+			writtenSize += newBytes;
+			Flash::write(nullptr, flashAddress + writtenCount, decodeBuffer, writeSize,
+				[](void* c, bool result, uint32_t address, uint16_t s) {
+					if (currentState != State_WaitingForData) {
+						return;
+					}
+					if (!result || connectionLost) {
+						finishToFlash(false, 0);
+						return;
+					}
+					if (decodedCount < decodedSize) {
+						writtenCount += s;
+						decodeCount -= s;
+						memmove(decodeBuffer, &decodeBuffer[s], decodeCount);
+						decodeChunk();
+					} else {
+						writtenCount = decodedCount;
+						decodeCount = 0;
+						finishCompressedChunk();
 					}
 				}
 			);
 		}
 
+		void decodeChunk() {
+			while (decodedCount < decodedSize || !headerRead) {
+				if (decodeCount + LZ77_MAX_TOKEN_OUTPUT > DECODE_BUFFER_SIZE) {
+					// Make room first, we'll be called again
+					writeDecoded(false);
+					return;
+				}
+
+				// Gather the next token, it may have started in the previous chunk
+				int needed = headerRead ? LZ77_TOKEN_SIZE : LZ77_HEADER_SIZE;
+				while (tokenByteCount < needed && chunkPosition < chunkSize) {
+					tokenBytes[tokenByteCount++] = dataBuffer[chunkPosition++];
+				}
+				if (tokenByteCount < needed) {
+					// Wait for the next chunk
+					finishCompressedChunk();
+					return;
+				}
+				tokenByteCount = 0;
+
+				if (!headerRead) {
+					decodedSize = tokenBytes[0] | (tokenBytes[1] << 8) | (tokenBytes[2] << 16) | ((uint32_t)tokenBytes[3] << 24);
+					headerRead = true;
+					NRF_LOG_DEBUG("Decoding 0x%04x bytes from 0x%04x", decodedSize, size);
+					if (decodedSize != expectedDecodedSize) {
+						// Don't write anything, the data set header would describe data we don't have
+						NRF_LOG_ERROR("Decoded data should be 0x%04x bytes, not 0x%04x", expectedDecodedSize, decodedSize);
+						finishToFlash(false, 0);
+						return;
+					}
+					continue;
+				}
+
+				uint16_t pointer = tokenBytes[0] | (tokenBytes[1] << 8);
+				uint32_t distance = pointer >> 4;
+				int length = pointer & 15;
+				if (distance > decodedCount || decodedCount + length + 1 > decodedSize) {
+					NRF_LOG_ERROR("Bad compressed data at 0x%04x", chunkOffset + chunkPosition);
+					finishToFlash(false, 0);
+					return;
+				}
+				if (distance != 0) {
+					// Byte by byte, the copy may overlap what it produces
+					uint32_t from = decodedCount - distance;
+					for (int i = 0; i < length; ++i) {
+						decodeBuffer[decodeCount++] = decodedByte(from++);
+						decodedCount++;
+					}
+				}
+				decodeBuffer[decodeCount++] = tokenBytes[2];
+				decodedCount++;
+			}
+
+			// Everything is decoded
+			writeDecoded(true);
+		}
+
+		/// <summary>
+		/// Acks the chunk once all it decoded to is in flash (but the last few bytes), or fails
+		/// </summary>
+		void finishCompressedChunk() {
+			programming = false;
+			nextOffset = chunkOffset + chunkSize;
+			bool done = headerRead && decodedCount >= decodedSize && decodeCount == 0;
+			if (windowSize > 1) {
+				markChunkReceived(chunkOffset);
+				sendWindowAckMessage();
+			} else {
+				sendBulkAckMessage(chunkOffset);
+			}
+
+			if (done) {
+				NRF_LOG_DEBUG("Done!");
+				finishToFlash(true, decodedSize);
+			} else if (nextOffset >= size) {
+				NRF_LOG_ERROR("Compressed data ended early");
+				finishToFlash(false, 0);
+			} else {
+				// Carry on with the next chunk if it already came in
+				int slot = firstQueuedChunk();
+				while (slot >= 0 && chunkQueue[slot].offset < nextOffset) {
+					// Overlaps what we decoded
+					queuedChunkMask &= ~(1u << slot);
+					slot = firstQueuedChunk();
+				}
+				if (slot >= 0 && chunkQueue[slot].offset == nextOffset) {
+					uint16_t nextSize = chunkQueue[slot].size;
+					dequeueChunk(slot);
+					decodeNewChunk(nextOffset, nextSize);
+				}
+			}
+		}
+
 		/// <summary>
 		/// Bulk data transfer directly to flash, note that the flash area must already be erased
 		/// </summary>
@@ -381,6 +1009,8 @@ namespace Bluetooth
 			retryCount = 0;
 			flashCallback = theCallback;
 			context = theContext;
+			decompress = false;
+			resuming = false;
 
 			currentState = State_Init;
 
@@ -390,17 +1020,14 @@ namespace Bluetooth
 					if (currentState == State_Init) {
 						// Fail!
 						NRF_LOG_WARNING("Timeout waiting for setup message");
-						currentState = State_Done;
-						MessageService::UnregisterMessageHandler(Message::MessageType_BulkSetup);
-						flashCallback(context, false, flashAddress, 0);
+						finishToFlash(false, 0);
 					}
 					// Else ignore
 				}
 			);
 
-			// We register for the setup message
-			MessageService::RegisterMessageHandler(Message::MessageType_BulkSetup, nullptr,
-				[](void* c, const Message* message) {
+			// We register for the setup message, from either kind of sender
+			static auto onSetup = [](void* c, const Message* message) {
 					NRF_LOG_INFO("Received Bulk Setup");
 					if (currentState == State_WaitingForSetup || currentState == State_WaitingForData) {
 
@@ -408,11 +1035,14 @@ namespace Bluetooth
 						Timers::stopTimer(timeoutTimer);
 
 						// Stop listening for setup
-						MessageService::UnregisterMessageHandler(Message::MessageType_BulkSetup);
+						unregisterSetupHandlers();
 
-						auto msg = (const MessageBulkSetup*)message;
-						size = msg->size;
-						NRF_LOG_INFO("Transfer size: 0x%04x", size);
+						readSetupMessage(message);
+						NRF_LOG_INFO("Transfer size: 0x%04x, window: %d", size, windowSize);
+						if (!setupResume(message)) {
+							finishToFlash(false, 0);
+							return;
+						}
 						currentState = State_WaitingForData;
 
 						// Send Ack, and wait for data to come in, or timeout!
@@ -421,11 +1051,9 @@ namespace Bluetooth
 								if (currentState == State_WaitingForData) {
 									retryCount++;
 									if (retryCount >= MAX_RETRY_COUNT) {
-										// Fail!
+										// Fail! If the transfer is resumable, we keep what was written so far
 										NRF_LOG_WARNING("Timeout waiting for next data message");
-										currentState = State_Done;
-										MessageService::UnregisterMessageHandler(Message::MessageType_BulkData);
-										flashCallback(context, false, flashAddress, 0);
+										finishToFlash(false, 0);
 									} else {
 										// Try again...
 										sendSetupAckMessage();
@@ -435,18 +1063,95 @@ namespace Bluetooth
 							}
 						);
 
-						MessageService::RegisterMessageHandler(Message::MessageType_BulkData, nullptr, receiveChunk);
+						if (decompress) {
+							decodedSize = 0;
+							decodedCount = 0;
+							writtenCount = 0;
+							decodeCount = 0;
+							tokenByteCount = 0;
+							headerRead = false;
+							nextOffset = 0;
+							MessageService::RegisterMessageHandler(Message::MessageType_BulkData, nullptr, receiveCompressedChunk);
+						} else {
+							MessageService::RegisterMessageHandler(Message::MessageType_BulkData, nullptr, receiveChunk);
+						}
 
 						// Send Setup ack
 						sendSetupAckMessage();
 					}
 					// Else ignore this setup, we've probably already gotten it!
-				}
-			);
+				};
+			MessageService::RegisterMessageHandler(Message::MessageType_BulkSetup, nullptr, onSetup);
+			MessageService::RegisterMessageHandler(Message::MessageType_BulkWindowSetup, nullptr, onSetup);
+			MessageService::RegisterMessageHandler(Message::MessageType_BulkResumeSetup, nullptr, onSetup);
+
+			// Fail as soon as the central goes away, rather than after all the retries
+			connectionLost = false;
+			Bluetooth::Stack::unHook(onConnectionEvent);
+			Bluetooth::Stack::hook(onConnectionEvent, nullptr);
 
 			currentState = State_WaitingForSetup;
 		}
 
+		/// <summary>
+		/// Fails the transfer to flash when the connection drops, so that a central that reconnects
+		/// right away can resume it. If we're programming, that happens once the flash is done.
+		/// </summary>
+		void onConnectionEvent(void* param, bool connected) {
+			if (connected || (currentState != State_WaitingForSetup && currentState != State_WaitingForData)) {
+				return;
+			}
+			NRF_LOG_WARNING("Connection lost during bulk transfer");
+			if (programming) {
+				connectionLost = true;
+			} else {
+				finishToFlash(false, 0);
+			}
+		}
+
+		/// <summary>
+		/// Size and CRC of the data the last transfer to flash wrote (decoded if it was compressed)
+		/// </summary>
+		uint32_t getReceivedSize()
+		{
+			return writtenSize;
+		}
+
+		uint32_t getReceivedHash()
+		{
+			return writtenHash;
+		}
+
+		/// <summary>
+		/// Whether what's in flash at this address is the beginning of an interrupted transfer
+		/// </summary>
+		bool canResumeToFlash(uint32_t theFlashAddress)
+		{
+			return resumeSize != 0 && resumeFlashAddress == theFlashAddress && writtenSize < resumeSize &&
+				Utils::computeHash((const uint8_t*)theFlashAddress, writtenSize) == writtenHash;
+		}
+
+		/// <summary>
+		/// Same as receiveToFlash, but picks up the interrupted transfer, the central has to set it up
+		/// with the same session id. Only the flash after what was written so far needs to be erased.
+		/// </summary>
+		void resumeToFlash(uint32_t theFlashAddress, void* theContext, receiveToFlashResultCallback theCallback)
+		{
+			receiveToFlash(theFlashAddress, theContext, theCallback);
+			resuming = true;
+		}
+
+		/// <summary>
+		/// Same as receiveToFlash, but the central sends the data LZ77 compressed,
+		/// it has to decode to exactly the passed in size
+		/// </summary>
+		void receiveCompressedToFlash(uint32_t theFlashAddress, uint32_t theDecodedSize, void* theContext, receiveToFlashResultCallback theCallback)
+		{
+			receiveToFlash(theFlashAddress, theContext, theCallback);
+			decompress = true;
+			expectedDecodedSize = theDecodedSize;
+		}
+
 		#if DICE_SELFTEST && BULK_DATA_TRANSFER_SELFTEST
 		void transferDone(void* context, bool result, uint8_t* data, uint16_t size) {
 			if (result) {
@@ -31,6 +31,11 @@ namespace Bluetooth
 		void receive(void* context, receiveAllocator allocator, receiveResultCallback callback);
 		typedef void (*receiveToFlashResultCallback)(void* context, bool result, uint32_t address, uint16_t data_size);
 		void receiveToFlash(uint32_t flashAddress, void* context, receiveToFlashResultCallback callback);
+		void receiveCompressedToFlash(uint32_t flashAddress, uint32_t decodedSize, void* context, receiveToFlashResultCallback callback);
+		uint32_t getReceivedSize();
+		uint32_t getReceivedHash();
+		bool canResumeToFlash(uint32_t flashAddress);
+		void resumeToFlash(uint32_t flashAddress, void* context, receiveToFlashResultCallback callback);
 		void selfTest();
 	};
 }
@@ -2,6 +2,7 @@
 #include "bluetooth_message_service.h"
 #include "bluetooth_messages.h"
 #include "bluetooth_stack.h"
+#include "bulk_data_transfer.h"
 #include "app_error.h"
 #include "app_error_weak.h"
 #include "nrf_log.h"
@@ -11,6 +12,7 @@
 #include "drivers_nrf/timers.h"
 #include "modules/accelerometer.h"
 #include "utils/utils.h"
+#include "malloc.h"
 
 using namespace Modules;
 using namespace Bluetooth;
@@ -21,11 +23,38 @@ namespace Bluetooth
 namespace Telemetry
 {
     #define TELEMETRY_RATE_MS 100
+    #define TELEMETRY_RAW_BATCH_MS 200 // Longest we hold on to raw samples before sending them
+    #define TELEMETRY_RAW_MAX_SAMPLE_NIBBLES 9 // 3 axes that each moved too much for a delta
+    #define TELEMETRY_CAPTURE_PREROLL_MS 500 // How much of what happened before the die got picked up we keep
     MessageAcc teleMessage;
     bool telemetryActive;
+    TelemetryMode telemetryMode;
     uint32_t lastMessageMS;
 
+    // Raw telemetry batch being filled
+    MessageTelemetryRaw rawMessage;
+    int rawNibbleCount;
+    Accelerometer::AccelSample rawPrevious;
+    uint16_t rawSequence;
+    uint32_t rawSentSamples;
+    uint32_t rawSentBytes;
+
     void onAccDataReceived(void* param, const Accelerometer::AccelFrame& accelFrame);
+    void onRawAccDataReceived(void* param, const Accelerometer::AccelFrame& accelFrame);
+    void writeRawNibble(uint8_t nibble);
+    void writeRawAxis(int16_t value, int16_t previous);
+    void flushRawTelemetry();
+
+    // Roll capture, the samples are kept in the accelerometer history until the roll is over
+    bool captureTriggered;
+    bool captureRolled;
+    bool captureUploading;
+    uint32_t captureTriggerTime;
+    uint8_t* captureData;
+
+    void onCaptureRollState(void* param, Accelerometer::RollState newState, int newFace);
+    void uploadCapture(Accelerometer::RollState rollState, int face);
+    void onCaptureUploaded(void* context, bool result, const uint8_t* data, uint16_t size);
     void onRequestTelemetryMessage(void* token, const Message* message);
 
     void init() {
@@ -33,6 +62,7 @@ namespace Telemetry
         MessageService::RegisterMessageHandler(Message::MessageType_RequestTelemetry, nullptr, onRequestTelemetryMessage);
         lastMessageMS = 0;
         telemetryActive = false;
+        captureUploading = false;
 
    		NRF_LOG_INFO("Telemetry initialized");
     }
@@ -52,12 +82,180 @@ namespace Telemetry
         }
     }
 
+    /// <summary>
+    /// Adds the newest raw sample to the batch, and sends the batch when it is full or old enough
+    /// </summary>
+    void onRawAccDataReceived(void* param, const Accelerometer::AccelFrame& frame) {
+        auto& history = Accelerometer::getHistory();
+        auto& sample = history.sample(history.count() - 1);
+
+        if (rawMessage.sampleCount == 0) {
+            rawMessage.time = frame.time;
+            rawMessage.firstX = (int8_t)sample.x;
+            rawMessage.firstY = (int8_t)sample.y;
+            rawMessage.firstZ = (int8_t)sample.z;
+        } else {
+            writeRawAxis(sample.x, rawPrevious.x);
+            writeRawAxis(sample.y, rawPrevious.y);
+            writeRawAxis(sample.z, rawPrevious.z);
+        }
+        rawMessage.sampleCount++;
+        rawPrevious = sample;
+
+        if (rawNibbleCount + TELEMETRY_RAW_MAX_SAMPLE_NIBBLES > TELEMETRY_RAW_DATA_SIZE * 2 ||
+            rawMessage.sampleCount == UINT8_MAX ||
+            frame.time - rawMessage.time >= TELEMETRY_RAW_BATCH_MS) {
+            flushRawTelemetry();
+        }
+    }
+
+    void writeRawNibble(uint8_t nibble) {
+        uint8_t& byte = rawMessage.data[rawNibbleCount >> 1];
+        if (rawNibbleCount & 1) {
+            byte |= nibble << 4;
+        } else {
+            byte = nibble & 0xF;
+        }
+        rawNibbleCount++;
+    }
+
+    void writeRawAxis(int16_t value, int16_t previous) {
+        int delta = value - previous;
+        if (delta >= -7 && delta <= 7) {
+            writeRawNibble(delta & 0xF);
+        } else {
+            // Escape, then the 8 bit reading
+            writeRawNibble(0x8);
+            writeRawNibble(value & 0xF);
+            writeRawNibble((value >> 4) & 0xF);
+        }
+    }
+
+    void flushRawTelemetry() {
+        if (rawMessage.sampleCount == 0) {
+            return;
+        }
+
+        int size = sizeof(MessageTelemetryRaw) - TELEMETRY_RAW_DATA_SIZE + (rawNibbleCount + 1) / 2;
+        if (Stack::canSend() && MessageService::SendMessage(&rawMessage, size)) {
+            rawSentSamples += rawMessage.sampleCount;
+            rawSentBytes += size;
+        } else {
+            NRF_LOG_DEBUG("Dropped raw telemetry batch %d", rawMessage.sequence);
+        }
+
+        rawMessage.sequence = ++rawSequence;
+        rawMessage.sampleCount = 0;
+        rawNibbleCount = 0;
+    }
+
+    /// <summary>
+    /// Starts a capture when the die gets picked up, or starts rolling straight away,
+    /// and uploads it once it has rolled and come to rest
+    /// </summary>
+    void onCaptureRollState(void* param, Accelerometer::RollState newState, int newFace) {
+        switch (newState) {
+            case Accelerometer::RollState_Handling:
+            case Accelerometer::RollState_Rolling:
+                if (!captureTriggered && !captureUploading) {
+                    captureTriggered = true;
+                    captureRolled = false;
+                    captureTriggerTime = Accelerometer::getHistory().last().time;
+                }
+                if (newState == Accelerometer::RollState_Rolling) {
+                    captureRolled = captureTriggered;
+                }
+                break;
+            case Accelerometer::RollState_OnFace:
+            case Accelerometer::RollState_Crooked:
+                if (captureTriggered) {
+                    captureTriggered = false;
+                    if (captureRolled) {
+                        // Just moving the die around isn't interesting
+                        uploadCapture(newState, newFace);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    void uploadCapture(Accelerometer::RollState rollState, int face) {
+        // Walk back from the newest sample to the start of the pre-roll, or as far as the history goes
+        auto& history = Accelerometer::getHistory();
+        uint32_t startTime = captureTriggerTime - TELEMETRY_CAPTURE_PREROLL_MS;
+        int first = history.count() - 1;
+        int trigger = first;
+        uint32_t firstTime = history.last().time;
+        while (first > 0 && (int)(firstTime - startTime) > 0) {
+            firstTime -= history.sample(first).deltaTime;
+            first--;
+            if ((int)(firstTime - captureTriggerTime) >= 0) {
+                trigger = first;
+            }
+        }
+
+        // A long roll can push the pre-roll, and even the trigger, out of the history
+        bool truncated = (int)(firstTime - startTime) > 0;
+        trigger = MAX(trigger, first);
+
+        int sampleCount = history.count() - first;
+        captureData = (uint8_t*)malloc(sampleCount * 3);
+        if (captureData == nullptr) {
+            NRF_LOG_ERROR("Not enough memory to upload roll capture");
+            return;
+        }
+        for (int i = 0; i < sampleCount; ++i) {
+            auto& sample = history.sample(first + i);
+            captureData[i * 3 + 0] = (uint8_t)sample.x;
+            captureData[i * 3 + 1] = (uint8_t)sample.y;
+            captureData[i * 3 + 2] = (uint8_t)sample.z;
+        }
+
+        // Tell the central what's coming, then send it over
+        MessageRollCapture captureMsg;
+        captureMsg.time = firstTime;
+        captureMsg.sampleCount = sampleCount;
+        captureMsg.triggerIndex = trigger - first;
+        captureMsg.truncated = truncated ? 1 : 0;
+        captureMsg.sampleRate = 1000 / ACCEL_FRAME_MS;
+        captureMsg.rollState = rollState;
+        captureMsg.face = face;
+        if (!MessageService::SendMessage(&captureMsg)) {
+            NRF_LOG_DEBUG("Couldn't send roll capture");
+            free(captureData);
+            captureData = nullptr;
+            return;
+        }
+
+        NRF_LOG_INFO("Uploading roll capture, %d samples%s", sampleCount, truncated ? ", truncated" : "");
+        captureUploading = true;
+        SendBulkData::send(captureData, sampleCount * 3, nullptr, onCaptureUploaded);
+    }
+
+    void onCaptureUploaded(void* context, bool result, const uint8_t* data, uint16_t size) {
+        if (!result) {
+            NRF_LOG_WARNING("Roll capture upload failed");
+        }
+        free(captureData);
+        captureData = nullptr;
+        captureUploading = false;
+    }
+
     void onRequestTelemetryMessage(void* token, const Message* message) {
         auto reqTelem = static_cast<const MessageRequestTelemetry*>(message);
-        if (reqTelem->telemetry != 0) {
+        if (reqTelem->telemetry != TelemetryMode_Off) {
+            TelemetryMode mode = TelemetryMode_Frames;
+            if (reqTelem->telemetry == TelemetryMode_Raw || reqTelem->telemetry == TelemetryMode_Capture) {
+                mode = (TelemetryMode)reqTelem->telemetry;
+            }
+            if (telemetryActive && mode != telemetryMode) {
+                stop();
+            }
             if (!telemetryActive) {
                 NRF_LOG_INFO("Starting Telemetry");
-                start();
+                start(mode);
             }
         } else {
             if (telemetryActive) {
@@ -67,20 +265,49 @@ namespace Telemetry
         }
     }
 
-    void start() {
-        // Init our reuseable telemetry message
-        memset(&teleMessage, 0, sizeof(teleMessage));
-        teleMessage.type = Message::MessageType_Telemetry;
+    void start(TelemetryMode mode) {
+        if (mode == TelemetryMode_Raw) {
+            // Start a new batch sequence
+            memset(&rawMessage, 0, sizeof(rawMessage));
+            rawMessage.type = Message::MessageType_TelemetryRaw;
+            rawMessage.sampleRate = 1000 / ACCEL_FRAME_MS;
+            rawNibbleCount = 0;
+            rawSequence = 0;
+            rawSentSamples = 0;
+            rawSentBytes = 0;
+            Accelerometer::hookFrameData(onRawAccDataReceived, nullptr);
+        } else if (mode == TelemetryMode_Capture) {
+            // Wait for the die to be picked up
+            captureTriggered = false;
+            Accelerometer::hookRollState(onCaptureRollState, nullptr);
+        } else {
+            // Init our reuseable telemetry message
+            memset(&teleMessage, 0, sizeof(teleMessage));
+            teleMessage.type = Message::MessageType_Telemetry;
 
-        // Ask the acceleration controller to be notified when
-        // new acceleration data comes in!
-        Accelerometer::hookFrameData(onAccDataReceived, nullptr);
+            // Ask the acceleration controller to be notified when
+            // new acceleration data comes in!
+            Accelerometer::hookFrameData(onAccDataReceived, nullptr);
+        }
+        telemetryMode = mode;
         telemetryActive = true;
     }
 
     void stop() {
         // Stop being notified!
-        Accelerometer::unHookFrameData(onAccDataReceived);
+        if (telemetryMode == TelemetryMode_Raw) {
+            Accelerometer::unHookFrameData(onRawAccDataReceived);
+            flushRawTelemetry();
+            if (rawSentSamples > 0) {
+                NRF_LOG_INFO("Raw telemetry: %d samples, %d.%02d bytes per sample", rawSentSamples,
+                    rawSentBytes / rawSentSamples, (rawSentBytes * 100 / rawSentSamples) % 100);
+            }
+        } else if (telemetryMode == TelemetryMode_Capture) {
+            // An upload in progress finishes on its own
+            Accelerometer::unHookRollState(onCaptureRollState);
+        } else {
+            Accelerometer::unHookFrameData(onAccDataReceived);
+        }
         telemetryActive = false;
     }
 }
@@ -1,11 +1,13 @@
 #pragma once
 
+#include "bluetooth_messages.h"
+
 namespace Bluetooth
 {
     namespace Telemetry
     {
         void init();
-        void start();
+        void start(TelemetryMode mode = TelemetryMode_Frames);
         void stop();
     }
 }
@@ -21,6 +21,7 @@ namespace BoardManager
         .ledDataPin =  6,
         .ledClockPin = 5,
         .ledPowerPin = 9,
+        .ledBackend = LEDBackend_BitBang,
 
         // I2C Pins for accelerometer
         .i2cDataPin = 14,
@@ -49,6 +50,7 @@ namespace BoardManager
         .ledDataPin =  1,
         .ledClockPin = 4,
         .ledPowerPin = 0,
+        .ledBackend = LEDBackend_BitBang,
 
         // I2C Pins for accelerometer
         .i2cDataPin = 12,
@@ -77,6 +79,7 @@ namespace BoardManager
         .ledDataPin =  1,
         .ledClockPin = 4,
         .ledPowerPin = 0,
+        .ledBackend = LEDBackend_BitBang,
 
         // I2C Pins for accelerometer
         .i2cDataPin = 12,
@@ -105,6 +108,7 @@ namespace BoardManager
         .ledDataPin =  0,
         .ledClockPin = 1,
         .ledPowerPin = 10,
+        .ledBackend = LEDBackend_SPIM,
 
         // I2C Pins for accelerometer
         .i2cDataPin = 12,
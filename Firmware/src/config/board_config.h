@@ -11,6 +11,15 @@ namespace Config
 {
     namespace BoardManager
     {
+        /// <summary>
+        /// How the LED chain gets its data
+        /// </summary>
+        enum LEDBackend : uint8_t
+        {
+            LEDBackend_BitBang = 0,     // GPIOs toggled by the CPU, blocks until the frame is out
+            LEDBackend_SPIM,            // SPIM peripheral with EasyDMA, frames go out in the background
+        };
+
         struct Board
         {
             // Measuring board type
@@ -20,6 +29,7 @@ namespace Config
             uint32_t ledDataPin;
             uint32_t ledClockPin;
             uint32_t ledPowerPin;
+            LEDBackend ledBackend;
 
             // I2C Pins for accelerometer
             uint32_t i2cDataPin;
@@ -424,6 +424,30 @@
 #define NRFX_TWIM_DEFAULT_CONFIG_IRQ_PRIORITY 6
 
 
+//==========================================================
+// nrfx_spim - SPIM peripheral driver
+//==========================================================
+
+// <e> NRFX_SPIM_ENABLED - nrfx_spim - SPIM peripheral driver
+#define NRFX_SPIM_ENABLED 1
+
+// <q> NRFX_SPIM0_ENABLED  - Enable SPIM0 instance
+#define NRFX_SPIM0_ENABLED 1
+
+// <q> NRFX_SPIM_EXTENDED_ENABLED  - Enable extended SPIM features
+#define NRFX_SPIM_EXTENDED_ENABLED 0
+
+// <o> NRFX_SPIM_MISO_PULL_CFG  - MISO pin pull configuration.
+// <0=> NRF_GPIO_PIN_NOPULL 
+// <1=> NRF_GPIO_PIN_PULLDOWN 
+// <3=> NRF_GPIO_PIN_PULLUP 
+#define NRFX_SPIM_MISO_PULL_CFG 1
+
+// <o> NRFX_SPIM_DEFAULT_CONFIG_IRQ_PRIORITY  - Interrupt priority
+// <0=> 0 (highest) -> 7 (lowest)
+#define NRFX_SPIM_DEFAULT_CONFIG_IRQ_PRIORITY 6
+
+
 //==========================================================
 // <h> nRF_SoftDevice 
 //==========================================================
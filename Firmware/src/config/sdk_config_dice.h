@@ -24,6 +24,19 @@
 #define SETTINGS_MANAGER_SELFTEST 0
 #define BULK_DATA_TRANSFER_SELFTEST 0
 
+//==========================================================
+// ACCELEROMETER
+//==========================================================
+// Read the accelerometer when its FIFO watermark interrupt fires, instead of only on a timer
+#ifndef ACCEL_FIFO_INTERRUPT
+#define ACCEL_FIFO_INTERRUPT 1
+#endif
+
+// Run the motion filters and face detection in fixed point, the nRF52810 has no FPU
+#ifndef ACCEL_FIXED_POINT
+#define ACCEL_FIXED_POINT 1
+#endif
+
 // Force logging on!
 #if DICE_SELFTEST
 #undef NRF_LOG_ENABLED
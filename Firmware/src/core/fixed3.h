@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include "float3.h"
+
+#define FIXED_SHIFT 16
+#define FIXED_ONE (1 << FIXED_SHIFT)
+
+namespace Core
+{
+	// Q16.16 fixed point numbers, for math that would otherwise go through the software float library
+	typedef int32_t fixed;
+
+	inline fixed toFixed(float value) { return (fixed)(value * FIXED_ONE + (value < 0.0f ? -0.5f : 0.5f)); }
+	inline float toFloat(fixed value) { return (float)value * (1.0f / FIXED_ONE); }
+	inline fixed mulFixed(fixed left, fixed right) { return (fixed)(((int64_t)left * right) >> FIXED_SHIFT); }
+	inline fixed divFixed(fixed left, fixed right) { return (fixed)(((int64_t)left << FIXED_SHIFT) / right); }
+
+	/// <summary>
+	/// Integer square root, rounded down
+	/// </summary>
+	inline uint32_t isqrt(uint64_t value)
+	{
+		uint64_t result = 0;
+		uint64_t bit = (uint64_t)1 << 62;
+		while (bit > value) {
+			bit >>= 2;
+		}
+		while (bit != 0) {
+			if (value >= result + bit) {
+				value -= result + bit;
+				result = (result >> 1) + bit;
+			} else {
+				result >>= 1;
+			}
+			bit >>= 2;
+		}
+		return (uint32_t)result;
+	}
+
+	struct fixed3
+	{
+		fixed x;
+		fixed y;
+		fixed z;
+
+		fixed3() {}
+		fixed3(fixed ax, fixed ay, fixed az) : x(ax), y(ay), z(az) {}
+		explicit fixed3(const float3& model) : x(toFixed(model.x)), y(toFixed(model.y)), z(toFixed(model.z)) {}
+
+		float3 toFloat3() const
+		{
+			return float3(toFloat(x), toFloat(y), toFloat(z));
+		}
+
+		// Squared magnitude with the full product precision, i.e. in Q32.32
+		int64_t sqrMagnitude64() const
+		{
+			return (int64_t)x * x + (int64_t)y * y + (int64_t)z * z;
+		}
+		fixed magnitude() const
+		{
+			return (fixed)isqrt(sqrMagnitude64());
+		}
+		fixed3 normalized() const
+		{
+			fixed mag = magnitude();
+			if (mag == 0) {
+				return zero();
+			}
+			return fixed3(divFixed(x, mag), divFixed(y, mag), divFixed(z, mag));
+		}
+
+		// Dot product with the full product precision, i.e. in Q32.32
+		static int64_t dot64(const fixed3& left, const fixed3& right)
+		{
+			return (int64_t)left.x * right.x + (int64_t)left.y * right.y + (int64_t)left.z * right.z;
+		}
+
+		static fixed3 zero() { return fixed3(0, 0, 0); }
+	};
+
+	inline fixed3 operator+(const fixed3& left, const fixed3& right)
+	{
+		return fixed3(left.x + right.x, left.y + right.y, left.z + right.z);
+	}
+	inline fixed3 operator-(const fixed3& left, const fixed3& right)
+	{
+		return fixed3(left.x - right.x, left.y - right.y, left.z - right.z);
+	}
+	inline fixed3 operator*(const fixed3& left, fixed right)
+	{
+		return fixed3(mulFixed(left.x, right), mulFixed(left.y, right), mulFixed(left.z, right));
+	}
+}
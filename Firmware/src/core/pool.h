@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include "assert.h"
+
+namespace Core
+{
+	/// <summary>
+	/// Fixed capacity block allocator. Hands out up to MaxCount blocks of BlockSize bytes
+	/// from a statically allocated buffer, so it never touches (or fragments) the heap.
+	/// Free blocks are chained through their own storage, so alloc and free are both O(1).
+	/// </summary>
+	template <int BlockSize, int MaxCount>
+	class Pool
+	{
+		union Block
+		{
+			Block* next;
+			uint8_t data[BlockSize];
+		};
+
+		Block blocks[MaxCount] __attribute__ ((aligned (4)));
+		Block* freeList;
+		int _count;
+		int _highWater;
+		int _failures;
+
+	public:
+		/// <summary>
+		/// Constructor
+		/// </summary>
+		Pool()
+		{
+			reset();
+		}
+
+		/// <summary>
+		/// Returns a block of BlockSize bytes, or nullptr if the pool is exhausted
+		/// </summary>
+		void* alloc()
+		{
+			Block* ret = freeList;
+			if (ret != nullptr)
+			{
+				freeList = ret->next;
+				_count++;
+				if (_count > _highWater)
+					_highWater = _count;
+			}
+			else
+			{
+				_failures++;
+			}
+			return ret;
+		}
+
+		/// <summary>
+		/// Returns a block to the pool, the pointer must have been returned by alloc()
+		/// </summary>
+		void free(void* ptr)
+		{
+			if (ptr != nullptr)
+			{
+				assert(owns(ptr));
+				Block* block = static_cast<Block*>(ptr);
+				block->next = freeList;
+				freeList = block;
+				_count--;
+			}
+		}
+
+		/// <summary>
+		/// Marks all the blocks as free again, and clears the statistics
+		/// </summary>
+		void reset()
+		{
+			for (int i = 0; i < MaxCount - 1; ++i)
+				blocks[i].next = &blocks[i + 1];
+			blocks[MaxCount - 1].next = nullptr;
+			freeList = &blocks[0];
+			_count = 0;
+			_highWater = 0;
+			_failures = 0;
+		}
+
+		/// <summary>
+		/// Checks whether a pointer belongs to this pool
+		/// </summary>
+		bool owns(const void* ptr) const
+		{
+			return ptr >= (const void*)&blocks[0] && ptr < (const void*)&blocks[MaxCount];
+		}
+
+		/// <summary>
+		/// Number of blocks currently handed out
+		/// </summary>
+		int count() const
+		{
+			return _count;
+		}
+
+		/// <summary>
+		/// Max number of blocks ever handed out at the same time
+		/// </summary>
+		int highWaterMark() const
+		{
+			return _highWater;
+		}
+
+		/// <summary>
+		/// Number of allocations that failed because the pool was exhausted
+		/// </summary>
+		int failureCount() const
+		{
+			return _failures;
+		}
+	};
+}
@@ -1,5 +1,6 @@
 #include "data_set.h"
 #include "data_set_data.h"
+#include "data_set_compiled.h"
 #include "utils/utils.h"
 #include "drivers_nrf/flash.h"
 #include "drivers_nrf/scheduler.h"
@@ -40,6 +41,9 @@ namespace DataSet
 	uint32_t size = 0;
 	uint32_t hash = 0;
 
+	// Whether the data set was programmed by a single bulk transfer, which computed its CRC as the data came in
+	bool hashReceived = false;
+
 	uint32_t availableDataSize() {
 		return Flash::getFlashEndAddress() - Flash::getDataSetDataAddress();
 	}
@@ -67,12 +71,18 @@ namespace DataSet
 				PowerManager::clearClearSettingsAndDataSet();
 
 				MessageService::RegisterMessageHandler(Message::MessageType_TransferAnimSet, nullptr, ReceiveDataSetHandler);
+				MessageService::RegisterMessageHandler(Message::MessageType_TransferCompressedAnimSet, nullptr, ReceiveDataSetHandler);
+				MessageService::RegisterMessageHandler(Message::MessageType_TransferAnimSetPatch, nullptr, ReceiveDataSetPatchHandler);
+				MessageService::RegisterMessageHandler(Message::MessageType_RequestDataSetHashes, nullptr, RequestDataSetHashesHandler);
 				NRF_LOG_INFO("DataSet initialized, size=0x%x, hash=0x%08x", size, hash);
 				auto callBackCopy = _callback;
 				_callback = nullptr;
 				if (callBackCopy != nullptr) {
 					callBackCopy(result);
 				}
+
+				// Precompute flat timelines for the animations, in the background
+				initCompiler();
 			};
 
 		//ProgramDefaultDataSet();
@@ -103,7 +113,7 @@ namespace DataSet
 
 	const Animation* getAnimation(int animationIndex) {
 		// Grab the preset data
-		uint32_t animationAddress = (uint32_t)(const void*)data->animations + data->animationOffsets[animationIndex];
+		uint32_t animationAddress = (uintptr_t)(const void*)data->animations + data->animationOffsets[animationIndex];
 		return (const Animation *)animationAddress;
 	}
 
@@ -114,7 +124,7 @@ namespace DataSet
 
 	const Condition* getCondition(int conditionIndex) {
 		assert(CheckValid());
-		uint32_t conditionAddress = (uint32_t)(const void*)data->conditions + data->conditionsOffsets[conditionIndex];
+		uint32_t conditionAddress = (uintptr_t)(const void*)data->conditions + data->conditionsOffsets[conditionIndex];
 		return (const Condition*)conditionAddress;
 	}
 
@@ -125,7 +135,7 @@ namespace DataSet
 
 	const Action* getAction(int actionIndex) {
 		assert(CheckValid());
-		uint32_t actionAddress = (uint32_t)(const void*)data->actions + data->actionsOffsets[actionIndex];
+		uint32_t actionAddress = (uintptr_t)(const void*)data->actions + data->actionsOffsets[actionIndex];
 		return (const Action*)actionAddress;
 	}
 
@@ -152,28 +162,12 @@ namespace DataSet
 
 	int offset = 0;
 
-	void ReceiveDataSetHandler(void* context, const Message* msg) {
-		NRF_LOG_INFO("Received Request to download new animation set");
-		const MessageTransferAnimSet* message = (const MessageTransferAnimSet*)msg;
-
-		NRF_LOG_DEBUG("Animation Data to be received:");
-		NRF_LOG_DEBUG("Palette: %d * %d", message->paletteSize, sizeof(uint8_t));
-		NRF_LOG_DEBUG("RGB Keyframes: %d * %d", message->rgbKeyFrameCount, sizeof(RGBKeyframe));
-		NRF_LOG_DEBUG("RGB Tracks: %d * %d", message->rgbTrackCount, sizeof(RGBTrack));
-		NRF_LOG_DEBUG("Keyframes: %d * %d", message->keyFrameCount, sizeof(Keyframe));
-		NRF_LOG_DEBUG("Tracks: %d * %d", message->trackCount, sizeof(Track));
-		NRF_LOG_DEBUG("Animation Offsets: %d * %d", message->animationCount, sizeof(uint16_t));
-		NRF_LOG_DEBUG("Animations: %d", message->animationSize);
-		NRF_LOG_DEBUG("Conditions Offsets: %d * %d", message->conditionCount, sizeof(uint16_t));
-		NRF_LOG_DEBUG("Conditions: %d", message->conditionSize);
-		NRF_LOG_DEBUG("Actions Offsets: %d * %d", message->actionCount, sizeof(uint16_t));
-		NRF_LOG_DEBUG("Actions: %d", message->actionSize);
-		NRF_LOG_DEBUG("Rules: %d * %d", message->ruleCount, sizeof(Rule));
-		NRF_LOG_DEBUG("Behavior: %d", sizeof(Behavior));
-
-		// Store the address and size
+	/// <summary>
+	/// Lays out the data set described by a transfer message, right after the data set header in flash
+	/// </summary>
+	void layoutDataSet(const MessageTransferAnimSet* message, Data& newData) {
 		NRF_LOG_DEBUG("Setting up pointers");
-		Data newData  __attribute__ ((aligned (4)));
+		memset(&newData, 0, sizeof(Data)); // So that the same layout always compares equal
 		newData.headMarker = ANIMATION_SET_VALID_KEY;
 		newData.version = ANIMATION_SET_VERSION;
 
@@ -227,6 +221,56 @@ namespace DataSet
 		address += sizeof(Behavior);
 
 		newData.tailMarker = ANIMATION_SET_VALID_KEY;
+	}
+
+	void onDataSetProgrammed(bool result) {
+		size = computeDataSetSize();
+		if (result && hashReceived && ReceiveBulkData::getReceivedSize() == size) {
+			hash = ReceiveBulkData::getReceivedHash();
+		} else {
+			hash = computeDataSetHash();
+		}
+
+		//printAnimationInfo();
+		NRF_LOG_INFO("Dataset size=0x%x, hash=0x%08x", size, hash);
+		//NRF_LOG_INFO("Data addr: 0x%08x, data: 0x%08x", Flash::getDataSetAddress(), Flash::getDataSetDataAddress());
+		MessageService::SendMessage(Message::MessageType_TransferAnimSetFinished);
+	}
+
+	void ReceiveDataSetHandler(void* context, const Message* msg) {
+		NRF_LOG_INFO("Received Request to download new animation set");
+		const MessageTransferAnimSet* message = (const MessageTransferAnimSet*)msg;
+
+		NRF_LOG_DEBUG("Animation Data to be received:");
+		NRF_LOG_DEBUG("Palette: %d * %d", message->paletteSize, sizeof(uint8_t));
+		NRF_LOG_DEBUG("RGB Keyframes: %d * %d", message->rgbKeyFrameCount, sizeof(RGBKeyframe));
+		NRF_LOG_DEBUG("RGB Tracks: %d * %d", message->rgbTrackCount, sizeof(RGBTrack));
+		NRF_LOG_DEBUG("Keyframes: %d * %d", message->keyFrameCount, sizeof(Keyframe));
+		NRF_LOG_DEBUG("Tracks: %d * %d", message->trackCount, sizeof(Track));
+		NRF_LOG_DEBUG("Animation Offsets: %d * %d", message->animationCount, sizeof(uint16_t));
+		NRF_LOG_DEBUG("Animations: %d", message->animationSize);
+		NRF_LOG_DEBUG("Conditions Offsets: %d * %d", message->conditionCount, sizeof(uint16_t));
+		NRF_LOG_DEBUG("Conditions: %d", message->conditionSize);
+		NRF_LOG_DEBUG("Actions Offsets: %d * %d", message->actionCount, sizeof(uint16_t));
+		NRF_LOG_DEBUG("Actions: %d", message->actionSize);
+		NRF_LOG_DEBUG("Rules: %d * %d", message->ruleCount, sizeof(Rule));
+		NRF_LOG_DEBUG("Behavior: %d", sizeof(Behavior));
+
+		// Store the address and size
+		Data newData  __attribute__ ((aligned (4)));
+		layoutDataSet(message, newData);
+
+		// Compressed data is decoded as it comes in, it has to decode to exactly what we laid out
+		static bool compressed;
+		static uint32_t dataSize;
+		compressed = message->type == Message::MessageType_TransferCompressedAnimSet;
+		dataSize = computeDataSetDataSize(&newData);
+
+		hashReceived = true;
+
+		// If the last transfer of this same data set got interrupted, pick up where it left off
+		static bool resuming;
+		resuming = !compressed && Bluetooth::ReceiveBulkData::canResumeToFlash(Flash::getDataSetDataAddress());
 
 		static auto receiveToFlash = [](Flash::ProgramFlashFuncCallback callback) {
 			MessageTransferAnimSetAck ack;
@@ -234,20 +278,22 @@ namespace DataSet
 			MessageService::SendMessage(&ack);
 
 			// Transfer data
-			Bluetooth::ReceiveBulkData::receiveToFlash(Flash::getDataSetDataAddress(), nullptr, callback);
+			if (resuming) {
+				Bluetooth::ReceiveBulkData::resumeToFlash(Flash::getDataSetDataAddress(), nullptr, callback);
+			} else if (compressed) {
+				Bluetooth::ReceiveBulkData::receiveCompressedToFlash(Flash::getDataSetDataAddress(), dataSize, nullptr, callback);
+			} else {
+				Bluetooth::ReceiveBulkData::receiveToFlash(Flash::getDataSetDataAddress(), nullptr, callback);
+			}
 		};
 
-		static auto onProgramFinished = [](bool result) {
-			size = computeDataSetSize();
-			hash = computeDataSetHash();
-
-			//printAnimationInfo();
-			NRF_LOG_INFO("Dataset size=0x%x, hash=0x%08x", size, hash);
-			//NRF_LOG_INFO("Data addr: 0x%08x, data: 0x%08x", Flash::getDataSetAddress(), Flash::getDataSetDataAddress());
-			MessageService::SendMessage(Message::MessageType_TransferAnimSetFinished);
-		};
+		if (resuming && Flash::resumeProgramFlash(newData, receiveToFlash, onDataSetProgrammed)) {
+			NRF_LOG_INFO("Resuming animation set transfer");
+			return;
+		}
 
-		if (!Flash::programFlash(newData, *SettingsManager::getSettings(), receiveToFlash, onProgramFinished)) {
+		resuming = false;
+		if (!Flash::programFlash(newData, *SettingsManager::getSettings(), receiveToFlash, onDataSetProgrammed)) {
 			// Don't send data please
 			MessageTransferAnimSetAck ack;
 			ack.result = 0;
@@ -255,21 +301,82 @@ namespace DataSet
 		}
 	}
 
+	/// <summary>
+	/// Same as ReceiveDataSetHandler, but only the pages that changed get erased and sent over
+	/// </summary>
+	void ReceiveDataSetPatchHandler(void* context, const Message* msg) {
+		const MessageTransferAnimSetPatch* message = (const MessageTransferAnimSetPatch*)msg;
+		NRF_LOG_INFO("Received Request to patch animation set, pages 0x%08x", message->pageMask);
+
+		Data newData  __attribute__ ((aligned (4)));
+		layoutDataSet(message, newData);
+		hashReceived = false;
+
+		static auto receivePageToFlash = [](uint32_t pageMask, uint32_t address, uint32_t size, Flash::ProgramFlashFuncCallback callback) {
+			// Let the central know we're ready for the next page
+			MessageTransferAnimSetPatchAck ack;
+			ack.result = 1;
+			ack.pageMask = pageMask;
+			MessageService::SendMessage(&ack);
+
+			Bluetooth::ReceiveBulkData::receiveToFlash(address, nullptr, callback);
+		};
+
+		if (!Flash::patchFlash(newData, *SettingsManager::getSettings(), message->pageMask, receivePageToFlash, onDataSetProgrammed)) {
+			// The central should send the whole data set instead
+			MessageTransferAnimSetPatchAck ack;
+			ack.result = 0;
+			ack.pageMask = 0;
+			MessageService::SendMessage(&ack);
+		}
+	}
+
+	/// <summary>
+	/// Sends the hash of each section of the data set, so the central can figure out what changed
+	/// </summary>
+	void RequestDataSetHashesHandler(void* context, const Message* msg) {
+		uint32_t sizes[DataSetSection_Count];
+		computeDataSetSectionSizes(data, sizes);
+
+		MessageDataSetHashes hashes;
+		hashes.pageSize = Flash::getPageSize();
+		hashes.dataOffset = Flash::getDataSetDataAddress() - Flash::getFlashStartAddress();
+		hashes.dataSize = size;
+		const uint8_t* address = (const uint8_t*)Flash::getDataSetDataAddress();
+		for (int i = 0; i < DataSetSection_Count; ++i) {
+			hashes.sectionHashes[i] = Utils::computeHash(address, sizes[i]);
+			address += sizes[i];
+		}
+		MessageService::SendMessage(&hashes);
+	}
+
+	/// <summary>
+	/// Size in flash of each section of the data set, they follow each other in that order
+	/// </summary>
+	void computeDataSetSectionSizes(const Data* newData, uint32_t outSizes[DataSetSection_Count]) {
+		outSizes[DataSetSection_Palette] = Utils::roundUpTo4(newData->animationBits.paletteSize * sizeof(uint8_t));
+		outSizes[DataSetSection_RGBKeyframes] = newData->animationBits.rgbKeyFrameCount * sizeof(RGBKeyframe);
+		outSizes[DataSetSection_RGBTracks] = newData->animationBits.rgbTrackCount * sizeof(RGBTrack);
+		outSizes[DataSetSection_Keyframes] = newData->animationBits.keyFrameCount * sizeof(Keyframe);
+		outSizes[DataSetSection_Tracks] = newData->animationBits.trackCount * sizeof(Track);
+		outSizes[DataSetSection_AnimationOffsets] = Utils::roundUpTo4(sizeof(uint16_t) * newData->animationCount); // round up to multiple of 4
+		outSizes[DataSetSection_Animations] = newData->animationsSize;
+		outSizes[DataSetSection_ConditionOffsets] = Utils::roundUpTo4(sizeof(uint16_t) * newData->conditionCount); // round up to multiple of 4
+		outSizes[DataSetSection_Conditions] = newData->conditionsSize;
+		outSizes[DataSetSection_ActionOffsets] = Utils::roundUpTo4(sizeof(uint16_t) * newData->actionCount); // round up to multiple of 4
+		outSizes[DataSetSection_Actions] = newData->actionsSize;
+		outSizes[DataSetSection_Rules] = newData->ruleCount * sizeof(Rule);
+		outSizes[DataSetSection_Behavior] = sizeof(Behavior);
+	}
+
 	uint32_t computeDataSetDataSize(const Data* newData) {
-		return
-			Utils::roundUpTo4(newData->animationBits.paletteSize * sizeof(uint8_t)) +
-			newData->animationBits.rgbKeyFrameCount * sizeof(RGBKeyframe) +
-			newData->animationBits.rgbTrackCount * sizeof(RGBTrack) +
-			newData->animationBits.keyFrameCount * sizeof(Keyframe) +
-			newData->animationBits.trackCount * sizeof(Track) +
-			Utils::roundUpTo4(sizeof(uint16_t) * newData->animationCount) + // round up to multiple of 4
-			newData->animationsSize +
-			Utils::roundUpTo4(sizeof(uint16_t) * newData->conditionCount) + // round up to multiple of 4
-			newData->conditionsSize +
-			Utils::roundUpTo4(sizeof(uint16_t) * newData->actionCount) + // round up to multiple of 4
-			newData->actionsSize +
-			newData->ruleCount * sizeof(Rule) +
-			sizeof(Behavior);
+		uint32_t sizes[DataSetSection_Count];
+		computeDataSetSectionSizes(newData, sizes);
+		uint32_t ret = 0;
+		for (int i = 0; i < DataSetSection_Count; ++i) {
+			ret += sizes[i];
+		}
+		return ret;
 	}
 
 
@@ -20,6 +20,25 @@ namespace DataSet
 {
 	struct Data;
 
+	// The regions of the data set data, in the order they are laid out in flash
+	enum DataSetSection
+	{
+		DataSetSection_Palette = 0,
+		DataSetSection_RGBKeyframes,
+		DataSetSection_RGBTracks,
+		DataSetSection_Keyframes,
+		DataSetSection_Tracks,
+		DataSetSection_AnimationOffsets,
+		DataSetSection_Animations,
+		DataSetSection_ConditionOffsets,
+		DataSetSection_Conditions,
+		DataSetSection_ActionOffsets,
+		DataSetSection_Actions,
+		DataSetSection_Rules,
+		DataSetSection_Behavior,
+		DataSetSection_Count // Must match DATA_SET_SECTION_COUNT
+	};
+
 	typedef void (*DataSetWrittenCallback)(bool success);
 
 	void init(DataSetWrittenCallback callback);
@@ -56,9 +75,12 @@ namespace DataSet
 	const Behaviors::Behavior* getBehavior();
 
 	uint32_t computeDataSetDataSize(const Data* newData);
+	void computeDataSetSectionSizes(const Data* newData, uint32_t outSizes[DataSetSection_Count]);
 
 	void ProgramDefaultDataSet(const Config::Settings& settingsPackAlong, DataSetWrittenCallback callback);
 	void ReceiveDataSetHandler(void* context, const Bluetooth::Message* msg);
+	void ReceiveDataSetPatchHandler(void* context, const Bluetooth::Message* msg);
+	void RequestDataSetHashesHandler(void* context, const Bluetooth::Message* msg);
 
 	void printAnimationInfo();
 }
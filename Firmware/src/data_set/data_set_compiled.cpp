@@ -0,0 +1,523 @@
+#include "data_set_compiled.h"
+#include "data_set.h"
+#include "data_set_data.h"
+#include "data_animation_bits.h"
+#include "animations/animation_keyframed.h"
+#include "animations/animation_gradientpattern.h"
+#include "drivers_nrf/flash.h"
+#include "config/board_config.h"
+#include "config/settings.h"
+#include "utils/utils.h"
+#include "nrf_log.h"
+
+using namespace Animations;
+using namespace DriversNRF;
+using namespace Config;
+using namespace Utils;
+
+#define COMPILE_BUFFER_SIZE 160 // bytes written to flash at a time, must be a multiple of 4
+
+namespace DataSet
+{
+	void onProgrammingEvent(void* context, Flash::ProgrammingEventType evt);
+	void compileNextChunk();
+	void finishCompile(bool result);
+
+	// Where the compiled data is, valid only when compiledValid is true
+	bool compiledValid = false;
+	const CompiledAnimation* compiledAnimations = nullptr;
+	const CompiledTimeline* compiledTimelines = nullptr;
+	const CompiledSegment* compiledSegments = nullptr;
+
+	enum CompilePhase
+	{
+		CompilePhase_Animations = 0,
+		CompilePhase_Timelines,
+		CompilePhase_Segments,
+		CompilePhase_Header,
+	};
+
+	// Compilation is done a flash page write at a time, this keeps track of where we are
+	struct CompileState
+	{
+		CompilePhase phase;
+		int animationIndex;
+		int timelineIndex;
+		int segmentTime;		// Start time of the next segment to emit
+		int runningOffset;		// Offset of the next timeline or segment
+		uint32_t address;		// Where the next chunk goes
+		int chunkSize;
+		uint64_t compilableMask;// Which animations get compiled
+		bool running;
+	};
+
+	CompileState state;
+	CompiledData header __attribute__ ((aligned (4)));
+	uint8_t compileBuffer[COMPILE_BUFFER_SIZE] __attribute__ ((aligned (4)));
+
+	/// <summary>
+	/// The compiled data starts on the first page after the ones used by the settings and data set
+	/// </summary>
+	uint32_t getCompiledDataAddress() {
+		return Flash::getFlashStartAddress() + Flash::getFlashByteSize(sizeof(Settings) + sizeof(Data) + dataSize());
+	}
+
+	/// <summary>
+	/// Checks whether the compiled data in flash matches the current data set, and if so
+	/// sets up the pointers to it.
+	/// </summary>
+	bool checkCompiledData() {
+		uint32_t address = getCompiledDataAddress();
+		auto compiledData = (const CompiledData*)address;
+		compiledValid =
+			!state.running &&
+			CheckValid() &&
+			address + sizeof(CompiledData) < Flash::getFlashEndAddress() &&
+			compiledData->headMarker == COMPILED_DATA_SET_VALID_KEY &&
+			compiledData->version == COMPILED_DATA_SET_VERSION &&
+			compiledData->dataSetHash == dataHash() &&
+			compiledData->animationCount == getAnimationCount();
+
+		if (compiledValid) {
+			address += sizeof(CompiledData);
+			compiledAnimations = (const CompiledAnimation*)address;
+			address += compiledData->animationCount * sizeof(CompiledAnimation);
+			compiledTimelines = (const CompiledTimeline*)address;
+			address += compiledData->timelineCount * sizeof(CompiledTimeline);
+			compiledSegments = (const CompiledSegment*)address;
+		}
+		return compiledValid;
+	}
+
+	/// <summary>
+	/// Random and face based colors are only known when the animation plays
+	/// </summary>
+	bool isRGBTrackCompilable(const AnimationBits* bits, const RGBTrack& track) {
+		for (int i = 0; i < track.keyFrameCount; ++i) {
+			uint16_t colorIndex = track.getRGBKeyframe(bits, i).timeAndColor & 0b01111111;
+			if (colorIndex == PALETTE_COLOR_FROM_FACE || colorIndex == PALETTE_COLOR_FROM_RANDOM) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Only animations that don't depend on the state of the die can be compiled
+	/// </summary>
+	bool isAnimationCompilable(const Animation* preset) {
+		auto bits = getAnimationBits();
+		switch (preset->type) {
+			case Animation_Keyframed:
+				{
+					auto keyframed = static_cast<const AnimationKeyframed*>(preset);
+					if (keyframed->speedMultiplier256 == 0) {
+						return false;
+					}
+					for (int i = 0; i < keyframed->trackCount; ++i) {
+						if (!isRGBTrackCompilable(bits, bits->getRGBTrack(keyframed->tracksOffset + i))) {
+							return false;
+						}
+					}
+					return true;
+				}
+			case Animation_GradientPattern:
+				{
+					auto pattern = static_cast<const AnimationGradientPattern*>(preset);
+					if (pattern->overrideWithFace || pattern->speedMultiplier256 == 0 || pattern->duration == 0) {
+						return false;
+					}
+					auto& gradient = bits->getRGBTrack(pattern->gradientTrackOffset);
+					return gradient.keyFrameCount > 0 && isRGBTrackCompilable(bits, gradient);
+				}
+			default:
+				return false;
+		}
+	}
+
+	bool isAnimationCompiled(int animationIndex) {
+		return animationIndex < MAX_ANIMATIONS && (state.compilableMask & ((uint64_t)1 << animationIndex)) != 0;
+	}
+
+	int getTimelineCount(const Animation* preset) {
+		switch (preset->type) {
+			case Animation_Keyframed:
+				return static_cast<const AnimationKeyframed*>(preset)->trackCount;
+			case Animation_GradientPattern:
+				return static_cast<const AnimationGradientPattern*>(preset)->trackCount;
+			default:
+				return 0;
+		}
+	}
+
+	int getTimelineKeyframeCount(const Animation* preset, int timelineIndex) {
+		auto bits = getAnimationBits();
+		if (preset->type == Animation_Keyframed) {
+			auto keyframed = static_cast<const AnimationKeyframed*>(preset);
+			return bits->getRGBTrack(keyframed->tracksOffset + timelineIndex).keyFrameCount;
+		} else {
+			auto pattern = static_cast<const AnimationGradientPattern*>(preset);
+			return bits->getTrack(pattern->tracksOffset + timelineIndex).keyFrameCount;
+		}
+	}
+
+	/// <summary>
+	/// Returns the leds driven by a timeline, with the flow order already applied
+	/// </summary>
+	uint32_t getTimelineLEDMask(const Animation* preset, int timelineIndex) {
+		auto bits = getAnimationBits();
+		int ledCount = BoardManager::getBoard()->ledCount;
+		uint32_t boardMask = lowBitsMask(ledCount);
+		if (preset->type == Animation_Keyframed) {
+			auto keyframed = static_cast<const AnimationKeyframed*>(preset);
+			uint32_t ledMask = bits->getRGBTrack(keyframed->tracksOffset + timelineIndex).ledMask & boardMask;
+			if (keyframed->flowOrder != 0) {
+				uint32_t flowMask = 0;
+				for (int i = 0; i < ledCount && i < 20; ++i) {
+					if (ledMask & (1 << i)) {
+						flowMask |= 1 << flowOrderToLEDIndex(i);
+					}
+				}
+				ledMask = flowMask;
+			}
+			return ledMask;
+		} else {
+			auto pattern = static_cast<const AnimationGradientPattern*>(preset);
+			return bits->getTrack(pattern->tracksOffset + timelineIndex).ledMask & boardMask;
+		}
+	}
+
+	/// <summary>
+	/// Evaluates the timeline color the same way the regular animation instances do
+	/// </summary>
+	uint32_t evaluateTimeline(const Animation* preset, int timelineIndex, int time) {
+		auto bits = getAnimationBits();
+		if (preset->type == Animation_Keyframed) {
+			auto keyframed = static_cast<const AnimationKeyframed*>(preset);
+			auto& track = bits->getRGBTrack(keyframed->tracksOffset + timelineIndex);
+			return track.evaluateColor(bits, time * 256 / keyframed->speedMultiplier256);
+		} else {
+			auto pattern = static_cast<const AnimationGradientPattern*>(preset);
+			auto& gradient = bits->getRGBTrack(pattern->gradientTrackOffset);
+			auto& track = bits->getTrack(pattern->tracksOffset + timelineIndex);
+			uint32_t gradientColor = gradient.evaluateColor(bits, time * 1000 / pattern->duration);
+			return track.modulateColor(bits, gradientColor, time * 256 / pattern->speedMultiplier256);
+		}
+	}
+
+	/// <summary>
+	/// Returns the first animation time after the passed in one at which a keyframe of the timeline
+	/// is reached, or -1 if there are none left before the end of the animation.
+	/// </summary>
+	int getNextBreakpoint(const Animation* preset, int timelineIndex, int after) {
+		auto bits = getAnimationBits();
+		int ret = -1;
+		auto consider = [&](int time) {
+			if (time > after && time <= preset->duration && (ret < 0 || time < ret)) {
+				ret = time;
+			}
+		};
+
+		// Keyframe times are converted to the first animation time that reaches them
+		if (preset->type == Animation_Keyframed) {
+			auto keyframed = static_cast<const AnimationKeyframed*>(preset);
+			auto& track = bits->getRGBTrack(keyframed->tracksOffset + timelineIndex);
+			for (int i = 0; i < track.keyFrameCount; ++i) {
+				consider((track.getRGBKeyframe(bits, i).time() * keyframed->speedMultiplier256 + 255) / 256);
+			}
+		} else {
+			auto pattern = static_cast<const AnimationGradientPattern*>(preset);
+			auto& gradient = bits->getRGBTrack(pattern->gradientTrackOffset);
+			auto& track = bits->getTrack(pattern->tracksOffset + timelineIndex);
+			for (int i = 0; i < track.keyFrameCount; ++i) {
+				consider((track.getKeyframe(bits, i).time() * pattern->speedMultiplier256 + 255) / 256);
+			}
+			for (int i = 0; i < gradient.keyFrameCount; ++i) {
+				consider((gradient.getRGBKeyframe(bits, i).time() * pattern->duration + 999) / 1000);
+			}
+		}
+		return ret;
+	}
+
+	int getSegmentCount(const Animation* preset, int timelineIndex) {
+		if (getTimelineKeyframeCount(preset, timelineIndex) == 0) {
+			return 0;
+		}
+		int count = 1;
+		for (int time = getNextBreakpoint(preset, timelineIndex, 0); time >= 0; time = getNextBreakpoint(preset, timelineIndex, time)) {
+			count++;
+		}
+		return count;
+	}
+
+	/// <summary>
+	/// Fills a segment going from the passed in time to the next breakpoint, and returns
+	/// that breakpoint, or -1 if it was the last segment of the timeline.
+	/// The colors are exact at the breakpoints and linearly interpolated in between.
+	/// </summary>
+	int compileSegment(const Animation* preset, int timelineIndex, int startTime, CompiledSegment* outSegment) {
+		uint32_t startColor = evaluateTimeline(preset, timelineIndex, startTime);
+		int endTime = getNextBreakpoint(preset, timelineIndex, startTime);
+
+		outSegment->startColor = startColor;
+		outSegment->startTime = (uint16_t)startTime;
+		outSegment->padding = 0;
+		if (endTime < 0) {
+			// Hold the last color
+			outSegment->deltaRed = 0;
+			outSegment->deltaGreen = 0;
+			outSegment->deltaBlue = 0;
+		} else {
+			uint32_t endColor = evaluateTimeline(preset, timelineIndex, endTime);
+			int duration = endTime - startTime;
+			outSegment->deltaRed = ((int)getRed(endColor) - (int)getRed(startColor)) * 65536 / duration;
+			outSegment->deltaGreen = ((int)getGreen(endColor) - (int)getGreen(startColor)) * 65536 / duration;
+			outSegment->deltaBlue = ((int)getBlue(endColor) - (int)getBlue(startColor)) * 65536 / duration;
+		}
+		return endTime;
+	}
+
+	/// <summary>
+	/// Moves the compile state to the next timeline to process, starting with the current one.
+	/// Returns false once all the compiled animations have been visited.
+	/// </summary>
+	bool seekTimeline(bool needSegments) {
+		while (state.animationIndex < (int)header.animationCount) {
+			auto preset = getAnimation(state.animationIndex);
+			int timelineCount = isAnimationCompiled(state.animationIndex) ? getTimelineCount(preset) : 0;
+			if (state.timelineIndex >= timelineCount) {
+				state.animationIndex++;
+				state.timelineIndex = 0;
+			} else if (needSegments && getTimelineKeyframeCount(preset, state.timelineIndex) == 0) {
+				state.timelineIndex++;
+			} else {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void restartState(CompilePhase phase) {
+		state.phase = phase;
+		state.animationIndex = 0;
+		state.timelineIndex = 0;
+		state.segmentTime = 0;
+		state.runningOffset = 0;
+	}
+
+	/// <summary>
+	/// Writes the next compiled record into the buffer, returns its size or 0 if it doesn't fit
+	/// </summary>
+	int emitRecord(uint8_t* buffer, int bufferSize) {
+		switch (state.phase) {
+			case CompilePhase_Animations:
+				{
+					if (bufferSize < (int)sizeof(CompiledAnimation)) {
+						return 0;
+					}
+					auto preset = getAnimation(state.animationIndex);
+					auto compiledAnimation = reinterpret_cast<CompiledAnimation*>(buffer);
+					compiledAnimation->timelinesOffset = (uint16_t)state.runningOffset;
+					compiledAnimation->timelineCount = isAnimationCompiled(state.animationIndex) ? getTimelineCount(preset) : 0;
+					state.runningOffset += compiledAnimation->timelineCount;
+					state.animationIndex++;
+					if (state.animationIndex >= (int)header.animationCount) {
+						restartState(CompilePhase_Timelines);
+						if (!seekTimeline(false)) {
+							state.phase = CompilePhase_Header;
+						}
+					}
+					return sizeof(CompiledAnimation);
+				}
+			case CompilePhase_Timelines:
+				{
+					if (bufferSize < (int)sizeof(CompiledTimeline)) {
+						return 0;
+					}
+					auto preset = getAnimation(state.animationIndex);
+					auto timeline = reinterpret_cast<CompiledTimeline*>(buffer);
+					timeline->ledMask = getTimelineLEDMask(preset, state.timelineIndex);
+					timeline->segmentsOffset = (uint16_t)state.runningOffset;
+					timeline->segmentCount = getSegmentCount(preset, state.timelineIndex);
+					state.runningOffset += timeline->segmentCount;
+					state.timelineIndex++;
+					if (!seekTimeline(false)) {
+						restartState(CompilePhase_Segments);
+						if (!seekTimeline(true)) {
+							state.phase = CompilePhase_Header;
+						}
+					}
+					return sizeof(CompiledTimeline);
+				}
+			case CompilePhase_Segments:
+				{
+					if (bufferSize < (int)sizeof(CompiledSegment)) {
+						return 0;
+					}
+					auto preset = getAnimation(state.animationIndex);
+					auto segment = reinterpret_cast<CompiledSegment*>(buffer);
+					state.segmentTime = compileSegment(preset, state.timelineIndex, state.segmentTime, segment);
+					if (state.segmentTime < 0) {
+						// Done with this timeline
+						state.timelineIndex++;
+						state.segmentTime = 0;
+						if (!seekTimeline(true)) {
+							state.phase = CompilePhase_Header;
+						}
+					}
+					return sizeof(CompiledSegment);
+				}
+			default:
+				return 0;
+		}
+	}
+
+	/// <summary>
+	/// Hooks the compiler into flash programming and compiles the current data set
+	/// </summary>
+	void initCompiler() {
+		Flash::hookProgrammingEvent(onProgrammingEvent, nullptr);
+		compile();
+	}
+
+	void compile() {
+		if (state.running) {
+			// Already on it
+			return;
+		}
+
+		if (checkCompiledData()) {
+			NRF_LOG_INFO("Compiled animations up to date");
+			return;
+		}
+
+		if (!CheckValid()) {
+			return;
+		}
+
+		// Figure out which animations can be compiled and how much room they will take
+		header.headMarker = COMPILED_DATA_SET_VALID_KEY;
+		header.version = COMPILED_DATA_SET_VERSION;
+		header.dataSetHash = dataHash();
+		header.animationCount = getAnimationCount();
+		header.timelineCount = 0;
+		header.segmentCount = 0;
+		state.compilableMask = 0;
+		for (int i = 0; i < (int)header.animationCount && i < MAX_ANIMATIONS; ++i) {
+			auto preset = getAnimation(i);
+			if (isAnimationCompilable(preset)) {
+				state.compilableMask |= (uint64_t)1 << i;
+				int timelineCount = getTimelineCount(preset);
+				header.timelineCount += timelineCount;
+				for (int j = 0; j < timelineCount; ++j) {
+					header.segmentCount += getSegmentCount(preset, j);
+				}
+			}
+		}
+
+		if (state.compilableMask == 0) {
+			NRF_LOG_INFO("No animation to compile");
+			return;
+		}
+
+		if (header.timelineCount > 0xFFFF || header.segmentCount > 0xFFFF) {
+			NRF_LOG_WARNING("Too many timelines or segments to compile animations");
+			return;
+		}
+
+		uint32_t totalSize =
+			sizeof(CompiledData) +
+			header.animationCount * sizeof(CompiledAnimation) +
+			header.timelineCount * sizeof(CompiledTimeline) +
+			header.segmentCount * sizeof(CompiledSegment);
+
+		uint32_t address = getCompiledDataAddress();
+		if (address + totalSize > Flash::getFlashEndAddress()) {
+			NRF_LOG_WARNING("Not enough flash to compile animations, %d bytes needed", totalSize);
+			return;
+		}
+
+		NRF_LOG_INFO("Compiling %d timelines, %d segments", header.timelineCount, header.segmentCount);
+		state.running = true;
+		state.address = address + sizeof(CompiledData);
+		restartState(CompilePhase_Animations);
+		Flash::erase(nullptr, address, Flash::bytesToPages(totalSize), [](void* context, bool result, uint32_t address, uint16_t size) {
+			if (result && state.running) {
+				compileNextChunk();
+			} else {
+				finishCompile(false);
+			}
+		});
+	}
+
+	/// <summary>
+	/// Fills the buffer with as many records as will fit and writes it to flash,
+	/// the header goes last, so that an interrupted compilation is never used.
+	/// </summary>
+	void compileNextChunk() {
+		int size = 0;
+		while (state.phase != CompilePhase_Header) {
+			int recordSize = emitRecord(&compileBuffer[size], COMPILE_BUFFER_SIZE - size);
+			if (recordSize == 0) {
+				break;
+			}
+			size += recordSize;
+		}
+
+		if (size > 0) {
+			state.chunkSize = size;
+			Flash::write(nullptr, state.address, compileBuffer, size, [](void* context, bool result, uint32_t address, uint16_t size) {
+				if (result && state.running) {
+					state.address += state.chunkSize;
+					compileNextChunk();
+				} else {
+					finishCompile(false);
+				}
+			});
+		} else {
+			Flash::write(nullptr, getCompiledDataAddress(), &header, sizeof(CompiledData), [](void* context, bool result, uint32_t address, uint16_t size) {
+				finishCompile(result && state.running);
+			});
+		}
+	}
+
+	void finishCompile(bool result) {
+		state.running = false;
+		if (result && checkCompiledData()) {
+			NRF_LOG_INFO("Animations compiled to 0x%08x", getCompiledDataAddress());
+		} else {
+			NRF_LOG_ERROR("Error compiling animations");
+		}
+	}
+
+	bool isCompiled() {
+		return compiledValid;
+	}
+
+	const CompiledAnimation* getCompiledAnimation(int animationIndex) {
+		if (!compiledValid || compiledAnimations[animationIndex].timelineCount == 0) {
+			return nullptr;
+		}
+		return &compiledAnimations[animationIndex];
+	}
+
+	const CompiledTimeline& getCompiledTimeline(int timelineIndex) {
+		return compiledTimelines[timelineIndex];
+	}
+
+	const CompiledSegment* getCompiledSegments(int segmentsOffset) {
+		return &compiledSegments[segmentsOffset];
+	}
+
+	void onProgrammingEvent(void* context, Flash::ProgrammingEventType evt) {
+		if (evt == Flash::ProgrammingEventType_Begin) {
+			// The data set (and possibly the compiled data) is about to be overwritten. If a compile
+			// erase or write is still in flight, Flash waits for it before programming, and the
+			// compile stops when it completes.
+			compiledValid = false;
+			state.running = false;
+		} else {
+			compile();
+		}
+	}
+}
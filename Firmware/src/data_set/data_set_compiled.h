@@ -0,0 +1,37 @@
+#pragma once
+
+#include "animations/animation_compiled.h"
+#include "stdint.h"
+
+#define COMPILED_DATA_SET_VALID_KEY (0xC0DEF00D)
+#define COMPILED_DATA_SET_VERSION 1
+
+namespace DataSet
+{
+	/// <summary>
+	/// Header of the compiled animations, stored in flash on the first page after the data set.
+	/// It is followed by the compiled animations, timelines and segments arrays, in that order.
+	/// </summary>
+	struct CompiledData
+	{
+		uint32_t headMarker;
+		uint32_t version;
+		uint32_t dataSetHash; // Hash of the data set the animations were compiled from
+		uint32_t animationCount;
+		uint32_t timelineCount;
+		uint32_t segmentCount;
+	};
+
+	// Hooks flash programming so that new data sets get compiled too, and compiles the current one
+	void initCompiler();
+
+	// Compiles the keyframed and gradient pattern animations of the current data set
+	// into flat timelines, unless they already are. Runs asynchronously.
+	void compile();
+	bool isCompiled();
+
+	// Returns the compiled version of an animation of the data set, or nullptr
+	const Animations::CompiledAnimation* getCompiledAnimation(int animationIndex);
+	const Animations::CompiledTimeline& getCompiledTimeline(int timelineIndex);
+	const Animations::CompiledSegment* getCompiledSegments(int segmentsOffset);
+}
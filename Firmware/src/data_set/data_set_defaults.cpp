@@ -127,7 +127,7 @@ namespace DataSet
         // Allocate a buffer for all the data we're about to create
         // We'll write the data in the buffer and then program it into flash!
         writeBuffer = malloc(bufferSize);
-        uint32_t writeBufferAddress = (uint32_t)writeBuffer;
+        uint32_t writeBufferAddress = (uint32_t)(uintptr_t)writeBuffer;
 
         // Allocate a new data object
         // We need to fill it with pointers as if the data it points to is located in flash already.
@@ -241,7 +241,7 @@ namespace DataSet
 		}
 
         // Create conditions
-        uint32_t address = reinterpret_cast<uint32_t>(writeConditions);
+        uint32_t address = (uint32_t)(uintptr_t)writeConditions;
         uint16_t offset = 0;
 
         // Add Hello condition (index 0)
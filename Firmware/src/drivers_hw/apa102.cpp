@@ -2,12 +2,13 @@
 #include "nrf_gpio.h"
 #include "nrf_delay.h"
 #include "config/board_config.h"
-#include "string.h" // for memset
+#include "string.h" // for memset, memcmp
 #include "../utils/utils.h"
 #include "../utils/Rainbow.h"
 #include "core/delegate_array.h"
 #include "../drivers_nrf/log.h"
 #include "../drivers_nrf/power_manager.h"
+#include "../drivers_nrf/spi.h"
 
 using namespace Config;
 using namespace DriversNRF;
@@ -27,6 +28,24 @@ namespace APA102
 	static uint8_t clockPin;
 	static uint8_t powerPin;
 
+	// Copy of the last frame clocked out, so we don't send the same one twice
+	static uint8_t sentPixels[MAX_LED_COUNT * 3];
+	static bool sentPixelsValid;
+	static uint32_t sentFrameCount;
+	static uint32_t skippedFrameCount;
+
+	// Encoded frames, one can be composed while the other one is clocked out by the SPIM
+	#define MAX_FRAME_SIZE (4 + MAX_LED_COUNT * 4 + (MAX_LED_COUNT + 15) / 16)
+	static uint8_t frameBuffers[2][MAX_FRAME_SIZE] __attribute__ ((aligned (4)));
+	static int frameSizes[2];
+	static int frameBufferIndex; // The buffer to compose the next frame in
+	static bool framePending;
+	static bool pendingAllOff;
+	static bool inFlightAllOff;
+	static BoardManager::LEDBackend backend;
+
+	void onFrameTransferred();
+
 	DelegateArray<APA102ClientMethod, MAX_APA102_CLIENTS> ledPowerClients;
 
 	void init() {
@@ -37,7 +56,15 @@ namespace APA102
 		clockPin = board->ledClockPin;
 		powerPin = board->ledPowerPin;
 		numLEDs = board->ledCount;
+		backend = board->ledBackend;
+		frameBufferIndex = 0;
+		framePending = false;
+		pendingAllOff = false;
+		inFlightAllOff = false;
 		clear();
+		sentPixelsValid = false;
+		sentFrameCount = 0;
+		skippedFrameCount = 0;
 
 		// Initialize the pins
 		nrf_gpio_cfg(dataPin,
@@ -97,13 +124,90 @@ namespace APA102
 
 			nrf_gpio_pin_set(powerPin);
 			nrf_delay_ms(2); // Anything less than 2ms before toggling data/clk lines will cause artifacts
+
+			if (backend == BoardManager::LEDBackend_SPIM) {
+				SPI::init(clockPin, dataPin);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Turns the led power off and notifies clients, the data lines are driven low too
+	/// so they don't power the leds through their inputs.
+	/// </summary>
+	void powerOff() {
+		if (backend == BoardManager::LEDBackend_SPIM) {
+			// Release the pins
+			SPI::uninit();
+			nrf_gpio_cfg_output(dataPin);
+			nrf_gpio_cfg_output(clockPin);
+		}
+
+		nrf_gpio_pin_clear(powerPin);
+		nrf_gpio_pin_clear(dataPin);
+		nrf_gpio_pin_clear(clockPin);
+
+		// Notify clients we're turning led power off
+		for (int i = 0; i < ledPowerClients.Count(); ++i) {
+			ledPowerClients[i].handler(ledPowerClients[i].token, false);
+		}
+	}
+
+	/// <summary>
+	/// Fills an APA102 frame: start marker, one 4-byte packet per led and end marker.
+	/// Returns the number of bytes written, at most MAX_FRAME_SIZE.
+	/// </summary>
+	int encodeFrame(const uint8_t* pixelData, int ledCount, uint8_t* outFrame) {
+		uint8_t* ptr = outFrame;
+		for (int i = 0; i < 4; i++) {
+			*ptr++ = 0;						// Start-frame marker
+		}
+		for (int i = 0; i < ledCount; ++i) {
+			*ptr++ = 0xFF;					// Pixel start
+			*ptr++ = pixelData[i * 3 + 0];	// B,G,R
+			*ptr++ = pixelData[i * 3 + 1];
+			*ptr++ = pixelData[i * 3 + 2];
+		}
+		for (int i = 0; i < ((ledCount + 15) / 16); i++) {
+			*ptr++ = 0xFF;					// End-frame marker (see note above)
+		}
+		return ptr - outFrame;
+	}
+
+	/// <summary>
+	/// Hands the frame that was last composed to the SPIM, and composes the next one in the other buffer
+	/// </summary>
+	void startFrameTransfer() {
+		inFlightAllOff = pendingAllOff;
+		framePending = false;
+		if (!SPI::write(frameBuffers[frameBufferIndex], frameSizes[frameBufferIndex], onFrameTransferred)) {
+			NRF_LOG_ERROR("Could not send LED frame");
+			// The leds never got this frame, so don't skip it next time
+			sentPixelsValid = false;
+			return;
+		}
+		frameBufferIndex = 1 - frameBufferIndex;
+	}
+
+	/// <summary>
+	/// Called from the main loop once the SPIM is done clocking out a frame
+	/// </summary>
+	void onFrameTransferred() {
+		if (SPI::isBusy()) {
+			// Another frame already went out, it will call us back
+			return;
+		}
+		if (framePending) {
+			startFrameTransfer();
+		} else if (inFlightAllOff) {
+			powerOff();
 		}
 	}
 
 	void show(void) {
 
 		// Are all the physical leds already all off?
-		bool powerOff = nrf_gpio_pin_out_read(powerPin) == 0;
+		bool powerIsOff = nrf_gpio_pin_out_read(powerPin) == 0;
 
 		// Do we want all the leds to be off?
 		bool allOff = true;
@@ -114,42 +218,43 @@ namespace APA102
 			}
 		}
 
-		if (powerOff && allOff) {
+		if (powerIsOff && allOff) {
 			// Displaying all black and we've already turned every led off
+			skippedFrameCount++;
+			return;
+		}
+
+		if (!powerIsOff && sentPixelsValid && memcmp(pixels, sentPixels, numLEDs * 3) == 0) {
+			// The leds already display this exact frame
+			skippedFrameCount++;
 			return;
 		}
 
 		// Turn power on so we display something!!!
 		prepare();
 
-		uint8_t *ptr = pixels;            // -> LED data
-		uint16_t n = numLEDs;              // Counter
-
-		for (int i = 0; i < 4; i++) {
-			swSpiOut(0);    // Start-frame marker
-		}
-		do {                               // For each pixel...
-			swSpiOut(0xFF);                //  Pixel start
-			for (int i = 0; i < 3; i++) {
-				uint8_t comp = *ptr;
-				swSpiOut(comp); // R,G,B
-				ptr++;
+		memcpy(sentPixels, pixels, numLEDs * 3);
+		sentPixelsValid = true;
+		sentFrameCount++;
+
+		if (backend == BoardManager::LEDBackend_SPIM) {
+			// Compose the frame in the buffer that isn't being sent, and send it as soon as the SPIM is free.
+			// If the previous pending frame never made it out, this one replaces it.
+			frameSizes[frameBufferIndex] = encodeFrame(pixels, numLEDs, frameBuffers[frameBufferIndex]);
+			pendingAllOff = allOff;
+			framePending = true;
+			if (!SPI::isBusy()) {
+				startFrameTransfer();
+			}
+		} else {
+			int frameSize = encodeFrame(pixels, numLEDs, frameBuffers[0]);
+			for (int i = 0; i < frameSize; ++i) {
+				swSpiOut(frameBuffers[0][i]);
 			}
-		} while (--n);
-		for (int i = 0; i < ((numLEDs + 15) / 16); i++) {
-			swSpiOut(0xFF); // End-frame marker (see note above)
-		}
-
-		if (allOff) {
-			// Turn power off too
-			//nrf_delay_ms(1);
-			nrf_gpio_pin_clear(powerPin);
-			nrf_gpio_pin_clear(dataPin);
-			nrf_gpio_pin_clear(clockPin);
 
-			// Notify clients we're turning led power off
-			for (int i = 0; i < ledPowerClients.Count(); ++i) {
-				ledPowerClients[i].handler(ledPowerClients[i].token, false);
+			if (allOff) {
+				// Turn power off too
+				powerOff();
 			}
 		}
 	}
@@ -234,6 +339,14 @@ namespace APA102
 		return pixels;
 	}
 
+	uint32_t getSentFrameCount() {
+		return sentFrameCount;
+	}
+
+	uint32_t getSkippedFrameCount() {
+		return skippedFrameCount;
+	}
+
 	void hookPowerState(APA102ClientMethod method, void* param) {
 		ledPowerClients.Register(param, method);
 	}
@@ -36,6 +36,13 @@ namespace DriversHW
     uint16_t numPixels();
     uint8_t *getPixels();
 
+    // Encodes pixel data (BGR, 3 bytes per led) into the bytes to clock out to the chain
+    int encodeFrame(const uint8_t* pixelData, int ledCount, uint8_t* outFrame);
+
+    // Frames actually clocked out vs. skipped because they matched what the leds already show
+    uint32_t getSentFrameCount();
+    uint32_t getSkippedFrameCount();
+
     void selfTest();
 
 		typedef void(*APA102ClientMethod)(void* param, bool powerOn);
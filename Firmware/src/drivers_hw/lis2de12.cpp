@@ -92,10 +92,22 @@ namespace LIS2DE12
 	float cx, cy, cz;
 
 	LIS2DE12_Scale scale;
+	LIS2DE12_FIFOMode fifoMode = FIFO_BYPASS;
+
+	// Background FIFO read, in progress while the callback is set
+	FIFOReadCallback fifoReadCallback = nullptr;
+	uint8_t fifoSource;
+	uint8_t fifoBuffer[LIS2DE12_FIFO_SIZE * 6];
+	Sample fifoSamples[LIS2DE12_FIFO_SIZE];
 
 	void writeRegister(LIS2DE12_Register reg, uint8_t data);
 	uint8_t readRegister(LIS2DE12_Register reg);
 	void readRegisters(LIS2DE12_Register reg, uint8_t *buffer, uint8_t len);
+	int fifoSampleCount(uint8_t source);
+	void parseFIFOSamples(const uint8_t* buffer, Sample outSamples[], int count);
+	void onFIFOSourceRead(void* param, bool success);
+	void onFIFODataRead(void* param, bool success);
+	void finishFIFORead(int count);
 
 	/// <summary>
 	///	This function initializes the LIS2DE12. It sets up the scale (either 2, 4,
@@ -185,20 +197,42 @@ namespace LIS2DE12
 	/// </summary>
 	void read()
 	{
-		x = twosComplement(readRegister(OUT_X_H));
-		y = twosComplement(readRegister(OUT_Y_H));
-		z = twosComplement(readRegister(OUT_Z_H));
+		if (fifoMode != FIFO_BYPASS) {
+			// The output registers return the oldest sample of the FIFO, so empty it and keep the latest
+			Sample samples[LIS2DE12_FIFO_SIZE];
+			int count = readFIFO(samples, LIS2DE12_FIFO_SIZE);
+			if (count > 0) {
+				x = samples[count - 1].x;
+				y = samples[count - 1].y;
+				z = samples[count - 1].z;
+			}
+		} else {
+			x = twosComplement(readRegister(OUT_X_H));
+			y = twosComplement(readRegister(OUT_Y_H));
+			z = twosComplement(readRegister(OUT_Z_H));
+		}
 		float scaleMult = getScaleMult();
 		cx = (float)x / (float)(1 << 7) * scaleMult;
 		cy = (float)y / (float)(1 << 7) * scaleMult;
 		cz = (float)z / (float)(1 << 7) * scaleMult;
 	}
 
+	/// <summary>
+	/// Converts a raw reading, i.e. from the FIFO, into g's
+	/// </summary>
 	float convert(short value)
 	{
-		int a = twosComplement(readRegister(OUT_X_H));
 		float scaleMult = getScaleMult();
-		return (float)a / (float)(1 << 7) * scaleMult;
+		return (float)value / (float)(1 << 7) * scaleMult;
+	}
+
+	/// <summary>
+	/// Converts a raw reading into g's, as a Q16.16 fixed point number
+	/// </summary>
+	int32_t convertFixed(short value)
+	{
+		int scaleMult = 2 << scale;
+		return (int32_t)value * scaleMult * ((1 << 16) / (1 << 7));
 	}
 
 	/// <summary>
@@ -211,6 +245,122 @@ namespace LIS2DE12
 		return (readRegister(FIFO_SRC_REG) & 0x1F);
 	}
 
+	/// <summary>
+	/// ENABLE THE FIFO
+	///	In stream mode the FIFO keeps the latest 32 samples, in FIFO mode it stops collecting once full.
+	///	The watermark flag is raised when the FIFO holds more than the watermark samples.
+	///	Going through bypass mode first empties the FIFO.
+	/// </summary>
+	void enableFIFO(LIS2DE12_FIFOMode mode, uint8_t watermark)
+	{
+		writeRegister(FIFO_CTRL_REG, FIFO_BYPASS << 6);
+		uint8_t ctrl = readRegister(CTRL_REG5);
+		writeRegister(CTRL_REG5, ctrl | 0x40); // FIFO_EN
+		writeRegister(FIFO_CTRL_REG, (mode << 6) | (watermark & 0x1F));
+		fifoMode = mode;
+	}
+
+	/// <summary>
+	/// DISABLE THE FIFO
+	///	The output registers go back to holding the latest sample
+	/// </summary>
+	void disableFIFO()
+	{
+		writeRegister(FIFO_CTRL_REG, FIFO_BYPASS << 6);
+		uint8_t ctrl = readRegister(CTRL_REG5);
+		writeRegister(CTRL_REG5, ctrl & ~0x40);
+		fifoMode = FIFO_BYPASS;
+	}
+
+	/// <summary>
+	/// READ THE FIFO
+	///	Reads all the samples stored in the FIFO (up to maxCount), oldest first, with a single burst read.
+	///	While the FIFO is enabled, the register address wraps from OUT_Z_H back to OUT_X_L.
+	/// </summary>
+	/// <returns>The number of samples read</returns>
+	int readFIFO(Sample outSamples[], int maxCount)
+	{
+		int count = fifoSampleCount(readRegister(FIFO_SRC_REG));
+		if (count > maxCount) {
+			count = maxCount;
+		}
+		if (count == 0) {
+			return 0;
+		}
+
+		uint8_t buffer[LIS2DE12_FIFO_SIZE * 6];
+		readRegisters(FIFO_READ_START, buffer, count * 6);
+		parseFIFOSamples(buffer, outSamples, count);
+		return count;
+	}
+
+	/// <summary>
+	/// READ THE FIFO IN THE BACKGROUND
+	///	Same as readFIFO, but the I2C transfers are queued and the callback is called once they are done.
+	///	Returns false if a read is already in progress.
+	/// </summary>
+	bool readFIFOAsync(FIFOReadCallback callback)
+	{
+		if (fifoReadCallback != nullptr) {
+			return false;
+		}
+
+		fifoReadCallback = callback;
+		if (!I2C::readRegistersAsync(DEV_ADDRESS, FIFO_SRC_REG, &fifoSource, 1, onFIFOSourceRead, nullptr)) {
+			fifoReadCallback = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// First step of the background FIFO read, we now know how many samples to read
+	/// </summary>
+	void onFIFOSourceRead(void* param, bool success)
+	{
+		int count = success ? fifoSampleCount(fifoSource) : 0;
+		if (count == 0 || !I2C::readRegistersAsync(DEV_ADDRESS, FIFO_READ_START | 0x80, fifoBuffer, count * 6, onFIFODataRead, (void*)(intptr_t)count)) {
+			finishFIFORead(0);
+		}
+	}
+
+	/// <summary>
+	/// Second step of the background FIFO read, the samples are in
+	/// </summary>
+	void onFIFODataRead(void* param, bool success)
+	{
+		int count = success ? (int)(intptr_t)param : 0;
+		parseFIFOSamples(fifoBuffer, fifoSamples, count);
+		finishFIFORead(count);
+	}
+
+	void finishFIFORead(int count)
+	{
+		auto callback = fifoReadCallback;
+		fifoReadCallback = nullptr;
+		callback(fifoSamples, count);
+	}
+
+	/// <summary>
+	/// Returns how many samples the FIFO holds, from the FIFO_SRC_REG value
+	/// </summary>
+	int fifoSampleCount(uint8_t source)
+	{
+		return (source & 0x40) ? LIS2DE12_FIFO_SIZE : (source & 0x1F); // Overrun means the FIFO is full
+	}
+
+	/// <summary>
+	/// Each sample is stored as X_L, X_H, Y_L, Y_H, Z_L, Z_H, only the high bytes hold data
+	/// </summary>
+	void parseFIFOSamples(const uint8_t* buffer, Sample outSamples[], int count)
+	{
+		for (int i = 0; i < count; ++i) {
+			outSamples[i].x = twosComplement(buffer[i * 6 + 1]);
+			outSamples[i].y = twosComplement(buffer[i * 6 + 3]);
+			outSamples[i].z = twosComplement(buffer[i * 6 + 5]);
+		}
+	}
+
 	/// <summary>
 	/// SET FULL-SCALE RANGE
 	///	This function sets the full-scale range of the x, y, and z axis accelerometers.
@@ -239,6 +389,25 @@ namespace LIS2DE12
 		writeRegister(CTRL_REG1, ctrl);
 	}
 
+	/// <summary>
+	/// ENABLE INTERRUPT ON FIFO WATERMARK
+	/// Pin 1 goes high when the FIFO holds more samples than its watermark, and back low once read.
+	/// </summary>
+	void enableFIFOInterrupt()
+	{
+		uint8_t ctrl = readRegister(CTRL_REG3);
+		writeRegister(CTRL_REG3, ctrl | 0x04); // I1_WTM
+	}
+
+	/// <summary>
+	/// DISABLE INTERRUPT ON FIFO WATERMARK
+	/// </summary>
+	void disableFIFOInterrupt()
+	{
+		uint8_t ctrl = readRegister(CTRL_REG3);
+		writeRegister(CTRL_REG3, ctrl & ~0x04);
+	}
+
 	/// <summary>
 	/// ENABLE INTERRUPT ON TRANSIENT MOTION DETECTION
 	/// This function sets up the MMA8452Q to trigger an interrupt on pin 1
@@ -286,7 +455,8 @@ namespace LIS2DE12
 	{
 		standby();
 		// Disable interrupt on xyz axes
-		writeRegister(CTRL_REG3, 0b00000000);
+		uint8_t ctrl = readRegister(CTRL_REG3);
+		writeRegister(CTRL_REG3, ctrl & ~0b01000000);
 		active();
 	}
 
@@ -345,7 +515,7 @@ namespace LIS2DE12
 	/// </summary>
 	void readRegisters(LIS2DE12_Register reg, uint8_t *buffer, uint8_t len)
 	{
-		I2C::write(DEV_ADDRESS & 0x8000, reg, true);
+		I2C::write(DEV_ADDRESS, reg | 0x80, true); // MSB of the address enables auto-increment
 		I2C::read(DEV_ADDRESS, buffer, len);
 	}
 
@@ -55,6 +55,16 @@ enum LIS2DE12_ODR
 	ODR_5376,
 }; // possible data rates
 
+enum LIS2DE12_FIFOMode
+{
+	FIFO_BYPASS = 0,
+	FIFO_FIFO,
+	FIFO_STREAM,
+	FIFO_STREAM_TO_FIFO,
+}; // possible FIFO modes
+
+#define LIS2DE12_FIFO_SIZE 32 // Number of samples the FIFO can hold
+
 namespace DriversHW
 {
 	/// <summary>
@@ -65,17 +75,37 @@ namespace DriversHW
 		extern short x, y, z;
 		extern float cx, cy, cz;
 
-		void init(LIS2DE12_Scale fsr = SCALE_4G, LIS2DE12_ODR odr = ODR_200);
+		/// <summary>
+		/// A single raw reading, as stored in the FIFO
+		/// </summary>
+		struct Sample
+		{
+			short x, y, z;
+		};
+
+		void init(LIS2DE12_Scale fsr = SCALE_4G, LIS2DE12_ODR odr = ODR_100);
 		void read();
 		uint8_t available();
 
+		void enableFIFO(LIS2DE12_FIFOMode mode, uint8_t watermark = LIS2DE12_FIFO_SIZE - 1);
+		void disableFIFO();
+		int readFIFO(Sample outSamples[], int maxCount);
+
+		// Called from the main loop with the samples read from the FIFO, oldest first
+		typedef void (*FIFOReadCallback)(const Sample samples[], int count);
+		bool readFIFOAsync(FIFOReadCallback callback);
+
 		float convert(short value);
+		int32_t convertFixed(short value);
 
 		void setScale(LIS2DE12_Scale fsr);
 		void setODR(LIS2DE12_ODR odr);
 		void standby();
 		void active();
 
+		void enableFIFOInterrupt();
+		void disableFIFOInterrupt();
+
 		void enableTransientInterrupt();
 		void clearTransientInterrupt();
 		void disableTransientInterrupt();
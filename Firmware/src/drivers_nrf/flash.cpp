@@ -14,6 +14,7 @@
 #include "data_set/data_set.h"
 #include "data_set/data_set_data.h"
 #include "behaviors/behavior.h"
+#include "utils/utils.h"
 
 using namespace DriversNRF;
 using namespace Config;
@@ -21,6 +22,8 @@ using namespace DataSet;
 using namespace Behaviors;
 
 #define MAX_ACC_CLIENTS 8
+#define COPY_BUFFER_SIZE 64 // Bytes copied at a time when patching flash
+#define MAX_PATCH_PAGES 32 // Pages in a patch mask
 
 namespace DriversNRF
 {
@@ -32,6 +35,10 @@ namespace Flash
 
     FlashCallback callback; // This should be allocated per call...
     void* context;
+    bool busy = false; // A write or erase is in flight
+
+    typedef void (*ProgrammingStartFunc)();
+    ProgrammingStartFunc pendingProgramming; // Waiting for the operation in flight to finish
 
 	DelegateArray<ProgrammingEventMethod, MAX_ACC_CLIENTS> programmingClients;
 
@@ -122,6 +129,7 @@ namespace Flash
             }
         }
         
+        busy = false;
         if (callback != nullptr) {
             auto callbackCopy = callback;
             callback = nullptr;
@@ -129,6 +137,14 @@ namespace Flash
         } else {
             NRF_LOG_INFO("No callback");
         }
+
+        // Programming can only start once whoever had the flash (i.e. the compiler) is done with it,
+        // there is only one callback
+        if (!busy && pendingProgramming != nullptr) {
+            auto start = pendingProgramming;
+            pendingProgramming = nullptr;
+            start();
+        }
     }
 
 
@@ -152,6 +168,7 @@ namespace Flash
     }
 
     void write(void* theContext, uint32_t flashAddress, const void* data, uint32_t size, FlashCallback theCallback) {
+        busy = true;
         callback = theCallback;
         context = theContext;
         ret_code_t rc = nrf_fstorage_write(&fstorage, flashAddress, data, size, NULL);
@@ -166,6 +183,7 @@ namespace Flash
     }
 
     void erase(void* theContext, uint32_t flashAddress, uint32_t pages, FlashCallback theCallback) {
+        busy = true;
         callback = theCallback;
         context = theContext;
         ret_code_t rc = nrf_fstorage_erase(&fstorage, flashAddress, pages, NULL);
@@ -199,97 +217,406 @@ namespace Flash
 	}
 
 
-	bool programFlash(
-		const Data& newData,
-		const Settings& newSettings,
-		ProgramFlashFunc programFlashFunc,
-		ProgramFlashNotification onProgramFinished) {
+	// The data set and settings being programmed, shared by full programming and patching
+	Data _newData __attribute__ ((aligned (4)));
 
-		static Data _newData __attribute__ ((aligned (4)));
+	// Hack so we don't try to construct a new Settings in static initialization block
+	char _newSettingsBuffer[sizeof(Settings)]  __attribute__ ((aligned (4)));
+	Settings& _newSettings = *((Settings*)_newSettingsBuffer);
+	ProgramFlashNotification _onProgramFinished;
+	ProgramFlashFunc _programDataFunc;
+	bool dataInterrupted = false; // The last programming failed while receiving the data set data
 
-        // Hack so we don't try to construct a new Settings in static initialization block
-        static char _newSettingsBuffer[sizeof(Settings)]  __attribute__ ((aligned (4)));
-		static Settings& _newSettings = *((Settings*)_newSettingsBuffer);
-		static ProgramFlashFunc _programDataFunc;
-		static ProgramFlashNotification _onProgramFinished;
+	/// <summary>
+	/// Notifies clients that programming begins, so they stop using the flash, then starts
+	/// programming, right away or once the operation still in flight completes.
+	/// </summary>
+	void beginProgramming(ProgrammingStartFunc start) {
+		// Notify clients
+		for (int i = 0; i < programmingClients.Count(); ++i)
+		{
+			programmingClients[i].handler(programmingClients[i].token, ProgrammingEventType_Begin);
+		}
 
-		static auto beginProgramming = []() {
-			// Notify clients
-			for (int i = 0; i < programmingClients.Count(); ++i)
-			{
-				programmingClients[i].handler(programmingClients[i].token, ProgrammingEventType_Begin);
+		if (busy) {
+			NRF_LOG_INFO("Waiting for pending flash operation");
+			pendingProgramming = start;
+		} else {
+			start();
+		}
+	}
+
+	void finishProgramming() {
+		// Notify clients
+		for (int i = 0; i < programmingClients.Count(); ++i)
+		{
+			programmingClients[i].handler(programmingClients[i].token, ProgrammingEventType_End);
+		}
+	}
+
+	/// <summary>
+	/// Has the data set data programmed, then writes the data set header
+	/// </summary>
+	void programData() {
+		_programDataFunc([](void* context, bool result, uint32_t address, uint16_t data_size) {
+			if (result) {
+				// Program the animation set itself
+				NRF_LOG_INFO("Finished flashing dataset data, flashing dataset itself");
+				Flash::write(nullptr, getDataSetAddress(), &_newData, sizeof(Data),
+					[](void* context, bool result, uint32_t address, uint16_t data_size) {
+						if (result) {
+							NRF_LOG_INFO("Data Set written to flash!");
+						} else {
+							NRF_LOG_ERROR("Error programming dataset to flash");
+						}
+						_onProgramFinished(result);
+						finishProgramming();
+				});
+			} else {
+				NRF_LOG_ERROR("Error transfering animation data");
+				dataInterrupted = true;
+				_onProgramFinished(false);
+				finishProgramming();
 			}
-		};
+		});
+	}
 
-		static auto finishProgramming = []() {
-			// Notify clients
-			for (int i = 0; i < programmingClients.Count(); ++i)
-			{
-				programmingClients[i].handler(programmingClients[i].token, ProgrammingEventType_End);
+	/// <summary>
+	/// Erases the flash, writes the settings and has the data set programmed
+	/// </summary>
+	void eraseAndProgram() {
+		uint32_t bufferSize = DataSet::computeDataSetDataSize(&_newData);
+		uint32_t totalSize = bufferSize + sizeof(Data) + sizeof(Settings);
+		uint32_t flashSize = Flash::getFlashByteSize(totalSize);
+		uint32_t pageAddress = Flash::getFlashStartAddress();
+		uint32_t pageCount = Flash::bytesToPages(flashSize);
+
+		// Start by erasing the flash
+		Flash::erase(nullptr, pageAddress, pageCount, [](void* context, bool result, uint32_t address, uint16_t data_size) {
+			NRF_LOG_INFO("done Erasing %d page", data_size);
+			if (result) {
+				// Program settings
+				Flash::write(nullptr, getSettingsStartAddress(), &_newSettings, sizeof(Settings), [](void* context, bool result, uint32_t address, uint16_t data_size) {
+					if (result) {
+						NRF_LOG_INFO("Finished flashing settings, flashing dataset data");
+						// Receive all the buffers directly to flash
+						programData();
+					} else {
+						NRF_LOG_ERROR("Error writing settings");
+						_onProgramFinished(false);
+						finishProgramming();
+					}
+				});
+			} else {
+				NRF_LOG_ERROR("Error erasing flash");
+				_onProgramFinished(false);
+				finishProgramming();
 			}
-		};
+		});
+	}
+
+	bool programFlash(
+		const Data& newData,
+		const Settings& newSettings,
+		ProgramFlashFunc programFlashFunc,
+		ProgramFlashNotification onProgramFinished) {
 
         _newData = newData;
         _newSettings = newSettings;
         _programDataFunc = programFlashFunc;
         _onProgramFinished = onProgramFinished;
+		dataInterrupted = false;
 
 		uint32_t bufferSize = DataSet::computeDataSetDataSize(&_newData);
 		if (availableDataSize() > bufferSize) {
-			beginProgramming();
-
-			uint32_t totalSize = bufferSize + sizeof(Data) + sizeof(Settings);
-			uint32_t flashSize = Flash::getFlashByteSize(totalSize);
-			uint32_t pageAddress = Flash::getFlashStartAddress();
-			uint32_t pageCount = Flash::bytesToPages(flashSize);
-
-			// Start by erasing the flash
-			Flash::erase(nullptr, pageAddress, pageCount, [](void* context, bool result, uint32_t address, uint16_t data_size) {
-				NRF_LOG_INFO("done Erasing %d page", data_size);
-				if (result) {
-					// Program settings
-					Flash::write(nullptr, getSettingsStartAddress(), &_newSettings, sizeof(Settings), [](void* context, bool result, uint32_t address, uint16_t data_size) {
-						if (result) {
-							NRF_LOG_INFO("Finished flashing settings, flashing dataset data");
-							// Receive all the buffers directly to flash
-							_programDataFunc([](void* context, bool result, uint32_t address, uint16_t data_size) {
-								if (result) {
-									// Program the animation set itself
-    								NRF_LOG_INFO("Finished flashing dataset data, flashing dataset itself");
-									Flash::write(nullptr, getDataSetAddress(), &_newData, sizeof(Data),
-										[](void* context, bool result, uint32_t address, uint16_t data_size) {
-											if (result) {
-												NRF_LOG_INFO("Data Set written to flash!");
-											} else {
-												NRF_LOG_ERROR("Error programming dataset to flash");
-											}
-											_onProgramFinished(result);
-											finishProgramming();
-									});
-								} else {
-									NRF_LOG_ERROR("Error transfering animation data");
-									_onProgramFinished(false);
-									finishProgramming();
-								}
-							});
-						} else {
-							NRF_LOG_ERROR("Error writing settings");
-							_onProgramFinished(false);
-							finishProgramming();
-						}
-					});
-				} else {
-					NRF_LOG_ERROR("Error erasing flash");
-					_onProgramFinished(false);
-					finishProgramming();
-				}
-			});
+			beginProgramming(eraseAndProgram);
             return true;
 		} else {
             return false;
 		}
 	}
 
+	/// <summary>
+	/// Picks up programming the same data set after the data transfer failed, without erasing
+	/// the flash again. Returns false if the last programming wasn't that.
+	/// </summary>
+	bool resumeProgramFlash(
+		const Data& newData,
+		ProgramFlashFunc programFlashFunc,
+		ProgramFlashNotification onProgramFinished) {
+
+		if (!dataInterrupted || programFlashFunc != _programDataFunc || memcmp(&newData, &_newData, sizeof(Data)) != 0) {
+			return false;
+		}
+
+		NRF_LOG_INFO("Resuming dataset data");
+		_onProgramFinished = onProgramFinished;
+		dataInterrupted = false;
+		beginProgramming(programData);
+		return true;
+	}
+
+	enum PatchStep
+	{
+		PatchStep_EraseStaging = 0,
+		PatchStep_StageFirstPage,
+		PatchStep_ReceivePage,
+		PatchStep_ErasePage,
+		PatchStep_WriteSettings,
+		PatchStep_CommitPage,
+		PatchStep_WriteHeader
+	};
+
+	// Patching state
+	ProgramFlashPageFunc _programPageFunc;
+	PatchStep patchStep;
+	int patchPage; // Page being received or committed
+	uint32_t patchPageMask; // Pages left to receive
+	uint32_t patchStageMask; // Pages staged, that get committed once they are all received
+	uint32_t patchDataEnd; // End of the new data set data, rounded up to 4 bytes
+	uint32_t stagingAddress; // Where the staged pages go, one after the other
+
+	// Flash to flash copy, through a small buffer
+	uint32_t copyFrom;
+	uint32_t copyTo;
+	uint32_t copySize;
+	uint32_t copyOffset;
+	FlashCallback copyDone;
+	uint8_t copyBuffer[COPY_BUFFER_SIZE] __attribute__ ((aligned (4)));
+
+	void continuePatch(void* context, bool result, uint32_t address, uint16_t data_size);
+
+	uint32_t getPageAddress(int page) {
+		return getFlashStartAddress() + page * getPageSize();
+	}
+
+	int countPages(uint32_t pageMask) {
+		int ret = 0;
+		for (; pageMask != 0; pageMask &= pageMask - 1) {
+			ret++;
+		}
+		return ret;
+	}
+
+	/// <summary>
+	/// Returns the part of a page that holds data set data
+	/// </summary>
+	void getPageDataRange(int page, uint32_t* outStart, uint32_t* outEnd) {
+		uint32_t pageStart = getPageAddress(page);
+		uint32_t pageEnd = pageStart + getPageSize();
+		*outStart = pageStart > getDataSetDataAddress() ? pageStart : getDataSetDataAddress();
+		*outEnd = pageEnd < patchDataEnd ? pageEnd : patchDataEnd;
+		if (*outEnd < *outStart) {
+			*outEnd = *outStart;
+		}
+	}
+
+	/// <summary>
+	/// Returns where an address of a staged page is kept until the page gets committed
+	/// </summary>
+	uint32_t getStagedAddress(int page, uint32_t address) {
+		int slot = countPages(patchStageMask & ((1u << page) - 1));
+		return stagingAddress + slot * getPageSize() + address - getPageAddress(page);
+	}
+
+	void copyNextChunk() {
+		if (copyOffset >= copySize) {
+			copyDone(nullptr, true, copyTo, copySize);
+			return;
+		}
+		uint32_t chunkSize = copySize - copyOffset;
+		if (chunkSize > COPY_BUFFER_SIZE) {
+			chunkSize = COPY_BUFFER_SIZE;
+		}
+		memcpy(copyBuffer, (const void*)(copyFrom + copyOffset), chunkSize);
+		write(nullptr, copyTo + copyOffset, copyBuffer, chunkSize, [](void* context, bool result, uint32_t address, uint16_t data_size) {
+			if (result) {
+				copyOffset += data_size;
+				copyNextChunk();
+			} else {
+				copyDone(nullptr, false, copyTo, copyOffset);
+			}
+		});
+	}
+
+	void copy(uint32_t from, uint32_t to, uint32_t size, FlashCallback callback) {
+		copyFrom = from;
+		copyTo = to;
+		copySize = size;
+		copyOffset = 0;
+		copyDone = callback;
+		copyNextChunk();
+	}
+
+	/// <summary>
+	/// Has the data of the next page in the mask sent over to its staging page
+	/// </summary>
+	void receiveNextPage() {
+		patchPage = 0;
+		while ((patchPageMask & (1u << patchPage)) == 0) {
+			patchPage++;
+		}
+		patchStep = PatchStep_ReceivePage;
+		uint32_t start, end;
+		getPageDataRange(patchPage, &start, &end);
+		_programPageFunc(patchPageMask, getStagedAddress(patchPage, start), end - start, [](void* context, bool result, uint32_t address, uint16_t data_size) {
+			uint32_t start, end;
+			getPageDataRange(patchPage, &start, &end);
+			if (result && Utils::roundUpTo4(data_size) != end - start) {
+				NRF_LOG_ERROR("Page %d should have 0x%x bytes, got 0x%x", patchPage, end - start, data_size);
+				result = false;
+			}
+			patchPageMask &= ~(1u << patchPage);
+			continuePatch(context, result, address, data_size);
+		});
+	}
+
+	/// <summary>
+	/// Erases the next staged page, or writes the data set header if they are all committed
+	/// </summary>
+	void commitNextPage() {
+		do {
+			patchPage++;
+		} while (patchPage < MAX_PATCH_PAGES && (patchStageMask & (1u << patchPage)) == 0);
+
+		if (patchPage == MAX_PATCH_PAGES) {
+			patchStep = PatchStep_WriteHeader;
+			write(nullptr, getDataSetAddress(), &_newData, sizeof(Data), continuePatch);
+		} else {
+			patchStep = PatchStep_ErasePage;
+			erase(nullptr, getPageAddress(patchPage), 1, continuePatch);
+		}
+	}
+
+	/// <summary>
+	/// Copies the staged data back to the page, now that it's erased
+	/// </summary>
+	void commitPage() {
+		patchStep = PatchStep_CommitPage;
+		uint32_t start, end;
+		getPageDataRange(patchPage, &start, &end);
+		copy(getStagedAddress(patchPage, start), start, end - start, continuePatch);
+	}
+
+	/// <summary>
+	/// Moves the patch along once the current flash operation is done. Nothing of the current data set
+	/// is touched until all the pages are staged, so a failed transfer leaves it intact.
+	/// </summary>
+	void continuePatch(void* context, bool result, uint32_t address, uint16_t data_size) {
+		if (!result) {
+			if (patchStep < PatchStep_ErasePage) {
+				NRF_LOG_ERROR("Error staging flash patch, page %d step %d", patchPage, patchStep);
+			} else {
+				NRF_LOG_ERROR("Error committing flash patch, page %d step %d", patchPage, patchStep);
+			}
+			_onProgramFinished(false);
+			finishProgramming();
+			return;
+		}
+
+		uint32_t start, end;
+		switch (patchStep) {
+			case PatchStep_EraseStaging:
+				if ((patchPageMask & 1) == 0) {
+					// The first page gets rewritten with the settings, so its data needs a staged copy too
+					patchStep = PatchStep_StageFirstPage;
+					getPageDataRange(0, &start, &end);
+					copy(start, getStagedAddress(0, start), end - start, continuePatch);
+					break;
+				}
+				// Fallthrough
+			case PatchStep_StageFirstPage:
+			case PatchStep_ReceivePage:
+				if (patchPageMask != 0) {
+					receiveNextPage();
+				} else {
+					NRF_LOG_INFO("Patch staged, committing %d pages", countPages(patchStageMask));
+					patchPage = -1;
+					commitNextPage();
+				}
+				break;
+			case PatchStep_ErasePage:
+				if (patchPage == 0) {
+					patchStep = PatchStep_WriteSettings;
+					write(nullptr, getSettingsStartAddress(), &_newSettings, sizeof(Settings), continuePatch);
+				} else {
+					commitPage();
+				}
+				break;
+			case PatchStep_WriteSettings:
+				commitPage();
+				break;
+			case PatchStep_CommitPage:
+				commitNextPage();
+				break;
+			case PatchStep_WriteHeader:
+				NRF_LOG_INFO("Data Set patched!");
+				_onProgramFinished(true);
+				finishProgramming();
+				break;
+		}
+	}
+
+	void startPatch() {
+		patchPage = 0;
+		patchStep = PatchStep_EraseStaging;
+		erase(nullptr, stagingAddress, countPages(patchStageMask), continuePatch);
+	}
+
+	/// <summary>
+	/// Updates the data set in place, only reprogramming the pages in the mask. Pages that the current
+	/// data set doesn't fully cover are added to the mask. The pages are first received into spare flash
+	/// past the data set, and only once they all made it are they copied over, along with the first page
+	/// (it holds the settings), and the header is written last.
+	/// The page function gets called with the remaining pages, once each is ready to be programmed.
+	/// </summary>
+	bool patchFlash(
+		const Data& newData,
+		const Settings& newSettings,
+		uint32_t pageMask,
+		ProgramFlashPageFunc programPageFunc,
+		ProgramFlashNotification onProgramFinished) {
+
+		uint32_t bufferSize = DataSet::computeDataSetDataSize(&newData);
+		uint32_t pageCount = bytesToPages(sizeof(Settings) + sizeof(Data) + bufferSize);
+		if (!DataSet::CheckValid() || availableDataSize() <= bufferSize || pageCount > MAX_PATCH_PAGES) {
+			return false;
+		}
+
+		// Whatever the current data set doesn't cover has to be sent
+		uint32_t oldDataEnd = getDataSetDataAddress() + DataSet::dataSize();
+		uint32_t newDataEnd = getDataSetDataAddress() + Utils::roundUpTo4(bufferSize);
+		uint32_t newPageMask = pageCount < MAX_PATCH_PAGES ? pageMask & ((1u << pageCount) - 1) : pageMask;
+		for (int page = 0; page < (int)pageCount && newDataEnd > oldDataEnd; ++page) {
+			uint32_t pageStart = getPageAddress(page);
+			if (pageStart < newDataEnd && pageStart + getPageSize() > oldDataEnd) {
+				newPageMask |= 1u << page;
+			}
+		}
+
+		// The staging pages are where the compiled animations go, past both the old and new data sets,
+		// the animations get rebuilt after programming anyway
+		uint32_t oldPageCount = bytesToPages(oldDataEnd - getFlashStartAddress());
+		uint32_t newStagingAddress = getPageAddress(oldPageCount > pageCount ? oldPageCount : pageCount);
+		if (newStagingAddress + countPages(newPageMask | 1) * getPageSize() > getFlashEndAddress()) {
+			NRF_LOG_INFO("Not enough flash to stage the patch");
+			return false;
+		}
+
+		_newData = newData;
+		_newSettings = newSettings;
+		_programPageFunc = programPageFunc;
+		dataInterrupted = false;
+		_onProgramFinished = onProgramFinished;
+		patchDataEnd = newDataEnd;
+		patchPageMask = newPageMask;
+		patchStageMask = newPageMask | 1;
+		stagingAddress = newStagingAddress;
+
+		beginProgramming(startPatch);
+		return true;
+	}
+
 	uint32_t getDataSetAddress() {
 		return getSettingsEndAddress();
 	}
@@ -49,6 +49,21 @@ namespace DriversNRF
             ProgramFlashFunc programFlashFunc,
             ProgramFlashNotification onProgramFinished);
 
+        bool resumeProgramFlash(
+            const DataSet::Data& newData,
+            ProgramFlashFunc programFlashFunc,
+            ProgramFlashNotification onProgramFinished);
+
+        // Called for each page to patch with where to put its data, and the mask of the pages left to program
+        typedef void (*ProgramFlashPageFunc)(uint32_t pageMask, uint32_t address, uint32_t size, ProgramFlashFuncCallback callback);
+
+        bool patchFlash(
+            const DataSet::Data& newData,
+            const Config::Settings& newSettings,
+            uint32_t pageMask,
+            ProgramFlashPageFunc programPageFunc,
+            ProgramFlashNotification onProgramFinished);
+
 
         enum ProgrammingEventType
         {
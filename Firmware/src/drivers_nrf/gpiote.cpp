@@ -24,6 +24,11 @@ namespace GPIOTE
         in_config.sense = polarity;
         in_config.skip_gpio_setup = false;
 
+        // The pin may already be used for another purpose, i.e. the accelerometer interrupt
+        if (nrf_drv_gpiote_in_is_set(pin)) {
+            nrf_drv_gpiote_in_uninit(pin);
+        }
+
         ret_code_t err_code = nrf_drv_gpiote_in_init(pin, &in_config, handler);
         APP_ERROR_CHECK(err_code);
 
@@ -4,6 +4,10 @@
 #include "app_error_weak.h"
 #include "config/board_config.h"
 #include "nrf_log.h"
+#include "app_util_platform.h"
+#include "scheduler.h"
+
+#define I2C_QUEUE_SIZE 4
 
 namespace DriversNRF
 {
@@ -12,6 +16,70 @@ namespace I2C
     /* TWI instance. */
     static const nrf_drv_twi_t m_twi = NRF_DRV_TWI_INSTANCE(0);
 
+    /// <summary>
+    /// A queued transfer, either a write, or a register address write followed by a read
+    /// </summary>
+    struct Transaction
+    {
+        uint8_t device;
+        uint8_t reg;
+        const uint8_t* txData;
+        size_t txSize;
+        uint8_t* rxData;
+        size_t rxSize;
+        TransferCallback callback;
+        void* param;
+    };
+
+    // Queued transfers, the first one is the one in progress
+    static Transaction queue[I2C_QUEUE_SIZE];
+    static volatile int queueHead = 0;
+    static volatile int queueCount = 0;
+
+    // Blocking transfers wait on these, with the queue empty
+    static volatile bool blockingTransfer = false;
+    static volatile bool blockingDone = false;
+    static volatile bool blockingSuccess = false;
+
+    struct CompletionEvent
+    {
+        TransferCallback callback;
+        void* param;
+        bool success;
+    };
+
+    void startNextTransaction();
+
+    void twiEventHandler(nrf_drv_twi_evt_t const* p_event, void* p_context)
+    {
+        bool success = p_event->type == NRF_DRV_TWI_EVT_DONE;
+        if (blockingTransfer) {
+            blockingSuccess = success;
+            blockingTransfer = false;
+            blockingDone = true;
+            return;
+        }
+
+        if (queueCount == 0) {
+            return;
+        }
+
+        // Get out of interrupt context before notifying
+        auto& transaction = queue[queueHead];
+        if (transaction.callback != nullptr) {
+            CompletionEvent evt = { transaction.callback, transaction.param, success };
+            Scheduler::push(&evt, sizeof(evt), [](void* p_event_data, uint16_t event_size) {
+                auto evt = (const CompletionEvent*)p_event_data;
+                evt->callback(evt->param, evt->success);
+            });
+        }
+        queueHead = (queueHead + 1) % I2C_QUEUE_SIZE;
+        queueCount--;
+
+        // Chain the next transfer right away
+        startNextTransaction();
+    }
+
     void init()
     {
         auto board = Config::BoardManager::getBoard();
@@ -23,7 +91,7 @@ namespace I2C
         .clear_bus_init     = false
         };
 
-        nrf_drv_twi_init(&m_twi, &twi_config, NULL, NULL);
+        nrf_drv_twi_init(&m_twi, &twi_config, twiEventHandler, NULL);
         //APP_ERROR_CHECK(err_code);
 
         nrf_drv_twi_enable(&m_twi);        
@@ -36,10 +104,32 @@ namespace I2C
         return write(device, &value, 1, no_stop);
     }
 
+    /// <summary>
+    /// Runs a transfer and waits for it to complete, once queued transfers are done
+    /// </summary>
+    bool blockingXfer(const nrf_drv_twi_xfer_desc_t& xfer, uint32_t flags)
+    {
+        while (queueCount > 0) {
+            // Wait for the queued transfers, they complete in interrupt context
+        }
+
+        blockingDone = false;
+        blockingTransfer = true;
+        auto err = nrf_drv_twi_xfer(&m_twi, &xfer, flags);
+        if (err != NRF_SUCCESS) {
+            blockingTransfer = false;
+            return false;
+        }
+        while (!blockingDone) {
+            // Wait for the transfer to complete
+        }
+        return blockingSuccess;
+    }
+
     bool write(uint8_t device, const uint8_t* data, size_t size, bool no_stop)
     {
-        auto err = nrf_drv_twi_tx(&m_twi, device, data, size, no_stop);
-        return err == NRF_SUCCESS;
+        nrf_drv_twi_xfer_desc_t xfer = NRF_DRV_TWI_XFER_DESC_TX(device, (uint8_t*)data, size);
+        return blockingXfer(xfer, no_stop ? NRF_DRV_TWI_FLAG_TX_NO_STOP : 0);
     }
 
     bool read(uint8_t device, uint8_t* value)
@@ -49,8 +139,83 @@ namespace I2C
 
     bool read(uint8_t device, uint8_t* data, size_t size)
     {
-        auto err = nrf_drv_twi_rx(&m_twi, device, data, size);
-        return err == NRF_SUCCESS;
+        nrf_drv_twi_xfer_desc_t xfer = NRF_DRV_TWI_XFER_DESC_RX(device, data, size);
+        return blockingXfer(xfer, 0);
+    }
+
+    /// <summary>
+    /// Starts the transfer at the head of the queue, if any. Called with the bus idle.
+    /// </summary>
+    void startNextTransaction()
+    {
+        while (queueCount > 0) {
+            auto& transaction = queue[queueHead];
+            ret_code_t err;
+            if (transaction.rxSize > 0) {
+                // The register address write and the read happen back to back, without the CPU
+                nrf_drv_twi_xfer_desc_t xfer = NRF_DRV_TWI_XFER_DESC_TXRX(transaction.device, &transaction.reg, 1, transaction.rxData, transaction.rxSize);
+                err = nrf_drv_twi_xfer(&m_twi, &xfer, 0);
+            } else {
+                nrf_drv_twi_xfer_desc_t xfer = NRF_DRV_TWI_XFER_DESC_TX(transaction.device, (uint8_t*)transaction.txData, transaction.txSize);
+                err = nrf_drv_twi_xfer(&m_twi, &xfer, 0);
+            }
+            if (err == NRF_SUCCESS) {
+                return;
+            }
+
+            // Couldn't start this one, report it and move on to the next
+            NRF_LOG_ERROR("I2C transfer error %d", err);
+            if (transaction.callback != nullptr) {
+                CompletionEvent evt = { transaction.callback, transaction.param, false };
+                Scheduler::push(&evt, sizeof(evt), [](void* p_event_data, uint16_t event_size) {
+                    auto evt = (const CompletionEvent*)p_event_data;
+                    evt->callback(evt->param, evt->success);
+                });
+            }
+            queueHead = (queueHead + 1) % I2C_QUEUE_SIZE;
+            queueCount--;
+        }
+    }
+
+    /// <summary>
+    /// Adds a transfer to the queue, and starts it if the bus is idle
+    /// </summary>
+    bool enqueue(const Transaction& transaction)
+    {
+        bool start = false;
+        bool ret = false;
+        CRITICAL_REGION_ENTER();
+        if (queueCount < I2C_QUEUE_SIZE) {
+            queue[(queueHead + queueCount) % I2C_QUEUE_SIZE] = transaction;
+            queueCount++;
+            start = queueCount == 1;
+            ret = true;
+        }
+        CRITICAL_REGION_EXIT();
+
+        if (!ret) {
+            NRF_LOG_ERROR("I2C queue full");
+        } else if (start) {
+            startNextTransaction();
+        }
+        return ret;
+    }
+
+    bool writeAsync(uint8_t device, const uint8_t* data, size_t size, TransferCallback callback, void* param)
+    {
+        Transaction transaction = { device, 0, data, size, nullptr, 0, callback, param };
+        return enqueue(transaction);
+    }
+
+    bool readRegistersAsync(uint8_t device, uint8_t reg, uint8_t* data, size_t size, TransferCallback callback, void* param)
+    {
+        Transaction transaction = { device, reg, nullptr, 0, data, size, callback, param };
+        return enqueue(transaction);
+    }
+
+    bool isBusy()
+    {
+        return queueCount > 0;
     }
 }
 }
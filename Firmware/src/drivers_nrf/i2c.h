@@ -7,15 +7,24 @@ namespace DriversNRF
 {
 	/// <summary>
 	/// Wrapper for the Wire library that is set to use the Die pins
+	/// Transfers can either block, or be queued and run in the background (TWIM + EasyDMA).
 	/// </summary>
 	namespace I2C
 	{
+		// Called from the main loop (through the scheduler) once a queued transfer is done
+		typedef void (*TransferCallback)(void* param, bool success);
+
 		void init();
 
 		bool write(uint8_t device, uint8_t value, bool no_stop = false);
 		bool write(uint8_t device, const uint8_t* data, size_t size, bool no_stop = false);
 		bool read(uint8_t device, uint8_t* value);
 		bool read(uint8_t device, uint8_t* data, size_t size);
+
+		// Queued transfers, the data must stay valid until the callback is called
+		bool writeAsync(uint8_t device, const uint8_t* data, size_t size, TransferCallback callback, void* param);
+		bool readRegistersAsync(uint8_t device, uint8_t reg, uint8_t* data, size_t size, TransferCallback callback, void* param);
+		bool isBusy();
 	}
 }
 
@@ -0,0 +1,93 @@
+#include "spi.h"
+#include "nrfx_spim.h"
+#include "app_error.h"
+#include "app_error_weak.h"
+#include "scheduler.h"
+#include "nrf_log.h"
+
+namespace DriversNRF
+{
+namespace SPI
+{
+    static const nrfx_spim_t m_spim = NRFX_SPIM_INSTANCE(0);
+
+    static bool initialized = false;
+    static volatile bool busy = false;
+    static SPITransferCallback transferCallback = nullptr;
+
+    void spimEventHandler(nrfx_spim_evt_t const* p_event, void* p_context)
+    {
+        if (p_event->type == NRFX_SPIM_EVENT_DONE) {
+            busy = false;
+            if (transferCallback != nullptr) {
+                // Get out of interrupt context before notifying
+                Scheduler::push(nullptr, 0, [](void* p_event_data, uint16_t event_size) {
+                    if (transferCallback != nullptr) {
+                        transferCallback();
+                    }
+                });
+            }
+        }
+    }
+
+    void init(uint32_t clockPin, uint32_t dataPin)
+    {
+        if (initialized) {
+            return;
+        }
+
+        nrfx_spim_config_t spim_config = NRFX_SPIM_DEFAULT_CONFIG;
+        spim_config.sck_pin = clockPin;
+        spim_config.mosi_pin = dataPin;
+        spim_config.miso_pin = NRFX_SPIM_PIN_NOT_USED;
+        spim_config.ss_pin = NRFX_SPIM_PIN_NOT_USED;
+        spim_config.frequency = NRF_SPIM_FREQ_4M;
+        spim_config.mode = NRF_SPIM_MODE_0;
+        spim_config.bit_order = NRF_SPIM_BIT_ORDER_MSB_FIRST;
+
+        ret_code_t err_code = nrfx_spim_init(&m_spim, &spim_config, spimEventHandler, nullptr);
+        APP_ERROR_CHECK(err_code);
+
+        initialized = true;
+        busy = false;
+    }
+
+    void uninit()
+    {
+        if (initialized) {
+            nrfx_spim_uninit(&m_spim);
+            initialized = false;
+            busy = false;
+        }
+    }
+
+    bool isInitialized()
+    {
+        return initialized;
+    }
+
+    bool isBusy()
+    {
+        return busy;
+    }
+
+    bool write(const uint8_t* data, size_t size, SPITransferCallback callback)
+    {
+        if (!initialized || busy) {
+            return false;
+        }
+
+        transferCallback = callback;
+        busy = true;
+        nrfx_spim_xfer_desc_t xfer = NRFX_SPIM_XFER_TX(data, size);
+        auto err = nrfx_spim_xfer(&m_spim, &xfer, 0);
+        if (err != NRF_SUCCESS) {
+            busy = false;
+            NRF_LOG_ERROR("SPI transfer error %d", err);
+            return false;
+        }
+        return true;
+    }
+}
+}
+
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace DriversNRF
+{
+	/// <summary>
+	/// Write-only SPI master using the SPIM peripheral and EasyDMA, so transfers
+	/// happen in the background while the CPU does something else (or sleeps).
+	/// </summary>
+	namespace SPI
+	{
+		// Called from the main loop (through the scheduler) once a transfer is done
+		typedef void (*SPITransferCallback)();
+
+		void init(uint32_t clockPin, uint32_t dataPin);
+		void uninit();
+		bool isInitialized();
+		bool isBusy();
+
+		// The data must stay valid until the callback is called
+		bool write(const uint8_t* data, size_t size, SPITransferCallback callback);
+	}
+}
+
@@ -93,6 +93,28 @@ namespace Timers
 		return APP_TIMER_MS(ticks);
 	}
 
+	uint32_t getTicks()
+	{
+		return app_timer_cnt_get();
+	}
+
+	/// <summary>
+	/// Ticks elapsed between two tick counts, taking counter wrap around into account.
+	/// Only meaningful while the RTC runs, i.e. while at least one timer is active.
+	/// </summary>
+	uint32_t ticksBetween(uint32_t ticksFrom, uint32_t ticksTo)
+	{
+		return app_timer_cnt_diff_compute(ticksTo, ticksFrom);
+	}
+
+	/// <summary>
+	/// Converts a tick count to ms, rounding down, so that a running total of ticks converts without drift
+	/// </summary>
+	int ticksToMillis(uint64_t ticks)
+	{
+		return (int)(ticks * 1000 * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1) / APP_TIMER_CLOCK_FREQ);
+	}
+
     void delayedCallbacksTimerCallback(void* ignore) {
         int time = millis();
         do
@@ -17,6 +17,9 @@ namespace DriversNRF
         void resume(void);
         void selfTest();
         int millis();
+        uint32_t getTicks();
+        uint32_t ticksBetween(uint32_t ticksFrom, uint32_t ticksTo);
+        int ticksToMillis(uint64_t ticks);
 
         typedef void (*DelayedCallback)(void* param);
         bool setDelayedCallback(DelayedCallback callback, void* param, int periodMs);
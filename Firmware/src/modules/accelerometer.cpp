@@ -2,7 +2,7 @@
 
 #include "drivers_hw/lis2de12.h"
 #include "utils/utils.h"
-#include "core/ring_buffer.h"
+#include "core/fixed3.h"
 #include "config/board_config.h"
 #include "config/settings.h"
 #include "config/dice_variants.h"
@@ -19,6 +19,8 @@
 #include "drivers_nrf/gpiote.h"
 #include "drivers_nrf/timers.h"
 #include "drivers_nrf/flash.h"
+#include "drivers_nrf/scheduler.h"
+#include <math.h>
 
 
 using namespace Modules;
@@ -28,9 +30,19 @@ using namespace DriversNRF;
 using namespace Config;
 using namespace Bluetooth;
 
-// This defines how frequently we try to read the accelerometer
+// This defines how frequently we read the accelerometer's FIFO, i.e. ~10 frames at a time
 #define TIMER2_RESOLUTION (100)	// ms
+#if ACCEL_FIFO_INTERRUPT
+// The FIFO interrupt fires every ~5 frames, the timer only makes sure we never miss it for long
+#define ACCEL_FIFO_WATERMARK (4)
+#define ACCEL_BACKUP_TIMER_RESOLUTION (500) // ms
+#endif
 #define JERK_SCALE (1000)		// To make the jerk in the same range as the acceleration
+#define FACE_LOOKUP_SIZE 12 // Cells per side of each of the 6 faces of the direction cube map
+#define FACE_LOOKUP_AMBIGUOUS 0xFF
+#define ACCEL_SETTLE_WINDOW 8 // Samples the die must be still for to be settled, 80ms
+#define ACCEL_SETTLE_VARIANCE (0.002f) // g^2 summed over the 3 axes, about 1.5 LSB of noise at 4g
+#define ACCEL_UNSETTLE_VARIANCE (ACCEL_SETTLE_VARIANCE * 4)
 #define MAX_ACC_CLIENTS 8
 
 namespace Modules
@@ -41,18 +53,68 @@ namespace Accelerometer
 
 	int face;
 	float confidence;
-	float sigma;
-	float3 smoothAcc;
 	RollState rollState = RollState_Unknown;
 	bool moving = false;
-	float3 handleStateNormal; // The normal when we entered the handled state, so we can determine if we've moved enough
 	bool paused;
 
-	// This small buffer stores about 1 second of Acceleration data
-	Core::RingBuffer<AccelFrame, ACCEL_BUFFER_SIZE> buffer;
+#if ACCEL_FIXED_POINT
+	// Motion state, in Q16.16
+	fixed sigma;
+	fixed3 smoothAcc;
+	fixed3 lastAcc;
+	fixed3 handleStateNormal; // The normal when we entered the handled state, so we can determine if we've moved enough
+
+	// The settings converted to Q16.16 when we start, squared thresholds are in Q32.32 like sqrMagnitude64()
+	fixed frameSigmaDecay;
+	fixed frameAccDecay;
+	fixed startMovingThreshold;
+	fixed stopMovingThreshold;
+	fixed faceThreshold;
+	int64_t fallingThresholdSqr;
+	int64_t shockThresholdSqr;
+	fixed3 faceNormals[MAX_LED_COUNT];
+
+	int determineFace(const fixed3& acc, int64_t accSqrMag, fixed* outConfidence);
+#else
+	float sigma;
+	float3 smoothAcc;
+	float3 handleStateNormal; // The normal when we entered the handled state, so we can determine if we've moved enough
+
+	// The settings' filter rates, adjusted to the time between two frames
+	float frameSigmaDecay;
+	float frameAccDecay;
+#endif
+
+	// Cube map of directions to the face that is up for all of them, or FACE_LOOKUP_AMBIGUOUS
+	// when the cell straddles two faces and we need to compare against all the normals.
+	uint8_t faceLookup[6 * FACE_LOOKUP_SIZE * FACE_LOOKUP_SIZE];
+	void buildFaceLookup();
+
+	/// <summary>
+	/// The result of comparing a new frame against the settings' thresholds
+	/// </summary>
+	struct MotionFlags
+	{
+		bool startMoving;
+		bool stopMoving;
+		bool onFace;
+		bool zeroG;
+		bool shock;
+	};
+
+	// When we last emptied the accelerometer FIFO
+	uint32_t lastReadTime;
+	bool sampling = false;
+
+	// The last few seconds of raw samples
+	AccelHistory history;
 
 	DelegateArray<FrameDataClientMethod, MAX_ACC_CLIENTS> frameDataClients;
 	DelegateArray<RollStateClientMethod, MAX_ACC_CLIENTS> rollStateClients;
+	DelegateArray<SettleClientMethod, MAX_ACC_CLIENTS> settleClients;
+
+	// The face we told the settle clients the die was settling on, or -1
+	int settleFace = -1;
 
 	void updateState();
 	void pauseNotifications();
@@ -62,8 +124,17 @@ namespace Accelerometer
 	void CalibrateFaceHandler(void* context, const Message* msg);
 	void onSettingsProgrammingEvent(void* context, Flash::ProgrammingEventType evt);
 	void onPowerEvent(void* context, nrf_pwr_mgmt_evt_t event);
+	void onFIFOInterrupt(uint32_t pin, nrf_gpiote_polarity_t action);
 
 	void update(void* context);
+	void onSamplesRead(const LIS2DE12::Sample samples[], int count);
+	void filterSample(const LIS2DE12::Sample& sample, uint32_t time, AccelFrame& outFrame, MotionFlags& outFlags);
+	void saveHandleStateNormal();
+	bool rotatedFromHandleStateNormal();
+	void loadSettings();
+	bool settleWindowStill(int* outMeanFace, bool* outMoving);
+	void updateSettle(RollState newRollState, int newFace);
+	void notifySettle(int settledFace, SettleEvent event);
 
     void init() {
         MessageService::RegisterMessageHandler(Message::MessageType_Calibrate, nullptr, CalibrateHandler);
@@ -73,16 +144,19 @@ namespace Accelerometer
 
 		face = 0;
 		confidence = 0.0f;
+	#if ACCEL_FIXED_POINT
+		sigma = 0;
+		smoothAcc = fixed3::zero();
+	#else
+		sigma = 0.0f;
 		smoothAcc = float3::zero();
+	#endif
 
 		LIS2DE12::read();
-		AccelFrame newFrame;
-		newFrame.acc = float3(LIS2DE12::cx, LIS2DE12::cy, LIS2DE12::cz);
-		newFrame.time = DriversNRF::Timers::millis();
-		newFrame.jerk = float3::zero();
-		newFrame.sigma = 0.0f;
-		newFrame.smoothAcc = newFrame.acc;
-		buffer.push(newFrame);
+		history.push(LIS2DE12::x, LIS2DE12::y, LIS2DE12::z, DriversNRF::Timers::millis());
+	#if ACCEL_FIXED_POINT
+		lastAcc = fixed3(LIS2DE12::convertFixed(LIS2DE12::x), LIS2DE12::convertFixed(LIS2DE12::y), LIS2DE12::convertFixed(LIS2DE12::z));
+	#endif
 
 		// Attach to the power manager, so we can wake the device up
 		PowerManager::hook(onPowerEvent, nullptr);
@@ -96,31 +170,40 @@ namespace Accelerometer
 	}
 
 	/// <summary>
-	/// update is called from the timer
+	/// update is called from the timer or the FIFO interrupt, and processes all the samples the accelerometer collected since last time
 	/// </summary>
 	void update(void* context) {
-		auto settings = SettingsManager::getSettings();
-		auto& lastFrame = buffer.last();
-
-		LIS2DE12::read();
+		// The read happens in the background, if one is still in progress the next update gets the new samples
+		LIS2DE12::readFIFOAsync(onSamplesRead);
+	}
 
-		AccelFrame newFrame;
-		newFrame.acc = float3(LIS2DE12::cx, LIS2DE12::cy, LIS2DE12::cz);
-		newFrame.time = DriversNRF::Timers::millis();
-		newFrame.jerk = ((newFrame.acc - lastFrame.acc) * 1000.0f) / (float)(newFrame.time - lastFrame.time);
+	/// <summary>
+	/// Called once the samples are read from the accelerometer FIFO
+	/// </summary>
+	void onSamplesRead(const LIS2DE12::Sample samples[], int count) {
+		if (count == 0 || !sampling) {
+			// Nothing new, or we were stopped during the read
+			return;
+		}
 
-		float jerkMag = newFrame.jerk.sqrMagnitude();
-		if (jerkMag > 10.f) {
-			jerkMag = 10.f;
+		// The samples were taken at a regular interval since the last read
+		uint32_t time = DriversNRF::Timers::millis();
+		uint32_t elapsed = time - lastReadTime;
+		for (int i = 0; i < count; ++i) {
+			processSample(samples[i], lastReadTime + elapsed * (i + 1) / count);
 		}
-		sigma = sigma * settings->sigmaDecay + jerkMag * (1.0f - settings->sigmaDecay);
-		newFrame.sigma = sigma;
+		lastReadTime = time;
+	}
 
-		smoothAcc = smoothAcc * settings->accDecay + newFrame.acc * (1.0f - settings->accDecay);
-		newFrame.smoothAcc = smoothAcc;
-		newFrame.face = determineFace(newFrame.acc, &newFrame.faceConfidence);
+	/// <summary>
+	/// Updates the motion state with a new accelerometer sample
+	/// </summary>
+	void processSample(const LIS2DE12::Sample& sample, uint32_t time) {
+		AccelFrame newFrame;
+		MotionFlags flags;
+		filterSample(sample, time, newFrame, flags);
 
-		buffer.push(newFrame);
+		history.push(sample.x, sample.y, sample.z, time);
 
 		// Notify clients
 		for (int i = 0; i < frameDataClients.Count(); ++i)
@@ -128,11 +211,11 @@ namespace Accelerometer
 			frameDataClients[i].handler(frameDataClients[i].token, newFrame);
 		}
 
-		bool startMoving = sigma > settings->startMovingThreshold;
-		bool stopMoving = sigma < settings->stopMovingThreshold;
-		bool onFace = newFrame.faceConfidence > settings->faceThreshold;
-		bool zeroG = newFrame.acc.sqrMagnitude() < (settings->fallingThreshold * settings->fallingThreshold);
-        bool shock = newFrame.acc.sqrMagnitude() > (settings->shockThreshold * settings->shockThreshold);
+		bool startMoving = flags.startMoving;
+		bool stopMoving = flags.stopMoving;
+		bool onFace = flags.onFace;
+		bool zeroG = flags.zeroG;
+		bool shock = flags.shock;
 
         RollState newRollState = rollState;
         switch (rollState) {
@@ -143,13 +226,13 @@ namespace Accelerometer
                 if (startMoving) {
                     // We're at least being handled
                     newRollState = RollState_Handling;
-					handleStateNormal = newFrame.acc.normalized();
+					saveHandleStateNormal();
                 }
                 break;
             case RollState_Handling:
 				// Did we move enough?
 				{
-					bool rotatedEnough = float3::dot(newFrame.acc.normalized(), handleStateNormal) < 0.5f;
+					bool rotatedEnough = rotatedFromHandleStateNormal();
 					if (shock || zeroG || rotatedEnough) {
 						// Stuff is happening that we are most likely rolling now
 						newRollState = RollState_Rolling;
@@ -199,6 +282,8 @@ namespace Accelerometer
 			//NRF_LOG_INFO("Face %d, confidence " NRF_LOG_FLOAT_MARKER, face, NRF_LOG_FLOAT(confidence));
 		}
 
+		updateSettle(newRollState, newFrame.face);
+
 		if (newRollState != rollState) {
 
 			// Debugging
@@ -218,12 +303,248 @@ namespace Accelerometer
 		}
 	}
 
+	/// <summary>
+	/// Looks at the variance of the acceleration over the last few samples, summed over the 3 axes.
+	/// Unlike sigma there is no decay to wait for, it drops as soon as the die stops.
+	/// Returns whether the die is still enough to settle, and if so the face of the mean acceleration,
+	/// or -1 when that isn't confidently on a face. outMoving tells whether it moves enough to drop a settled face.
+	/// </summary>
+	bool settleWindowStill(int* outMeanFace, bool* outMoving) {
+		int32_t sum[3] = {0, 0, 0};
+		int64_t sqrSum = 0;
+		for (int i = history.count() - ACCEL_SETTLE_WINDOW; i < history.count(); ++i) {
+			auto& sample = history.sample(i);
+			sum[0] += sample.x;
+			sum[1] += sample.y;
+			sum[2] += sample.z;
+			sqrSum += (int32_t)sample.x * sample.x + (int32_t)sample.y * sample.y + (int32_t)sample.z * sample.z;
+		}
+
+		// N^2 * variance = N * sum(x^2) - sum(x)^2, still in raw units
+		int64_t sqrMeanSum = (int64_t)sum[0] * sum[0] + (int64_t)sum[1] * sum[1] + (int64_t)sum[2] * sum[2];
+		int64_t rawVariance = ACCEL_SETTLE_WINDOW * sqrSum - sqrMeanSum;
+	#if ACCEL_FIXED_POINT
+		// In Q16.16 g^2, the readings are 8 bits so this stays well within 64 bits
+		int64_t rawToG = LIS2DE12::convertFixed(1);
+		fixed variance = (fixed)((rawVariance * rawToG * rawToG / (ACCEL_SETTLE_WINDOW * ACCEL_SETTLE_WINDOW)) >> FIXED_SHIFT);
+		*outMoving = variance > toFixed(ACCEL_UNSETTLE_VARIANCE);
+		if (variance >= toFixed(ACCEL_SETTLE_VARIANCE)) {
+			return false;
+		}
+
+		fixed3 meanAcc(
+			(fixed)(sum[0] * rawToG / ACCEL_SETTLE_WINDOW),
+			(fixed)(sum[1] * rawToG / ACCEL_SETTLE_WINDOW),
+			(fixed)(sum[2] * rawToG / ACCEL_SETTLE_WINDOW));
+		fixed meanConfidence;
+		int meanFace = determineFace(meanAcc, meanAcc.sqrMagnitude64(), &meanConfidence);
+		bool onFace = meanConfidence > faceThreshold;
+	#else
+		float rawToG = LIS2DE12::convert(1);
+		float variance = (float)rawVariance * (rawToG * rawToG / (ACCEL_SETTLE_WINDOW * ACCEL_SETTLE_WINDOW));
+		*outMoving = variance > ACCEL_UNSETTLE_VARIANCE;
+		if (variance >= ACCEL_SETTLE_VARIANCE) {
+			return false;
+		}
+
+		float3 meanAcc = float3(sum[0], sum[1], sum[2]) * (rawToG / ACCEL_SETTLE_WINDOW);
+		float meanConfidence;
+		int meanFace = determineFace(meanAcc, &meanConfidence);
+		bool onFace = meanConfidence > SettingsManager::getSettings()->faceThreshold;
+	#endif
+		*outMeanFace = onFace || BoardManager::getBoard()->ledCount != 6 ? meanFace : -1;
+		return true;
+	}
+
+	/// <summary>
+	/// Tells settle clients the die is at rest while the roll state still says it's moving,
+	/// then either confirms it once the roll state gets to RollState_OnFace on that face, or withdraws it
+	/// </summary>
+	void updateSettle(RollState newRollState, int newFace) {
+		if (newRollState == RollState_Handling || newRollState == RollState_Rolling) {
+			if (history.count() < ACCEL_SETTLE_WINDOW) {
+				return;
+			}
+
+			int meanFace = -1;
+			bool moving = false;
+			bool still = settleWindowStill(&meanFace, &moving);
+			if (settleFace == -1) {
+				// Still, and the orientation agrees with the last sample
+				if (still && meanFace != -1 && meanFace == newFace) {
+					settleFace = meanFace;
+					notifySettle(settleFace, SettleEvent_Settling);
+				}
+			} else if (moving || newFace != settleFace) {
+				// Moving again, or tipped over, we may settle on another face
+				notifySettle(settleFace, SettleEvent_Withdrawn);
+				settleFace = -1;
+			}
+		} else {
+			bool confirmed = newRollState == RollState_OnFace && (rollState == RollState_Handling || rollState == RollState_Rolling);
+			if (settleFace != -1 && (!confirmed || newFace != settleFace)) {
+				// Crooked, or it ended up on another face
+				notifySettle(settleFace, SettleEvent_Withdrawn);
+			}
+			if (confirmed) {
+				notifySettle(newFace, SettleEvent_Settled);
+			}
+			settleFace = -1;
+		}
+	}
+
+	void notifySettle(int settledFace, SettleEvent event) {
+		NRF_LOG_INFO("%s on face %d", getSettleEventString(event), settledFace);
+		if (!paused) {
+			for (int i = 0; i < settleClients.Count(); ++i) {
+				settleClients[i].handler(settleClients[i].token, settledFace, event);
+			}
+		}
+	}
+
+	/// <summary>
+	/// Returns the sample to measure the jerk of a new one against, about ACCEL_SETTINGS_FRAME_MS
+	/// before it, so that the thresholds keep the meaning they had at that frame rate. Over a single
+	/// frame, one LSB of noise would look like a hundred times more jerk.
+	/// </summary>
+	const AccelSample& getJerkReference(uint32_t time, int* outDeltaTime) {
+		int index = history.count() - 1;
+		uint32_t sampleTime = history.last().time;
+		while (index > 0 && time - sampleTime < ACCEL_SETTINGS_FRAME_MS) {
+			sampleTime -= history.sample(index).deltaTime;
+			index--;
+		}
+		*outDeltaTime = std::max((int)(time - sampleTime), 1);
+		return history.sample(index);
+	}
+
+#if ACCEL_FIXED_POINT
+	/// <summary>
+	/// Runs the motion filters on a new sample, in fixed point
+	/// </summary>
+	void filterSample(const LIS2DE12::Sample& sample, uint32_t time, AccelFrame& outFrame, MotionFlags& outFlags) {
+		fixed3 acc(LIS2DE12::convertFixed(sample.x), LIS2DE12::convertFixed(sample.y), LIS2DE12::convertFixed(sample.z));
+		int deltaTime;
+		auto& reference = getJerkReference(time, &deltaTime);
+		fixed3 referenceAcc(LIS2DE12::convertFixed(reference.x), LIS2DE12::convertFixed(reference.y), LIS2DE12::convertFixed(reference.z));
+		fixed3 jerk = (acc - referenceAcc) * (1000 * FIXED_ONE / deltaTime);
+
+		int64_t jerkSqrMag = jerk.sqrMagnitude64();
+		fixed jerkMag = jerkSqrMag > ((int64_t)10 << 32) ? 10 * FIXED_ONE : (fixed)(jerkSqrMag >> FIXED_SHIFT);
+		sigma = mulFixed(sigma, frameSigmaDecay) + mulFixed(jerkMag, FIXED_ONE - frameSigmaDecay);
+		smoothAcc = smoothAcc * frameAccDecay + acc * (FIXED_ONE - frameAccDecay);
+
+		int64_t accSqrMag = acc.sqrMagnitude64();
+		fixed faceConfidence;
+		outFrame.face = determineFace(acc, accSqrMag, &faceConfidence);
+		lastAcc = acc;
+
+		// Clients get the frame in floats
+		outFrame.acc = acc.toFloat3();
+		outFrame.jerk = jerk.toFloat3();
+		outFrame.smoothAcc = smoothAcc.toFloat3();
+		outFrame.sigma = toFloat(sigma);
+		outFrame.faceConfidence = toFloat(faceConfidence);
+		outFrame.time = time;
+
+		outFlags.startMoving = sigma > startMovingThreshold;
+		outFlags.stopMoving = sigma < stopMovingThreshold;
+		outFlags.onFace = faceConfidence > faceThreshold;
+		outFlags.zeroG = accSqrMag < fallingThresholdSqr;
+		outFlags.shock = accSqrMag > shockThresholdSqr;
+	}
+
+	void saveHandleStateNormal() {
+		handleStateNormal = lastAcc.normalized();
+	}
+
+	/// <summary>
+	/// Same as dot(acc.normalized(), handleStateNormal) < 0.5, without the square root
+	/// </summary>
+	bool rotatedFromHandleStateNormal() {
+		int64_t dot = fixed3::dot64(lastAcc, handleStateNormal) >> FIXED_SHIFT;
+		return dot < 0 || dot * dot < (lastAcc.sqrMagnitude64() >> 2);
+	}
+
+	/// <summary>
+	/// Converts the thresholds and face normals to fixed point, and the filter rates to our frame rate
+	/// </summary>
+	void loadSettings() {
+		auto settings = SettingsManager::getSettings();
+		frameSigmaDecay = toFixed(powf(settings->sigmaDecay, (float)ACCEL_FRAME_MS / ACCEL_SETTINGS_FRAME_MS));
+		frameAccDecay = toFixed(powf(settings->accDecay, (float)ACCEL_FRAME_MS / ACCEL_SETTINGS_FRAME_MS));
+		startMovingThreshold = toFixed(settings->startMovingThreshold);
+		stopMovingThreshold = toFixed(settings->stopMovingThreshold);
+		faceThreshold = toFixed(settings->faceThreshold);
+		int64_t fallingThreshold = toFixed(settings->fallingThreshold);
+		fallingThresholdSqr = fallingThreshold * fallingThreshold;
+		int64_t shockThreshold = toFixed(settings->shockThreshold);
+		shockThresholdSqr = shockThreshold * shockThreshold;
+		int faceCount = BoardManager::getBoard()->ledCount;
+		for (int i = 0; i < faceCount; ++i) {
+			faceNormals[i] = fixed3(settings->faceNormals[i]);
+		}
+		buildFaceLookup();
+	}
+#else
+	/// <summary>
+	/// Runs the motion filters on a new sample
+	/// </summary>
+	void filterSample(const LIS2DE12::Sample& sample, uint32_t time, AccelFrame& outFrame, MotionFlags& outFlags) {
+		auto settings = SettingsManager::getSettings();
+
+		outFrame.acc = float3(LIS2DE12::convert(sample.x), LIS2DE12::convert(sample.y), LIS2DE12::convert(sample.z));
+		outFrame.time = time;
+		int deltaTime;
+		auto& reference = getJerkReference(time, &deltaTime);
+		float3 referenceAcc(LIS2DE12::convert(reference.x), LIS2DE12::convert(reference.y), LIS2DE12::convert(reference.z));
+		outFrame.jerk = ((outFrame.acc - referenceAcc) * 1000.0f) / (float)deltaTime;
+
+		float jerkMag = outFrame.jerk.sqrMagnitude();
+		if (jerkMag > 10.f) {
+			jerkMag = 10.f;
+		}
+		sigma = sigma * frameSigmaDecay + jerkMag * (1.0f - frameSigmaDecay);
+		outFrame.sigma = sigma;
+
+		smoothAcc = smoothAcc * frameAccDecay + outFrame.acc * (1.0f - frameAccDecay);
+		outFrame.smoothAcc = smoothAcc;
+		outFrame.face = determineFace(outFrame.acc, &outFrame.faceConfidence);
+
+		outFlags.startMoving = sigma > settings->startMovingThreshold;
+		outFlags.stopMoving = sigma < settings->stopMovingThreshold;
+		outFlags.onFace = outFrame.faceConfidence > settings->faceThreshold;
+		outFlags.zeroG = outFrame.acc.sqrMagnitude() < (settings->fallingThreshold * settings->fallingThreshold);
+		outFlags.shock = outFrame.acc.sqrMagnitude() > (settings->shockThreshold * settings->shockThreshold);
+	}
+
+	void saveHandleStateNormal() {
+		handleStateNormal = history.last().acc().normalized();
+	}
+
+	bool rotatedFromHandleStateNormal() {
+		return float3::dot(history.last().acc().normalized(), handleStateNormal) < 0.5f;
+	}
+
+	/// <summary>
+	/// Adjusts the filter rates to our frame rate
+	/// </summary>
+	void loadSettings() {
+		auto settings = SettingsManager::getSettings();
+		frameSigmaDecay = powf(settings->sigmaDecay, (float)ACCEL_FRAME_MS / ACCEL_SETTINGS_FRAME_MS);
+		frameAccDecay = powf(settings->accDecay, (float)ACCEL_FRAME_MS / ACCEL_SETTINGS_FRAME_MS);
+		buildFaceLookup();
+	}
+#endif
+
 	/// <summary>
 	/// Initialize the acceleration system
 	/// </summary>
 	void start()
 	{
 		NRF_LOG_INFO("Starting accelerometer");
+		loadSettings();
+
 		// Set initial value
 		LIS2DE12::read();
 		float3 acc(LIS2DE12::cx, LIS2DE12::cy, LIS2DE12::cz);
@@ -238,8 +559,26 @@ namespace Accelerometer
             rollState = RollState_Crooked;
         }
 
+		// Collect samples in the FIFO between updates, starting empty
+		lastReadTime = DriversNRF::Timers::millis();
+		sampling = true;
+	#if ACCEL_FIFO_INTERRUPT
+		LIS2DE12::enableFIFO(FIFO_STREAM, ACCEL_FIFO_WATERMARK);
+		GPIOTE::enableInterrupt(
+			BoardManager::getBoard()->accInterruptPin,
+			NRF_GPIO_PIN_NOPULL,
+			NRF_GPIOTE_POLARITY_LOTOHI,
+			onFIFOInterrupt);
+		LIS2DE12::enableFIFOInterrupt();
+
+		ret_code_t ret_code = app_timer_start(accelControllerTimer, APP_TIMER_TICKS(ACCEL_BACKUP_TIMER_RESOLUTION), NULL);
+		APP_ERROR_CHECK(ret_code);
+	#else
+		LIS2DE12::enableFIFO(FIFO_STREAM);
+
 		ret_code_t ret_code = app_timer_start(accelControllerTimer, APP_TIMER_TICKS(TIMER2_RESOLUTION), NULL);
 		APP_ERROR_CHECK(ret_code);
+	#endif
 	}
 
 	/// <summary>
@@ -249,6 +588,12 @@ namespace Accelerometer
 	{
 		ret_code_t ret_code = app_timer_stop(accelControllerTimer);
 		APP_ERROR_CHECK(ret_code);
+		sampling = false;
+	#if ACCEL_FIFO_INTERRUPT
+		LIS2DE12::disableFIFOInterrupt();
+		GPIOTE::disableInterrupt(BoardManager::getBoard()->accInterruptPin);
+	#endif
+		LIS2DE12::disableFIFO();
 		NRF_LOG_INFO("Stopped accelerometer");
 	}
 
@@ -267,6 +612,114 @@ namespace Accelerometer
 		return rollState;
 	}
 
+	const AccelHistory& getHistory() {
+		return history;
+	}
+
+	float3 AccelHistoryFrame::acc() const {
+		return float3(LIS2DE12::convert(sample->x), LIS2DE12::convert(sample->y), LIS2DE12::convert(sample->z));
+	}
+
+	/// <summary>
+	/// Change of acceleration since the previous sample, per second
+	/// </summary>
+	float3 AccelHistoryFrame::jerk() const {
+		if (previous == nullptr) {
+			return float3::zero();
+		}
+		float3 previousAcc(LIS2DE12::convert(previous->x), LIS2DE12::convert(previous->y), LIS2DE12::convert(previous->z));
+		return ((acc() - previousAcc) * 1000.0f) / (float)std::max((int)sample->deltaTime, 1);
+	}
+
+	AccelHistory::AccelHistory() {
+		clear();
+	}
+
+	void AccelHistory::clear() {
+		next = 0;
+		sampleCount = 0;
+		lastTime = 0;
+	}
+
+	/// <summary>
+	/// Adds a raw sample, replacing the oldest one if necessary
+	/// </summary>
+	void AccelHistory::push(int16_t x, int16_t y, int16_t z, uint32_t time) {
+		AccelSample& sample = samples[next];
+		sample.x = x;
+		sample.y = y;
+		sample.z = z;
+		// Long gaps (i.e. we were stopped) only make the samples before them look more recent than they are
+		sample.deltaTime = sampleCount > 0 ? (uint16_t)std::min(time - lastTime, (uint32_t)UINT16_MAX) : 0;
+		lastTime = time;
+		next = (next + 1) % ACCEL_HISTORY_SIZE;
+		if (sampleCount < ACCEL_HISTORY_SIZE) {
+			sampleCount++;
+		}
+	}
+
+	const AccelSample& AccelHistory::sample(int index) const {
+		int dataIndex = next - sampleCount + index;
+		if (dataIndex < 0) {
+			dataIndex += ACCEL_HISTORY_SIZE;
+		}
+		return samples[dataIndex];
+	}
+
+	uint32_t AccelHistory::timeAt(int index) const {
+		uint32_t time = lastTime;
+		for (int i = sampleCount - 1; i > index; --i) {
+			time -= sample(i).deltaTime;
+		}
+		return time;
+	}
+
+	AccelHistoryFrame AccelHistory::first() const {
+		return (*this)[0];
+	}
+
+	AccelHistoryFrame AccelHistory::last() const {
+		return (*this)[sampleCount - 1];
+	}
+
+	AccelHistoryFrame AccelHistory::operator[](int index) const {
+		AccelHistoryFrame frame;
+		frame.sample = &sample(index);
+		frame.previous = index > 0 ? &sample(index - 1) : nullptr;
+		frame.time = timeAt(index);
+		return frame;
+	}
+
+	AccelHistory::Iterator AccelHistory::begin() const {
+		return Iterator(this, 0, timeAt(0));
+	}
+
+	AccelHistory::Iterator AccelHistory::end() const {
+		return Iterator(this, sampleCount, lastTime);
+	}
+
+	AccelHistory::Iterator::Iterator(const AccelHistory* history, int index, uint32_t time)
+		: history(history)
+		, index(index)
+		, time(time) {
+	}
+
+	AccelHistoryFrame AccelHistory::Iterator::operator*() const {
+		AccelHistoryFrame frame;
+		frame.sample = &history->sample(index);
+		frame.previous = index > 0 ? &history->sample(index - 1) : nullptr;
+		frame.time = time;
+		return frame;
+	}
+
+	AccelHistory::Iterator& AccelHistory::Iterator::operator++() {
+		index++;
+		if (index < history->sampleCount) {
+			time += history->sample(index).deltaTime;
+		}
+		return *this;
+	}
+
 	const char* getRollStateString(RollState state) {
 		switch (state) {
 			case RollState_Unknown:
@@ -283,12 +736,124 @@ namespace Accelerometer
 		}
 	}
 
+	const char* getSettleEventString(SettleEvent event) {
+		switch (event) {
+			case SettleEvent_Settling:
+			default:
+				return "Settling";
+			case SettleEvent_Settled:
+				return "Settled";
+			case SettleEvent_Withdrawn:
+				return "Withdrawn";
+		}
+	}
+
+	/// <summary>
+	/// Returns the cube map cell a direction falls in. The cube face is picked from the largest
+	/// component, and the other two, divided by that one, give the cell on that face.
+	/// </summary>
+	template <typename T>
+	int faceLookupCell(T x, T y, T z)
+	{
+		T ax = x < 0 ? -x : x;
+		T ay = y < 0 ? -y : y;
+		T az = z < 0 ? -z : z;
+		int cubeFace;
+		T major, u, v;
+		if (ax >= ay && ax >= az) {
+			cubeFace = x >= 0 ? 0 : 1; major = ax; u = y; v = z;
+		} else if (ay >= az) {
+			cubeFace = y >= 0 ? 2 : 3; major = ay; u = x; v = z;
+		} else {
+			cubeFace = z >= 0 ? 4 : 5; major = az; u = x; v = y;
+		}
+		if (major == 0) {
+			return -1;
+		}
+		int cu = std::min((int)((u + major) * FACE_LOOKUP_SIZE / (2 * major)), FACE_LOOKUP_SIZE - 1);
+		int cv = std::min((int)((v + major) * FACE_LOOKUP_SIZE / (2 * major)), FACE_LOOKUP_SIZE - 1);
+		return (cubeFace * FACE_LOOKUP_SIZE + cu) * FACE_LOOKUP_SIZE + cv;
+	}
+
+	/// <summary>
+	/// Fills the face lookup cube map from the calibrated normals. The directions of a cell are all
+	/// positive combinations of its 4 corners, and face i beats face j wherever dot(d, ni - nj) > 0,
+	/// so if that holds at every corner it holds for the whole cell, and the lookup is exact.
+	/// </summary>
+	void buildFaceLookup()
+	{
+		int faceCount = BoardManager::getBoard()->ledCount;
+		auto settings = SettingsManager::getSettings();
+		fixed3 normals[MAX_LED_COUNT];
+		for (int i = 0; i < faceCount; ++i) {
+			normals[i] = fixed3(settings->faceNormals[i]);
+		}
+
+		// Leave some room for rounding, since the float path and the cell index computation aren't exact
+		const int64_t margin = (int64_t)FIXED_ONE * FACE_LOOKUP_SIZE / 256;
+		int ambiguousCount = 0;
+		for (int cubeFace = 0; cubeFace < 6; ++cubeFace) {
+			int major = (cubeFace & 1) ? -FACE_LOOKUP_SIZE : FACE_LOOKUP_SIZE;
+			for (int cu = 0; cu < FACE_LOOKUP_SIZE; ++cu) {
+				for (int cv = 0; cv < FACE_LOOKUP_SIZE; ++cv) {
+					// Corners, in the same units as the cell computation above
+					fixed3 corners[4];
+					for (int k = 0; k < 4; ++k) {
+						int u = 2 * (cu + (k & 1)) - FACE_LOOKUP_SIZE;
+						int v = 2 * (cv + (k >> 1)) - FACE_LOOKUP_SIZE;
+						switch (cubeFace / 2) {
+							case 0: corners[k] = fixed3(major, u, v); break;
+							case 1: corners[k] = fixed3(u, major, v); break;
+							default: corners[k] = fixed3(u, v, major); break;
+						}
+					}
+
+					// Best face at the first corner, then check that it wins everywhere in the cell
+					int bestFace = 0;
+					int64_t bestDot = fixed3::dot64(corners[0], normals[0]);
+					for (int i = 1; i < faceCount; ++i) {
+						int64_t dot = fixed3::dot64(corners[0], normals[i]);
+						if (dot > bestDot) {
+							bestDot = dot;
+							bestFace = i;
+						}
+					}
+					bool ambiguous = false;
+					for (int i = 0; i < faceCount && !ambiguous; ++i) {
+						if (i == bestFace) {
+							continue;
+						}
+						fixed3 delta = normals[bestFace] - normals[i];
+						for (int k = 0; k < 4 && !ambiguous; ++k) {
+							ambiguous = fixed3::dot64(corners[k], delta) <= margin;
+						}
+					}
+
+					faceLookup[(cubeFace * FACE_LOOKUP_SIZE + cu) * FACE_LOOKUP_SIZE + cv] = ambiguous ? FACE_LOOKUP_AMBIGUOUS : bestFace;
+					if (ambiguous) {
+						ambiguousCount++;
+					}
+				}
+			}
+		}
+		NRF_LOG_DEBUG("Face lookup has %d ambiguous cells", ambiguousCount);
+	}
+
 	/// <summary>
 	/// Crudely compares accelerometer readings passed in to determine the current face up
 	/// </summary>
 	/// <returns>The face number, starting at 0</returns>
 	int determineFace(float3 acc, float* outConfidence)
 	{
+	#if ACCEL_FIXED_POINT
+		fixed3 accFixed(acc);
+		fixed confidenceFixed;
+		int ret = determineFace(accFixed, accFixed.sqrMagnitude64(), &confidenceFixed);
+		if (outConfidence != nullptr) {
+			*outConfidence = toFloat(confidenceFixed);
+		}
+		return ret;
+	#else
 		// Compare against face normals stored in board manager
 		int faceCount = BoardManager::getBoard()->ledCount;
 		auto settings = SettingsManager::getSettings();
@@ -302,12 +867,16 @@ namespace Accelerometer
 		} else {
 			float3 nacc  = acc / accMag; // normalize
 			float bestDot = -1000.0f;
-			int bestFace = -1;
-			for (int i = 0; i < faceCount; ++i) {
-				float dot = float3::dot(nacc, normals[i]);
-				if (dot > bestDot) {
-					bestDot = dot;
-					bestFace = i;
+			int bestFace = faceLookup[faceLookupCell(acc.x, acc.y, acc.z)];
+			if (bestFace != FACE_LOOKUP_AMBIGUOUS) {
+				bestDot = float3::dot(nacc, normals[bestFace]);
+			} else {
+				for (int i = 0; i < faceCount; ++i) {
+					float dot = float3::dot(nacc, normals[i]);
+					if (dot > bestDot) {
+						bestDot = dot;
+						bestFace = i;
+					}
 				}
 			}
 			if (outConfidence != nullptr) {
@@ -315,7 +884,39 @@ namespace Accelerometer
 			}
 			return bestFace;
 		}
+	#endif
+	}
+
+#if ACCEL_FIXED_POINT
+	/// <summary>
+	/// Fixed point version of the above. The best face doesn't depend on the vector's length,
+	/// so we only divide by it once, to compute the confidence.
+	/// </summary>
+	int determineFace(const fixed3& acc, int64_t accSqrMag, fixed* outConfidence)
+	{
+		if (accSqrMag < fallingThresholdSqr || accSqrMag == 0) {
+			*outConfidence = 0;
+			return face;
+		}
+
+		int64_t bestDot = INT64_MIN;
+		int bestFace = faceLookup[faceLookupCell(acc.x, acc.y, acc.z)];
+		if (bestFace != FACE_LOOKUP_AMBIGUOUS) {
+			bestDot = fixed3::dot64(acc, faceNormals[bestFace]);
+		} else {
+			int faceCount = BoardManager::getBoard()->ledCount;
+			for (int i = 0; i < faceCount; ++i) {
+				int64_t dot = fixed3::dot64(acc, faceNormals[i]);
+				if (dot > bestDot) {
+					bestDot = dot;
+					bestFace = i;
+				}
+			}
+		}
+		*outConfidence = (fixed)(bestDot / (int64_t)isqrt(accSqrMag));
+		return bestFace;
 	}
+#endif
 
 	/// <summary>
 	/// Method used by clients to request timer callbacks when accelerometer readings are in
@@ -362,6 +963,24 @@ namespace Accelerometer
 		rollStateClients.UnregisterWithToken(param);
 	}
 
+	void hookSettle(SettleClientMethod method, void* param)
+	{
+		if (!settleClients.Register(param, method))
+		{
+			NRF_LOG_ERROR("Too many accelerometer hooks registered.");
+		}
+	}
+
+	void unHookSettle(SettleClientMethod client)
+	{
+		settleClients.UnregisterWithHandler(client);
+	}
+
+	void unHookSettleWithParam(void* param)
+	{
+		settleClients.UnregisterWithToken(param);
+	}
+
 	struct CalibrationNormals
 	{
 		float3 face1;
@@ -554,6 +1173,16 @@ namespace Accelerometer
 		}
 	}
 
+	/// <summary>
+	/// Called in interrupt context when the accelerometer FIFO reaches its watermark
+	/// </summary>
+	void onFIFOInterrupt(uint32_t pin, nrf_gpiote_polarity_t action) {
+		// Read the samples from the main loop, like the timer does
+		Scheduler::push(nullptr, 0, [](void* eventData, uint16_t eventSize) {
+			update(nullptr);
+		});
+	}
+
 	bool interruptTriggered = false;
 	void accInterruptHandler(uint32_t pin, nrf_gpiote_polarity_t action) {
 		// Aknowledge the interrupt
@@ -1,11 +1,15 @@
 #pragma once
 
-#include "core/ring_buffer.h"
+#include <stdint.h>
 #include "core/float3.h"
 #include "core/delegate_array.h"
+#include "drivers_hw/lis2de12.h"
 
-#define ACCEL_BUFFER_SIZE 10 // 10ms * 10 = 100ms seconds of buffer
-							  // 16 bytes * 128 = 2k of RAM
+#define ACCEL_HISTORY_SIZE 256 // 10ms * 256 = 2.5 seconds of history
+							  // 8 bytes * 256 = 2k of RAM
+
+#define ACCEL_FRAME_MS 10 // Time between two frames, i.e. the accelerometer's output data rate (100Hz)
+#define ACCEL_SETTINGS_FRAME_MS 100 // The filter rates and jerk thresholds in the settings are expressed per this period
 
 namespace Modules
 {
@@ -31,6 +35,74 @@ namespace Modules
 			uint32_t time;
 		};
 
+		/// <summary>
+		/// A raw accelerometer reading as kept in the history, with the time since the previous one
+		/// size is 8
+		/// </summary>
+		struct AccelSample
+		{
+			int16_t x, y, z;
+			uint16_t deltaTime; // ms
+		};
+
+		/// <summary>
+		/// A sample of the history, with values derived from it computed on access
+		/// </summary>
+		struct AccelHistoryFrame
+		{
+			const AccelSample* sample;
+			const AccelSample* previous; // nullptr for the oldest sample
+			uint32_t time;
+
+			Core::float3 acc() const;
+			Core::float3 jerk() const;
+		};
+
+		/// <summary>
+		/// Ring buffer of the last raw samples, automatically overwrites the oldest ones.
+		/// Times are stored as deltas, so they're rebuilt from the newest sample backward.
+		/// </summary>
+		class AccelHistory
+		{
+		private:
+			AccelSample samples[ACCEL_HISTORY_SIZE];
+			int next;
+			int sampleCount;
+			uint32_t lastTime;
+
+			uint32_t timeAt(int index) const;
+
+		public:
+			class Iterator
+			{
+			private:
+				const AccelHistory* history;
+				int index;
+				uint32_t time;
+
+			public:
+				Iterator(const AccelHistory* history, int index, uint32_t time);
+				AccelHistoryFrame operator*() const;
+				Iterator& operator++();
+				bool operator!=(const Iterator& other) const { return index != other.index; }
+			};
+
+			AccelHistory();
+			void push(int16_t x, int16_t y, int16_t z, uint32_t time);
+			void clear();
+
+			// Number of samples stored so far, up to ACCEL_HISTORY_SIZE
+			int count() const { return sampleCount; }
+			AccelHistoryFrame first() const;
+			AccelHistoryFrame last() const;
+
+			// Samples from oldest to newest, prefer the iterator when going through all of them
+			AccelHistoryFrame operator[](int index) const;
+			const AccelSample& sample(int index) const; // Cheaper when the time isn't needed
+			Iterator begin() const;
+			Iterator end() const;
+		};
+
 	    enum RollState : uint8_t
 		{
 			RollState_Unknown = 0,
@@ -41,16 +113,29 @@ namespace Modules
 			RollState_Count
 		};
 
+		enum SettleEvent : uint8_t
+		{
+			SettleEvent_Settling = 0,	// Provisional, the die came to rest after being handled or rolled
+			SettleEvent_Settled,		// The roll state confirmed it with RollState_OnFace
+			SettleEvent_Withdrawn,		// The provisional face was wrong: the die moved again, ended crooked or on another face
+		};
+
 		int determineFace(Core::float3 acc, float* outConfidence = nullptr);
 
 		void init();
 		void start();
 		void stop();
 
+		// Runs a raw reading through the filters and the roll state machine, as if it came out of the FIFO
+		// at that time. Recorded samples can be replayed with it while stopped.
+		void processSample(const DriversHW::LIS2DE12::Sample& sample, uint32_t time);
+
 		int currentFace();
 		float currentFaceConfidence();
 		RollState currentRollState();
+		const AccelHistory& getHistory();
 		const char* getRollStateString(RollState state);
+		const char* getSettleEventString(SettleEvent event);
 
 		// Notification management
 		typedef void(*FrameDataClientMethod)(void* param, const AccelFrame& accelFrame);
@@ -62,6 +147,13 @@ namespace Modules
 		void hookRollState(RollStateClientMethod method, void* param);
 		void unHookRollState(RollStateClientMethod client);
 		void unHookRollStateWithParam(void* param);
+
+		// Every SettleEvent_Settling is followed by either SettleEvent_Settled or SettleEvent_Withdrawn for the same face.
+		// SettleEvent_Settled may also come on its own, when the die stopped too quickly for a provisional face.
+		typedef void(*SettleClientMethod)(void* param, int face, SettleEvent event);
+		void hookSettle(SettleClientMethod method, void* param);
+		void unHookSettle(SettleClientMethod client);
+		void unHookSettleWithParam(void* param);
 	}
 }
 
@@ -16,6 +16,8 @@
 #include "accelerometer.h"
 #include "bluetooth/bluetooth_messages.h"
 #include "bluetooth/bluetooth_message_service.h"
+#include <math.h>
+#include <algorithm>
 
 using namespace Animations;
 using namespace Modules;
@@ -24,38 +26,74 @@ using namespace DriversNRF;
 using namespace DriversHW;
 using namespace Bluetooth;
 
-#define MAX_ANIMS (20)
-#define TIMER2_RESOLUTION 33 //ms
+#define MIN_FRAME_MS 16 // Never refresh the leds faster than ~60fps
+#define MIN_TIMER_MS 2 // Shortest delay we can ask of the app timer
+#define ANIM_BUCKET_COUNT 32 // Power of 2, larger than MAX_ANIMS so that chains stay short
 
 namespace Modules
 {
 namespace AnimController
 {
-	// Our currently running animations
+	// Our currently running animations, packed but in no particular order
 	Animations::AnimationInstance* animations[MAX_ANIMS];
 	int animationCount;
 
+	// Index of the running animations by preset, each bucket is a chain of indices into animations[]
+	int8_t animationBuckets[ANIM_BUCKET_COUNT];
+	int8_t nextInBucket[MAX_ANIMS];
+
 	// FIXME!!!
 	int currentRainbowIndex = 0;
 	const int rainbowScale = 1; 
 	float heat = 0.0f;
+	float frameCoolDown = 1.0f; // How much heat is kept from one accelerometer frame to the next
 
 	uint32_t getColorForAnim(void* token, uint32_t colorIndex);
 	void onAccelFrame(void* param, const Accelerometer::AccelFrame& accelFrame);
 	uint8_t animIndexToLEDIndex(int animFaceIndex, int remapFace);
+	void buildFaceToLEDRemap();
 
 	void onProgrammingEvent(void* context, Flash::ProgrammingEventType evt);
 
 	void printDebugAnimControllerState(void* context, const Message* msg);
 
+	void startAnimation(const Animation* animationPreset, const DataSet::AnimationBits* animationBits, int animIndex, uint8_t remapFace, bool loop);
+	int findAnimation(const Animation* animationPreset, uint8_t remapFace);
+	void addAnimation(Animations::AnimationInstance* anim);
+	void removeAnimation(int animIndex);
+	void clearAnimationIndex();
+
+	int advanceClock();
+	int getNextUpdateTime(int ms);
+	void scheduleUpdate(int ms);
+
 	APP_TIMER_DEF(animControllerTimer);
-	// To be passed to the timer
-	int animControllerTicks = 0;
+	bool running = false;
+
+	// The animation clock, only advances while animations are playing. It keeps a running total
+	// of RTC ticks and derives the time in ms from that, so that rounding doesn't accumulate.
+	int currentTime = 0;
+	uint64_t currentTimeTotalTicks = 0;
+	uint32_t currentTimeTicks = 0; // RTC count when the clock was last advanced
+
+	// When the timer is set to fire, -1 if it isn't running
+	int nextUpdateTime = -1;
+
+	// Number of times the leds were refreshed, for debugging
+	int updateCount = 0;
+
+	// Animation face index -> led index, for each remap face, i.e. the layout's face remapping
+	// composed with the settings' face to led lookup. Rebuilt whenever settings may have changed.
+	uint8_t faceToLEDRemap[MAX_LED_COUNT * MAX_LED_COUNT];
+	int faceToLEDRemapLedCount = 0;
+	bool faceToLEDRemapValid = false;
+
 	void animationControllerUpdate(void* param)
 	{
-		animControllerTicks++;
-		int timeMs = animControllerTicks * TIMER2_RESOLUTION;
+		nextUpdateTime = -1;
+		int timeMs = advanceClock();
 		update(timeMs);
+		scheduleUpdate(getNextUpdateTime(timeMs));
 	}
 
 	/// <summary>
@@ -71,7 +109,9 @@ namespace AnimController
 		currentRainbowIndex = 0;
 
 		animationCount = 0;
-		Timers::createTimer(&animControllerTimer, APP_TIMER_MODE_REPEATED, animationControllerUpdate);
+		clearAnimationIndex();
+		buildFaceToLEDRemap();
+		Timers::createTimer(&animControllerTimer, APP_TIMER_MODE_SINGLE_SHOT, animationControllerUpdate);
 		start();
 		NRF_LOG_INFO("Anim Controller Initialized");
 	}
@@ -82,19 +122,10 @@ namespace AnimController
 	/// <param name="ms">Current global time in milliseconds</param>
 	void update(int ms)
 	{
-		auto s = SettingsManager::getSettings();
-		auto b = BoardManager::getBoard();
-		auto l = DiceVariants::getLayout(b->ledCount, s->faceLayoutLookupIndex);
-		int c = b->ledCount;
-
-		// Update heat value (cool down)
-		heat *= s->coolDownRate;
-		if (heat < 0.0f) {
-			heat = 0.0f;
-		}
-
+		int c = BoardManager::getBoard()->ledCount;
 		if (animationCount > 0) {
 	        PowerManager::feed();
+			updateCount++;
 
 			// clear the global color array
 			uint32_t allColors[MAX_LED_COUNT];
@@ -116,17 +147,9 @@ namespace AnimController
 				if (animTime > anim->animationPreset->duration)
 				{
 					// The animation is over, get rid of it!
+					removeAnimation(i);
 					Animations::destroyAnimationInstance(anim);
 
-					// Shift the other animations
-					for (int j = i; j < animationCount - 1; ++j)
-					{
-						animations[j] = animations[j + 1];
-					}
-
-					// Reduce the count
-					animationCount--;
-
 					// Decrement loop counter since we just replaced the current anim
 					i--;
 				}
@@ -138,6 +161,7 @@ namespace AnimController
 
 					// Update the leds
 					int animTrackCount = anim->updateLEDs(ms, canonIndices, colors);
+					const uint8_t* remap = getFaceToLEDRemap(anim->remapFace);
 
 					// Gamma correct and map face index to led index
 					//NRF_LOG_INFO("track_count = %d", animTrackCount);
@@ -150,8 +174,7 @@ namespace AnimController
 						//	   face should light up to "retarget" the animation around the current up face)
 						//		-> ledIndex (based on pcb face to led mapping, i.e. to account for the internal rotation
 						//		   of the PCB and the fact that the LEDs are not accessed in the same order as the number of the faces)
-						int rotatedAnimFaceIndex = l->faceRemap[anim->remapFace * c + canonIndices[j]];
-						ledIndices[j] = s->faceToLEDLookup[rotatedAnimFaceIndex];
+						ledIndices[j] = remap[canonIndices[j]];
 					}
 
 					// Update color array
@@ -176,6 +199,8 @@ namespace AnimController
 	void stop()
 	{
 		Accelerometer::unHookFrameData(onAccelFrame);
+		running = false;
+		nextUpdateTime = -1;
 		Timers::stopTimer(animControllerTimer);
 		// Clear all data
 		stopAll();
@@ -184,9 +209,70 @@ namespace AnimController
 
 	void start()
 	{
+		// The cool down rate used to be applied every 33ms
+		frameCoolDown = powf(SettingsManager::getSettings()->coolDownRate, (float)ACCEL_FRAME_MS / 33.0f);
 		Accelerometer::hookFrameData(onAccelFrame, nullptr);
 		NRF_LOG_INFO("Starting anim controller");
-		Timers::startTimer(animControllerTimer, TIMER2_RESOLUTION, NULL);
+		running = true;
+		if (animationCount > 0) {
+			scheduleUpdate(advanceClock());
+		}
+	}
+
+	/// <summary>
+	/// Returns the current animation time, in ms, and makes it the reference for the next update.
+	/// The clock is measured with the RTC while animations play, and simply resumes when they start again.
+	/// </summary>
+	int advanceClock()
+	{
+		uint32_t now = Timers::getTicks();
+		if (animationCount > 0) {
+			currentTimeTotalTicks += Timers::ticksBetween(currentTimeTicks, now);
+			currentTime = Timers::ticksToMillis(currentTimeTotalTicks);
+		}
+		currentTimeTicks = now;
+		return currentTime;
+	}
+
+	/// <summary>
+	/// Asks all running animations when their output will next change, and returns the earliest
+	/// of those times (including animations ending), or -1 if there is nothing to update.
+	/// </summary>
+	int getNextUpdateTime(int ms)
+	{
+		int ret = -1;
+		for (int i = 0; i < animationCount; ++i) {
+			auto anim = animations[i];
+			int endTime = anim->startTime + anim->animationPreset->duration + 1;
+			int animTime = std::min(anim->getNextUpdateTime(ms), endTime);
+			if (ret < 0 || animTime < ret) {
+				ret = animTime;
+			}
+		}
+		if (ret >= 0 && ret < ms + MIN_FRAME_MS) {
+			ret = ms + MIN_FRAME_MS;
+		}
+		return ret;
+	}
+
+	/// <summary>
+	/// Makes sure the timer fires no later than the passed in time, -1 means no update is needed
+	/// </summary>
+	void scheduleUpdate(int ms)
+	{
+		if (!running || ms < 0) {
+			return;
+		}
+		if (nextUpdateTime >= 0) {
+			if (nextUpdateTime <= ms) {
+				// Already going to update soon enough
+				return;
+			}
+			Timers::stopTimer(animControllerTimer);
+		}
+		int delay = std::max(ms - currentTime, MIN_TIMER_MS);
+		nextUpdateTime = currentTime + delay;
+		Timers::startTimer(animControllerTimer, delay, NULL);
 	}
 
 	/// <summary>
@@ -196,10 +282,19 @@ namespace AnimController
 	{
 		// Find the preset for this animation Index
 		auto animationPreset = DataSet::getAnimation(animIndex);
-		play(animationPreset, DataSet::getAnimationBits(), remapFace, loop);
+		startAnimation(animationPreset, DataSet::getAnimationBits(), animIndex, remapFace, loop);
 	}
 
 	void play(const Animation* animationPreset, const DataSet::AnimationBits* animationBits, uint8_t remapFace, bool loop)
+	{
+		// Not from the data set (i.e. previews), so no compiled version
+		startAnimation(animationPreset, animationBits, -1, remapFace, loop);
+	}
+
+	/// <summary>
+	/// Plays a preset, animIndex is its index in the data set if it comes from there, -1 otherwise
+	/// </summary>
+	void startAnimation(const Animation* animationPreset, const DataSet::AnimationBits* animationBits, int animIndex, uint8_t remapFace, bool loop)
 	{
 		#if (NRF_LOG_DEFAULT_LEVEL == 4)
 		NRF_LOG_DEBUG("Playing Anim!");
@@ -222,18 +317,10 @@ namespace AnimController
 		#endif
 
 		// Is there already an animation for this?
-		int prevAnimIndex = 0;
-		for (; prevAnimIndex < animationCount; ++prevAnimIndex)
-		{
-			auto prevAnim = animations[prevAnimIndex];
-			if (prevAnim->animationPreset == animationPreset && prevAnim->remapFace == remapFace)
-			{
-				break;
-			}
-		}
+		int prevAnimIndex = findAnimation(animationPreset, remapFace);
 
-		int ms = animControllerTicks * TIMER2_RESOLUTION;
-		if (prevAnimIndex < animationCount)
+		int ms = advanceClock();
+		if (prevAnimIndex >= 0)
 		{
 			// Replace a previous animation
 			stopAtIndex(prevAnimIndex);
@@ -242,11 +329,18 @@ namespace AnimController
 		else if (animationCount < MAX_ANIMS)
 		{
 			// Add a new animation
-			animations[animationCount] = Animations::createAnimationInstance(animationPreset, animationBits);
-			animations[animationCount]->start(ms, remapFace, loop);
-			animationCount++;
+			auto anim = animIndex >= 0 ?
+				Animations::createAnimationInstance(animIndex) :
+				Animations::createAnimationInstance(animationPreset, animationBits);
+			if (anim != nullptr) {
+				anim->start(ms, remapFace, loop);
+				addAnimation(anim);
+			}
 		}
 		// Else there is no more room
+
+		// Show the new animation right away
+		scheduleUpdate(ms);
 	}
 
 	/// <summary>
@@ -263,20 +357,10 @@ namespace AnimController
 	void stop(const Animation* animationPreset, uint8_t remapFace) {
 
 		// Find the animation with that preset and remap face
-		int prevAnimIndex = 0;
-		AnimationInstance* prevAnimInstance = nullptr;
-		for (; prevAnimIndex < animationCount; ++prevAnimIndex)
-		{
-			auto instance = animations[prevAnimIndex];
-			if (instance->animationPreset == animationPreset && (remapFace == 255 || instance->remapFace == remapFace))
-			{
-				prevAnimInstance = instance;
-				break;
-			}
-		}
-
-		if (prevAnimIndex < animationCount)
+		int prevAnimIndex = findAnimation(animationPreset, remapFace);
+		if (prevAnimIndex >= 0)
 		{
+			AnimationInstance* prevAnimInstance = animations[prevAnimIndex];
 			removeAtIndex(prevAnimIndex);
 
 			// Delete the instance
@@ -296,6 +380,7 @@ namespace AnimController
 			Animations::destroyAnimationInstance(animations[i]);
 		}
 		animationCount = 0;
+		clearAnimationIndex();
 		APA102::clear();
 		APA102::show();
 	}
@@ -305,11 +390,6 @@ namespace AnimController
 	/// </summary>
 	void stopAtIndex(int animIndex)
 	{
-		auto s = SettingsManager::getSettings();
-		auto b = BoardManager::getBoard();
-		auto l = DiceVariants::getLayout(b->ledCount, s->faceLayoutLookupIndex);
-		int c = b->ledCount;
-
 		// Found the animation, start by killing the leds it controls
 		int canonIndices[MAX_LED_COUNT];
 		int ledIndices[MAX_LED_COUNT];
@@ -317,6 +397,7 @@ namespace AnimController
 		memset(zeros, 0, sizeof(uint32_t) * MAX_LED_COUNT);
 		auto anim = animations[animIndex];
 		int ledCount = anim->stop(canonIndices);
+		const uint8_t* remap = getFaceToLEDRemap(anim->remapFace);
 		for (int i = 0; i < ledCount; ++i) {
 			// The transformation is:
 			// animFaceIndex (what face the animation says it wants to light up)
@@ -324,8 +405,7 @@ namespace AnimController
 			//	   face should light up to "retarget" the animation around the current up face)
 			//		-> ledIndex (based on pcb face to led mapping, i.e. to account for the internal rotation
 			//		   of the PCB and the fact that the LEDs are not accessed in the same order as the number of the faces)
-			int rotatedAnimFaceIndex = l->faceRemap[anim->remapFace * c + canonIndices[i]];
-			ledIndices[i] = s->faceToLEDLookup[rotatedAnimFaceIndex];
+			ledIndices[i] = remap[canonIndices[i]];
 		}
 		APA102::setPixelColors(ledIndices, zeros, ledCount);
 		APA102::show();
@@ -337,22 +417,81 @@ namespace AnimController
 	void removeAtIndex(int animIndex)
 	{
 		stopAtIndex(animIndex);
+		removeAnimation(animIndex);
+	}
 
-		// Shift the other animations
-		for (; animIndex < animationCount - 1; ++animIndex)
-		{
-			animations[animIndex] = animations[animIndex + 1];
+	int animationBucket(const Animation* animationPreset) {
+		uintptr_t address = (uintptr_t)animationPreset;
+		return (address ^ (address >> 5)) & (ANIM_BUCKET_COUNT - 1);
+	}
+
+	/// <summary>
+	/// Returns the index of the running animation for that preset and remap face, or -1.
+	/// A remap face of 255 matches any face.
+	/// </summary>
+	int findAnimation(const Animation* animationPreset, uint8_t remapFace) {
+		for (int i = animationBuckets[animationBucket(animationPreset)]; i >= 0; i = nextInBucket[i]) {
+			auto instance = animations[i];
+			if (instance->animationPreset == animationPreset && (remapFace == 255 || instance->remapFace == remapFace)) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	void linkAnimation(int animIndex) {
+		int bucket = animationBucket(animations[animIndex]->animationPreset);
+		nextInBucket[animIndex] = animationBuckets[bucket];
+		animationBuckets[bucket] = animIndex;
+	}
+
+	void unlinkAnimation(int animIndex) {
+		int8_t* link = &animationBuckets[animationBucket(animations[animIndex]->animationPreset)];
+		while (*link != animIndex) {
+			link = &nextInBucket[*link];
 		}
+		*link = nextInBucket[animIndex];
+	}
 
-		// Reduce the count
+	/// <summary>
+	/// Appends an animation instance to the running list, caller checks there is room
+	/// </summary>
+	void addAnimation(Animations::AnimationInstance* anim) {
+		animations[animationCount] = anim;
+		linkAnimation(animationCount);
+		animationCount++;
+	}
+
+	/// <summary>
+	/// Removes an animation from the running list, moving the last one in its place.
+	/// Doesn't destroy the instance.
+	/// </summary>
+	void removeAnimation(int animIndex) {
+		unlinkAnimation(animIndex);
+		int lastIndex = animationCount - 1;
+		if (animIndex != lastIndex) {
+			unlinkAnimation(lastIndex);
+			animations[animIndex] = animations[lastIndex];
+			linkAnimation(animIndex);
+		}
 		animationCount--;
 	}
 
+	void clearAnimationIndex() {
+		memset(animationBuckets, -1, sizeof(animationBuckets));
+	}
+
 	void onAccelFrame(void* param, const Accelerometer::AccelFrame& accelFrame) {
 		auto sqrMag = accelFrame.jerk.sqrMagnitude();
+		heat *= frameCoolDown;
+		if (heat < 0.0f) {
+			heat = 0.0f;
+		}
+
 		if (sqrMag > 0.0f) {
 			currentRainbowIndex++;
-			heat += sqrt(sqrMag) * SettingsManager::getSettings()->heatUpRate;
+			// The heat up rate is per settings period, and we get several frames in that time
+			heat += sqrt(sqrMag) * SettingsManager::getSettings()->heatUpRate * ACCEL_FRAME_MS / ACCEL_SETTINGS_FRAME_MS;
 			if (heat > 1.0f) {
 				heat = 1.0f;
 			}
@@ -366,14 +505,41 @@ namespace AnimController
 		//	   face should light up to "retarget" the animation around the current up face)
 		//		-> ledIndex (based on pcb face to led mapping, i.e. to account for the internal rotation
 		//		   of the PCB and the fact that the LEDs are not accessed in the same order as the number of the faces)
+		return getFaceToLEDRemap(remapFace)[animFaceIndex];
+	}
 
+	/// <summary>
+	/// Precomputes the animation face to led index table for every remap face, so that
+	/// mapping an led is a single lookup instead of going through the layout and settings.
+	/// </summary>
+	void buildFaceToLEDRemap() {
 		auto s = SettingsManager::getSettings();
 		auto b = BoardManager::getBoard();
+		if (s == nullptr || b == nullptr) {
+			faceToLEDRemapValid = false;
+			return;
+		}
+
 		auto l = DiceVariants::getLayout(b->ledCount, s->faceLayoutLookupIndex);
 		int c = b->ledCount;
+		for (int remapFace = 0; remapFace < c; ++remapFace) {
+			for (int animFaceIndex = 0; animFaceIndex < c; ++animFaceIndex) {
+				int rotatedAnimFaceIndex = l->faceRemap[remapFace * c + animFaceIndex];
+				faceToLEDRemap[remapFace * c + animFaceIndex] = s->faceToLEDLookup[rotatedAnimFaceIndex];
+			}
+		}
+		faceToLEDRemapLedCount = c;
+		faceToLEDRemapValid = true;
+	}
 
-		int rotatedAnimFaceIndex = l->faceRemap[remapFace * c + animFaceIndex];
-		return s->faceToLEDLookup[rotatedAnimFaceIndex];
+	/// <summary>
+	/// Returns the led index of each animation face index for the given remap face
+	/// </summary>
+	const uint8_t* getFaceToLEDRemap(int remapFace) {
+		if (!faceToLEDRemapValid) {
+			buildFaceToLEDRemap();
+		}
+		return &faceToLEDRemap[remapFace * faceToLEDRemapLedCount];
 	}
 
 	int getCurrentRainbowOffset() {
@@ -387,13 +553,19 @@ namespace AnimController
 	void onProgrammingEvent(void* context, Flash::ProgrammingEventType evt){
 		if (evt == Flash::ProgrammingEventType_Begin) {
 			stop();
+			faceToLEDRemapValid = false;
 		} else {
+			// Settings (face layout, calibration) may have changed
+			buildFaceToLEDRemap();
 			start();
 		}
 	}
 
 	void printDebugAnimControllerState(void* context, const Message* msg) {
 		NRF_LOG_INFO("Anim Controller has %d animations", animationCount);
+		NRF_LOG_INFO("Time %d, %d updates, next update at %d", currentTime, updateCount, nextUpdateTime);
+		NRF_LOG_INFO("LED frames sent %d, skipped %d", APA102::getSentFrameCount(), APA102::getSkippedFrameCount());
+		NRF_LOG_INFO("Instances: %d, high water mark %d, failed allocs %d", Animations::getInstanceCount(), Animations::getInstanceHighWaterMark(), Animations::getInstanceAllocFailures());
 		for (int i = 0; i < animationCount; ++i) {
 			AnimationInstance* anim = animations[i];
 			NRF_LOG_INFO("Anim %d is of type %d, duration %d", i, anim->animationPreset->type, anim->animationPreset->duration);
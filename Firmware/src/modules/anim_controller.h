@@ -31,6 +31,8 @@ namespace Modules
 		void stop(const Animations::Animation* animationPreset, uint8_t remapFace = 0);
 		void stopAll();
 
+		const uint8_t* getFaceToLEDRemap(int remapFace);
+
 		int getCurrentRainbowOffset();
 		float getCurrentHeat();
 	}
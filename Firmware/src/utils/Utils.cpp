@@ -9,6 +9,13 @@
 #include "nrf_log.h"
 #include "bluetooth/bluetooth_message_service.h"
 
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+#include "nrf.h" // For the Cortex-M4 SIMD intrinsics
+#define UTILS_USE_DSP 1
+#else
+#define UTILS_USE_DSP 0
+#endif
+
 
 using namespace Core;
 using namespace Config;
@@ -19,17 +26,61 @@ namespace Utils
 		return 4 * ((address + 3) / 4);
 	}
 
+	// The color kernels below work on all three channels of a packed color at once,
+	// either with the Cortex-M4 SIMD instructions or with plain integer math on
+	// the red and blue channels side by side (each gets 16 bits of headroom).
+
+	/// <summary>
+	/// Returns the per channel maximum of the two colors
+	/// </summary>
 	uint32_t addColors(uint32_t a, uint32_t b) {
-		uint8_t red = MAX(getRed(a), getRed(b));
-		uint8_t green = MAX(getGreen(a), getGreen(b));
-		uint8_t blue = MAX(getBlue(a), getBlue(b));
-		return toColor(red,green,blue);
+	#if UTILS_USE_DSP
+		// USUB8 sets the GE flag of each byte where a >= b, SEL then picks those bytes from a
+		__USUB8(a, b);
+		return __SEL(a, b) & 0xFFFFFF;
+	#else
+		uint32_t arb = a & 0xFF00FF;
+		uint32_t brb = b & 0xFF00FF;
+		// Bit 8 of each lane survives the subtraction only if a >= b
+		uint32_t ge = (((arb | 0x01000100) - brb) >> 8) & 0x00010001;
+		uint32_t mask = ge * 0xFF;
+		uint32_t rb = (arb & mask) | (brb & ~mask);
+		return rb | (MAX(a & 0xFF00, b & 0xFF00));
+	#endif
+	}
+
+	/// <summary>
+	/// Returns the per channel sum of the two colors, clamped to 255
+	/// </summary>
+	uint32_t addColorsSaturated(uint32_t a, uint32_t b) {
+	#if UTILS_USE_DSP
+		return __UQADD8(a, b) & 0xFFFFFF;
+	#else
+		// Add the low 7 bits of each channel, then work out the top bit and carry by hand
+		uint32_t sum = (a & 0x7F7F7F) + (b & 0x7F7F7F);
+		uint32_t carry = ((a & b) | ((a | b) & sum)) & 0x808080;
+		return (sum ^ ((a ^ b) & 0x808080)) | ((carry >> 7) * 0xFF);
+	#endif
 	}
 
 	uint32_t interpolateColors(uint32_t color1, uint32_t time1, uint32_t color2, uint32_t time2, uint32_t time) {
 		// To stick to integer math, we'll scale the values
 		int scaler = 1024;
 		int scaledPercent = (time - time1) * scaler / (time2 - time1);
+	#if UTILS_USE_DSP
+		if (scaledPercent >= 0 && scaledPercent <= scaler) {
+			// One dual multiply-accumulate per channel, with both weights packed in a register
+			uint32_t weights = __PKHBT(scaler - scaledPercent, scaledPercent, 16);
+			uint32_t rb1 = __UXTB16(color1);
+			uint32_t rb2 = __UXTB16(color2);
+			uint32_t g1 = __UXTB16(color1 >> 8);
+			uint32_t g2 = __UXTB16(color2 >> 8);
+			uint32_t red = __SMUAD(__PKHTB(rb2, rb1, 16), weights) >> 10;
+			uint32_t green = __SMUAD(__PKHBT(g1, g2, 16), weights) >> 10;
+			uint32_t blue = __SMUAD(__PKHBT(rb1, rb2, 16), weights) >> 10;
+			return toColor(red, green, blue);
+		}
+	#endif
 		int scaledRed = getRed(color1)* (scaler - scaledPercent) + getRed(color2) * scaledPercent;
 		int scaledGreen = getGreen(color1) * (scaler - scaledPercent) + getGreen(color2) * scaledPercent;
 		int scaledBlue = getBlue(color1) * (scaler - scaledPercent) + getBlue(color2) * scaledPercent;
@@ -282,13 +333,67 @@ for x in range(256):
 		return false;
 	}
 
-	/* D. J. Bernstein hash function */
+	// CRC-32 (the zlib / IEEE 802.3 one), one entry per byte value
+	static const uint32_t crcTable[256] = {
+		0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+		0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+		0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+		0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+		0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+		0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+		0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+		0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+		0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+		0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+		0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+		0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+		0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+		0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+		0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+		0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+		0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+		0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+		0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+		0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+		0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+		0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+		0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+		0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+		0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+		0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+		0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+		0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+		0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+		0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+		0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+		0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+		0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+		0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+		0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+		0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+		0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+		0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+		0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+		0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+		0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+		0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+		0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+	};
+
+	/* CRC-32, same as zlib's crc32(0, data, size) */
 	uint32_t computeHash(const uint8_t* data, int size) {
-		uint32_t hash = 5381;
+		return updateHash(0, data, size);
+	}
+
+	/// <summary>
+	/// Continues a CRC-32 with more data, i.e. updateHash(computeHash(a), b) == computeHash(a followed by b)
+	/// </summary>
+	uint32_t updateHash(uint32_t hash, const uint8_t* data, int size) {
+		uint32_t crc = ~hash;
 		for (int i = 0; i < size; ++i) {
-			hash = 33 * hash ^ data[i];
+			crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
 		}
-		return hash;
+		return ~crc;
 	}
 
 	// Originals: https://github.com/andyherbert/lz1
@@ -310,7 +415,8 @@ for x in range(256):
 			{
 				look_behind = coding_pos - temp_pointer_pos;
 				look_ahead = coding_pos;
-				for(temp_pointer_length = 0; uncompressed_text[look_ahead++] == uncompressed_text[look_behind++]; ++temp_pointer_length)
+				// Matches stop at the end of the input, or the stream would decode to more than its size
+				for(temp_pointer_length = 0; look_ahead < uncompressed_size && uncompressed_text[look_ahead++] == uncompressed_text[look_behind++]; ++temp_pointer_length)
 					if(temp_pointer_length == 15)
 						break;
 				if(temp_pointer_length > pointer_length)
@@ -372,10 +478,13 @@ for x in range(256):
     }
 
     uint32_t modulateColor(uint32_t color, uint8_t intensity) {
-		int red = getRed(color) * intensity / 255;
-		int green = getGreen(color) * intensity / 255;
-		int blue = getBlue(color) * intensity / 255;
-		return toColor((uint8_t)red, (uint8_t)green, (uint8_t)blue);
+		// Red and blue are multiplied together, each product fits in its 16 bit lane
+		uint32_t rb = (color & 0xFF00FF) * intensity;
+		uint32_t g = ((color >> 8) & 0xFF) * intensity;
+		// x / 255 == (x + (x >> 8) + 1) >> 8 for any product of two bytes
+		rb = ((rb + ((rb >> 8) & 0xFF00FF) + 0x00010001) >> 8) & 0xFF00FF;
+		g = (g + (g >> 8) + 1) & 0xFF00;
+		return rb | g;
     }
 
 	uint16_t nextRand(uint16_t prevRand) {
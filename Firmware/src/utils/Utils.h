@@ -48,7 +48,40 @@ namespace Utils
 		return std::max(getRed(color), std::max(getGreen(color), getBlue(color)));
 	}
 
+	// Mask with the lowest count bits set, i.e. all leds of a die with count leds
+	constexpr uint32_t lowBitsMask(int count) { return count >= 32 ? 0xFFFFFFFF : (1u << count) - 1; }
+
+	// Index of the lowest set bit, the mask must not be 0
+	inline int lowestBitIndex(uint32_t mask) { return __builtin_ctz(mask); }
+	inline uint32_t clearLowestBit(uint32_t mask) { return mask & (mask - 1); }
+
+	/// <summary>
+	/// Writes the index of every bit set in the mask, lowest first, and returns how many there were.
+	/// Only loops over the set bits.
+	/// </summary>
+	inline int extractBitIndices(uint32_t mask, int retIndices[]) {
+		int count = 0;
+		for (; mask != 0; mask = clearLowestBit(mask)) {
+			retIndices[count++] = lowestBitIndex(mask);
+		}
+		return count;
+	}
+
+	/// <summary>
+	/// Same as above, also setting the color of each of the indices
+	/// </summary>
+	inline int extractBitIndices(uint32_t mask, uint32_t color, int retIndices[], uint32_t retColors[]) {
+		int count = 0;
+		for (; mask != 0; mask = clearLowestBit(mask)) {
+			retIndices[count] = lowestBitIndex(mask);
+			retColors[count] = color;
+			count++;
+		}
+		return count;
+	}
+
 	uint32_t addColors(uint32_t a, uint32_t b);
+	uint32_t addColorsSaturated(uint32_t a, uint32_t b);
 
 	uint32_t interpolateColors(uint32_t color1, uint32_t time1, uint32_t color2, uint32_t time2, uint32_t time);
 	uint8_t sine8(uint8_t x);
@@ -76,6 +109,7 @@ namespace Utils
 	uint32_t lz77_decompress (uint8_t *compressed_text, uint8_t *uncompressed_text);
 
 	uint32_t computeHash(const uint8_t* data, int size);
+	uint32_t updateHash(uint32_t hash, const uint8_t* data, int size); // Continues computeHash with more data
 
 	uint8_t interpolateIntensity(uint8_t intensity1, int time1, uint8_t intensity2, int time2, int time);
     uint32_t modulateColor(uint32_t color, uint8_t intensity);
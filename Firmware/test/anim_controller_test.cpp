@@ -0,0 +1,93 @@
+#include "test.h"
+#include <vector>
+#include "host.h"
+#include "animations/Animation.h"
+#include "animations/animation_simple.h"
+#include "data_set/data_set.h"
+#include "drivers_hw/apa102.h"
+#include "modules/anim_controller.h"
+
+using namespace Animations;
+using namespace DriversHW;
+using namespace Modules;
+
+namespace
+{
+	bool programmed;
+
+	void programDefaultDataSet() {
+		Host::startAnimController();
+		programmed = false;
+		DataSet::ProgramDefaultDataSet(Host::settings(), [](bool result) {
+			programmed = result;
+		});
+		CHECK(programmed);
+	}
+
+	uint32_t frameCount() {
+		return APA102::getSentFrameCount() + APA102::getSkippedFrameCount();
+	}
+
+	/// <summary>
+	/// Lets the controller play the animation to the end, a ms at a time, and returns when it refreshed the leds
+	/// </summary>
+	std::vector<uint32_t> playToTheEnd(const Animation* preset) {
+		std::vector<uint32_t> frameTimes;
+		uint32_t start = Host::millis();
+		uint32_t frames = frameCount();
+		AnimController::play(preset, DataSet::getAnimationBits());
+		while (Host::millis() - start < preset->duration + 100U) {
+			if (frameCount() != frames) {
+				frames = frameCount();
+				frameTimes.push_back(Host::millis() - start);
+			}
+			Host::advance(1);
+		}
+		return frameTimes;
+	}
+}
+
+TEST(animControllerWakesUpWhenTheLedsChange)
+{
+	programDefaultDataSet();
+	for (int i = 0; i < DataSet::getAnimationCount(); ++i) {
+		auto preset = static_cast<const AnimationSimple*>(DataSet::getAnimation(i));
+		int fixedRateFrames = preset->duration / DEFAULT_FRAME_MS + 2;
+
+		// The default data set only fades, which needs every frame
+		auto frameTimes = playToTheEnd(preset);
+		printf("  default animation %d (%d ms, %d blinks): %d wakeups, %d at a fixed %d ms frame rate\n", i,
+			preset->duration, preset->count, (int)frameTimes.size(), fixedRateFrames, DEFAULT_FRAME_MS);
+		CHECK((int)frameTimes.size() <= fixedRateFrames);
+
+		// The same blinks without the fades only need a wakeup when the leds switch, and when it ends
+		AnimationSimple blink = *preset;
+		blink.fade = 0;
+		frameTimes = playToTheEnd(&blink);
+		printf("    without fades: %d wakeups\n", (int)frameTimes.size());
+		CHECK((int)frameTimes.size() == blink.count * 2 + 1);
+		int period = blink.duration / blink.count;
+		CHECK(frameTimes[0] <= 2); // Shows right away, give or take the shortest timer delay
+		for (int b = 0; b < blink.count; ++b) {
+			CHECK(b == 0 || frameTimes[b * 2] == (uint32_t)(b * period));
+			CHECK(frameTimes[b * 2 + 1] == (uint32_t)(b * period + period / 2 + 1));
+		}
+		CHECK(frameTimes.back() == blink.duration + 1U);
+	}
+}
+
+TEST(animControllerClockDoesNotDrift)
+{
+	// A minute of fading, i.e. a frame every 33 ms, which the RTC can only time to 32.96 ms.
+	// Rounding each frame to whole ms used to get the animation ending 60 ms early.
+	programDefaultDataSet();
+	AnimationSimple blink = *static_cast<const AnimationSimple*>(DataSet::getAnimation(0));
+	blink.duration = 60000;
+	blink.count = 1;
+	blink.fade = 255;
+	auto frameTimes = playToTheEnd(&blink);
+	// The last frame comes when it ends, or up to a frame late when the previous one was too close
+	printf("  %d frames over %d ms, the last one %d ms after the end\n", (int)frameTimes.size(), blink.duration,
+		(int)frameTimes.back() - blink.duration);
+	CHECK(frameTimes.back() > blink.duration && frameTimes.back() <= blink.duration + 1U + 16);
+}
@@ -0,0 +1,133 @@
+#include "test.h"
+#include <string.h>
+#include <vector>
+#include "host.h"
+#include "config/board_config.h"
+#include "drivers_hw/apa102.h"
+
+using namespace Config;
+using namespace DriversHW;
+
+namespace
+{
+	/// <summary>
+	/// The bytes the chain expects: a zero start marker, 0xFF then B, G, R for each led,
+	/// and an end marker of one 0xFF per 16 leds (rounded up) to clock the data through
+	/// </summary>
+	std::vector<uint8_t> expectedFrame(const uint8_t* pixelData, int ledCount) {
+		std::vector<uint8_t> ret(4, 0);
+		for (int i = 0; i < ledCount; ++i) {
+			ret.push_back(0xFF);
+			ret.insert(ret.end(), pixelData + i * 3, pixelData + i * 3 + 3);
+		}
+		ret.insert(ret.end(), (ledCount + 15) / 16, 0xFF);
+		return ret;
+	}
+
+	std::vector<uint8_t> currentFrame() {
+		return expectedFrame(APA102::getPixels(), APA102::numPixels());
+	}
+
+	void startLEDs(BoardManager::LEDBackend backend) {
+		Host::setFaceCount(20);
+		Host::startLEDs();
+		Host::setLEDBackend(backend);
+		Host::takeLEDData();
+		CHECK(!Host::ledPowerOn());
+	}
+
+	void turnOff() {
+		APA102::clear();
+		APA102::show();
+		Host::advance(1);
+		CHECK(!Host::ledPowerOn());
+		Host::takeLEDData();
+	}
+}
+
+TEST(apa102EncodesFrames)
+{
+	const int ledCounts[] = { 1, 6, 16, 17, 20, 21 };
+	for (int ledCount : ledCounts) {
+		uint8_t pixelData[MAX_LED_COUNT * 3];
+		for (int i = 0; i < ledCount * 3; ++i) {
+			pixelData[i] = (uint8_t)(i * 37 + 1);
+		}
+		uint8_t frame[4 + MAX_LED_COUNT * 4 + (MAX_LED_COUNT + 15) / 16 + 4];
+		memset(frame, 0xAA, sizeof(frame));
+		int size = APA102::encodeFrame(pixelData, ledCount, frame);
+		auto expected = expectedFrame(pixelData, ledCount);
+		CHECK(size == (int)expected.size());
+		CHECK(memcmp(frame, expected.data(), size) == 0);
+		CHECK(frame[size] == 0xAA);
+	}
+}
+
+TEST(apa102SendsFramesThroughTheSPIM)
+{
+	startLEDs(BoardManager::LEDBackend_SPIM);
+	uint32_t sent = APA102::getSentFrameCount();
+	uint32_t skipped = APA102::getSkippedFrameCount();
+
+	// Nothing to show, the leds stay off
+	APA102::clear();
+	APA102::show();
+	CHECK(APA102::getSkippedFrameCount() == skipped + 1);
+	CHECK(Host::takeLEDData().empty());
+
+	// A frame powers the leds on and goes out right away
+	APA102::setAll(0x102030);
+	APA102::show();
+	CHECK(Host::ledPowerOn());
+	auto first = currentFrame();
+	CHECK(Host::takeLEDData() == first);
+	CHECK(APA102::getSentFrameCount() == sent + 1);
+
+	// While it is being clocked out, the next frames wait, and only the latest one is kept
+	APA102::setPixelColor(3, 0xFF0000);
+	APA102::show();
+	APA102::setPixelColor(4, 0x00FF00);
+	APA102::show();
+	auto latest = currentFrame();
+	CHECK(Host::takeLEDData().empty());
+	CHECK(APA102::getSentFrameCount() == sent + 3);
+
+	// It goes out once the transfer is done
+	Host::advance(1);
+	CHECK(Host::takeLEDData() == latest);
+	Host::advance(1);
+	CHECK(Host::takeLEDData().empty());
+
+	// The same frame again isn't sent
+	APA102::show();
+	CHECK(APA102::getSkippedFrameCount() == skipped + 2);
+	CHECK(Host::takeLEDData().empty());
+
+	// All off is sent, then the leds power off once it is out
+	APA102::clear();
+	APA102::show();
+	CHECK(Host::ledPowerOn());
+	auto off = currentFrame();
+	Host::advance(1);
+	CHECK(Host::takeLEDData() == off);
+	CHECK(!Host::ledPowerOn());
+}
+
+TEST(apa102BitBangsTheSameFrames)
+{
+	startLEDs(BoardManager::LEDBackend_BitBang);
+	APA102::setAll(0x0A0B0C);
+	APA102::setPixelColor(19, 0xFFFFFF);
+	APA102::show();
+	CHECK(Host::ledPowerOn());
+	CHECK(Host::takeLEDData() == currentFrame());
+
+	// Bit banging is synchronous, the power goes off with the all off frame
+	APA102::clear();
+	APA102::show();
+	CHECK(Host::takeLEDData() == currentFrame());
+	CHECK(!Host::ledPowerOn());
+
+	// Back to the SPIM for the other tests
+	startLEDs(BoardManager::LEDBackend_SPIM);
+}
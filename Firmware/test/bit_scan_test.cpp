@@ -0,0 +1,98 @@
+#include "test.h"
+#include <stdlib.h>
+#include <vector>
+#include "utils/Utils.h"
+
+using namespace Utils;
+
+namespace
+{
+	#define FACE_COUNT 20
+
+	/// <summary>
+	/// How the animations used to turn their face masks into indices, testing every bit
+	/// </summary>
+	int perBitIndices(uint32_t mask, uint32_t color, int retIndices[], uint32_t retColors[]) {
+		int retCount = 0;
+		for (int i = 0; i < FACE_COUNT; ++i) {
+			if ((mask & (1 << i)) != 0)
+			{
+				retIndices[retCount] = i;
+				retColors[retCount] = color;
+				retCount++;
+			}
+		}
+		return retCount;
+	}
+
+	// A face mask with the given number of random faces set
+	uint32_t randomMask(int bitCount) {
+		uint32_t mask = 0;
+		while (__builtin_popcount(mask) < bitCount) {
+			mask |= 1 << (rand() % FACE_COUNT);
+		}
+		return mask;
+	}
+}
+
+TEST(bitScanMatchesPerBitLoop)
+{
+	srand(10);
+	for (int i = 0; i < 100000; ++i) {
+		uint32_t mask = i < (1 << 12) ? i << (i % 9) : randomMask(rand() % (FACE_COUNT + 1));
+		int expectedIndices[32], indices[32], colorIndices[32];
+		uint32_t expectedColors[32], colors[32];
+		int count = perBitIndices(mask, i, expectedIndices, expectedColors);
+		CHECK(extractBitIndices(mask & lowBitsMask(FACE_COUNT), indices) == count);
+		CHECK(extractBitIndices(mask & lowBitsMask(FACE_COUNT), i, colorIndices, colors) == count);
+		for (int j = 0; j < count; ++j) {
+			CHECK(indices[j] == expectedIndices[j]);
+			CHECK(colorIndices[j] == expectedIndices[j]);
+			CHECK(colors[j] == expectedColors[j]);
+		}
+	}
+	int allIndices[32];
+	CHECK(extractBitIndices(0xFFFFFFFF, allIndices) == 32 && allIndices[31] == 31);
+	CHECK(lowBitsMask(0) == 0 && lowBitsMask(20) == 0xFFFFF && lowBitsMask(32) == 0xFFFFFFFF);
+}
+
+// Host ns per mask, animations mostly light one face or a handful of them
+BENCHMARK(bitScanSparseMasks)
+{
+	const int maskCount = 4096;
+	const int loops = 2000;
+	const int bitCounts[] = { 1, 2, 4, 10, 20 };
+	printf("  ns per %d face mask: per bit loop / bit scan\n", FACE_COUNT);
+	for (int bitCount : bitCounts) {
+		srand(bitCount);
+		std::vector<uint32_t> masks;
+		for (int i = 0; i < maskCount; ++i) {
+			masks.push_back(randomMask(bitCount));
+		}
+
+		int indices[32];
+		uint32_t colors[32];
+		uint32_t sum = 0;
+		uint64_t start = Test::nanos();
+		for (int loop = 0; loop < loops; ++loop) {
+			for (uint32_t mask : masks) {
+				sum += perBitIndices(mask, loop, indices, colors);
+				sum += indices[0];
+			}
+		}
+		uint64_t perBitNanos = Test::nanos() - start;
+
+		start = Test::nanos();
+		for (int loop = 0; loop < loops; ++loop) {
+			for (uint32_t mask : masks) {
+				sum += extractBitIndices(mask & lowBitsMask(FACE_COUNT), loop, indices, colors);
+				sum += indices[0];
+			}
+		}
+		uint64_t bitScanNanos = Test::nanos() - start;
+		Test::keep(sum);
+
+		double callCount = (double)loops * maskCount;
+		printf("    %2d faces set: %.2f / %.2f\n", bitCount, perBitNanos / callCount, bitScanNanos / callCount);
+	}
+}
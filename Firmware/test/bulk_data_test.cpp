@@ -0,0 +1,215 @@
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "host.h"
+#include "bluetooth/bulk_data_transfer.h"
+#include "utils/Utils.h"
+
+using namespace Bluetooth;
+
+namespace
+{
+	bool done;
+	bool doneResult;
+	uint32_t doneSize;
+	std::vector<uint16_t> ackedOffsets;
+
+	void onMessageSent(const Message* msg, int size) {
+		if (msg->type == Message::MessageType_BulkDataAck) {
+			ackedOffsets.push_back(((const MessageBulkDataAck*)msg)->offset);
+		}
+	}
+
+	MessageBulkData makeChunk(const std::vector<uint8_t>& payload, int offset) {
+		MessageBulkData chunk;
+		chunk.offset = offset;
+		chunk.size = std::min((int)payload.size() - offset, MAX_DATA_SIZE);
+		memcpy(chunk.data, &payload[offset], chunk.size);
+		chunk.crc = Utils::computeHash(chunk.data, chunk.size);
+		return chunk;
+	}
+}
+
+TEST(bulkDataDropsCorruptChunks)
+{
+	Host::setMessageSentHandler(onMessageSent);
+	srand(9);
+	std::vector<uint8_t> data(250);
+	for (auto& b : data) {
+		b = rand();
+	}
+	memset((void*)(uintptr_t)Host::flashStart(), 0xFF, Host::flashSize());
+	done = false;
+	ackedOffsets.clear();
+	ReceiveBulkData::receiveToFlash(Host::flashStart(), nullptr, [](void* context, bool result, uint32_t address, uint16_t size) {
+		done = true;
+		doneResult = result;
+		doneSize = size;
+	});
+	MessageBulkSetup setup;
+	setup.size = data.size();
+	Host::deliver(&setup);
+
+	for (int offset = 0; offset < (int)data.size(); offset += MAX_DATA_SIZE) {
+		// A flipped bit isn't acked, the sender then resends the chunk
+		auto chunk = makeChunk(data, offset);
+		chunk.data[0] ^= 1;
+		Host::deliver(&chunk);
+		CHECK(ackedOffsets.empty() || ackedOffsets.back() != offset);
+		chunk.data[0] ^= 1;
+		Host::deliver(&chunk);
+		CHECK(!ackedOffsets.empty() && ackedOffsets.back() == offset);
+	}
+	CHECK(done && doneResult && doneSize == data.size());
+	CHECK(memcmp((const void*)(uintptr_t)Host::flashStart(), data.data(), data.size()) == 0);
+	CHECK(ReceiveBulkData::getReceivedHash() == Utils::computeHash(data.data(), data.size()));
+	Host::setMessageSentHandler(nullptr);
+}
+
+namespace
+{
+	/// <summary>
+	/// Loopback link between SendBulkData and ReceiveBulkData, both running here. Messages go out on
+	/// the next connection event, a few per event in each direction, and some of them get lost.
+	/// </summary>
+	namespace Link
+	{
+		struct Packet
+		{
+			std::vector<uint8_t> bytes;
+			bool toReceiver;
+		};
+		std::vector<Packet> inFlight;
+		int windowSize;
+		int lossPercent;
+		int sentCount;
+		int lostCount;
+
+		void onMessageSent(const Message* msg, int size) {
+			Packet packet;
+			packet.bytes.assign((const uint8_t*)msg, (const uint8_t*)msg + size);
+			packet.toReceiver = msg->type == Message::MessageType_BulkSetup || msg->type == Message::MessageType_BulkData;
+			if (msg->type == Message::MessageType_BulkSetup && windowSize > 1) {
+				// The die sends a plain setup, a central that can take a window asks for one, like the app does
+				MessageBulkWindowSetup setup;
+				setup.size = ((const MessageBulkSetup*)msg)->size;
+				setup.windowSize = windowSize;
+				packet.bytes.assign((const uint8_t*)&setup, (const uint8_t*)&setup + sizeof(setup));
+			}
+			inFlight.push_back(packet);
+		}
+
+		/// <summary>
+		/// Delivers what was sent before this connection event, up to packetsPerEvent each way
+		/// </summary>
+		void connectionEvent(int packetsPerEvent) {
+			auto packets = std::move(inFlight);
+			inFlight.clear();
+			int delivered[2] = {0, 0};
+			for (auto& packet : packets) {
+				if (delivered[packet.toReceiver] == packetsPerEvent) {
+					// Next event
+					inFlight.push_back(std::move(packet));
+					continue;
+				}
+				delivered[packet.toReceiver]++;
+				sentCount++;
+				if (rand() % 100 < lossPercent) {
+					lostCount++;
+					continue;
+				}
+				Host::deliver((const Message*)packet.bytes.data());
+			}
+		}
+	}
+
+	uint8_t receiveBuffer[UINT16_MAX];
+	bool received;
+	bool sent;
+	bool sendResult;
+
+	/// <summary>
+	/// Sends the data from one side of the loopback to the other, returns the simulated ms it took
+	/// for the receiver to have it all, or 0 if it didn't
+	/// </summary>
+	uint32_t loopback(const std::vector<uint8_t>& data, int windowSize, int lossPercent, int intervalMs, int packetsPerEvent) {
+		Link::inFlight.clear();
+		Link::windowSize = windowSize;
+		Link::lossPercent = lossPercent;
+		Link::sentCount = 0;
+		Link::lostCount = 0;
+		Host::setMessageSentHandler(Link::onMessageSent);
+		memset(receiveBuffer, 0, sizeof(receiveBuffer));
+		received = false;
+		sent = false;
+
+		uint32_t start = Host::millis();
+		ReceiveBulkData::receive(nullptr,
+			[](void* context, uint16_t size) { return receiveBuffer; },
+			[](void* context, bool result, uint8_t* data, uint16_t size) { received = result; });
+		SendBulkData::send(data.data(), data.size(), nullptr,
+			[](void* context, bool result, const uint8_t* data, uint16_t size) { sent = true; sendResult = result; });
+
+		uint32_t elapsed = 0;
+		while (!received && !sent) {
+			Link::connectionEvent(packetsPerEvent);
+			Host::advance(intervalMs);
+			if (received) {
+				elapsed = Host::millis() - start;
+			}
+		}
+		// Let the sender time out on its own if the last ack was lost, and forget what's left
+		while (!sent) {
+			Link::connectionEvent(packetsPerEvent);
+			Host::advance(intervalMs);
+		}
+		Link::inFlight.clear();
+		Host::setMessageSentHandler(nullptr);
+		return received && memcmp(receiveBuffer, data.data(), data.size()) == 0 ? elapsed : 0;
+	}
+
+	std::vector<uint8_t> randomData(int size) {
+		std::vector<uint8_t> data(size);
+		for (auto& b : data) {
+			b = rand();
+		}
+		return data;
+	}
+}
+
+TEST(bulkDataLoopbackSurvivesLoss)
+{
+	srand(10);
+	auto data = randomData(2000);
+	for (int windowSize : {1, 4, 8}) {
+		for (int lossPercent : {0, 10}) {
+			CHECK(loopback(data, windowSize, lossPercent, 30, 4) != 0);
+		}
+	}
+}
+
+// Throughput over a simulated 30ms connection interval with 4 packets per event each way
+BENCHMARK(bulkDataLoopbackThroughput)
+{
+	srand(11);
+	auto data = randomData(4096);
+	const int runCount = 20;
+	for (int lossPercent : {0, 2, 10, 25}) {
+		for (int windowSize : {1, 2, 4, 8}) {
+			uint64_t totalMs = 0;
+			int failedCount = 0;
+			for (int run = 0; run < runCount; ++run) {
+				uint32_t ms = loopback(data, windowSize, lossPercent, 30, 4);
+				if (ms == 0) {
+					failedCount++;
+				}
+				totalMs += ms;
+			}
+			double seconds = totalMs / 1000.0 / (runCount - failedCount);
+			printf("  %2d%% loss, window %d: %6.2f KB/s (%.2f s for %d bytes), %d of %d transfers failed\n",
+				lossPercent, windowSize, data.size() / 1024.0 / seconds, seconds, (int)data.size(), failedCount, runCount);
+		}
+	}
+}
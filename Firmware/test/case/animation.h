@@ -0,0 +1,3 @@
+// The firmware is built on a case insensitive file system, this forwards to animations/Animation.h
+#pragma once
+#include "../../src/animations/Animation.h"
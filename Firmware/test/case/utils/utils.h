@@ -0,0 +1,3 @@
+// The firmware is built on a case insensitive file system, this forwards to utils/Utils.h
+#pragma once
+#include "../../../src/utils/Utils.h"
@@ -0,0 +1,160 @@
+#include "test.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "utils/Utils.h"
+
+using namespace Utils;
+
+namespace Animations
+{
+	uint32_t scaleColor(uint32_t refColor, uint8_t intensity);
+}
+
+// Utils.cpp built with the Cortex-M4 SIMD path, see the Makefile
+namespace UtilsDSP
+{
+	uint32_t addColors(uint32_t a, uint32_t b);
+	uint32_t addColorsSaturated(uint32_t a, uint32_t b);
+	uint32_t interpolateColors(uint32_t color1, uint32_t time1, uint32_t color2, uint32_t time2, uint32_t time);
+	uint32_t modulateColor(uint32_t color, uint8_t intensity);
+}
+
+namespace
+{
+	// The kernels as they were before the packed versions, one channel at a time
+
+	uint32_t oldAddColors(uint32_t a, uint32_t b) {
+		uint8_t red = std::max(getRed(a), getRed(b));
+		uint8_t green = std::max(getGreen(a), getGreen(b));
+		uint8_t blue = std::max(getBlue(a), getBlue(b));
+		return toColor(red,green,blue);
+	}
+
+	uint32_t oldInterpolateColors(uint32_t color1, uint32_t time1, uint32_t color2, uint32_t time2, uint32_t time) {
+		int scaler = 1024;
+		int scaledPercent = (time - time1) * scaler / (time2 - time1);
+		int scaledRed = getRed(color1)* (scaler - scaledPercent) + getRed(color2) * scaledPercent;
+		int scaledGreen = getGreen(color1) * (scaler - scaledPercent) + getGreen(color2) * scaledPercent;
+		int scaledBlue = getBlue(color1) * (scaler - scaledPercent) + getBlue(color2) * scaledPercent;
+		return toColor(scaledRed / scaler, scaledGreen / scaler, scaledBlue / scaler);
+	}
+
+	uint32_t oldModulateColor(uint32_t color, uint8_t intensity) {
+		int red = getRed(color) * intensity / 255;
+		int green = getGreen(color) * intensity / 255;
+		int blue = getBlue(color) * intensity / 255;
+		return toColor((uint8_t)red, (uint8_t)green, (uint8_t)blue);
+	}
+
+	uint32_t oldScaleColor(uint32_t refColor, uint8_t intensity) {
+		uint8_t r = getRed(refColor);
+		uint8_t g = getGreen(refColor);
+		uint8_t b = getBlue(refColor);
+		return toColor(r * intensity / 256, g * intensity / 256, b * intensity / 256);
+	}
+
+	uint32_t saturatedSum(uint32_t a, uint32_t b) {
+		return toColor(
+			std::min(getRed(a) + getRed(b), 255),
+			std::min(getGreen(a) + getGreen(b), 255),
+			std::min(getBlue(a) + getBlue(b), 255));
+	}
+
+	uint32_t randomColor() {
+		return ((uint32_t)rand() ^ ((uint32_t)rand() << 12)) & 0xFFFFFF;
+	}
+
+	/// <summary>
+	/// Every pair of values in one channel, with random values in the other two,
+	/// the channels don't interact so this covers the carries and borrows between lanes
+	/// </summary>
+	template <typename Check>
+	void forEachChannelPair(Check check) {
+		for (int shift = 0; shift < 24; shift += 8) {
+			for (uint32_t x = 0; x < 256; ++x) {
+				for (uint32_t y = 0; y < 256; ++y) {
+					uint32_t a = (randomColor() & ~(0xFF << shift)) | (x << shift);
+					uint32_t b = (randomColor() & ~(0xFF << shift)) | (y << shift);
+					check(a, b, (uint8_t)y);
+				}
+			}
+		}
+		for (int i = 0; i < 1000000; ++i) {
+			check(randomColor(), randomColor(), (uint8_t)rand());
+		}
+	}
+}
+
+TEST(colorKernelsMatchThePerChannelCode)
+{
+	srand(8);
+	int mismatches = 0;
+	forEachChannelPair([&](uint32_t a, uint32_t b, uint8_t intensity) {
+		uint32_t expected = oldAddColors(a, b);
+		mismatches += addColors(a, b) != expected;
+		mismatches += UtilsDSP::addColors(a, b) != expected;
+
+		expected = saturatedSum(a, b);
+		mismatches += addColorsSaturated(a, b) != expected;
+		mismatches += UtilsDSP::addColorsSaturated(a, b) != expected;
+
+		expected = oldModulateColor(a, intensity);
+		mismatches += modulateColor(a, intensity) != expected;
+		mismatches += UtilsDSP::modulateColor(a, intensity) != expected;
+
+		mismatches += Animations::scaleColor(a, intensity) != oldScaleColor(a, intensity);
+	});
+
+	// Keyframe times, including before and after the keyframes where the weights go negative
+	for (int i = 0; i < 1000000; ++i) {
+		uint32_t a = randomColor();
+		uint32_t b = randomColor();
+		uint32_t time1 = rand() % 10000;
+		uint32_t time2 = time1 + 1 + rand() % 2000;
+		uint32_t time = i % 10 == 0 ? rand() % 15000 : time1 + rand() % (time2 - time1 + 1);
+		uint32_t expected = oldInterpolateColors(a, time1, b, time2, time);
+		mismatches += interpolateColors(a, time1, b, time2, time) != expected;
+		mismatches += UtilsDSP::interpolateColors(a, time1, b, time2, time) != expected;
+	}
+	CHECK(mismatches == 0);
+}
+
+// Host ns per call of the portable kernels. interpolateColors only changed in the DSP path,
+// which runs on the die, here its intrinsics are emulated so it isn't timed.
+BENCHMARK(colorKernels)
+{
+	const int count = 4096;
+	std::vector<uint32_t> colors(count + 1);
+	std::vector<uint8_t> intensities(count);
+	srand(8);
+	for (int i = 0; i < count; ++i) {
+		colors[i] = randomColor();
+		intensities[i] = rand();
+	}
+	colors[count] = colors[0];
+
+	const int loops = 2000;
+	auto measure = [&](uint32_t (*kernel)(uint32_t, uint32_t, uint8_t)) {
+		uint32_t sum = 0;
+		uint64_t start = Test::nanos();
+		for (int loop = 0; loop < loops; ++loop) {
+			for (int i = 0; i < count; ++i) {
+				sum += kernel(colors[i], colors[i + 1], intensities[i]);
+			}
+		}
+		Test::keep(sum);
+		return (double)(Test::nanos() - start) / ((double)loops * count);
+	};
+
+	printf("  ns per call: per channel / packed\n");
+	printf("    addColors: %.2f / %.2f\n",
+		measure([](uint32_t a, uint32_t b, uint8_t) { return oldAddColors(a, b); }),
+		measure([](uint32_t a, uint32_t b, uint8_t) { return addColors(a, b); }));
+	printf("    modulateColor: %.2f / %.2f\n",
+		measure([](uint32_t a, uint32_t, uint8_t i) { return oldModulateColor(a, i); }),
+		measure([](uint32_t a, uint32_t, uint8_t i) { return modulateColor(a, i); }));
+	printf("    scaleColor: %.2f / %.2f\n",
+		measure([](uint32_t a, uint32_t, uint8_t i) { return oldScaleColor(a, i); }),
+		measure([](uint32_t a, uint32_t, uint8_t i) { return Animations::scaleColor(a, i); }));
+}
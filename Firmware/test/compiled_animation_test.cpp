@@ -0,0 +1,219 @@
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "host.h"
+#include "animations/Animation.h"
+#include "animations/animation_compiled.h"
+#include "animations/animation_keyframed.h"
+#include "behaviors/behavior.h"
+#include "bluetooth/bluetooth_messages.h"
+#include "data_set/data_set.h"
+#include "data_set/data_set_compiled.h"
+#include "utils/Utils.h"
+
+using namespace Animations;
+using namespace Bluetooth;
+
+namespace
+{
+	#define ANIMATION_COUNT 8
+	#define ANIMATION_DURATION 3000
+	#define TRACKS_PER_ANIMATION 4
+	#define KEYFRAMES_PER_TRACK 8
+	#define PALETTE_COLOR_COUNT 16
+
+	void append(std::vector<uint8_t>& payload, const void* data, int size) {
+		auto bytes = (const uint8_t*)data;
+		payload.insert(payload.end(), bytes, bytes + size);
+	}
+
+	void padTo4(std::vector<uint8_t>& payload) {
+		payload.resize(Utils::roundUpTo4(payload.size()), 0);
+	}
+
+	bool programmed;
+
+	void onMessageSent(const Message* msg, int size) {
+		if (msg->type == Message::MessageType_TransferAnimSetFinished) {
+			programmed = true;
+		}
+	}
+
+	/// <summary>
+	/// Programs a data set of keyframed animations the way the app does, i.e. a transfer message
+	/// followed by the data, laid out in layoutDataSet() order. The compiler then runs once
+	/// flash programming is done.
+	/// </summary>
+	void programKeyframedDataSet() {
+		srand(3);
+		std::vector<uint8_t> palette;
+		for (int i = 0; i < PALETTE_COLOR_COUNT * 3; ++i) {
+			palette.push_back((uint8_t)rand());
+		}
+
+		std::vector<RGBKeyframe> keyframes;
+		std::vector<RGBTrack> tracks;
+		int trackCount = ANIMATION_COUNT * TRACKS_PER_ANIMATION;
+		for (int i = 0; i < trackCount; ++i) {
+			RGBTrack track;
+			track.keyframesOffset = keyframes.size();
+			track.keyFrameCount = KEYFRAMES_PER_TRACK;
+			track.padding = 0;
+			// Each track of an animation drives its own leds
+			track.ledMask = 0;
+			for (int led = i % TRACKS_PER_ANIMATION; led < 20; led += TRACKS_PER_ANIMATION) {
+				track.ledMask |= 1 << led;
+			}
+			tracks.push_back(track);
+			for (int k = 0; k < KEYFRAMES_PER_TRACK; ++k) {
+				RGBKeyframe keyframe;
+				keyframe.setTimeAndColorIndex(k * ANIMATION_DURATION / (KEYFRAMES_PER_TRACK - 1), rand() % PALETTE_COLOR_COUNT);
+				keyframes.push_back(keyframe);
+			}
+		}
+
+		std::vector<uint16_t> animationOffsets;
+		std::vector<AnimationKeyframed> animations;
+		for (int i = 0; i < ANIMATION_COUNT; ++i) {
+			AnimationKeyframed animation;
+			animation.type = Animation_Keyframed;
+			animation.padding_type = 0;
+			animation.duration = ANIMATION_DURATION;
+			animation.speedMultiplier256 = 256;
+			animation.tracksOffset = i * TRACKS_PER_ANIMATION;
+			animation.trackCount = TRACKS_PER_ANIMATION;
+			animation.flowOrder = i & 1;
+			animation.padding_flowOrder = 0;
+			animationOffsets.push_back(animations.size() * sizeof(AnimationKeyframed));
+			animations.push_back(animation);
+		}
+
+		std::vector<uint8_t> payload;
+		append(payload, palette.data(), palette.size());
+		padTo4(payload);
+		append(payload, keyframes.data(), keyframes.size() * sizeof(RGBKeyframe));
+		append(payload, tracks.data(), tracks.size() * sizeof(RGBTrack));
+		append(payload, animationOffsets.data(), animationOffsets.size() * sizeof(uint16_t));
+		padTo4(payload);
+		append(payload, animations.data(), animations.size() * sizeof(AnimationKeyframed));
+		Behaviors::Behavior behavior = { 0, 0 };
+		append(payload, &behavior, sizeof(behavior));
+
+		MessageTransferAnimSet transfer;
+		transfer.paletteSize = palette.size();
+		transfer.rgbKeyFrameCount = keyframes.size();
+		transfer.rgbTrackCount = tracks.size();
+		transfer.keyFrameCount = 0;
+		transfer.trackCount = 0;
+		transfer.animationCount = animations.size();
+		transfer.animationSize = animations.size() * sizeof(AnimationKeyframed);
+		transfer.conditionCount = 0;
+		transfer.conditionSize = 0;
+		transfer.actionCount = 0;
+		transfer.actionSize = 0;
+		transfer.ruleCount = 0;
+
+		Host::startDataSet();
+		Host::setMessageSentHandler(onMessageSent);
+		programmed = false;
+		CHECK(Host::deliver(&transfer));
+		MessageBulkSetup setup;
+		setup.size = payload.size();
+		Host::deliver(&setup);
+		for (int offset = 0; offset < (int)payload.size(); offset += MAX_DATA_SIZE) {
+			MessageBulkData chunk;
+			chunk.offset = offset;
+			chunk.size = std::min((int)payload.size() - offset, MAX_DATA_SIZE);
+			memcpy(chunk.data, &payload[offset], chunk.size);
+			chunk.crc = Utils::computeHash(chunk.data, chunk.size);
+			Host::deliver(&chunk);
+		}
+		Host::setMessageSentHandler(nullptr);
+		CHECK(programmed);
+		CHECK(DataSet::getAnimationCount() == ANIMATION_COUNT);
+		CHECK(DataSet::isCompiled());
+	}
+
+	/// <summary>
+	/// Leds colors of a frame, the same way the controller combines them
+	/// </summary>
+	void renderFrame(AnimationInstance* instance, int ms, uint32_t ledColors[MAX_LED_COUNT]) {
+		int indices[MAX_LED_COUNT * 4];
+		uint32_t colors[MAX_LED_COUNT * 4];
+		memset(ledColors, 0, MAX_LED_COUNT * sizeof(uint32_t));
+		int count = instance->updateLEDs(ms, indices, colors);
+		for (int i = 0; i < count; ++i) {
+			ledColors[indices[i]] = Utils::addColors(ledColors[indices[i]], colors[i]);
+		}
+	}
+
+	int channelDifference(uint32_t a, uint32_t b) {
+		int ret = 0;
+		for (int shift = 0; shift < 24; shift += 8) {
+			ret = std::max(ret, abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF)));
+		}
+		return ret;
+	}
+}
+
+TEST(compiledAnimationsMatchRegularInstances)
+{
+	programKeyframedDataSet();
+	int maxDifference = 0;
+	for (int i = 0; i < ANIMATION_COUNT; ++i) {
+		auto compiled = createAnimationInstance(i);
+		auto regular = createAnimationInstance(DataSet::getAnimation(i), DataSet::getAnimationBits());
+		CHECK(dynamic_cast<AnimationInstanceCompiled*>(compiled) != nullptr);
+		CHECK(dynamic_cast<AnimationInstanceKeyframed*>(regular) != nullptr);
+		compiled->start(100, 0, false);
+		regular->start(100, 0, false);
+		for (int ms = 100; ms <= 100 + ANIMATION_DURATION; ms += 7) {
+			uint32_t compiledColors[MAX_LED_COUNT];
+			uint32_t regularColors[MAX_LED_COUNT];
+			renderFrame(compiled, ms, compiledColors);
+			renderFrame(regular, ms, regularColors);
+			for (int led = 0; led < MAX_LED_COUNT; ++led) {
+				maxDifference = std::max(maxDifference, channelDifference(compiledColors[led], regularColors[led]));
+			}
+		}
+		destroyAnimationInstance(compiled);
+		destroyAnimationInstance(regular);
+	}
+	// The compiled segments step in 16.16 fixed point, the keyframes interpolate in integers
+	printf("  max channel difference: %d\n", maxDifference);
+	CHECK(maxDifference <= 1);
+}
+
+// Host ns, the die runs the same code a few tens of times slower but the ratios should hold
+BENCHMARK(compiledAnimationFrameRate)
+{
+	programKeyframedDataSet();
+	printf("  %d keyframed animations, %d tracks of %d keyframes each\n", ANIMATION_COUNT, TRACKS_PER_ANIMATION, KEYFRAMES_PER_TRACK);
+	uint64_t nanos[2] = {};
+	int frameCount = 0;
+	for (int compiled = 0; compiled < 2; ++compiled) {
+		frameCount = 0;
+		for (int i = 0; i < ANIMATION_COUNT; ++i) {
+			auto instance = compiled ?
+				createAnimationInstance(i) :
+				createAnimationInstance(DataSet::getAnimation(i), DataSet::getAnimationBits());
+			int indices[MAX_LED_COUNT * 4];
+			uint32_t colors[MAX_LED_COUNT * 4];
+			uint64_t start = Test::nanos();
+			for (int loop = 0; loop < 200; ++loop) {
+				instance->start(0, 0, false);
+				for (int ms = 0; ms < ANIMATION_DURATION; ms += DEFAULT_FRAME_MS) {
+					Test::keep(instance->updateLEDs(ms, indices, colors));
+					frameCount++;
+				}
+			}
+			nanos[compiled] += Test::nanos() - start;
+			destroyAnimationInstance(instance);
+		}
+	}
+	printf("  regular: %.0f ns per frame (%.0f frames/s), compiled: %.0f ns per frame (%.0f frames/s)\n",
+		(double)nanos[0] / frameCount, frameCount * 1e9 / nanos[0],
+		(double)nanos[1] / frameCount, frameCount * 1e9 / nanos[1]);
+}
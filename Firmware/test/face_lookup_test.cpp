@@ -0,0 +1,137 @@
+#include "test.h"
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+#include "host.h"
+#include "config/sdk_config.h"
+#include "core/fixed3.h"
+#include "modules/accelerometer.h"
+
+using namespace Core;
+using namespace Modules;
+
+namespace
+{
+	/// <summary>
+	/// Checks the accelerometer's cube map lookup against comparing with every normal
+	/// </summary>
+	void checkFaceLookup(int faceCount) {
+		Host::setFaceCount(faceCount);
+		Host::startAccelerometer();
+		auto& normals = Host::settings().faceNormals;
+
+		int mismatches = 0;
+		float maxConfidenceError = 0.0f;
+		srand(faceCount);
+		for (int i = 0; i < 100000; ++i) {
+			float3 acc((rand() % 2001 - 1000) / 500.0f, (rand() % 2001 - 1000) / 500.0f, (rand() % 2001 - 1000) / 500.0f);
+			if (acc.sqrMagnitude() < 0.25f) {
+				continue;
+			}
+
+			// Exact search, keeping the runner up to tell ties from errors
+			double mag = sqrt((double)acc.x * acc.x + (double)acc.y * acc.y + (double)acc.z * acc.z);
+			int bestFace = -1;
+			double bestDot = -2.0;
+			double secondDot = -2.0;
+			for (int f = 0; f < faceCount; ++f) {
+				double dot = (acc.x * normals[f].x + acc.y * normals[f].y + acc.z * normals[f].z) / mag;
+				if (dot > bestDot) {
+					secondDot = bestDot;
+					bestDot = dot;
+					bestFace = f;
+				} else if (dot > secondDot) {
+					secondDot = dot;
+				}
+			}
+
+			float confidence;
+			int face = Accelerometer::determineFace(acc, &confidence);
+			if (face != bestFace && bestDot - secondDot > 1e-3) {
+				mismatches++;
+			}
+			maxConfidenceError = fmaxf(maxConfidenceError, fabsf(confidence - (float)bestDot));
+		}
+		printf("  %d faces: %d mismatches, max confidence error %g\n", faceCount, mismatches, maxConfidenceError);
+		CHECK(mismatches == 0);
+		CHECK(maxConfidenceError < 1e-3f);
+	}
+}
+
+TEST(faceLookupMatchesExactSearchD20)
+{
+	checkFaceLookup(20);
+}
+
+TEST(faceLookupMatchesExactSearchD6)
+{
+	checkFaceLookup(6);
+	Host::setFaceCount(20);
+}
+
+BENCHMARK(faceLookupVsExactSearch)
+{
+	const int count = 1000000;
+	for (int faceCount : {6, 20}) {
+		Host::setFaceCount(faceCount);
+		Host::startAccelerometer();
+		auto& normals = Host::settings().faceNormals;
+
+		std::vector<float3> directions;
+		srand(faceCount);
+		while ((int)directions.size() < count) {
+			float3 acc((rand() % 256 - 128) / 32.0f, (rand() % 256 - 128) / 32.0f, (rand() % 256 - 128) / 32.0f);
+			if (acc.sqrMagnitude() >= 0.25f) {
+				directions.push_back(acc);
+			}
+		}
+
+		// What determineFace did before the lookup, compare with every normal
+		uint64_t start = Test::nanos();
+	#if ACCEL_FIXED_POINT
+		fixed3 fixedNormals[MAX_LED_COUNT];
+		for (int f = 0; f < faceCount; ++f) {
+			fixedNormals[f] = fixed3(normals[f]);
+		}
+		for (auto& acc : directions) {
+			fixed3 accFixed(acc);
+			int64_t bestDot = INT64_MIN;
+			int bestFace = 0;
+			for (int f = 0; f < faceCount; ++f) {
+				int64_t dot = fixed3::dot64(accFixed, fixedNormals[f]);
+				if (dot > bestDot) {
+					bestDot = dot;
+					bestFace = f;
+				}
+			}
+			Test::keep(bestFace + (uint32_t)(bestDot / (int64_t)isqrt(accFixed.sqrMagnitude64())));
+		}
+	#else
+		for (auto& acc : directions) {
+			float3 n = acc.normalized();
+			int bestFace = 0;
+			float bestDot = -2.0f;
+			for (int f = 0; f < faceCount; ++f) {
+				float dot = float3::dot(n, normals[f]);
+				if (dot > bestDot) {
+					bestDot = dot;
+					bestFace = f;
+				}
+			}
+			Test::keep(bestFace + (uint32_t)(bestDot * 1000.0f));
+		}
+	#endif
+		uint64_t exactNanos = Test::nanos() - start;
+
+		start = Test::nanos();
+		for (auto& acc : directions) {
+			float confidence;
+			Test::keep(Accelerometer::determineFace(acc, &confidence) + (uint32_t)(confidence * 1000.0f));
+		}
+		uint64_t lookupNanos = Test::nanos() - start;
+
+		printf("  %d faces: exact search %.1f ns, determineFace %.1f ns (%s)\n", faceCount,
+			(double)exactNanos / count, (double)lookupNanos / count, ACCEL_FIXED_POINT ? "fixed point" : "floating point");
+	}
+	Host::setFaceCount(20);
+}
@@ -0,0 +1,95 @@
+#include "test.h"
+#include <math.h>
+#include <stdlib.h>
+#include "core/fixed3.h"
+
+using namespace Core;
+
+namespace
+{
+	// A reading like the accelerometer's, in g
+	float3 randomAcc() {
+		return float3((rand() % 256 - 128) / 32.0f, (rand() % 256 - 128) / 32.0f, (rand() % 256 - 128) / 32.0f);
+	}
+}
+
+TEST(fixedConversionsRoundTrip)
+{
+	const float values[] = {0.0f, 1.0f, -1.0f, 0.5f, -0.98f, 7.5f, -16.0f, 1.0f / 65536.0f};
+	for (float value : values) {
+		CHECK(fabsf(toFloat(toFixed(value)) - value) <= 0.5f / FIXED_ONE);
+	}
+	CHECK(mulFixed(toFixed(1.5f), toFixed(-2.0f)) == toFixed(-3.0f));
+	CHECK(divFixed(toFixed(3.0f), toFixed(4.0f)) == toFixed(0.75f));
+}
+
+TEST(isqrtRoundsDown)
+{
+	srand(2);
+	for (int i = 0; i < 10000; ++i) {
+		uint64_t value = ((uint64_t)rand() << 31 | rand()) & 0xFFFFFFFFFFFFull;
+		uint64_t root = isqrt(value);
+		CHECK(root * root <= value && (root + 1) * (root + 1) > value);
+	}
+	CHECK(isqrt(0) == 0);
+	CHECK(isqrt((uint64_t)FIXED_ONE * FIXED_ONE) == FIXED_ONE);
+}
+
+TEST(fixedMathTracksFloat)
+{
+	// The fixed point motion pipeline only uses these, they should stay within a few LSBs of the float results
+	srand(3);
+	float maxNormalError = 0.0f;
+	float maxDotError = 0.0f;
+	float maxMagnitudeError = 0.0f;
+	for (int i = 0; i < 100000; ++i) {
+		float3 a = randomAcc();
+		float3 b = randomAcc();
+		fixed3 fa(a);
+		fixed3 fb(b);
+
+		float sqrMagnitude = (float)fa.sqrMagnitude64() / ((float)FIXED_ONE * FIXED_ONE);
+		maxMagnitudeError = fmaxf(maxMagnitudeError, fabsf(sqrMagnitude - a.sqrMagnitude()));
+		float dot = (float)fixed3::dot64(fa, fb) / ((float)FIXED_ONE * FIXED_ONE);
+		maxDotError = fmaxf(maxDotError, fabsf(dot - float3::dot(a, b)));
+
+		if (a.sqrMagnitude() > 0.01f) {
+			float3 normal = fa.normalized().toFloat3();
+			float3 expected = a.normalized();
+			maxNormalError = fmaxf(maxNormalError, fmaxf(fabsf(normal.x - expected.x), fmaxf(fabsf(normal.y - expected.y), fabsf(normal.z - expected.z))));
+		}
+	}
+	printf("  max error: sqrMagnitude %g, dot %g, normalized %g\n", maxMagnitudeError, maxDotError, maxNormalError);
+	CHECK(maxMagnitudeError < 1e-4f);
+	CHECK(maxDotError < 1e-4f);
+	CHECK(maxNormalError < 1e-3f);
+}
+
+TEST(fixedFiltersTrackFloat)
+{
+	// Same exponential filters as the accelerometer's sigma and smoothed acceleration
+	const float decay = 0.9f;
+	fixed fixedDecay = toFixed(decay);
+	float sigma = 0.0f;
+	fixed fixedSigma = 0;
+	float3 smooth = float3::zero();
+	fixed3 fixedSmooth = fixed3::zero();
+	float maxSigmaError = 0.0f;
+	float maxSmoothError = 0.0f;
+	srand(4);
+	for (int i = 0; i < 10000; ++i) {
+		float3 acc = randomAcc();
+		float jerk = (rand() % 1000) / 100.0f;
+		sigma = sigma * decay + jerk * (1.0f - decay);
+		fixedSigma = mulFixed(fixedSigma, fixedDecay) + mulFixed(toFixed(jerk), FIXED_ONE - fixedDecay);
+		smooth = smooth * decay + acc * (1.0f - decay);
+		fixedSmooth = fixedSmooth * fixedDecay + fixed3(acc) * (FIXED_ONE - fixedDecay);
+
+		maxSigmaError = fmaxf(maxSigmaError, fabsf(toFloat(fixedSigma) - sigma));
+		float3 smoothError = fixedSmooth.toFloat3() - smooth;
+		maxSmoothError = fmaxf(maxSmoothError, sqrtf(smoothError.sqrMagnitude()));
+	}
+	printf("  max error: sigma %g, smoothed acceleration %g\n", maxSigmaError, maxSmoothError);
+	CHECK(maxSigmaError < 1e-3f);
+	CHECK(maxSmoothError < 1e-3f);
+}
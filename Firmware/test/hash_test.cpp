@@ -0,0 +1,73 @@
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils/Utils.h"
+
+TEST(hashMatchesCRC32CheckValue)
+{
+	// The standard CRC-32 check value, the app and zlib compute the same
+	const char* text = "123456789";
+	CHECK(Utils::computeHash((const uint8_t*)text, 9) == 0xCBF43926);
+	CHECK(Utils::computeHash(nullptr, 0) == 0);
+}
+
+TEST(hashUpdatesIncrementally)
+{
+	uint8_t data[1000];
+	srand(1);
+	for (int i = 0; i < (int)sizeof(data); ++i) {
+		data[i] = rand();
+	}
+	uint32_t full = Utils::computeHash(data, sizeof(data));
+	for (int split = 0; split <= (int)sizeof(data); split += 37) {
+		uint32_t hash = Utils::computeHash(data, split);
+		CHECK(Utils::updateHash(hash, data + split, sizeof(data) - split) == full);
+	}
+}
+
+namespace
+{
+	// The DJB hash computeHash used to be, to compare against
+	uint32_t djbHash(const uint8_t* data, int size) {
+		uint32_t hash = 5381;
+		for (int i = 0; i < size; ++i) {
+			hash = 33 * hash ^ data[i];
+		}
+		return hash;
+	}
+}
+
+// What hashing the data set costs at boot, the D20 sample set (see make bench) and a whole 16KB
+BENCHMARK(hashVsDJB)
+{
+	uint8_t data[16384];
+	srand(2);
+	for (int i = 0; i < (int)sizeof(data); ++i) {
+		data[i] = rand();
+	}
+	int sizes[] = {(int)sizeof(data), 0};
+	FILE* f = fopen("_build/D20_animation_set.bin", "rb");
+	if (f != nullptr) {
+		sizes[1] = fread(data, 1, sizeof(data), f);
+		fclose(f);
+	}
+
+	for (int size : sizes) {
+		if (size == 0) {
+			continue;
+		}
+		const int repeatCount = 10000;
+		uint64_t start = Test::nanos();
+		for (int i = 0; i < repeatCount; ++i) {
+			Test::keep(djbHash(data, size));
+		}
+		uint64_t djbNanos = (Test::nanos() - start) / repeatCount;
+		start = Test::nanos();
+		for (int i = 0; i < repeatCount; ++i) {
+			Test::keep(Utils::computeHash(data, size));
+		}
+		uint64_t crcNanos = (Test::nanos() - start) / repeatCount;
+		printf("  %d bytes: DJB %.1f us, CRC-32 %.1f us (%.2f ns/byte)\n", size, djbNanos / 1000.0,
+			crcNanos / 1000.0, (double)crcNanos / size);
+	}
+}
@@ -0,0 +1,806 @@
+#include "host.h"
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <sys/mman.h>
+#include "app_timer.h"
+#include "bluetooth/bluetooth_message_service.h"
+#include "bluetooth/bluetooth_stack.h"
+#include "config/board_config.h"
+#include "config/dice_variants.h"
+#include "drivers_hw/apa102.h"
+#include "drivers_hw/lis2de12.h"
+#include "drivers_nrf/flash.h"
+#include "drivers_nrf/gpiote.h"
+#include "drivers_nrf/i2c.h"
+#include "drivers_nrf/power_manager.h"
+#include "drivers_nrf/scheduler.h"
+#include "drivers_nrf/timers.h"
+#include "modules/accelerometer.h"
+#include "modules/anim_controller.h"
+#include "data_set/data_set.h"
+#include "nrf_fstorage_sd.h"
+#include "nrf.h"
+#include "nrf_gpio.h"
+#include "nrfx_spim.h"
+#include "nrf_drv_twi.h"
+
+using namespace Bluetooth;
+using namespace Config;
+using namespace DriversHW;
+using namespace DriversNRF;
+
+// The Makefile sets FSTORAGE_START to where the flash is mapped
+#define HOST_FLASH_SIZE 0x10000
+#define HOST_FLASH_PAGE_SIZE 0x1000
+
+NRF_UICR_Type hostUICR = {{FSTORAGE_START + HOST_FLASH_SIZE}};
+NRF_FICR_Type hostFICR = {HOST_FLASH_PAGE_SIZE, HOST_FLASH_SIZE / HOST_FLASH_PAGE_SIZE};
+nrf_fstorage_api_t nrf_fstorage_sd;
+
+// The LIS2DE12's bus address and the registers its model has to know about
+#define ACC_ADDRESS 0x18
+#define ACC_WHO_AM_I 0x0F
+#define ACC_CTRL_REG1 0x20
+#define ACC_CTRL_REG3 0x22
+#define ACC_CTRL_REG5 0x24
+#define ACC_OUT_X_L 0x28
+#define ACC_OUT_Z_H 0x2D
+#define ACC_FIFO_CTRL_REG 0x2E
+#define ACC_FIFO_SRC_REG 0x2F
+
+// The RTC runs off the simulated clock, at the frequency sdk_config.h sets, and wraps at 24 bits like the real one
+#define HOST_RTC_FREQ (APP_TIMER_CLOCK_FREQ / (APP_TIMER_CONFIG_RTC_FREQUENCY + 1))
+#define HOST_RTC_MASK 0x00FFFFFF
+
+namespace Host
+{
+	// Time is kept in us so that timers expire on RTC ticks, which aren't whole ms, like on the die
+	uint64_t nowMicros;
+	std::vector<app_timer_id_t> timers;
+
+	// The LIS2DE12 registers. The output registers hold the latest reading, or the oldest FIFO sample
+	// while the FIFO is on, only their high bytes hold data on this 8 bit part.
+	uint8_t accRegisters[0x40];
+	std::deque<LIS2DE12::Sample> accFIFO;
+	LIS2DE12::Sample accReading;
+	uint8_t accRegisterPointer;
+	bool accAutoIncrement;
+	bool accInterruptLevel;
+	GPIOTE::PinHandler accInterruptHandler;
+
+	// The TWI, transfers end before the call that started them returns, unless timed
+	nrf_drv_twi_evt_handler_t twiHandler;
+	void* twiContext;
+	bool i2cTimed;
+	uint32_t i2cExtraLatencyMicros;
+	int i2cFailureCount;
+	uint32_t i2cTransferCount;
+	nrf_drv_twi_xfer_desc_t twiTransfer;
+	uint64_t twiDoneMicros;
+	bool twiBusy;
+	void endTWITransfer();
+
+	Settings hostSettings;
+
+	// The D20 v5 pins, setFaceCount sets the led count
+	BoardManager::Board makeBoard() {
+		BoardManager::Board ret = {};
+		ret.ledDataPin = 0;
+		ret.ledClockPin = 1;
+		ret.ledPowerPin = 10;
+		ret.ledBackend = BoardManager::LEDBackend_SPIM;
+		ret.i2cDataPin = 12;
+		ret.i2cClockPin = 14;
+		ret.accInterruptPin = 15;
+		return ret;
+	}
+	BoardManager::Board board = makeBoard();
+
+	// Output pins, and the bytes the led chain got, whether bit banged or from the SPIM
+	uint32_t gpioOut;
+	uint8_t bitBangByte;
+	int bitBangBitCount;
+	std::vector<uint8_t> ledData;
+
+	// The SPIM transfer in flight, it ends after the bytes are clocked out at the configured frequency
+	nrfx_spim_evt_handler_t spimHandler;
+	void* spimContext;
+	uint32_t spimFrequency;
+	nrfx_spim_xfer_desc_t spimTransfer;
+	uint64_t spimDoneMicros;
+	bool spimBusy;
+
+	MessageService::MessageHandler messageHandlers[256];
+	void* messageTokens[256];
+	MessageSentMethod messageSentHandler;
+	std::vector<std::pair<Stack::ConnectionEventMethod, void*>> connectionClients;
+
+	uint8_t* flash;
+
+	uint32_t millis() {
+		return (uint32_t)(nowMicros / 1000);
+	}
+
+	uint64_t micros() {
+		return nowMicros;
+	}
+
+	// RTC ticks since the start, the counter the firmware reads is the low 24 bits
+	uint64_t ticks() {
+		return nowMicros * HOST_RTC_FREQ / 1000000;
+	}
+
+	// When the RTC reaches a tick count
+	uint64_t tickMicros(uint64_t tick) {
+		return (tick * 1000000 + HOST_RTC_FREQ - 1) / HOST_RTC_FREQ;
+	}
+
+	void advance(uint32_t ms) {
+		uint64_t end = nowMicros + (uint64_t)ms * 1000;
+		for (;;) {
+			// Fire the timers in the order they expire
+			app_timer_id_t next = nullptr;
+			for (auto timer : timers) {
+				if (timer->active && tickMicros(timer->expiry) <= end && (next == nullptr || timer->expiry < next->expiry)) {
+					next = timer;
+				}
+			}
+
+			// The end of a TWI or SPIM transfer is an interrupt too
+			if (twiBusy && twiDoneMicros <= end && (next == nullptr || twiDoneMicros <= tickMicros(next->expiry))) {
+				nowMicros = std::max(nowMicros, twiDoneMicros);
+				twiBusy = false;
+				endTWITransfer();
+				continue;
+			}
+			if (spimBusy && spimDoneMicros <= end && (next == nullptr || spimDoneMicros <= tickMicros(next->expiry))) {
+				nowMicros = std::max(nowMicros, spimDoneMicros);
+				spimBusy = false;
+				nrfx_spim_evt_t evt = {NRFX_SPIM_EVENT_DONE, spimTransfer};
+				spimHandler(&evt, spimContext);
+				continue;
+			}
+
+			if (next == nullptr) {
+				break;
+			}
+			nowMicros = std::max(nowMicros, tickMicros(next->expiry));
+			if (next->mode == APP_TIMER_MODE_REPEATED) {
+				next->expiry += next->period;
+			} else {
+				next->active = false;
+			}
+			next->handler(next->context);
+		}
+		nowMicros = end;
+	}
+
+	LIS2DE12_FIFOMode accFIFOMode() {
+		if ((accRegisters[ACC_CTRL_REG5] & 0x40) == 0) {
+			return FIFO_BYPASS;
+		}
+		return (LIS2DE12_FIFOMode)(accRegisters[ACC_FIFO_CTRL_REG] >> 6);
+	}
+
+	/// <summary>
+	/// FIFO_SRC_REG: the watermark and overrun flags, empty flag, and the sample count (0 when full)
+	/// </summary>
+	uint8_t accFIFOSource() {
+		int count = accFIFO.size();
+		uint8_t ret = count & 0x1F;
+		if (count > (accRegisters[ACC_FIFO_CTRL_REG] & 0x1F)) {
+			ret |= 0x80;
+		}
+		if (count == LIS2DE12_FIFO_SIZE) {
+			ret |= 0x40;
+		}
+		if (count == 0) {
+			ret |= 0x20;
+		}
+		return ret;
+	}
+
+	// INT1 follows the watermark flag when I1_WTM is set
+	bool accInterruptLine() {
+		return (accRegisters[ACC_CTRL_REG3] & 0x04) != 0 && (accFIFOSource() & 0x80) != 0;
+	}
+
+	uint8_t readAccRegister() {
+		uint8_t reg = accRegisterPointer;
+		bool fromFIFO = accFIFOMode() != FIFO_BYPASS;
+		uint8_t ret;
+		if (reg >= ACC_OUT_X_L && reg <= ACC_OUT_Z_H) {
+			auto& sample = fromFIFO && !accFIFO.empty() ? accFIFO.front() : accReading;
+			int axis = (reg - ACC_OUT_X_L) / 2;
+			short value = axis == 0 ? sample.x : axis == 1 ? sample.y : sample.z;
+			ret = (reg & 1) ? (uint8_t)value : 0;
+			if (fromFIFO && reg == ACC_OUT_Z_H && !accFIFO.empty()) {
+				// Done with this sample, the next one moves up
+				accFIFO.pop_front();
+			}
+		} else if (reg == ACC_FIFO_SRC_REG) {
+			ret = accFIFOSource();
+		} else {
+			ret = accRegisters[reg];
+		}
+		if (accAutoIncrement) {
+			// Reading the FIFO, the address wraps around the output registers
+			accRegisterPointer = fromFIFO && reg == ACC_OUT_Z_H ? ACC_OUT_X_L : (reg + 1) & 0x3F;
+		}
+		return ret;
+	}
+
+	void writeAccRegister(uint8_t value) {
+		uint8_t reg = accRegisterPointer;
+		if (reg != ACC_WHO_AM_I && reg != ACC_FIFO_SRC_REG) {
+			accRegisters[reg] = value;
+			// Bypass mode, or turning the FIFO off, empties it
+			if (accFIFOMode() == FIFO_BYPASS) {
+				accFIFO.clear();
+			}
+		}
+		if (accAutoIncrement) {
+			accRegisterPointer = (reg + 1) & 0x3F;
+		}
+	}
+
+	/// <summary>
+	/// Runs a transfer against the accelerometer, the first byte written sets the register address,
+	/// with the MSB set to auto-increment. Returns false if nothing answers at the address.
+	/// </summary>
+	bool runTWITransfer(const nrf_drv_twi_xfer_desc_t& xfer) {
+		if (xfer.address != ACC_ADDRESS) {
+			return false;
+		}
+		if (xfer.type == NRF_DRV_TWI_XFER_RX) {
+			for (size_t i = 0; i < xfer.primary_length; ++i) {
+				xfer.p_primary_buf[i] = readAccRegister();
+			}
+		} else {
+			for (size_t i = 0; i < xfer.primary_length; ++i) {
+				if (i == 0) {
+					accRegisterPointer = xfer.p_primary_buf[0] & 0x3F;
+					accAutoIncrement = (xfer.p_primary_buf[0] & 0x80) != 0;
+				} else {
+					writeAccRegister(xfer.p_primary_buf[i]);
+				}
+			}
+			if (xfer.type == NRF_DRV_TWI_XFER_TXRX) {
+				for (size_t i = 0; i < xfer.secondary_length; ++i) {
+					xfer.p_secondary_buf[i] = readAccRegister();
+				}
+			}
+		}
+
+		// The line drops once the FIFO is read, it only rises when a sample comes in
+		accInterruptLevel = accInterruptLevel && accInterruptLine();
+		return true;
+	}
+
+	// The address byte and each data byte take 9 clocks on the 100kHz bus
+	uint64_t twiTransferMicros(const nrf_drv_twi_xfer_desc_t& xfer) {
+		size_t bytes = 1 + xfer.primary_length;
+		if (xfer.type == NRF_DRV_TWI_XFER_TXRX) {
+			bytes += 1 + xfer.secondary_length;
+		}
+		return bytes * 90;
+	}
+
+	void endTWITransfer() {
+		nrf_drv_twi_evt_t evt = {NRF_DRV_TWI_EVT_DONE, twiTransfer};
+		if (i2cFailureCount > 0) {
+			i2cFailureCount--;
+			evt.type = NRF_DRV_TWI_EVT_ADDRESS_NACK;
+		} else if (!runTWITransfer(twiTransfer)) {
+			evt.type = NRF_DRV_TWI_EVT_ADDRESS_NACK;
+		}
+		twiHandler(&evt, twiContext);
+	}
+
+	void setI2CTiming(bool timed, uint32_t extraLatencyMicros) {
+		i2cTimed = timed;
+		i2cExtraLatencyMicros = extraLatencyMicros;
+	}
+
+	void failI2CTransfers(int count) {
+		i2cFailureCount = count;
+	}
+
+	uint32_t getI2CTransferCount() {
+		return i2cTransferCount;
+	}
+
+	void setReading(int16_t x, int16_t y, int16_t z) {
+		accReading = {x, y, z};
+	}
+
+	void pushSample(int16_t x, int16_t y, int16_t z) {
+		accReading = {x, y, z};
+		switch (accFIFOMode()) {
+			case FIFO_BYPASS:
+				break;
+			case FIFO_FIFO:
+				// Stops collecting once full
+				if (accFIFO.size() < LIS2DE12_FIFO_SIZE) {
+					accFIFO.push_back(accReading);
+				}
+				break;
+			default:
+				// Stream mode, the oldest sample goes. Nothing triggers stream to FIFO here, so it keeps streaming.
+				if (accFIFO.size() == LIS2DE12_FIFO_SIZE) {
+					accFIFO.pop_front();
+				}
+				accFIFO.push_back(accReading);
+				break;
+		}
+
+		// The watermark interrupt, runs the handler right away like the scheduler does
+		bool line = accInterruptLine();
+		bool rising = line && !accInterruptLevel;
+		accInterruptLevel = line;
+		if (rising && accInterruptHandler != nullptr) {
+			accInterruptHandler(board.accInterruptPin, NRF_GPIOTE_POLARITY_LOTOHI);
+		}
+	}
+
+	uint8_t getAccRegister(uint8_t reg) {
+		return reg == ACC_FIFO_SRC_REG ? accFIFOSource() : accRegisters[reg];
+	}
+
+	int getAccFIFOCount() {
+		return accFIFO.size();
+	}
+
+	/// <summary>
+	/// Same as SettingsManager::setDefaults
+	/// </summary>
+	void setFaceCount(int count) {
+		board.ledCount = count;
+		memset(&hostSettings, 0, sizeof(Settings));
+		hostSettings.jerkClamp = 10.f;
+		hostSettings.sigmaDecay = 0.5f;
+		hostSettings.startMovingThreshold = 5.0f;
+		hostSettings.stopMovingThreshold = 0.5f;
+		hostSettings.faceThreshold = 0.98f;
+		hostSettings.fallingThreshold = 0.1f;
+		hostSettings.shockThreshold = 7.5f;
+		hostSettings.batteryLow = 3.0f;
+		hostSettings.batteryHigh = 4.0f;
+		hostSettings.accDecay = 0.9f;
+		hostSettings.heatUpRate = 0.0004f;
+		hostSettings.coolDownRate = 0.995f;
+		auto normals = DiceVariants::getDefaultNormals(count);
+		auto lookup = DiceVariants::getDefaultLookup(count);
+		for (int i = 0; i < count; ++i) {
+			hostSettings.faceNormals[i] = normals[i];
+			hostSettings.faceToLEDLookup[i] = lookup[i];
+		}
+	}
+
+	Settings& settings() {
+		if (board.ledCount == 0) {
+			setFaceCount(20);
+		}
+		return hostSettings;
+	}
+
+	void startAccelerometerDriver() {
+		static bool initialized = false;
+		settings();
+		if (!initialized) {
+			initialized = true;
+			// Power on values
+			accRegisters[ACC_WHO_AM_I] = 0x33;
+			accRegisters[ACC_CTRL_REG1] = 0x07;
+			I2C::init();
+			LIS2DE12::init();
+		}
+	}
+
+	void startAccelerometer() {
+		static bool initialized = false;
+		settings();
+		if (!initialized) {
+			initialized = true;
+			startAccelerometerDriver();
+			Modules::Accelerometer::init();
+		} else {
+			Modules::Accelerometer::stop();
+			Modules::Accelerometer::start();
+		}
+	}
+
+	void setMessageSentHandler(MessageSentMethod handler) {
+		messageSentHandler = handler;
+	}
+
+	bool deliver(const Message* msg) {
+		auto handler = messageHandlers[msg->type];
+		if (handler == nullptr) {
+			return false;
+		}
+		handler(messageTokens[msg->type], msg);
+		return true;
+	}
+
+	void disconnect() {
+		// Clients may unhook themselves
+		auto clients = connectionClients;
+		for (auto& client : clients) {
+			client.first(client.second, false);
+		}
+	}
+
+	uint32_t flashStart() {
+		if (flash == nullptr) {
+			flash = (uint8_t*)mmap((void*)FSTORAGE_START, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+			memset(flash, 0xFF, HOST_FLASH_SIZE);
+			Flash::init();
+		}
+		return FSTORAGE_START;
+	}
+
+	void eraseFlash() {
+		memset((void*)(uintptr_t)flashStart(), 0xFF, HOST_FLASH_SIZE);
+	}
+
+	void startDataSet() {
+		static bool initialized = false;
+		settings();
+		flashStart();
+		if (!initialized) {
+			initialized = true;
+			DataSet::init(nullptr);
+		}
+	}
+
+	void startLEDs() {
+		static bool initialized = false;
+		settings();
+		if (!initialized) {
+			initialized = true;
+			APA102::init();
+		}
+	}
+
+	void setLEDBackend(BoardManager::LEDBackend backend) {
+		settings();
+		board.ledBackend = backend;
+		APA102::init();
+	}
+
+	std::vector<uint8_t> takeLEDData() {
+		std::vector<uint8_t> ret;
+		ret.swap(ledData);
+		return ret;
+	}
+
+	bool ledPowerOn() {
+		return nrf_gpio_pin_out_read(board.ledPowerPin) != 0;
+	}
+
+	void startAnimController() {
+		static bool initialized = false;
+		startLEDs();
+		startDataSet();
+		if (!initialized) {
+			initialized = true;
+			Modules::AnimController::init();
+		}
+	}
+
+	uint32_t flashSize() {
+		return HOST_FLASH_SIZE;
+	}
+}
+
+ret_code_t app_timer_create(app_timer_id_t const* p_timer_id, app_timer_mode_t mode, app_timer_timeout_handler_t timeout_handler) {
+	app_timer_id_t timer = *p_timer_id;
+	timer->handler = timeout_handler;
+	timer->mode = mode;
+	timer->active = false;
+	for (auto t : Host::timers) {
+		if (t == timer) {
+			return NRF_SUCCESS;
+		}
+	}
+	Host::timers.push_back(timer);
+	return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void* p_context) {
+	timer_id->period = timeout_ticks;
+	timer_id->expiry = Host::ticks() + timeout_ticks;
+	timer_id->context = p_context;
+	timer_id->active = true;
+	return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id) {
+	timer_id->active = false;
+	return NRF_SUCCESS;
+}
+
+namespace DriversNRF
+{
+namespace Timers
+{
+	void createTimer(app_timer_id_t const* p_timer_id, app_timer_mode_t mode, app_timer_timeout_handler_t timeout_handler) {
+		app_timer_create(p_timer_id, mode, timeout_handler);
+	}
+
+	void startTimer(app_timer_id_t timer_id, uint32_t timeout_ms, void* p_context) {
+		app_timer_start(timer_id, APP_TIMER_TICKS(timeout_ms), p_context);
+	}
+
+	void stopTimer(app_timer_id_t timer_id) {
+		app_timer_stop(timer_id);
+	}
+
+	int millis() {
+		return Host::millis();
+	}
+
+	void pause() {
+	}
+
+	void resume() {
+	}
+
+	uint32_t getTicks() {
+		return (uint32_t)Host::ticks() & HOST_RTC_MASK;
+	}
+
+	uint32_t ticksBetween(uint32_t ticksFrom, uint32_t ticksTo) {
+		return (ticksTo - ticksFrom) & HOST_RTC_MASK;
+	}
+
+	int ticksToMillis(uint64_t ticks) {
+		return (int)(ticks * 1000 / HOST_RTC_FREQ);
+	}
+}
+
+namespace GPIOTE
+{
+	// Only the accelerometer's interrupt pin is wired up
+	void enableInterrupt(uint32_t pin, nrf_gpio_pin_pull_t pull, nrf_gpiote_polarity_t polarity, PinHandler handler) {
+		if (pin == Host::board.accInterruptPin) {
+			Host::accInterruptHandler = handler;
+		}
+	}
+
+	void disableInterrupt(uint32_t pin) {
+		if (pin == Host::board.accInterruptPin) {
+			Host::accInterruptHandler = nullptr;
+		}
+	}
+}
+
+namespace PowerManager
+{
+	void feed() {
+	}
+
+	void hook(PowerManagerClientMethod method, void* param) {
+	}
+
+	// Set when the watchdog reset the die, which never happens here
+	void clearClearSettingsAndDataSet() {
+	}
+
+	bool getClearSettingsAndDataSet() {
+		return false;
+	}
+}
+
+namespace Scheduler
+{
+	bool push(const void* eventData, uint16_t size, app_sched_event_handler_t handler) {
+		handler((void*)eventData, size);
+		return true;
+	}
+}
+}
+
+
+namespace Bluetooth
+{
+namespace MessageService
+{
+	bool SendMessage(Message::MessageType msgType) {
+		Message msg(msgType);
+		return SendMessage(&msg, sizeof(Message));
+	}
+
+	bool SendMessage(const Message* msg, int msgSize) {
+		if (Host::messageSentHandler != nullptr) {
+			Host::messageSentHandler(msg, msgSize);
+		}
+		return true;
+	}
+
+	void RegisterMessageHandler(Message::MessageType msgType, void* token, MessageHandler handler) {
+		Host::messageHandlers[msgType] = handler;
+		Host::messageTokens[msgType] = token;
+	}
+
+	void UnregisterMessageHandler(Message::MessageType msgType) {
+		Host::messageHandlers[msgType] = nullptr;
+	}
+
+	void NotifyUser(const char* text, bool ok, bool cancel, uint8_t timeout_s, NotifyUserCallback callback) {
+	}
+}
+
+namespace Stack
+{
+	bool canSend() {
+		return true;
+	}
+
+	void hook(ConnectionEventMethod method, void* param) {
+		Host::connectionClients.push_back(std::make_pair(method, param));
+	}
+
+	void unHook(ConnectionEventMethod client) {
+		for (auto it = Host::connectionClients.begin(); it != Host::connectionClients.end(); ++it) {
+			if (it->first == client) {
+				Host::connectionClients.erase(it);
+				return;
+			}
+		}
+	}
+}
+}
+
+namespace Config
+{
+namespace BoardManager
+{
+	const Board* getBoard() {
+		Host::settings();
+		return &Host::board;
+	}
+}
+
+namespace SettingsManager
+{
+	Settings const * const getSettings() {
+		return &Host::settings();
+	}
+
+	void programCalibrationData(const Core::float3* newNormals, int faceLayoutLookupIndex, const uint8_t* newFaceToLEDLookup, int count, SettingsWrittenCallback callback) {
+		memcpy(Host::settings().faceNormals, newNormals, count * sizeof(Core::float3));
+		memcpy(Host::settings().faceToLEDLookup, newFaceToLEDLookup, count);
+		Host::settings().faceLayoutLookupIndex = faceLayoutLookupIndex;
+		callback(true);
+	}
+}
+}
+
+// Flash operations on the mapped flash, which can only clear bits like the real thing
+nrf_fstorage_info_t hostFlashInfo = {HOST_FLASH_PAGE_SIZE, 4, true, false};
+
+ret_code_t nrf_fstorage_init(nrf_fstorage_t* p_fs, nrf_fstorage_api_t* p_api, void* p_param) {
+	p_fs->p_api = p_api;
+	p_fs->p_flash_info = &hostFlashInfo;
+	return NRF_SUCCESS;
+}
+
+ret_code_t nrf_fstorage_read(nrf_fstorage_t const* p_fs, uint32_t src, void* p_dest, uint32_t len) {
+	memcpy(p_dest, (const void*)(uintptr_t)src, len);
+	return NRF_SUCCESS;
+}
+
+ret_code_t nrf_fstorage_write(nrf_fstorage_t const* p_fs, uint32_t dest, void const* p_src, uint32_t len, void* p_param) {
+	auto flash = (uint8_t*)(uintptr_t)dest;
+	auto src = (const uint8_t*)p_src;
+	for (uint32_t i = 0; i < len; ++i) {
+		flash[i] &= src[i];
+	}
+	nrf_fstorage_evt_t evt = {NRF_FSTORAGE_EVT_WRITE_RESULT, NRF_SUCCESS, dest, p_src, len, p_param};
+	p_fs->evt_handler(&evt);
+	return NRF_SUCCESS;
+}
+
+ret_code_t nrf_fstorage_erase(nrf_fstorage_t const* p_fs, uint32_t page_addr, uint32_t len, void* p_param) {
+	memset((void*)(uintptr_t)page_addr, 0xFF, len * HOST_FLASH_PAGE_SIZE);
+	nrf_fstorage_evt_t evt = {NRF_FSTORAGE_EVT_ERASE_RESULT, NRF_SUCCESS, page_addr, nullptr, len, p_param};
+	p_fs->evt_handler(&evt);
+	return NRF_SUCCESS;
+}
+
+bool nrf_fstorage_is_busy(nrf_fstorage_t const* p_fs) {
+	return false;
+}
+
+// The led chain's pins, a rising edge on the clock pin shifts in a bit from the data pin
+void nrf_gpio_cfg(uint32_t pin_number, nrf_gpio_pin_dir_t dir, nrf_gpio_pin_input_t input, nrf_gpio_pin_pull_t pull, nrf_gpio_pin_drive_t drive, nrf_gpio_pin_sense_t sense) {
+}
+
+void nrf_gpio_cfg_output(uint32_t pin_number) {
+}
+
+void nrf_gpio_pin_set(uint32_t pin_number) {
+	if (pin_number == Host::board.ledClockPin && (Host::gpioOut & (1 << pin_number)) == 0) {
+		Host::bitBangByte = (Host::bitBangByte << 1) | nrf_gpio_pin_out_read(Host::board.ledDataPin);
+		if (++Host::bitBangBitCount == 8) {
+			Host::ledData.push_back(Host::bitBangByte);
+			Host::bitBangBitCount = 0;
+		}
+	}
+	Host::gpioOut |= 1 << pin_number;
+}
+
+void nrf_gpio_pin_clear(uint32_t pin_number) {
+	Host::gpioOut &= ~(1 << pin_number);
+}
+
+uint32_t nrf_gpio_pin_out_read(uint32_t pin_number) {
+	return (Host::gpioOut >> pin_number) & 1;
+}
+
+ret_code_t nrfx_spim_init(nrfx_spim_t const* p_instance, nrfx_spim_config_t const* p_config, nrfx_spim_evt_handler_t handler, void* p_context) {
+	Host::spimHandler = handler;
+	Host::spimContext = p_context;
+	Host::spimFrequency = p_config->frequency == NRF_SPIM_FREQ_8M ? 8000000 : p_config->frequency == NRF_SPIM_FREQ_4M ? 4000000 : 1000000;
+	Host::spimBusy = false;
+	return NRF_SUCCESS;
+}
+
+void nrfx_spim_uninit(nrfx_spim_t const* p_instance) {
+	Host::spimHandler = nullptr;
+	Host::spimBusy = false;
+}
+
+ret_code_t nrfx_spim_xfer(nrfx_spim_t const* p_instance, nrfx_spim_xfer_desc_t const* p_xfer_desc, uint32_t flags) {
+	if (Host::spimHandler == nullptr || Host::spimBusy) {
+		return NRF_ERROR_BUSY;
+	}
+	Host::spimTransfer = *p_xfer_desc;
+	Host::spimBusy = true;
+	Host::spimDoneMicros = Host::nowMicros + ((uint64_t)p_xfer_desc->tx_length * 8 * 1000000 + Host::spimFrequency - 1) / Host::spimFrequency;
+	Host::ledData.insert(Host::ledData.end(), p_xfer_desc->p_tx_buffer, p_xfer_desc->p_tx_buffer + p_xfer_desc->tx_length);
+	return NRF_SUCCESS;
+}
+
+void nrf_gpio_cfg_input(uint32_t pin_number, nrf_gpio_pin_pull_t pull_config) {
+}
+
+void nrf_gpio_cfg_default(uint32_t pin_number) {
+}
+
+// Inputs read back as driven, except for the accelerometer's interrupt line
+uint32_t nrf_gpio_pin_read(uint32_t pin_number) {
+	if (pin_number == Host::board.accInterruptPin) {
+		return Host::accInterruptLine() ? 1 : 0;
+	}
+	return nrf_gpio_pin_out_read(pin_number);
+}
+
+ret_code_t nrf_drv_twi_init(nrf_drv_twi_t const* p_instance, nrf_drv_twi_config_t const* p_config, nrf_drv_twi_evt_handler_t event_handler, void* p_context) {
+	Host::twiHandler = event_handler;
+	Host::twiContext = p_context;
+	return NRF_SUCCESS;
+}
+
+void nrf_drv_twi_enable(nrf_drv_twi_t const* p_instance) {
+}
+
+// Timed transfers run against the register model when they end, like the TWIM's DMA does
+ret_code_t nrf_drv_twi_xfer(nrf_drv_twi_t const* p_instance, nrf_drv_twi_xfer_desc_t const* p_xfer_desc, uint32_t flags) {
+	if (Host::twiBusy) {
+		return NRF_ERROR_BUSY;
+	}
+	Host::i2cTransferCount++;
+	Host::twiTransfer = *p_xfer_desc;
+	if (Host::i2cTimed) {
+		Host::twiBusy = true;
+		Host::twiDoneMicros = Host::nowMicros + Host::twiTransferMicros(*p_xfer_desc) + Host::i2cExtraLatencyMicros;
+	} else {
+		Host::endTWITransfer();
+	}
+	return NRF_SUCCESS;
+}
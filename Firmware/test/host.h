@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "bluetooth/bluetooth_messages.h"
+#include "config/board_config.h"
+#include "config/settings.h"
+
+/// <summary>
+/// Host implementations of the drivers and services the firmware modules under test call into,
+/// and the controls the tests and tools use to drive them. Everything runs synchronously:
+/// flash operations and scheduled events complete before the call that started them returns.
+/// </summary>
+namespace Host
+{
+	// Time, in ms since the start
+	uint32_t millis();
+	uint64_t micros();
+	// Moves time forward, firing the timers that expire on the way
+	void advance(uint32_t ms);
+
+	// The accelerometer is a model of the LIS2DE12's registers on the I2C bus, readings are raw 8 bit values.
+	// setReading changes what the output registers hold, pushSample also adds it to the FIFO (per the FIFO mode)
+	// and raises the watermark interrupt, the accelerometer module gets it on its next update.
+	void setReading(int16_t x, int16_t y, int16_t z);
+	void pushSample(int16_t x, int16_t y, int16_t z);
+	uint8_t getAccRegister(uint8_t reg);
+	int getAccFIFOCount();
+
+	// I2C, transfers end before the call that started them returns, unless timed: then they take their time
+	// on the 100kHz bus plus the extra latency, and end as time advances. The blocking transfers wait for
+	// the end of transfer interrupt, so only queued ones may be started while timed.
+	void setI2CTiming(bool timed, uint32_t extraLatencyMicros = 0);
+	// The next transfers aren't acknowledged
+	void failI2CTransfers(int count);
+	uint32_t getI2CTransferCount();
+
+	// Board and settings, a D20 with the default settings unless changed
+	void setFaceCount(int count);
+	Config::Settings& settings();
+
+	// Inits the I2C and LIS2DE12 drivers the first time, like the die does at boot
+	void startAccelerometerDriver();
+	// Inits the accelerometer module (and driver) the first time, restarts it after that (i.e. reloads the settings)
+	void startAccelerometer();
+
+	// Bluetooth, messages the firmware sends go to the handler, the tests deliver the central's
+	typedef void (*MessageSentMethod)(const Bluetooth::Message* msg, int size);
+	void setMessageSentHandler(MessageSentMethod handler);
+	bool deliver(const Bluetooth::Message* msg);
+	void disconnect();
+
+	// Flash, mapped at a fixed address below 4GB since the firmware keeps flash addresses in uint32_t
+	uint32_t flashStart();
+	uint32_t flashSize();
+	void eraseFlash();
+
+	// Inits the data set module the first time, which programs the default data set if the flash is blank
+	void startDataSet();
+
+	// LEDs, the APA102 driver gets inited the first time, on the board's backend (SPIM unless changed).
+	// The chain's data comes out as the bytes it received, SPIM transfers end as time advances.
+	void startLEDs();
+	void setLEDBackend(Config::BoardManager::LEDBackend backend);
+	std::vector<uint8_t> takeLEDData();
+	bool ledPowerOn();
+
+	// Inits the anim controller (and the data set and leds) the first time
+	void startAnimController();
+}
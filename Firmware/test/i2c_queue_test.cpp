@@ -0,0 +1,159 @@
+#include "test.h"
+#include <vector>
+#include "host.h"
+#include "drivers_hw/lis2de12.h"
+#include "drivers_nrf/i2c.h"
+#include "modules/accelerometer.h"
+
+using namespace DriversHW;
+using namespace DriversNRF;
+
+#define ACC_ADDRESS 0x18
+#define WHO_AM_I 0x0F
+#define CTRL_REG3 0x22
+
+// Each transfer is the address byte and the data, 9 clocks a byte at 100kHz
+#define BYTE_MICROS 90
+#define EXTRA_LATENCY_MICROS 250
+
+namespace
+{
+	struct Completion
+	{
+		int index;
+		bool success;
+		uint64_t micros;
+	};
+	std::vector<Completion> completions;
+
+	void onTransferDone(void* param, bool success) {
+		completions.push_back({ (int)(intptr_t)param, success, Host::micros() });
+	}
+
+	std::vector<LIS2DE12::Sample> fifoSamples;
+	uint64_t fifoReadMicros;
+	void onSamplesRead(const LIS2DE12::Sample samples[], int count) {
+		fifoSamples.assign(samples, samples + count);
+		fifoReadMicros = Host::micros();
+	}
+
+	/// <summary>
+	/// Stops the accelerometer module so that only the test uses the bus
+	/// </summary>
+	void takeBus() {
+		Host::startAccelerometer();
+		Modules::Accelerometer::stop();
+		completions.clear();
+	}
+
+	/// <summary>
+	/// Delays the end of the transfers, only the queued ones can run from then on
+	/// </summary>
+	void startTimedBus() {
+		Host::setI2CTiming(true, EXTRA_LATENCY_MICROS);
+	}
+
+	void stopTimedBus() {
+		Host::advance(100);
+		CHECK(!I2C::isBusy());
+		Host::setI2CTiming(false);
+		Host::failI2CTransfers(0);
+		Host::startAccelerometer();
+	}
+}
+
+TEST(i2cQueueRunsTransfersInOrder)
+{
+	takeBus();
+	startTimedBus();
+	uint8_t values[4] = {};
+	uint64_t start = Host::micros();
+	for (int i = 0; i < 4; ++i) {
+		CHECK(I2C::readRegistersAsync(ACC_ADDRESS, WHO_AM_I, &values[i], 1, onTransferDone, (void*)(intptr_t)i));
+	}
+	// The queue holds 4 transfers, including the one on the bus
+	CHECK(!I2C::readRegistersAsync(ACC_ADDRESS, WHO_AM_I, &values[0], 1, onTransferDone, nullptr));
+	CHECK(I2C::isBusy());
+	CHECK(completions.empty() && values[0] == 0);
+
+	// They run back to back, each one starting from the interrupt of the previous one
+	Host::advance(10);
+	CHECK(!I2C::isBusy());
+	CHECK(completions.size() == 4);
+	uint64_t transferMicros = 4 * BYTE_MICROS + EXTRA_LATENCY_MICROS;
+	for (int i = 0; i < (int)completions.size(); ++i) {
+		CHECK(completions[i].index == i);
+		CHECK(completions[i].success);
+		CHECK(completions[i].micros - start == (i + 1) * transferMicros);
+		CHECK(values[i] == 0x33);
+	}
+	stopTimedBus();
+}
+
+TEST(i2cQueueMovesOnAfterAFailure)
+{
+	takeBus();
+	startTimedBus();
+	uint8_t values[3] = {};
+	Host::failI2CTransfers(1);
+	CHECK(I2C::readRegistersAsync(ACC_ADDRESS, WHO_AM_I, &values[0], 1, onTransferDone, (void*)0));
+	CHECK(I2C::readRegistersAsync(ACC_ADDRESS + 1, WHO_AM_I, &values[1], 1, onTransferDone, (void*)1));
+	CHECK(I2C::readRegistersAsync(ACC_ADDRESS, WHO_AM_I, &values[2], 1, onTransferDone, (void*)2));
+	Host::advance(10);
+	CHECK(completions.size() == 3);
+	// Not acknowledged, nothing at that address, then fine
+	CHECK(completions[0].index == 0 && !completions[0].success);
+	CHECK(completions[1].index == 1 && !completions[1].success);
+	CHECK(completions[2].index == 2 && completions[2].success && values[2] == 0x33);
+	stopTimedBus();
+}
+
+TEST(i2cQueueWritesInTheBackground)
+{
+	takeBus();
+	startTimedBus();
+	uint8_t reg = Host::getAccRegister(CTRL_REG3);
+	uint8_t write[2] = { CTRL_REG3, (uint8_t)(reg ^ 0x04) };
+	CHECK(I2C::writeAsync(ACC_ADDRESS, write, 2, onTransferDone, nullptr));
+	CHECK(Host::getAccRegister(CTRL_REG3) == reg);
+	Host::advance(1);
+	CHECK(completions.size() == 1 && completions[0].success);
+	CHECK(Host::getAccRegister(CTRL_REG3) == (reg ^ 0x04));
+
+	// Without a callback too
+	write[1] = reg;
+	CHECK(I2C::writeAsync(ACC_ADDRESS, write, 2, nullptr, nullptr));
+	Host::advance(1);
+	CHECK(!I2C::isBusy());
+	CHECK(Host::getAccRegister(CTRL_REG3) == reg);
+	stopTimedBus();
+}
+
+TEST(i2cQueueReadsAFullFIFO)
+{
+	takeBus();
+	LIS2DE12::enableFIFO(FIFO_STREAM);
+	for (int i = 0; i < LIS2DE12_FIFO_SIZE; ++i) {
+		Host::pushSample(i, -i, 64);
+	}
+	startTimedBus();
+	fifoSamples.clear();
+	uint64_t start = Host::micros();
+	CHECK(LIS2DE12::readFIFOAsync(onSamplesRead));
+	// One read at a time
+	CHECK(!LIS2DE12::readFIFOAsync(onSamplesRead));
+	CHECK(fifoSamples.empty());
+
+	Host::advance(30);
+	CHECK(fifoSamples.size() == LIS2DE12_FIFO_SIZE);
+	for (int i = 0; i < (int)fifoSamples.size(); ++i) {
+		CHECK(fifoSamples[i].x == i && fifoSamples[i].y == -i && fifoSamples[i].z == 64);
+	}
+
+	// Each read is the device address and the register going out, then the device address and the data coming in:
+	// 1 byte for the FIFO source, 6 a sample
+	uint64_t expected = ((2 + 2) + (2 + 1 + LIS2DE12_FIFO_SIZE * 6)) * BYTE_MICROS + 2 * EXTRA_LATENCY_MICROS;
+	printf("  full FIFO read: %.1f ms on the bus, the CPU is free meanwhile\n", (fifoReadMicros - start) / 1000.0);
+	CHECK(fifoReadMicros - start == expected);
+	stopTimedBus();
+}
@@ -0,0 +1,184 @@
+#include "test.h"
+#include <stdlib.h>
+#include <vector>
+#include "host.h"
+#include "animations/Animation.h"
+#include "animations/keyframes.h"
+#include "data_set/data_set.h"
+#include "data_set/data_animation_bits.h"
+#include "utils/utils.h"
+
+using namespace Animations;
+using namespace DataSet;
+
+namespace
+{
+	// Keyframe times are stored in 20ms steps, and go up to about 10s
+	#define KEYFRAME_TIME_STEP 20
+	#define TRACK_DURATION 7680
+	#define PALETTE_COLOR_COUNT 16
+
+	/// <summary>
+	/// Animation bits with one RGB track and one intensity track of evenly spaced keyframes,
+	/// the default data set only has simple animations so it has no tracks to measure
+	/// </summary>
+	struct SyntheticTracks
+	{
+		std::vector<uint8_t> palette;
+		std::vector<RGBKeyframe> rgbKeyframes;
+		std::vector<Keyframe> keyframes;
+		RGBTrack rgbTrack;
+		Track track;
+		AnimationBits bits;
+
+		SyntheticTracks(int keyframeCount) {
+			srand(keyframeCount);
+			for (int i = 0; i < PALETTE_COLOR_COUNT * 3; ++i) {
+				palette.push_back((uint8_t)rand());
+			}
+			int spacing = TRACK_DURATION / keyframeCount / KEYFRAME_TIME_STEP * KEYFRAME_TIME_STEP;
+			for (int i = 0; i < keyframeCount; ++i) {
+				RGBKeyframe rgbKeyframe;
+				rgbKeyframe.setTimeAndColorIndex(i * spacing, rand() % PALETTE_COLOR_COUNT);
+				rgbKeyframes.push_back(rgbKeyframe);
+				Keyframe keyframe;
+				keyframe.setTimeAndIntensity(i * spacing, rand() % 128);
+				keyframes.push_back(keyframe);
+			}
+			rgbTrack = { 0, (uint8_t)keyframeCount, 0, 0xFFFFF };
+			track = { 0, (uint8_t)keyframeCount, 0, 0xFFFFF };
+
+			bits.Clear();
+			bits.palette = palette.data();
+			bits.paletteSize = palette.size();
+			bits.rgbKeyframes = rgbKeyframes.data();
+			bits.rgbKeyFrameCount = rgbKeyframes.size();
+			bits.rgbTracks = &rgbTrack;
+			bits.rgbTrackCount = 1;
+			bits.keyframes = keyframes.data();
+			bits.keyFrameCount = keyframes.size();
+			bits.tracks = &track;
+			bits.trackCount = 1;
+		}
+	};
+
+	/// <summary>
+	/// RGBTrack::evaluateColor as it was before the cursors, scanning from the first keyframe every time
+	/// </summary>
+	uint32_t linearEvaluateColor(const RGBTrack& track, const AnimationBits* bits, int time) {
+		int nextIndex = 0;
+		while (nextIndex < track.keyFrameCount && track.getRGBKeyframe(bits, nextIndex).time() < time) {
+			nextIndex++;
+		}
+
+		if (nextIndex == 0) {
+			return track.getRGBKeyframe(bits, nextIndex).color(bits);
+		} else if (nextIndex == track.keyFrameCount) {
+			return track.getRGBKeyframe(bits, nextIndex - 1).color(bits);
+		} else {
+			auto nextKeyframe = track.getRGBKeyframe(bits, nextIndex);
+			auto prevKeyframe = track.getRGBKeyframe(bits, nextIndex - 1);
+			return Utils::interpolateColors(prevKeyframe.color(bits), prevKeyframe.time(), nextKeyframe.color(bits), nextKeyframe.time(), time);
+		}
+	}
+
+	const int keyframeCounts[] = { 1, 2, 8, 32, 128 };
+}
+
+TEST(keyframeCursorMatchesLinearScan)
+{
+	for (int keyframeCount : keyframeCounts) {
+		SyntheticTracks tracks(keyframeCount);
+		TrackCursor rgbCursor, cursor;
+		rgbCursor.reset();
+		cursor.reset();
+
+		// Looping playback at the frame rate, going back to the start each loop, then random seeks
+		std::vector<int> times;
+		for (int loop = 0; loop < 3; ++loop) {
+			for (int time = -50; time < TRACK_DURATION + 100; time += 33) {
+				times.push_back(time);
+			}
+		}
+		for (int i = 0; i < 1000; ++i) {
+			times.push_back(rand() % (TRACK_DURATION + 200) - 100);
+		}
+
+		for (int time : times) {
+			uint32_t expected = linearEvaluateColor(tracks.rgbTrack, &tracks.bits, time);
+			CHECK(tracks.rgbTrack.evaluateColor(&tracks.bits, time) == expected);
+			CHECK(tracks.rgbTrack.evaluateColor(&tracks.bits, time, &rgbCursor) == expected);
+			uint32_t modulated = tracks.track.modulateColor(&tracks.bits, 0xFFFFFF, time);
+			CHECK(tracks.track.modulateColor(&tracks.bits, 0xFFFFFF, time, &cursor) == modulated);
+		}
+	}
+}
+
+// Host ns, the die runs the same code a few tens of times slower but the ratios should hold
+BENCHMARK(keyframeCursor)
+{
+	// What the default data set costs per frame, it has no keyframes so this is the floor
+	Host::startDataSet();
+	auto bits = DataSet::getAnimationBits();
+	printf("  default data set: %d animations, %d RGB tracks, %d RGB keyframes\n",
+		DataSet::getAnimationCount(), bits->getRGBTrackCount(), bits->getRGBKeyframeCount());
+	int indices[MAX_LED_COUNT * 4];
+	uint32_t colors[MAX_LED_COUNT * 4];
+	for (int i = 0; i < DataSet::getAnimationCount(); ++i) {
+		auto instance = createAnimationInstance(i);
+		CHECK(instance != nullptr);
+		instance->start(0, 0, false);
+		int duration = instance->animationPreset->duration;
+		const int loops = 2000;
+		uint64_t start = Test::nanos();
+		for (int loop = 0; loop < loops; ++loop) {
+			for (int ms = 0; ms < duration; ms += DEFAULT_FRAME_MS) {
+				Test::keep(instance->updateLEDs(ms, indices, colors));
+			}
+		}
+		uint64_t elapsed = Test::nanos() - start;
+		printf("    animation %d (type %d, %d ms): %.1f ns per frame\n", i, instance->animationPreset->type, duration,
+			(double)elapsed / (loops * ((duration + DEFAULT_FRAME_MS - 1) / DEFAULT_FRAME_MS)));
+		destroyAnimationInstance(instance);
+	}
+
+	// One color evaluation per 20ms frame over the whole track, as a keyframed animation does
+	printf("  synthetic RGB track, ns per evaluation: linear scan / binary search / cursor\n");
+	for (int keyframeCount : keyframeCounts) {
+		SyntheticTracks tracks(keyframeCount);
+		const int loops = 2000;
+		const int frameCount = TRACK_DURATION / KEYFRAME_TIME_STEP;
+		uint32_t sum = 0;
+
+		uint64_t start = Test::nanos();
+		for (int loop = 0; loop < loops; ++loop) {
+			for (int time = 0; time < TRACK_DURATION; time += KEYFRAME_TIME_STEP) {
+				sum += linearEvaluateColor(tracks.rgbTrack, &tracks.bits, time);
+			}
+		}
+		uint64_t linearNanos = Test::nanos() - start;
+
+		start = Test::nanos();
+		for (int loop = 0; loop < loops; ++loop) {
+			for (int time = 0; time < TRACK_DURATION; time += KEYFRAME_TIME_STEP) {
+				sum += tracks.rgbTrack.evaluateColor(&tracks.bits, time);
+			}
+		}
+		uint64_t binaryNanos = Test::nanos() - start;
+
+		start = Test::nanos();
+		for (int loop = 0; loop < loops; ++loop) {
+			TrackCursor cursor;
+			cursor.reset();
+			for (int time = 0; time < TRACK_DURATION; time += KEYFRAME_TIME_STEP) {
+				sum += tracks.rgbTrack.evaluateColor(&tracks.bits, time, &cursor);
+			}
+		}
+		uint64_t cursorNanos = Test::nanos() - start;
+		Test::keep(sum);
+
+		double evaluationCount = (double)loops * frameCount;
+		printf("    %3d keyframes: %.1f / %.1f / %.1f\n", keyframeCount,
+			linearNanos / evaluationCount, binaryNanos / evaluationCount, cursorNanos / evaluationCount);
+	}
+}
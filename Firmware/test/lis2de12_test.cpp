@@ -0,0 +1,192 @@
+#include "test.h"
+#include <vector>
+#include "host.h"
+#include "config/board_config.h"
+#include "drivers_hw/lis2de12.h"
+#include "drivers_nrf/gpiote.h"
+#include "modules/accelerometer.h"
+#include "nrf_gpio.h"
+
+using namespace Config;
+using namespace DriversHW;
+using namespace DriversNRF;
+
+// The registers the tests look at
+#define CTRL_REG1 0x20
+#define CTRL_REG3 0x22
+#define CTRL_REG4 0x23
+#define CTRL_REG5 0x24
+#define FIFO_CTRL_REG 0x2E
+#define FIFO_SRC_REG 0x2F
+
+namespace
+{
+	/// <summary>
+	/// Gets the driver to ourselves, the accelerometer module stops reading the FIFO and lets go of the interrupt
+	/// </summary>
+	void takeDriver() {
+		Host::startAccelerometer();
+		Modules::Accelerometer::stop();
+	}
+
+	void giveDriverBack() {
+		Host::startAccelerometer();
+	}
+
+	// Raw 8 bit readings that tell nearby samples apart, and use the sign bit
+	LIS2DE12::Sample testSample(int i) {
+		return { (int8_t)i, (int8_t)-i, (int8_t)(i * 3 - 64) };
+	}
+
+	void pushSamples(int first, int count) {
+		for (int i = first; i < first + count; ++i) {
+			auto sample = testSample(i);
+			Host::pushSample(sample.x, sample.y, sample.z);
+		}
+	}
+
+	bool samplesMatch(const LIS2DE12::Sample samples[], int count, int first) {
+		for (int i = 0; i < count; ++i) {
+			auto expected = testSample(first + i);
+			if (samples[i].x != expected.x || samples[i].y != expected.y || samples[i].z != expected.z) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int interruptCount;
+	void onInterrupt(uint32_t pin, nrf_gpiote_polarity_t action) {
+		interruptCount++;
+	}
+
+	std::vector<LIS2DE12::Sample> asyncSamples;
+	void onSamplesRead(const LIS2DE12::Sample samples[], int count) {
+		asyncSamples.assign(samples, samples + count);
+	}
+}
+
+TEST(lis2de12InitsTheSensor)
+{
+	takeDriver();
+	CHECK(LIS2DE12::checkWhoAMI());
+	// 100Hz, active, all axes on, and the 4g scale
+	CHECK(Host::getAccRegister(CTRL_REG1) == ((ODR_100 << 4) | 0x0F));
+	CHECK((Host::getAccRegister(CTRL_REG4) & 0x30) == (SCALE_4G << 4));
+	CHECK(LIS2DE12::checkIntPin());
+	giveDriverBack();
+}
+
+TEST(lis2de12ReadsTheLatestSampleWithoutFIFO)
+{
+	takeDriver();
+	CHECK((Host::getAccRegister(CTRL_REG5) & 0x40) == 0);
+	pushSamples(0, 10);
+	CHECK(Host::getAccFIFOCount() == 0);
+	LIS2DE12::Sample samples[LIS2DE12_FIFO_SIZE];
+	CHECK(LIS2DE12::readFIFO(samples, LIS2DE12_FIFO_SIZE) == 0);
+	LIS2DE12::read();
+	CHECK(LIS2DE12::x == testSample(9).x && LIS2DE12::y == testSample(9).y && LIS2DE12::z == testSample(9).z);
+	CHECK(LIS2DE12::cz == LIS2DE12::convert(testSample(9).z));
+	giveDriverBack();
+}
+
+TEST(lis2de12FIFOModes)
+{
+	takeDriver();
+	LIS2DE12::Sample samples[LIS2DE12_FIFO_SIZE];
+
+	// Stream mode keeps the latest 32 samples, and reads them back oldest first in one burst
+	LIS2DE12::enableFIFO(FIFO_STREAM);
+	CHECK(Host::getAccRegister(FIFO_CTRL_REG) >> 6 == FIFO_STREAM);
+	pushSamples(0, 40);
+	CHECK(Host::getAccRegister(FIFO_SRC_REG) & 0x40); // Overrun
+	uint32_t transfers = Host::getI2CTransferCount();
+	CHECK(LIS2DE12::readFIFO(samples, LIS2DE12_FIFO_SIZE) == LIS2DE12_FIFO_SIZE);
+	CHECK(samplesMatch(samples, LIS2DE12_FIFO_SIZE, 8));
+	// The FIFO source, then the register address and the burst read
+	CHECK(Host::getI2CTransferCount() - transfers == 4);
+	CHECK(Host::getAccFIFOCount() == 0);
+	CHECK(Host::getAccRegister(FIFO_SRC_REG) & 0x20); // Empty
+
+	// Reads can stop early, the rest stays for the next one
+	pushSamples(100, 5);
+	CHECK(LIS2DE12::available() == 5);
+	CHECK(LIS2DE12::readFIFO(samples, 3) == 3);
+	CHECK(samplesMatch(samples, 3, 100));
+	CHECK(LIS2DE12::readFIFO(samples, LIS2DE12_FIFO_SIZE) == 2);
+	CHECK(samplesMatch(samples, 2, 103));
+
+	// read() empties the FIFO and keeps the latest sample
+	pushSamples(200, 6);
+	LIS2DE12::read();
+	CHECK(LIS2DE12::x == testSample(205).x && LIS2DE12::z == testSample(205).z);
+	CHECK(Host::getAccFIFOCount() == 0);
+
+	// FIFO mode stops collecting once full, the newest samples are the ones lost
+	LIS2DE12::enableFIFO(FIFO_FIFO);
+	pushSamples(300, 40);
+	CHECK(LIS2DE12::readFIFO(samples, LIS2DE12_FIFO_SIZE) == LIS2DE12_FIFO_SIZE);
+	CHECK(samplesMatch(samples, LIS2DE12_FIFO_SIZE, 300));
+
+	// Enabling the FIFO again starts it empty, disabling it too
+	pushSamples(400, 5);
+	LIS2DE12::enableFIFO(FIFO_STREAM);
+	CHECK(Host::getAccFIFOCount() == 0);
+	pushSamples(500, 5);
+	LIS2DE12::disableFIFO();
+	CHECK(Host::getAccFIFOCount() == 0);
+	CHECK(LIS2DE12::readFIFO(samples, LIS2DE12_FIFO_SIZE) == 0);
+	giveDriverBack();
+}
+
+TEST(lis2de12ReadsTheFIFOInTheBackground)
+{
+	takeDriver();
+	LIS2DE12::enableFIFO(FIFO_STREAM);
+	pushSamples(0, 20);
+	asyncSamples.clear();
+	CHECK(LIS2DE12::readFIFOAsync(onSamplesRead));
+	CHECK(asyncSamples.size() == 20);
+	CHECK(samplesMatch(asyncSamples.data(), 20, 0));
+
+	// An empty FIFO calls back with nothing
+	asyncSamples.push_back(testSample(0));
+	CHECK(LIS2DE12::readFIFOAsync(onSamplesRead));
+	CHECK(asyncSamples.empty());
+	giveDriverBack();
+}
+
+TEST(lis2de12WatermarkInterrupt)
+{
+	takeDriver();
+	uint32_t pin = BoardManager::getBoard()->accInterruptPin;
+	LIS2DE12::enableFIFO(FIFO_STREAM, 9);
+	GPIOTE::enableInterrupt(pin, NRF_GPIO_PIN_NOPULL, NRF_GPIOTE_POLARITY_LOTOHI, onInterrupt);
+	LIS2DE12::enableFIFOInterrupt();
+	CHECK(Host::getAccRegister(CTRL_REG3) & 0x04);
+	interruptCount = 0;
+
+	// The line goes up once the FIFO holds more than the watermark, and stays up until read
+	pushSamples(0, 9);
+	CHECK(interruptCount == 0 && nrf_gpio_pin_read(pin) == 0);
+	pushSamples(9, 1);
+	CHECK(interruptCount == 1 && nrf_gpio_pin_read(pin) == 1);
+	CHECK(Host::getAccRegister(FIFO_SRC_REG) & 0x80);
+	pushSamples(10, 5);
+	CHECK(interruptCount == 1);
+
+	LIS2DE12::Sample samples[LIS2DE12_FIFO_SIZE];
+	CHECK(LIS2DE12::readFIFO(samples, LIS2DE12_FIFO_SIZE) == 15);
+	CHECK(nrf_gpio_pin_read(pin) == 0);
+	pushSamples(15, 10);
+	CHECK(interruptCount == 2);
+
+	// No more interrupts once disabled
+	LIS2DE12::disableFIFOInterrupt();
+	LIS2DE12::readFIFO(samples, LIS2DE12_FIFO_SIZE);
+	pushSamples(25, 10);
+	CHECK(interruptCount == 2 && nrf_gpio_pin_read(pin) == 0);
+	GPIOTE::disableInterrupt(pin);
+	giveDriverBack();
+}
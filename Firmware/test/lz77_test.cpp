@@ -0,0 +1,179 @@
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "host.h"
+#include "bluetooth/bulk_data_transfer.h"
+#include "utils/Utils.h"
+
+using namespace Bluetooth;
+
+namespace
+{
+	bool done;
+	bool doneResult;
+	uint32_t doneSize;
+
+	std::vector<uint8_t> makeData(int size, bool compressible) {
+		// Padded, lz77_decompress and the compressor's 4 byte writes go a little past the end
+		std::vector<uint8_t> data(size + 16, 0xFF);
+		for (int i = 0; i < size; ++i) {
+			data[i] = compressible ? (i / 7) % 13 + (rand() % 50 == 0) : rand();
+		}
+		return data;
+	}
+
+	std::vector<uint8_t> compress(std::vector<uint8_t>& data, int size) {
+		// Compressing can grow the data, and writes 4 bytes at a time
+		std::vector<uint8_t> compressed(size * 3 + 16);
+		compressed.resize(Utils::lz77_compress(data.data(), size, compressed.data()));
+		return compressed;
+	}
+
+	MessageBulkData makeChunk(const std::vector<uint8_t>& payload, int offset) {
+		MessageBulkData chunk;
+		chunk.offset = offset;
+		chunk.size = std::min((int)payload.size() - offset, MAX_DATA_SIZE);
+		memcpy(chunk.data, &payload[offset], chunk.size);
+		chunk.crc = Utils::computeHash(chunk.data, chunk.size);
+		return chunk;
+	}
+
+	/// <summary>
+	/// Sends a compressed transfer to flash, in windows of chunks sent back to front
+	/// </summary>
+	void sendCompressed(const std::vector<uint8_t>& payload, uint32_t decodedSize, int windowSize) {
+		// Only what the transfer writes, the benchmark sends small data sets many times
+		memset((void*)(uintptr_t)Host::flashStart(), 0xFF, std::min(decodedSize + 16, Host::flashSize()));
+		done = false;
+		ReceiveBulkData::receiveCompressedToFlash(Host::flashStart(), decodedSize, nullptr, [](void* context, bool result, uint32_t address, uint16_t size) {
+			done = true;
+			doneResult = result;
+			doneSize = size;
+		});
+
+		MessageBulkWindowSetup setup;
+		setup.size = payload.size();
+		setup.windowSize = windowSize;
+		Host::deliver(&setup);
+
+		int chunkCount = (payload.size() + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE;
+		for (int first = 0; first < chunkCount && !done; first += windowSize) {
+			for (int i = std::min(first + windowSize, chunkCount) - 1; i >= first && !done; --i) {
+				auto chunk = makeChunk(payload, i * MAX_DATA_SIZE);
+				Host::deliver(&chunk);
+			}
+		}
+	}
+}
+
+TEST(lz77RoundTrips)
+{
+	srand(6);
+	const int sizes[] = {1, 15, 16, 100, 101, 4096, 12345};
+	for (int size : sizes) {
+		for (int compressible = 0; compressible < 2; ++compressible) {
+			auto data = makeData(size, compressible);
+			auto compressed = compress(data, size);
+			std::vector<uint8_t> decompressed(size + 16);
+			CHECK(Utils::lz77_decompress(compressed.data(), decompressed.data()) == (uint32_t)size);
+			CHECK(memcmp(decompressed.data(), data.data(), size) == 0);
+		}
+	}
+}
+
+TEST(lz77MatchesStopAtTheEnd)
+{
+	// Data ending in the same bytes as the padding, a match used to run on into it
+	for (int size : {20, 100}) {
+		auto data = makeData(size, true);
+		std::fill(data.begin() + size - 8, data.end(), 0xFF);
+		auto compressed = compress(data, size);
+		std::vector<uint8_t> decompressed(size + 32);
+		CHECK(Utils::lz77_decompress(compressed.data(), decompressed.data()) == (uint32_t)size);
+		CHECK(memcmp(decompressed.data(), data.data(), size) == 0);
+	}
+}
+
+TEST(lz77StreamingDecoderRoundTrips)
+{
+	srand(7);
+	const int sizes[] = {1, 15, 16, 100, 101, 4096, 12345};
+	for (int size : sizes) {
+		for (int compressible = 0; compressible < 2; ++compressible) {
+			for (int windowSize : {1, 4, 8}) {
+				auto data = makeData(size, compressible);
+				auto compressed = compress(data, size);
+				if (compressed.size() > UINT16_MAX) {
+					continue;
+				}
+				sendCompressed(compressed, size, windowSize);
+				CHECK(done && doneResult && doneSize == (uint32_t)size);
+				CHECK(memcmp((const void*)(uintptr_t)Host::flashStart(), data.data(), size) == 0);
+				CHECK(ReceiveBulkData::getReceivedHash() == Utils::computeHash(data.data(), size));
+			}
+		}
+	}
+}
+
+TEST(lz77StreamingDecoderRejectsWrongSize)
+{
+	srand(8);
+	auto data = makeData(1000, true);
+	auto compressed = compress(data, 1000);
+	for (uint32_t decodedSize : {992u, 1008u}) {
+		sendCompressed(compressed, decodedSize, 4);
+		CHECK(done && !doneResult);
+		// The stream's header already tells, so nothing gets written
+		CHECK(*(const uint8_t*)(uintptr_t)Host::flashStart() == 0xFF);
+	}
+}
+
+// Packed data sets from raspi/, the Makefile puts them in _build for make bench
+BENCHMARK(lz77OnSampleDataSets)
+{
+	const char* files[] = {"_build/animation_set.bin", "_build/D20_animation_set.bin"};
+	for (auto file : files) {
+		FILE* f = fopen(file, "rb");
+		if (f == nullptr) {
+			printf("  %s not found, run make bench from Firmware/test\n", file);
+			continue;
+		}
+		std::vector<uint8_t> data(Host::flashSize());
+		int size = fread(data.data(), 1, data.size() - 16, f);
+		fclose(f);
+		std::fill(data.begin() + size, data.end(), 0xFF);
+
+		const int repeatCount = 1000;
+		uint64_t start = Test::nanos();
+		std::vector<uint8_t> compressed;
+		for (int i = 0; i < repeatCount; ++i) {
+			compressed = compress(data, size);
+		}
+		uint64_t compressNanos = (Test::nanos() - start) / repeatCount;
+
+		std::vector<uint8_t> decompressed(size + 16);
+		start = Test::nanos();
+		for (int i = 0; i < repeatCount; ++i) {
+			Test::keep(Utils::lz77_decompress(compressed.data(), decompressed.data()));
+		}
+		uint64_t decompressNanos = (Test::nanos() - start) / repeatCount;
+
+		// The streaming decoder, fed one chunk message at a time like the die is
+		start = Test::nanos();
+		for (int i = 0; i < repeatCount; ++i) {
+			sendCompressed(compressed, size, 8);
+		}
+		uint64_t streamNanos = (Test::nanos() - start) / repeatCount;
+		CHECK(done && doneResult && doneSize == (uint32_t)size);
+		CHECK(memcmp((const void*)(uintptr_t)Host::flashStart(), data.data(), size) == 0);
+
+		printf("  %s: %d -> %d bytes (%.1f%%), %d -> %d chunks\n", file, size, (int)compressed.size(),
+			100.0 * compressed.size() / size, (size + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE,
+			((int)compressed.size() + MAX_DATA_SIZE - 1) / MAX_DATA_SIZE);
+		printf("    compress %.1f MB/s, decompress %.1f MB/s, streaming decode to flash %.1f MB/s\n",
+			size * 1000.0 / compressNanos, size * 1000.0 / decompressNanos, size * 1000.0 / streamNanos);
+	}
+}
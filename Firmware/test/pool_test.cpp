@@ -0,0 +1,82 @@
+#include "test.h"
+#include <stdlib.h>
+#include <set>
+#include <vector>
+#include "core/pool.h"
+
+// Same capacity as the animation instance pool (MAX_ANIMS), blocks about the size of an instance
+#define POOL_BLOCK_SIZE 64
+#define POOL_BLOCK_COUNT 20
+
+TEST(poolHandsOutEachBlockOnce)
+{
+	static Core::Pool<POOL_BLOCK_SIZE, POOL_BLOCK_COUNT> pool;
+	pool.reset();
+	std::set<uint8_t*> blocks;
+	for (int i = 0; i < POOL_BLOCK_COUNT; ++i) {
+		auto block = (uint8_t*)pool.alloc();
+		CHECK(block != nullptr && ((uintptr_t)block & 3) == 0);
+		for (auto other : blocks) {
+			CHECK(block + POOL_BLOCK_SIZE <= other || other + POOL_BLOCK_SIZE <= block);
+		}
+		blocks.insert(block);
+	}
+	CHECK(pool.alloc() == nullptr);
+	CHECK(pool.count() == POOL_BLOCK_COUNT && pool.failureCount() == 1);
+
+	// Freed blocks come back
+	auto block = *blocks.begin();
+	pool.free(block);
+	CHECK(pool.alloc() == block);
+	for (auto b : blocks) {
+		pool.free(b);
+	}
+	CHECK(pool.count() == 0 && pool.highWaterMark() == POOL_BLOCK_COUNT);
+}
+
+namespace
+{
+	/// <summary>
+	/// Plays and stops animations at random, keeping up to POOL_BLOCK_COUNT alive like the controller does
+	/// </summary>
+	template <typename Alloc, typename Free>
+	uint64_t churn(int operationCount, Alloc alloc, Free free) {
+		void* live[POOL_BLOCK_COUNT] = {};
+		srand(1);
+		std::vector<uint8_t> ops(operationCount);
+		for (auto& op : ops) {
+			op = rand() % POOL_BLOCK_COUNT;
+		}
+		uint64_t start = Test::nanos();
+		for (auto op : ops) {
+			if (live[op] != nullptr) {
+				free(live[op]);
+				live[op] = nullptr;
+			} else {
+				live[op] = alloc();
+				// Constructing the instance touches it
+				*(volatile uint32_t*)live[op] = op;
+			}
+		}
+		uint64_t elapsed = Test::nanos() - start;
+		for (auto ptr : live) {
+			if (ptr != nullptr) {
+				free(ptr);
+			}
+		}
+		return elapsed;
+	}
+}
+
+// The host's malloc, not newlib's, so this only gives an idea of the difference on the die
+BENCHMARK(poolVsMalloc)
+{
+	static Core::Pool<POOL_BLOCK_SIZE, POOL_BLOCK_COUNT> pool;
+	pool.reset();
+	const int operationCount = 10000000;
+	uint64_t poolNanos = churn(operationCount, []() { return pool.alloc(); }, [](void* ptr) { pool.free(ptr); });
+	uint64_t mallocNanos = churn(operationCount, []() { return malloc(POOL_BLOCK_SIZE); }, [](void* ptr) { free(ptr); });
+	CHECK(pool.count() == 0 && pool.failureCount() == 0);
+	printf("  alloc or free of %d byte blocks: pool %.1f ns, malloc %.1f ns\n", POOL_BLOCK_SIZE,
+		(double)poolNanos / operationCount, (double)mallocNanos / operationCount);
+}
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "host.h"
+#include "config/sdk_config.h"
+#include "drivers_hw/lis2de12.h"
+#include "modules/accelerometer.h"
+
+// Replays recorded accelerometer streams through the roll detection, feeding the samples straight
+// to Accelerometer::processSample with live sampling stopped, and reports how well the rolls were
+// detected. Each CSV line is
+//
+//     time,x,y,z[,rolling]
+//
+// with the time in ms, the acceleration in g like AccelFrame::acc (or raw readings with -raw),
+// and optionally 1 while the die was really rolling and 0 otherwise, which the detection is
+// graded against. Lines that don't start with a number, like a header, are skipped. The samples
+// are resampled to the accelerometer's frame rate, so frame telemetry works as well as raw.
+//
+//     replay [-faces N] [-raw] [-set setting=value]... file.csv...
+
+using namespace Modules;
+
+#define ROLL_GRACE_MS 500 // How late after the end of a labelled roll we still count detections toward it
+#define WARM_UP_MS 1000 // How long we hold the first sample before each recording, so the filters start at rest
+
+namespace
+{
+	struct Row
+	{
+		double time;
+		double x, y, z;
+		bool rolling;
+	};
+
+	struct Frame
+	{
+		DriversHW::LIS2DE12::Sample sample;
+		bool rolling;
+	};
+
+	struct RollStats
+	{
+		int samples;
+		double processingMicros;
+		double restMs;
+		int labelledRolls;
+		int detectedRolls;
+		double latencySum;
+		double latencyMax;
+		int settledRolls;
+		double settleSum;
+		double settleMax;
+		int falseRolls;
+		int restedRolls; // Rolls that ended on a face or crooked
+		int crookedRolls;
+	};
+
+	// Time of the last sample we processed, the history wants it to keep going forward
+	uint32_t replayTime;
+
+	const char* rollStateName(int state) {
+		switch (state) {
+			case Accelerometer::RollState_OnFace: return "on face";
+			case Accelerometer::RollState_Handling: return "handling";
+			case Accelerometer::RollState_Rolling: return "rolling";
+			case Accelerometer::RollState_Crooked: return "crooked";
+			default: return "unknown";
+		}
+	}
+
+	bool setSetting(const char* assignment) {
+		struct { const char* name; float Config::Settings::* value; } settings[] = {
+			{"jerkClamp", &Config::Settings::jerkClamp},
+			{"sigmaDecay", &Config::Settings::sigmaDecay},
+			{"startMovingThreshold", &Config::Settings::startMovingThreshold},
+			{"stopMovingThreshold", &Config::Settings::stopMovingThreshold},
+			{"faceThreshold", &Config::Settings::faceThreshold},
+			{"fallingThreshold", &Config::Settings::fallingThreshold},
+			{"shockThreshold", &Config::Settings::shockThreshold},
+			{"accDecay", &Config::Settings::accDecay},
+		};
+		const char* equals = strchr(assignment, '=');
+		if (equals == nullptr) {
+			return false;
+		}
+		for (auto& setting : settings) {
+			if (strlen(setting.name) == (size_t)(equals - assignment) && strncmp(setting.name, assignment, equals - assignment) == 0) {
+				Host::settings().*setting.value = (float)atof(equals + 1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool readRows(const char* path, std::vector<Row>& outRows) {
+		FILE* file = fopen(path, "r");
+		if (file == nullptr) {
+			fprintf(stderr, "Can't open %s\n", path);
+			return false;
+		}
+		char line[256];
+		while (fgets(line, sizeof(line), file) != nullptr) {
+			double values[5];
+			int count = 0;
+			char* cursor = line;
+			while (count < 5) {
+				char* end;
+				values[count] = strtod(cursor, &end);
+				if (end == cursor) {
+					break;
+				}
+				count++;
+				cursor = end;
+				while (*cursor == ',' || *cursor == ' ' || *cursor == '\t') {
+					cursor++;
+				}
+			}
+			if (count < 4) {
+				continue;
+			}
+			outRows.push_back({values[0], values[1], values[2], values[3], count > 4 && values[4] != 0});
+		}
+		fclose(file);
+		if (outRows.size() < 2) {
+			fprintf(stderr, "%s: not enough samples\n", path);
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Linearly interpolates the rows at the accelerometer frame rate, and converts them to raw readings
+	/// </summary>
+	std::vector<Frame> resample(const std::vector<Row>& rows, bool raw) {
+		double scale = raw ? 1.0 : 1.0 / DriversHW::LIS2DE12::convert(1);
+		auto toReading = [scale](double value) {
+			return (short)std::max(-128.0, std::min(127.0, round(value * scale)));
+		};
+		std::vector<Frame> frames;
+		int row = 0;
+		for (double time = rows.front().time; time <= rows.back().time; time += ACCEL_FRAME_MS) {
+			while (row + 2 < (int)rows.size() && rows[row + 1].time <= time) {
+				row++;
+			}
+			auto& a = rows[row];
+			auto& b = rows[row + 1];
+			double t = b.time > a.time ? std::min(1.0, (time - a.time) / (b.time - a.time)) : 0.0;
+			Frame frame;
+			frame.sample.x = toReading(a.x + (b.x - a.x) * t);
+			frame.sample.y = toReading(a.y + (b.y - a.y) * t);
+			frame.sample.z = toReading(a.z + (b.z - a.z) * t);
+			frame.rolling = t < 1.0 ? a.rolling : b.rolling;
+			frames.push_back(frame);
+		}
+		return frames;
+	}
+
+	/// <summary>
+	/// Runs the frames through the roll detection one frame period apart, and keeps the roll state after each of them.
+	/// The first frame is held for a while first, so the motion left over from the previous recording dies down.
+	/// </summary>
+	std::vector<uint8_t> replay(const std::vector<Frame>& frames, RollStats& stats) {
+		for (int i = 0; i < WARM_UP_MS / ACCEL_FRAME_MS; ++i) {
+			replayTime += ACCEL_FRAME_MS;
+			Accelerometer::processSample(frames[0].sample, replayTime);
+		}
+
+		std::vector<uint8_t> states;
+		states.reserve(frames.size());
+		double processingMicros = 0.0;
+		for (auto& frame : frames) {
+			replayTime += ACCEL_FRAME_MS;
+			auto start = std::chrono::steady_clock::now();
+			Accelerometer::processSample(frame.sample, replayTime);
+			processingMicros += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+			states.push_back(Accelerometer::currentRollState());
+		}
+		stats.processingMicros += processingMicros;
+		stats.samples += frames.size();
+		return states;
+	}
+
+	/// <summary>
+	/// Grades the roll states against the labels, or just counts the rolls if there are none
+	/// </summary>
+	void grade(const char* path, const std::vector<Frame>& frames, const std::vector<uint8_t>& states, RollStats& stats) {
+		// Where each sample's labelled roll started and ended, if it's in one or just after
+		int count = (int)frames.size();
+		std::vector<int> rollStart(count, -1), rollEnd(count, -1);
+		bool labelled = false;
+		for (int i = 0; i < count; ++i) {
+			if (frames[i].rolling && (i == 0 || !frames[i - 1].rolling)) {
+				int end = i;
+				while (end + 1 < count && frames[end + 1].rolling) {
+					end++;
+				}
+				int graceEnd = std::min(count - 1, end + ROLL_GRACE_MS / ACCEL_FRAME_MS);
+				for (int j = i; j <= graceEnd; ++j) {
+					rollStart[j] = i;
+					rollEnd[j] = end;
+				}
+				stats.labelledRolls++;
+				labelled = true;
+			}
+			if (!frames[i].rolling) {
+				stats.restMs += ACCEL_FRAME_MS;
+			}
+		}
+
+		int detectedStart = -1; // Labelled roll we last detected
+		int detectedEnd = -1;
+		int settledStart = -1;
+		bool rolled = false; // Rolling since the die was last at rest
+		for (int i = 1; i < count; ++i) {
+			if (states[i] == states[i - 1]) {
+				continue;
+			}
+			double time = i * ACCEL_FRAME_MS;
+			if (states[i] == Accelerometer::RollState_Rolling) {
+				rolled = true;
+				if (!labelled) {
+					stats.detectedRolls++;
+				} else if (rollStart[i] == -1) {
+					stats.falseRolls++;
+					printf("  %8.0f ms: false roll\n", time);
+				} else if (rollStart[i] != detectedStart) {
+					detectedStart = rollStart[i];
+					detectedEnd = rollEnd[i];
+					double latency = (i - rollStart[i]) * ACCEL_FRAME_MS;
+					stats.detectedRolls++;
+					stats.latencySum += latency;
+					stats.latencyMax = std::max(stats.latencyMax, latency);
+					printf("  %8.0f ms: roll detected after %.0f ms\n", rollStart[i] * (double)ACCEL_FRAME_MS, latency);
+				}
+			} else if ((states[i] == Accelerometer::RollState_OnFace || states[i] == Accelerometer::RollState_Crooked) && rolled) {
+				rolled = false;
+				stats.restedRolls++;
+				if (states[i] == Accelerometer::RollState_Crooked) {
+					stats.crookedRolls++;
+				}
+				if (detectedStart != settledStart) {
+					settledStart = detectedStart;
+					double settle = (i - detectedEnd) * (double)ACCEL_FRAME_MS;
+					stats.settledRolls++;
+					stats.settleSum += settle;
+					stats.settleMax = std::max(stats.settleMax, settle);
+					printf("  %8.0f ms: %s %.0f ms after the roll\n", time, rollStateName(states[i]), settle);
+				}
+			}
+		}
+		printf("%s: %d samples, ended %s\n", path, count, rollStateName(states.back()));
+	}
+
+	void report(const RollStats& stats) {
+		printf("\n");
+		if (stats.labelledRolls > 0) {
+			printf("Rolls:      %d of %d detected", stats.detectedRolls, stats.labelledRolls);
+			if (stats.detectedRolls > 0) {
+				printf(", latency %.0f ms average, %.0f ms max", stats.latencySum / stats.detectedRolls, stats.latencyMax);
+			}
+			printf("\n");
+			if (stats.settledRolls > 0) {
+				printf("At rest:    %.0f ms average, %.0f ms max after the roll\n", stats.settleSum / stats.settledRolls, stats.settleMax);
+			}
+			printf("False:      %d, %.2f per minute not rolling\n", stats.falseRolls, stats.restMs > 0 ? stats.falseRolls * 60000.0 / stats.restMs : 0.0);
+		} else {
+			printf("Rolls:      %d detected, no labels to grade them against\n", stats.detectedRolls);
+		}
+		if (stats.restedRolls > 0) {
+			printf("Crooked:    %d of %d rolls (%.1f%%)\n", stats.crookedRolls, stats.restedRolls, stats.crookedRolls * 100.0 / stats.restedRolls);
+		}
+		if (stats.processingMicros > 0) {
+			// On the host, the die is a lot slower
+			printf("Throughput: %.0f samples/s on the host, %s\n", stats.samples * 1000000.0 / stats.processingMicros, ACCEL_FIXED_POINT ? "fixed point" : "floating point");
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	bool raw = false;
+	std::vector<const char*> paths;
+	std::vector<const char*> assignments;
+	int faces = 20;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-raw") == 0) {
+			raw = true;
+		} else if (strcmp(argv[i], "-faces") == 0 && i + 1 < argc) {
+			faces = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-set") == 0 && i + 1 < argc) {
+			assignments.push_back(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr, "Usage: %s [-faces N] [-raw] [-set setting=value]... file.csv...\n", argv[0]);
+			return 1;
+		} else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty() || (faces != 6 && faces != 20)) {
+		fprintf(stderr, "Usage: %s [-faces 6|20] [-raw] [-set setting=value]... file.csv...\n", argv[0]);
+		return 1;
+	}
+
+	Host::setFaceCount(faces);
+	for (auto assignment : assignments) {
+		if (!setSetting(assignment)) {
+			fprintf(stderr, "Unknown setting %s\n", assignment);
+			return 1;
+		}
+	}
+	// The samples come from the recordings, not the FIFO
+	Host::startAccelerometer();
+	Accelerometer::stop();
+	replayTime = Accelerometer::getHistory().last().time;
+
+	RollStats stats;
+	memset(&stats, 0, sizeof(stats));
+	for (auto path : paths) {
+		std::vector<Row> rows;
+		if (!readRows(path, rows)) {
+			return 1;
+		}
+		auto frames = resample(rows, raw);
+		auto states = replay(frames, stats);
+		grade(path, frames, states, stats);
+	}
+	report(stats);
+	return 0;
+}
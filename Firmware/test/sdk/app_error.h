@@ -0,0 +1,6 @@
+// Host stand-in for the nRF SDK's app_error.h
+#pragma once
+#include <stdint.h>
+#include "sdk_common.h"
+
+#define APP_ERROR_CHECK(ERR_CODE) (void)(ERR_CODE)
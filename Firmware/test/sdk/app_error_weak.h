@@ -0,0 +1,2 @@
+// Host stand-in for the nRF SDK's app_error_weak.h
+#pragma once
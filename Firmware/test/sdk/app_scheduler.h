@@ -0,0 +1,5 @@
+// Host stand-in for the nRF SDK's app_scheduler.h
+#pragma once
+#include "sdk_common.h"
+
+typedef void (*app_sched_event_handler_t)(void* p_event_data, uint16_t event_size);
@@ -0,0 +1,35 @@
+// Host stand-in for the nRF SDK's app_timer.h, see host.cpp
+#pragma once
+#include <stdint.h>
+#include "sdk_common.h"
+
+typedef void (*app_timer_timeout_handler_t)(void* p_context);
+typedef enum
+{
+    APP_TIMER_MODE_SINGLE_SHOT,
+    APP_TIMER_MODE_REPEATED
+} app_timer_mode_t;
+
+struct app_timer_t
+{
+    app_timer_timeout_handler_t handler;
+    app_timer_mode_t mode;
+    uint32_t period;
+    uint64_t expiry; // RTC tick, not wrapped
+    void* context;
+    bool active;
+};
+typedef app_timer_t* app_timer_id_t;
+
+#define APP_TIMER_DEF(timer_id) \
+    static app_timer_t timer_id##_data; \
+    static const app_timer_id_t timer_id = &timer_id##_data
+// Timers count RTC ticks, which host.cpp simulates
+#define APP_TIMER_CLOCK_FREQ 32768
+#define APP_TIMER_TICKS(MS) ((uint32_t)ROUNDED_DIV((MS) * (uint64_t)APP_TIMER_CLOCK_FREQ, 1000 * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)))
+
+ret_code_t app_timer_create(app_timer_id_t const* p_timer_id, app_timer_mode_t mode, app_timer_timeout_handler_t timeout_handler);
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void* p_context);
+ret_code_t app_timer_stop(app_timer_id_t timer_id);
+uint32_t app_timer_cnt_get();
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from);
@@ -0,0 +1,6 @@
+// Host stand-in for the nRF SDK's app_util.h
+#pragma once
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define ROUNDED_DIV(A, B) (((A) + ((B) / 2)) / (B))
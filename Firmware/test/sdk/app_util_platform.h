@@ -0,0 +1,8 @@
+// Host stand-in for the nRF SDK's app_util_platform.h, nothing interrupts the host code
+#pragma once
+#include "app_util.h"
+
+#define APP_IRQ_PRIORITY_HIGH 2
+
+#define CRITICAL_REGION_ENTER()
+#define CRITICAL_REGION_EXIT()
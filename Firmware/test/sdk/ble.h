@@ -0,0 +1,2 @@
+// Host stand-in for the nRF SDK's ble.h, nothing the tested code uses
+#pragma once
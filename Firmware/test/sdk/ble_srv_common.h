@@ -0,0 +1,2 @@
+// Host stand-in for the nRF SDK's ble_srv_common.h, nothing the tested code uses
+#pragma once
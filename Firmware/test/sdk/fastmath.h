@@ -0,0 +1,3 @@
+// Host stand-in for newlib's fastmath.h
+#pragma once
+#include <math.h>
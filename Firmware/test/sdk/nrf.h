@@ -0,0 +1,67 @@
+// Host stand-in for the nRF SDK's nrf.h, only the flash size registers and the SIMD intrinsics
+#pragma once
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t NRFFW[15]; // NRFFW[0] is the bootloader address, i.e. the end of the flash we can use
+} NRF_UICR_Type;
+
+typedef struct
+{
+    uint32_t CODEPAGESIZE;
+    uint32_t CODESIZE;
+} NRF_FICR_Type;
+
+extern NRF_UICR_Type hostUICR;
+extern NRF_FICR_Type hostFICR;
+#define NRF_UICR (&hostUICR)
+#define NRF_FICR (&hostFICR)
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+// The Cortex-M4 SIMD intrinsics from CMSIS, in plain C so the DSP code paths can be checked on the host.
+// USUB8 sets the GE flags that SEL reads, like the APSR does on the die.
+static uint32_t hostGEFlags;
+
+static inline uint32_t __USUB8(uint32_t a, uint32_t b) {
+    uint32_t ret = 0;
+    hostGEFlags = 0;
+    for (int i = 0; i < 4; ++i) {
+        uint32_t x = (a >> (i * 8)) & 0xFF;
+        uint32_t y = (b >> (i * 8)) & 0xFF;
+        if (x >= y) {
+            hostGEFlags |= 1 << i;
+        }
+        ret |= ((x - y) & 0xFF) << (i * 8);
+    }
+    return ret;
+}
+
+static inline uint32_t __SEL(uint32_t a, uint32_t b) {
+    uint32_t ret = 0;
+    for (int i = 0; i < 4; ++i) {
+        ret |= (((hostGEFlags >> i) & 1) ? a : b) & (0xFFu << (i * 8));
+    }
+    return ret;
+}
+
+static inline uint32_t __UQADD8(uint32_t a, uint32_t b) {
+    uint32_t ret = 0;
+    for (int i = 0; i < 4; ++i) {
+        uint32_t sum = ((a >> (i * 8)) & 0xFF) + ((b >> (i * 8)) & 0xFF);
+        ret |= (sum > 0xFF ? 0xFF : sum) << (i * 8);
+    }
+    return ret;
+}
+
+static inline uint32_t __UXTB16(uint32_t x) {
+    return x & 0x00FF00FF;
+}
+
+#define __PKHBT(ARG1, ARG2, ARG3) ((((uint32_t)(ARG1)) & 0x0000FFFFUL) | ((((uint32_t)(ARG2)) << (ARG3)) & 0xFFFF0000UL))
+#define __PKHTB(ARG1, ARG2, ARG3) ((((uint32_t)(ARG1)) & 0xFFFF0000UL) | ((((uint32_t)(ARG2)) >> (ARG3)) & 0x0000FFFFUL))
+
+static inline uint32_t __SMUAD(uint32_t a, uint32_t b) {
+    return (uint32_t)((int16_t)a * (int16_t)b + (int16_t)(a >> 16) * (int16_t)(b >> 16));
+}
+#endif
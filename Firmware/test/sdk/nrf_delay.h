@@ -0,0 +1,6 @@
+// Host stand-in for the nRF SDK's nrf_delay.h
+#pragma once
+#include <stdint.h>
+
+inline void nrf_delay_ms(uint32_t ms) {}
+inline void nrf_delay_us(uint32_t us) {}
@@ -0,0 +1,11 @@
+// Host stand-in for the nRF SDK's nrf_drv_gpiote.h
+#pragma once
+#include "sdk_common.h"
+#include "nrf_gpio.h"
+
+typedef enum
+{
+    NRF_GPIOTE_POLARITY_LOTOHI = 1,
+    NRF_GPIOTE_POLARITY_HITOLO,
+    NRF_GPIOTE_POLARITY_TOGGLE
+} nrf_gpiote_polarity_t;
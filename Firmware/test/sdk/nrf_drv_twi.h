@@ -0,0 +1,72 @@
+// Host stand-in for the nRF SDK's nrf_drv_twi.h, host.cpp puts the accelerometer's
+// register model on the bus, and ends transfers right away or as the simulated time passes
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "sdk_common.h"
+
+typedef struct
+{
+    uint8_t inst_idx;
+} nrf_drv_twi_t;
+
+#define NRF_DRV_TWI_INSTANCE(id) { id }
+
+typedef enum
+{
+    NRF_DRV_TWI_FREQ_100K = 0x01980000,
+    NRF_DRV_TWI_FREQ_250K = 0x04000000,
+    NRF_DRV_TWI_FREQ_400K = 0x06400000,
+} nrf_drv_twi_frequency_t;
+
+typedef struct
+{
+    uint32_t scl;
+    uint32_t sda;
+    nrf_drv_twi_frequency_t frequency;
+    uint8_t interrupt_priority;
+    bool clear_bus_init;
+} nrf_drv_twi_config_t;
+
+typedef enum
+{
+    NRF_DRV_TWI_EVT_DONE,
+    NRF_DRV_TWI_EVT_ADDRESS_NACK,
+    NRF_DRV_TWI_EVT_DATA_NACK,
+} nrf_drv_twi_evt_type_t;
+
+typedef enum
+{
+    NRF_DRV_TWI_XFER_TX,
+    NRF_DRV_TWI_XFER_RX,
+    NRF_DRV_TWI_XFER_TXRX,
+    NRF_DRV_TWI_XFER_TXTX,
+} nrf_drv_twi_xfer_type_t;
+
+typedef struct
+{
+    nrf_drv_twi_xfer_type_t type;
+    uint8_t address;
+    size_t primary_length;
+    size_t secondary_length;
+    uint8_t* p_primary_buf;
+    uint8_t* p_secondary_buf;
+} nrf_drv_twi_xfer_desc_t;
+
+#define NRF_DRV_TWI_XFER_DESC_TX(addr, p_data, length) { NRF_DRV_TWI_XFER_TX, addr, length, 0, p_data, nullptr }
+#define NRF_DRV_TWI_XFER_DESC_RX(addr, p_data, length) { NRF_DRV_TWI_XFER_RX, addr, length, 0, p_data, nullptr }
+#define NRF_DRV_TWI_XFER_DESC_TXRX(addr, p_tx, tx_len, p_rx, rx_len) { NRF_DRV_TWI_XFER_TXRX, addr, tx_len, rx_len, p_tx, p_rx }
+
+#define NRF_DRV_TWI_FLAG_TX_NO_STOP (1UL << 5)
+
+typedef struct
+{
+    nrf_drv_twi_evt_type_t type;
+    nrf_drv_twi_xfer_desc_t xfer_desc;
+} nrf_drv_twi_evt_t;
+
+typedef void (*nrf_drv_twi_evt_handler_t)(nrf_drv_twi_evt_t const* p_event, void* p_context);
+
+ret_code_t nrf_drv_twi_init(nrf_drv_twi_t const* p_instance, nrf_drv_twi_config_t const* p_config, nrf_drv_twi_evt_handler_t event_handler, void* p_context);
+void nrf_drv_twi_enable(nrf_drv_twi_t const* p_instance);
+ret_code_t nrf_drv_twi_xfer(nrf_drv_twi_t const* p_instance, nrf_drv_twi_xfer_desc_t const* p_xfer_desc, uint32_t flags);
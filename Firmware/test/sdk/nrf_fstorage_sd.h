@@ -0,0 +1,5 @@
+// Host stand-in for the nRF SDK's nrf_fstorage_sd.h
+#pragma once
+#include "nrf_fstorage.h"
+
+extern nrf_fstorage_api_t nrf_fstorage_sd;
@@ -0,0 +1,42 @@
+// Host stand-in for the nRF SDK's nrf_gpio.h, host.cpp keeps the output pin states
+// and reads the accelerometer's interrupt line
+#pragma once
+#include <stdint.h>
+
+typedef enum
+{
+    NRF_GPIO_PIN_DIR_INPUT = 0,
+    NRF_GPIO_PIN_DIR_OUTPUT = 1
+} nrf_gpio_pin_dir_t;
+
+typedef enum
+{
+    NRF_GPIO_PIN_INPUT_CONNECT = 0,
+    NRF_GPIO_PIN_INPUT_DISCONNECT = 1
+} nrf_gpio_pin_input_t;
+
+typedef enum
+{
+    NRF_GPIO_PIN_NOPULL = 0,
+    NRF_GPIO_PIN_PULLDOWN = 1,
+    NRF_GPIO_PIN_PULLUP = 3,
+} nrf_gpio_pin_pull_t;
+
+typedef enum
+{
+    NRF_GPIO_PIN_S0S1 = 0,
+} nrf_gpio_pin_drive_t;
+
+typedef enum
+{
+    NRF_GPIO_PIN_NOSENSE = 0,
+} nrf_gpio_pin_sense_t;
+
+void nrf_gpio_cfg(uint32_t pin_number, nrf_gpio_pin_dir_t dir, nrf_gpio_pin_input_t input, nrf_gpio_pin_pull_t pull, nrf_gpio_pin_drive_t drive, nrf_gpio_pin_sense_t sense);
+void nrf_gpio_cfg_output(uint32_t pin_number);
+void nrf_gpio_pin_set(uint32_t pin_number);
+void nrf_gpio_pin_clear(uint32_t pin_number);
+uint32_t nrf_gpio_pin_out_read(uint32_t pin_number);
+void nrf_gpio_cfg_input(uint32_t pin_number, nrf_gpio_pin_pull_t pull_config);
+void nrf_gpio_cfg_default(uint32_t pin_number);
+uint32_t nrf_gpio_pin_read(uint32_t pin_number);
@@ -0,0 +1,12 @@
+// Host stand-in for the nRF SDK's nrf_log.h, logs go nowhere
+#pragma once
+#include "sdk_common.h"
+
+#define NRF_LOG_INFO(...)
+#define NRF_LOG_ERROR(...)
+#define NRF_LOG_WARNING(...)
+#define NRF_LOG_DEBUG(...)
+#define NRF_LOG_RAW_INFO(...)
+#define NRF_LOG_FLUSH()
+#define NRF_LOG_FLOAT_MARKER "%f"
+#define NRF_LOG_FLOAT(val) (val)
@@ -0,0 +1,11 @@
+// Host stand-in for the nRF SDK's nrf_pwr_mgmt.h
+#pragma once
+#include "sdk_common.h"
+
+typedef enum
+{
+    NRF_PWR_MGMT_EVT_PREPARE_WAKEUP,
+    NRF_PWR_MGMT_EVT_PREPARE_SYSOFF,
+    NRF_PWR_MGMT_EVT_PREPARE_DFU,
+    NRF_PWR_MGMT_EVT_PREPARE_RESET,
+} nrf_pwr_mgmt_evt_t;
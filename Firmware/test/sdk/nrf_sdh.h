@@ -0,0 +1,2 @@
+// Host stand-in for the nRF SDK's nrf_sdh.h, nothing the tested code uses
+#pragma once
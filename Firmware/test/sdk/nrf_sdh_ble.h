@@ -0,0 +1,2 @@
+// Host stand-in for the nRF SDK's nrf_sdh_ble.h, nothing the tested code uses
+#pragma once
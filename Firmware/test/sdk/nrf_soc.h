@@ -0,0 +1,7 @@
+// Host stand-in for the nRF SDK's nrf_soc.h
+#pragma once
+#include "nrf.h"
+
+inline uint32_t sd_app_evt_wait() {
+    return 0;
+}
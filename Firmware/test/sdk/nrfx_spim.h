@@ -0,0 +1,81 @@
+// Host stand-in for the nRF SDK's nrfx_spim.h, host.cpp records what goes out and
+// signals the end of each transfer when the simulated time gets there
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "sdk_common.h"
+
+typedef struct
+{
+    uint8_t drv_inst_idx;
+} nrfx_spim_t;
+
+#define NRFX_SPIM_INSTANCE(id) { id }
+#define NRFX_SPIM_PIN_NOT_USED 0xFF
+
+typedef enum
+{
+    NRF_SPIM_FREQ_125K = 0x02000000,
+    NRF_SPIM_FREQ_1M = 0x10000000,
+    NRF_SPIM_FREQ_4M = 0x40000000,
+    NRF_SPIM_FREQ_8M = 0x80000000,
+} nrf_spim_frequency_t;
+
+typedef enum
+{
+    NRF_SPIM_MODE_0,
+    NRF_SPIM_MODE_1,
+    NRF_SPIM_MODE_2,
+    NRF_SPIM_MODE_3
+} nrf_spim_mode_t;
+
+typedef enum
+{
+    NRF_SPIM_BIT_ORDER_MSB_FIRST,
+    NRF_SPIM_BIT_ORDER_LSB_FIRST
+} nrf_spim_bit_order_t;
+
+typedef struct
+{
+    uint8_t sck_pin;
+    uint8_t mosi_pin;
+    uint8_t miso_pin;
+    uint8_t ss_pin;
+    uint8_t orc;
+    nrf_spim_frequency_t frequency;
+    nrf_spim_mode_t mode;
+    nrf_spim_bit_order_t bit_order;
+} nrfx_spim_config_t;
+
+#define NRFX_SPIM_DEFAULT_CONFIG \
+{ \
+    NRFX_SPIM_PIN_NOT_USED, NRFX_SPIM_PIN_NOT_USED, NRFX_SPIM_PIN_NOT_USED, NRFX_SPIM_PIN_NOT_USED, \
+    0xFF, NRF_SPIM_FREQ_4M, NRF_SPIM_MODE_0, NRF_SPIM_BIT_ORDER_MSB_FIRST \
+}
+
+typedef enum
+{
+    NRFX_SPIM_EVENT_DONE,
+} nrfx_spim_evt_type_t;
+
+typedef struct
+{
+    uint8_t const* p_tx_buffer;
+    size_t tx_length;
+    uint8_t* p_rx_buffer;
+    size_t rx_length;
+} nrfx_spim_xfer_desc_t;
+
+#define NRFX_SPIM_XFER_TX(p_buf, length) { (uint8_t const*)(p_buf), length, nullptr, 0 }
+
+typedef struct
+{
+    nrfx_spim_evt_type_t type;
+    nrfx_spim_xfer_desc_t xfer_desc;
+} nrfx_spim_evt_t;
+
+typedef void (*nrfx_spim_evt_handler_t)(nrfx_spim_evt_t const* p_event, void* p_context);
+
+ret_code_t nrfx_spim_init(nrfx_spim_t const* p_instance, nrfx_spim_config_t const* p_config, nrfx_spim_evt_handler_t handler, void* p_context);
+void nrfx_spim_uninit(nrfx_spim_t const* p_instance);
+ret_code_t nrfx_spim_xfer(nrfx_spim_t const* p_instance, nrfx_spim_xfer_desc_t const* p_xfer_desc, uint32_t flags);
@@ -0,0 +1,8 @@
+// Host stand-in for the nRF SDK's sdk_common.h
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "config/sdk_config.h"
+#include "sdk_errors.h"
+#include "app_util.h"
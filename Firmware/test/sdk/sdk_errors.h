@@ -0,0 +1,7 @@
+// Host stand-in for the nRF SDK's sdk_errors.h
+#pragma once
+#include <stdint.h>
+
+typedef uint32_t ret_code_t;
+#define NRF_SUCCESS 0
+#define NRF_ERROR_BUSY 17
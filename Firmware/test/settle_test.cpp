@@ -0,0 +1,251 @@
+#include "test.h"
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+#include "host.h"
+#include "modules/accelerometer.h"
+
+using namespace DriversHW;
+using namespace Modules;
+
+namespace
+{
+	struct Event
+	{
+		int face;
+		Accelerometer::SettleEvent event;
+		int sampleIndex;
+	};
+
+	std::vector<Event> events;
+	uint32_t sampleTime;
+	int sampleIndex;
+
+	void onSettle(void* param, int face, Accelerometer::SettleEvent event) {
+		events.push_back({face, event, sampleIndex});
+	}
+
+	/// <summary>
+	/// Stops live sampling and feeds our own samples instead, one frame period apart
+	/// </summary>
+	void startFeeding(int faceCount) {
+		Host::setFaceCount(faceCount);
+		Host::startAccelerometer();
+		Accelerometer::stop();
+		Accelerometer::hookSettle(onSettle, nullptr);
+		sampleTime = Accelerometer::getHistory().last().time;
+		sampleIndex = 0;
+		events.clear();
+	}
+
+	void stopFeeding() {
+		Accelerometer::unHookSettle(onSettle);
+		Host::setFaceCount(20);
+		Host::startAccelerometer();
+	}
+
+	void feed(int x, int y, int z) {
+		sampleTime += ACCEL_FRAME_MS;
+		sampleIndex++;
+		Accelerometer::processSample({(short)x, (short)y, (short)z}, sampleTime);
+	}
+
+	// 1g is 32 in raw readings at the 4g scale, with a little noise
+	void rest(int face, int frames) {
+		auto& normal = Host::settings().faceNormals[face];
+		for (int i = 0; i < frames; ++i) {
+			feed((int)(normal.x * 32) + rand() % 3 - 1, (int)(normal.y * 32) + rand() % 3 - 1, (int)(normal.z * 32) + rand() % 3 - 1);
+		}
+	}
+
+	/// <summary>
+	/// Slowly rolls over from one face toward another, stopping part way if amount is less than 1
+	/// </summary>
+	void tilt(int fromFace, int toFace, float amount, int frames) {
+		auto& a = Host::settings().faceNormals[fromFace];
+		auto& b = Host::settings().faceNormals[toFace];
+		for (int i = 1; i <= frames; ++i) {
+			float t = amount * i / frames;
+			float x = a.x + (b.x - a.x) * t, y = a.y + (b.y - a.y) * t, z = a.z + (b.z - a.z) * t;
+			float scale = 32.0f / sqrtf(x * x + y * y + z * z);
+			feed((int)roundf(x * scale), (int)roundf(y * scale), (int)roundf(z * scale));
+		}
+	}
+
+	void shake(int frames) {
+		for (int i = 0; i < frames; ++i) {
+			feed(rand() % 201 - 100, rand() % 201 - 100, rand() % 201 - 100);
+		}
+	}
+
+	/// <summary>
+	/// At rest on a face to begin with, whatever the live sample was, then rolling
+	/// </summary>
+	void startRolling() {
+		rest(0, 100);
+		CHECK(Accelerometer::currentRollState() == Accelerometer::RollState_OnFace);
+		events.clear();
+		shake(50);
+		CHECK(Accelerometer::currentRollState() == Accelerometer::RollState_Rolling);
+		CHECK(events.empty());
+	}
+
+	// Index of the first sample from which the roll state is OnFace, feeding more rest if needed
+	int restUntilOnFace(int face) {
+		for (int i = 0; i < 1000 && Accelerometer::currentRollState() != Accelerometer::RollState_OnFace; ++i) {
+			rest(face, 1);
+		}
+		return sampleIndex;
+	}
+
+	/// <summary>
+	/// Each provisional face is either confirmed or withdrawn before the next one, and never left hanging once on a face
+	/// </summary>
+	bool eventsAreConsistent() {
+		int pendingFace = -1;
+		for (auto& event : events) {
+			switch (event.event) {
+				case Accelerometer::SettleEvent_Settling:
+					if (pendingFace != -1) {
+						return false;
+					}
+					pendingFace = event.face;
+					break;
+				case Accelerometer::SettleEvent_Settled:
+					if (pendingFace != -1 && pendingFace != event.face) {
+						return false;
+					}
+					pendingFace = -1;
+					break;
+				case Accelerometer::SettleEvent_Withdrawn:
+					if (pendingFace != event.face) {
+						return false;
+					}
+					pendingFace = -1;
+					break;
+			}
+		}
+		return pendingFace == -1 || Accelerometer::currentRollState() == Accelerometer::RollState_Handling || Accelerometer::currentRollState() == Accelerometer::RollState_Rolling;
+	}
+}
+
+TEST(settleIsReportedBeforeTheRollStateAndConfirmed)
+{
+	srand(18);
+	startFeeding(20);
+	startRolling();
+
+	int restStart = sampleIndex;
+	int onFaceIndex = restUntilOnFace(5);
+	CHECK(events.size() == 2);
+	CHECK(events[0].event == Accelerometer::SettleEvent_Settling && events[0].face == 5);
+	CHECK(events[0].sampleIndex < onFaceIndex);
+	CHECK(events[1].event == Accelerometer::SettleEvent_Settled && events[1].face == 5);
+	CHECK(events[1].sampleIndex == onFaceIndex);
+	printf("  settling after %d ms, on face after %d ms\n", (events[0].sampleIndex - restStart) * ACCEL_FRAME_MS, (onFaceIndex - restStart) * ACCEL_FRAME_MS);
+	stopFeeding();
+}
+
+TEST(settleIsWithdrawnWhenTheDieMovesAgain)
+{
+	srand(18);
+	startFeeding(20);
+	startRolling();
+	rest(7, 20);
+	CHECK(events.size() == 1 && events[0].event == Accelerometer::SettleEvent_Settling && events[0].face == 7);
+	CHECK(Accelerometer::currentRollState() == Accelerometer::RollState_Rolling);
+
+	// Picked up again, the provisional face goes before the next one
+	shake(10);
+	CHECK(events.size() == 2 && events[1].event == Accelerometer::SettleEvent_Withdrawn && events[1].face == 7);
+	restUntilOnFace(12);
+	CHECK(events.size() == 4);
+	CHECK(events[2].event == Accelerometer::SettleEvent_Settling && events[2].face == 12);
+	CHECK(events[3].event == Accelerometer::SettleEvent_Settled && events[3].face == 12);
+	CHECK(eventsAreConsistent());
+	stopFeeding();
+}
+
+TEST(settleIsWithdrawnWhenTheDieEndsCrookedOrTipsOver)
+{
+	// A d6 coming to rest on face 0, then slowly tipping onto an edge
+	srand(18);
+	startFeeding(6);
+	startRolling();
+	rest(0, 20);
+	CHECK(events.size() == 1 && events[0].event == Accelerometer::SettleEvent_Settling && events[0].face == 0);
+	tilt(0, 1, 0.5f, 100);
+	for (int i = 0; i < 100 && Accelerometer::currentRollState() == Accelerometer::RollState_Rolling; ++i) {
+		tilt(0, 1, 0.5f, 1);
+	}
+	CHECK(Accelerometer::currentRollState() == Accelerometer::RollState_Crooked);
+	CHECK(events.size() == 2 && events[1].event == Accelerometer::SettleEvent_Withdrawn && events[1].face == 0);
+	stopFeeding();
+
+	// A d20 tipping over to the next face without ever moving fast
+	startFeeding(20);
+	startRolling();
+	rest(0, 20);
+	CHECK(events.size() == 1 && events[0].event == Accelerometer::SettleEvent_Settling && events[0].face == 0);
+	int nextFace = Accelerometer::determineFace(Host::settings().faceNormals[0] * 0.2f + Host::settings().faceNormals[1] * 0.8f);
+	tilt(0, 1, 0.8f, 200);
+	CHECK(events.size() >= 2 && events[1].event == Accelerometer::SettleEvent_Withdrawn && events[1].face == 0);
+	restUntilOnFace(nextFace);
+	CHECK(events.back().event == Accelerometer::SettleEvent_Settled && events.back().face == nextFace);
+	CHECK(eventsAreConsistent());
+	stopFeeding();
+}
+
+TEST(settleEventsStayConsistent)
+{
+	// Random rests, some of them between two faces, shakes, sudden flips and slow tilts, on both die sizes
+	const int faceCounts[] = { 6, 20 };
+	for (int faceCount : faceCounts) {
+		srand(faceCount);
+		startFeeding(faceCount);
+		auto& normals = Host::settings().faceNormals;
+		for (int i = 0; i < 2000; ++i) {
+			switch (rand() % 5) {
+				case 0:
+					shake(rand() % 40 + 1);
+					break;
+				case 1:
+					rest(rand() % faceCount, rand() % 100 + 1);
+					break;
+				case 2:
+				{
+					// Leaning on something
+					auto& a = normals[rand() % faceCount];
+					auto& b = normals[rand() % faceCount];
+					int frames = rand() % 100 + 1;
+					for (int j = 0; j < frames; ++j) {
+						feed((int)((a.x + b.x) * 16), (int)((a.y + b.y) * 16), (int)((a.z + b.z) * 16));
+					}
+					break;
+				}
+				case 3:
+				{
+					int face = Accelerometer::currentFace();
+					tilt(face, rand() % faceCount, (rand() % 100 + 1) / 100.0f, rand() % 200 + 1);
+					break;
+				}
+				default:
+					// Flipped to another face in one go
+					rest(rand() % faceCount, rand() % 10 + 1);
+					rest(rand() % faceCount, rand() % 10 + 1);
+					break;
+			}
+			CHECK(eventsAreConsistent());
+		}
+
+		int settling = 0, settled = 0, withdrawn = 0;
+		for (auto& event : events) {
+			settling += event.event == Accelerometer::SettleEvent_Settling;
+			settled += event.event == Accelerometer::SettleEvent_Settled;
+			withdrawn += event.event == Accelerometer::SettleEvent_Withdrawn;
+		}
+		printf("  %d faces: %d settling, %d settled, %d withdrawn\n", faceCount, settling, settled, withdrawn);
+		CHECK(settling > 0 && settled > 0 && withdrawn > 0);
+		stopFeeding();
+	}
+}
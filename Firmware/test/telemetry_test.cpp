@@ -0,0 +1,282 @@
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "host.h"
+#include "bluetooth/telemetry.h"
+#include "modules/accelerometer.h"
+
+using namespace Bluetooth;
+using namespace Modules;
+
+namespace Bluetooth
+{
+namespace Telemetry
+{
+	void onCaptureRollState(void* param, Accelerometer::RollState newState, int newFace);
+}
+}
+
+namespace
+{
+	struct Reading
+	{
+		int x, y, z;
+	};
+
+	std::vector<MessageTelemetryRaw> batches;
+	std::vector<int> batchSizes;
+
+	void onMessageSent(const Message* msg, int size) {
+		if (msg->type == Message::MessageType_TelemetryRaw) {
+			MessageTelemetryRaw batch;
+			memset(&batch, 0, sizeof(batch));
+			memcpy(&batch, msg, size);
+			batches.push_back(batch);
+			batchSizes.push_back(size);
+		}
+	}
+
+	/// <summary>
+	/// Reads the batches back the way the app does, see MessageTelemetryRaw
+	/// </summary>
+	std::vector<Reading> decodeBatches() {
+		std::vector<Reading> readings;
+		for (auto& batch : batches) {
+			Reading previous = {batch.firstX, batch.firstY, batch.firstZ};
+			readings.push_back(previous);
+			int nibble = 0;
+			auto readNibble = [&]() {
+				int value = (batch.data[nibble >> 1] >> ((nibble & 1) * 4)) & 0xF;
+				nibble++;
+				return value;
+			};
+			auto readAxis = [&](int previousValue) {
+				int value = readNibble();
+				if (value == 0x8) {
+					int low = readNibble();
+					return (int)(int8_t)(low | (readNibble() << 4));
+				}
+				return previousValue + (value >= 8 ? value - 16 : value);
+			};
+			for (int i = 1; i < batch.sampleCount; ++i) {
+				Reading reading;
+				reading.x = readAxis(previous.x);
+				reading.y = readAxis(previous.y);
+				reading.z = readAxis(previous.z);
+				readings.push_back(reading);
+				previous = reading;
+			}
+		}
+		return readings;
+	}
+}
+
+TEST(rawTelemetryRoundTrips)
+{
+	Host::startAccelerometer();
+	Host::setMessageSentHandler(onMessageSent);
+	batches.clear();
+	batchSizes.clear();
+	Telemetry::start(TelemetryMode_Raw);
+
+	// A die mostly at rest with some noise, and the odd large move
+	std::vector<Reading> readings;
+	Reading reading = {0, 0, 32};
+	srand(5);
+	for (int i = 0; i < 2000; ++i) {
+		int* axes[] = {&reading.x, &reading.y, &reading.z};
+		for (int* axis : axes) {
+			int step = rand() % 10 == 0 ? rand() % 201 - 100 : rand() % 7 - 3;
+			*axis = std::max(-128, std::min(127, *axis + step));
+		}
+		readings.push_back(reading);
+		Host::pushSample(reading.x, reading.y, reading.z);
+		Host::advance(ACCEL_FRAME_MS);
+	}
+	Telemetry::stop();
+	Host::setMessageSentHandler(nullptr);
+
+	auto decoded = decodeBatches();
+	CHECK(decoded.size() == readings.size());
+	bool match = decoded.size() == readings.size();
+	for (int i = 0; match && i < (int)decoded.size(); ++i) {
+		match = decoded[i].x == readings[i].x && decoded[i].y == readings[i].y && decoded[i].z == readings[i].z;
+	}
+	CHECK(match);
+
+	int bytes = 0;
+	for (int i = 0; i < (int)batches.size(); ++i) {
+		CHECK(batches[i].sequence == i);
+		CHECK(batchSizes[i] <= (int)sizeof(MessageTelemetryRaw));
+		bytes += batchSizes[i];
+	}
+	printf("  %d samples in %d batches, %.2f bytes per sample\n", (int)decoded.size(), (int)batches.size(), (float)bytes / decoded.size());
+}
+
+namespace
+{
+	std::vector<MessageRollCapture> captures;
+	std::vector<Reading> capturedHistory; // The newest samples of the history when the capture was sent
+	uint32_t capturedHistoryTime;
+	std::vector<uint8_t> captureData;
+	std::vector<MessageBulkData> bulkChunks;
+	bool bulkSetup;
+	uint32_t sampleTime;
+
+	void onCaptureMessageSent(const Message* msg, int size) {
+		if (msg->type == Message::MessageType_RollCapture) {
+			auto capture = (const MessageRollCapture*)msg;
+			captures.push_back(*capture);
+			auto& history = Accelerometer::getHistory();
+			int first = std::max(0, history.count() - capture->sampleCount);
+			capturedHistory.clear();
+			for (int i = first; i < history.count(); ++i) {
+				auto& sample = history.sample(i);
+				capturedHistory.push_back({sample.x, sample.y, sample.z});
+			}
+			capturedHistoryTime = history[first].time;
+		} else if (msg->type == Message::MessageType_BulkSetup) {
+			bulkSetup = true;
+		} else if (msg->type == Message::MessageType_BulkData) {
+			bulkChunks.push_back(*(const MessageBulkData*)msg);
+		}
+	}
+
+	/// <summary>
+	/// Plays the central's part of the bulk transfer, one chunk at a time
+	/// </summary>
+	void receiveCapture() {
+		captureData.clear();
+		if (!bulkSetup) {
+			return;
+		}
+		bulkSetup = false;
+		bulkChunks.clear();
+		Message setupAck(Message::MessageType_BulkSetupAck);
+		Host::deliver(&setupAck);
+		while (!bulkChunks.empty()) {
+			auto chunk = bulkChunks.back();
+			bulkChunks.clear();
+			captureData.insert(captureData.end(), chunk.data, chunk.data + chunk.size);
+			MessageBulkDataAck ack;
+			ack.offset = chunk.offset;
+			Host::deliver(&ack);
+		}
+	}
+
+	void startCapture() {
+		Host::setFaceCount(20);
+		Host::startAccelerometer();
+		Accelerometer::stop();
+		sampleTime = Accelerometer::getHistory().last().time;
+		Host::setMessageSentHandler(onCaptureMessageSent);
+		captures.clear();
+		bulkSetup = false;
+		Telemetry::start(TelemetryMode_Capture);
+	}
+
+	void stopCapture() {
+		Telemetry::stop();
+		Host::setMessageSentHandler(nullptr);
+		Host::startAccelerometer();
+	}
+
+	// Fed straight to the roll detection, one frame period apart
+	void feed(int x, int y, int z) {
+		sampleTime += ACCEL_FRAME_MS;
+		Accelerometer::processSample({(short)x, (short)y, (short)z}, sampleTime);
+	}
+
+	void rest(int frames) {
+		for (int i = 0; i < frames; ++i) {
+			feed(rand() % 3 - 1, rand() % 3 - 1, 32 + rand() % 3 - 1);
+		}
+	}
+
+	void shake(int frames) {
+		for (int i = 0; i < frames; ++i) {
+			feed(rand() % 201 - 100, rand() % 201 - 100, rand() % 201 - 100);
+		}
+	}
+
+	bool captureMatchesHistory(const MessageRollCapture& capture) {
+		if ((int)captureData.size() != capture.sampleCount * 3 || (int)capturedHistory.size() != capture.sampleCount) {
+			return false;
+		}
+		for (int i = 0; i < capture.sampleCount; ++i) {
+			auto& sample = capturedHistory[i];
+			if ((int8_t)captureData[i * 3] != sample.x || (int8_t)captureData[i * 3 + 1] != sample.y || (int8_t)captureData[i * 3 + 2] != sample.z) {
+				return false;
+			}
+		}
+		return capturedHistoryTime == capture.time;
+	}
+}
+
+TEST(rollCaptureKeepsThePreRoll)
+{
+	srand(20);
+	startCapture();
+	rest(100);
+	CHECK(Accelerometer::currentRollState() == Accelerometer::RollState_OnFace);
+	uint32_t pickUpTime = sampleTime;
+	shake(50);
+	rest(150);
+	CHECK(Accelerometer::currentRollState() == Accelerometer::RollState_OnFace);
+	CHECK(captures.size() == 1);
+	receiveCapture();
+
+	auto& capture = captures[0];
+	CHECK(!capture.truncated);
+	CHECK(capture.rollState == Accelerometer::RollState_OnFace);
+	CHECK(captureMatchesHistory(capture));
+	// The pre-roll is 500ms, the die was picked up with the first shaken sample or soon after
+	uint32_t triggerTime = capture.time + capture.triggerIndex * ACCEL_FRAME_MS;
+	CHECK(triggerTime > pickUpTime && triggerTime - capture.time >= 500);
+	stopCapture();
+}
+
+TEST(rollCaptureTriggersOnRolling)
+{
+	// Straight from a face to rolling, the roll detection normally goes through handling first
+	srand(20);
+	startCapture();
+	rest(100);
+	uint32_t rollTime = sampleTime;
+	Telemetry::onCaptureRollState(nullptr, Accelerometer::RollState_Rolling, 0);
+	rest(10);
+	Telemetry::onCaptureRollState(nullptr, Accelerometer::RollState_OnFace, 0);
+	CHECK(captures.size() == 1);
+	receiveCapture();
+	CHECK(!captures[0].truncated);
+	CHECK(captures[0].time + captures[0].triggerIndex * ACCEL_FRAME_MS == rollTime);
+	CHECK(captureMatchesHistory(captures[0]));
+	stopCapture();
+}
+
+TEST(rollCaptureFlagsLongRolls)
+{
+	// Rolling for longer than the history holds, the pre-roll and the trigger are gone
+	srand(20);
+	startCapture();
+	rest(100);
+	shake(ACCEL_HISTORY_SIZE + 50);
+	rest(150);
+	CHECK(captures.size() == 1);
+	receiveCapture();
+	auto& capture = captures[0];
+	CHECK(capture.truncated);
+	CHECK(capture.triggerIndex == 0);
+	CHECK(capture.sampleCount == ACCEL_HISTORY_SIZE);
+	CHECK(captureMatchesHistory(capture));
+
+	// The next roll is captured whole again
+	shake(50);
+	rest(150);
+	CHECK(captures.size() == 2);
+	receiveCapture();
+	CHECK(!captures[1].truncated);
+	stopCapture();
+}
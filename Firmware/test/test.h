@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/// <summary>
+/// Minimal test registry, each TEST gets run by test_main.cpp, and a failed CHECK fails the run.
+/// BENCHMARKs only run when asked for (make bench), they print their measurements and may CHECK too.
+/// </summary>
+namespace Test
+{
+	typedef void (*TestFunc)();
+	struct Registration
+	{
+		Registration(const char* name, TestFunc func, bool benchmark = false);
+	};
+	void fail(const char* file, int line, const char* expression);
+
+	// Host time, for the benchmarks
+	uint64_t nanos();
+
+	// Keeps the compiler from optimizing away the work being measured
+	void keep(uint32_t value);
+}
+
+#define TEST(name) \
+	static void name(); \
+	static Test::Registration name##Registration(#name, name); \
+	static void name()
+
+#define BENCHMARK(name) \
+	static void name(); \
+	static Test::Registration name##Registration(#name, name, true); \
+	static void name()
+
+#define CHECK(expression) \
+	do { \
+		if (!(expression)) { \
+			Test::fail(__FILE__, __LINE__, #expression); \
+		} \
+	} while (0)
@@ -0,0 +1,71 @@
+#include "test.h"
+#include <string.h>
+#include <chrono>
+
+#define MAX_TESTS 64
+
+namespace Test
+{
+	struct TestCase
+	{
+		const char* name;
+		TestFunc func;
+		bool benchmark;
+	};
+	TestCase tests[MAX_TESTS];
+	int testCount;
+	int failureCount;
+	volatile uint32_t kept;
+
+	Registration::Registration(const char* name, TestFunc func, bool benchmark) {
+		if (testCount < MAX_TESTS) {
+			tests[testCount].name = name;
+			tests[testCount].func = func;
+			tests[testCount].benchmark = benchmark;
+			testCount++;
+		}
+	}
+
+	void fail(const char* file, int line, const char* expression) {
+		printf("%s:%d: CHECK(%s) failed\n", file, line, expression);
+		failureCount++;
+	}
+
+	uint64_t nanos() {
+		auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	}
+
+	void keep(uint32_t value) {
+		kept ^= value;
+	}
+}
+
+// firmware_tests runs the tests, firmware_tests -bench [name] the benchmarks, or just the one named
+int main(int argc, char** argv) {
+	using namespace Test;
+	bool benchmarks = argc > 1 && strcmp(argv[1], "-bench") == 0;
+	const char* only = benchmarks && argc > 2 ? argv[2] : nullptr;
+	int runCount = 0;
+	int failedCount = 0;
+	for (int i = 0; i < testCount; ++i) {
+		if (tests[i].benchmark != benchmarks || (only != nullptr && strcmp(only, tests[i].name) != 0)) {
+			continue;
+		}
+		int failuresBefore = failureCount;
+		if (benchmarks) {
+			printf("%s\n", tests[i].name);
+		}
+		tests[i].func();
+		bool passed = failureCount == failuresBefore;
+		if (!benchmarks || !passed) {
+			printf("%s %s\n", passed ? "PASS" : "FAIL", tests[i].name);
+		}
+		runCount++;
+		if (!passed) {
+			failedCount++;
+		}
+	}
+	printf("%d of %d %s passed\n", runCount - failedCount, runCount, benchmarks ? "benchmarks" : "tests");
+	return failedCount == 0 ? 0 : 1;
+}
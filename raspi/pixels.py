@@ -7,6 +7,7 @@ import asyncio
 import threading
 import traceback
 import sys
+import zlib
 import signal
 from queue import Queue
 
@@ -109,8 +110,9 @@ class PixelLink:
     PIXELS_WRITE_CHARACTERISTIC = "6E400002-B5A3-F393-E0A9-E50E24DCCA9E".lower()
 
     # We're limited to 20 bytes paquets size because Raspberry Pi Model 3B is using Bluetooth 4.1
-    # so we're stuck making sure our BulkData paquet fits in the 20 byte, i.e. 16 bytes of payload
-    PIXELS_MESSAGE_BULK_DATA_SIZE = 16
+    # so we're stuck making sure our BulkData paquet fits in the 20 byte, i.e. 12 bytes of payload
+    # after the type, size, offset and CRC
+    PIXELS_MESSAGE_BULK_DATA_SIZE = 12
 
     # Default timeout in seconds used for waiting on a dice message
     DEFAULT_TIMEOUT = 3
@@ -265,8 +267,10 @@ class PixelLink:
         offset = 0
         while remainingSize > 0:
             size = min(remainingSize, PixelLink.PIXELS_MESSAGE_BULK_DATA_SIZE)
-            header = [size] + integer_to_bytes(offset, 2)
-            await self._send_and_ack(MessageType.BulkData, header + data[offset:offset+size], MessageType.BulkDataAck, timeout)
+            chunk = data[offset:offset+size]
+            # The die checks each chunk against its CRC-32
+            header = [size] + integer_to_bytes(offset, 2) + integer_to_bytes(zlib.crc32(bytes(chunk)), 4)
+            await self._send_and_ack(MessageType.BulkData, header + list(chunk), MessageType.BulkDataAck, timeout)
             if progress_callback != None:
                 progress_callback(offset, total_size)
             remainingSize -= size